@@ -24,10 +24,24 @@ static const char Version[] = "Version "
 #include "device.h"
 #include "stp_beacon.h"
 #include "random.h"
+#include "cloud_msg.h"
+#include "recent_bcast.h"
 
 ad_hoc_client_t ad_hoc_clients[AD_HOC_CLIENTS_ACROSS_CLOUD];
 int ad_hoc_client_count = 0;
 
+/* the time in milliseconds, for recent_bcast.c */
+static long long msec_now(void)
+{
+    struct timeval tv;
+
+    while (!checked_gettimeofday(&tv));
+
+    return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+static void send_ad_hoc_bcast_hint(message_t *msg, int msg_len);
+
 /* for each ad-hoc client we know about, indicate its mac address, which
  * cloud box it is attached to, its signal strength from me, and my
  * idea of its status (is it my client?  someone else's?  unknown status?)
@@ -270,91 +284,6 @@ void check_ad_hoc_client_improvement()
     //if (db[51].d) { ddprintf("done check_ad_hoc_client_improvement..\n"); }
 }
 
-/* another cloud box is about to send an ad-hoc client broadcast message.
- * it has told us (and any other cloud box that can hear it) to ignore
- * the client broadcast message; it's not really originating from an
- * ad-hoc client.
- */
-void process_ad_hoc_bcast_block_msg(message_t *message, int d)
-{
-    mac_address_ptr_t sender;
-    lockable_resource_t *l;
-
-    if (db[56].d) { ddprintf("process_ad_hoc_bcast_block_msg..\n"); }
-
-    if (locks_granted_count >= MAX_CLOUD) {
-        ddprintf("process_ad_hoc_bcast_block_msg; too many locks granted.\n");
-        return;
-    }
-
-    sender = get_name(d, message->eth_header.h_source);
-
-    if (sender == NULL) {
-        ddprintf("process_ad_hoc_bcast_block_msg:  get_name returned null\n");
-        return;
-    }
-
-    l = &locks_granted[locks_granted_count++];
-
-    l->type = ad_hoc_bcast_block_msg;
-    mac_copy(l->node_1, sender);
-    mac_copy(l->node_2, &message->v.msg.msg_body[0]);
-    set_lock_timer(l);
-
-    if (db[56].d) {
-        ddprintf("process_ad_hoc_bcast_block_msg returning; state:\n");
-        print_state();
-    }
-}
-
-/* another cloud box needed to send out a broadcast message on behalf of
- * an ad-hoc client.  before doing so it told all cloud boxes within
- * hearing distance of it to ignore the broadcast message, in particular
- * the cloud box that is the server for that ad-hoc client.  this is the
- * "all-clear" message from that cloud box.
- */
-void process_ad_hoc_bcast_unblock_msg(message_t *message, int d)
-{
-    mac_address_ptr_t sender;
-    int i;
-    bool_t found;
-
-    if (db[56].d) { ddprintf("process_ad_hoc_bcast_unblock_msg..\n"); }
-
-    sender = get_name(d, message->eth_header.h_source);
-
-    if (sender == NULL) {
-        ddprintf("process_ad_hoc_bcast_unblock_msg:  get_name returned null\n");
-        return;
-    }
-
-    found = false;
-    for (i = 0; i < locks_granted_count; i++) {
-        lockable_resource_t *l = &locks_granted[i];
-        if (l->type == ad_hoc_bcast_block_msg
-            && mac_equal(l->node_1, sender)
-            && mac_equal(l->node_2, &message->v.msg.msg_body[0]))
-        {
-            found = true;
-            break;
-        }
-    }
-
-    if (found) {
-        for(; i < locks_granted_count - 1; i++) {
-            locks_granted[i] = locks_granted[i + 1];
-        }
-        locks_granted_count--;
-    }
-
-    reset_lock_timer();
-
-    if (db[56].d) {
-        ddprintf("process_ad_hoc_bcast_unblock_msg returning; state:\n");
-        print_state();
-    }
-}
-
 /* we noticed a message from an an ad-hoc device for the first time.
  * not yet sure if it is a client ad-hoc device or another cloud box.
  * add it to our list of potential ad-hoc clients.
@@ -581,7 +510,6 @@ void ad_hoc_client_process_stp_beacon(message_t *message)
  */
 void ad_hoc_client_forward_msg(message_t *message, int msg_len, int d)
 {
-    message_t block_msg;
     int i;
 
     message_t *msg_buffer = (message_t *) &message->v.msg.msg_body;
@@ -595,6 +523,16 @@ void ad_hoc_client_forward_msg(message_t *message, int msg_len, int d)
                 mac_sprintf(mac_buf2, msg_buffer->eth_header.h_dest));
     }
 
+    /* whether or not we send it to clients, another box might, and we
+     * may hear it.
+     */
+    if (mac_equal(msg_buffer->eth_header.h_dest, mac_address_bcast)
+        || mac_equal(msg_buffer->eth_header.h_dest, mac_address_zero))
+    {
+        recent_bcast_add(recent_bcast_fingerprint((byte *) msg_buffer,
+                msg_len - wrapper_len), msec_now());
+    }
+
     /* if we have no ad-hoc clients, don't put the message out.
      * (this test is a special case of the one below.  trim it when
      * you have the guts.)
@@ -620,40 +558,18 @@ void ad_hoc_client_forward_msg(message_t *message, int msg_len, int d)
         goto maybe_doit;
     }
 
-    /* if this is a broadcast message, (gulp) send it.  but, there
-     * is a chance other cloud boxes will notice the message and think
-     * it came from a real client and try to re-send it themselves.
-     *
-     * but first, send a message to any other cloud boxes that can hear,
-     * the cloud box that is the server of this ad-hoc client in particular,
-     * telling them to ignore this broadcast message.
-     * other cloud boxes will store this blocking message
-     * (with timeout), and they won't re-broadcast messages they
-     * get that match the mac address.  then, send out an all-clear message.
-     * this is probably ok, because broadcast messages are rare.
+    /* if this is a broadcast message, (gulp) send it.  there is a chance
+     * other cloud boxes will notice the message and think it came from a
+     * real client and try to re-send it themselves.  they have passed it
+     * along too, so they will know it by its fingerprint and ignore it
+     * (see ignore_ad_hoc_bcast()); but only if the cloud got it to them
+     * before they hear us, so we send a hint first (see below).
      */
     if (mac_equal(msg_buffer->eth_header.h_dest, mac_address_bcast)
         || mac_equal(msg_buffer->eth_header.h_dest, mac_address_zero))
     {
         found = true;
         bcast = true;
-
-        /* send hash of the message to any cloud box that can hear,
-         * that this message is not coming from their ad-hoc client!
-         * presumably, the cloud boxes that hear the message we are
-         * about to transmit will have heard this hash message.
-         */
-        memset(&block_msg, 0, sizeof(block_msg));
-        block_msg.message_type = ad_hoc_bcast_block_msg;
-        mac_copy(&block_msg.v.msg.msg_body[0],
-                msg_buffer->eth_header.h_source);
-        mac_copy(block_msg.dest, mac_address_bcast);
-
-        if (db[56].d) {
-            ddprintf("sending ad_hoc_bcast_block_msg...\n");
-        }
-        send_cloud_message(&block_msg);
-
         goto maybe_doit;
     }
 
@@ -702,6 +618,10 @@ void ad_hoc_client_forward_msg(message_t *message, int msg_len, int d)
      * this message in from him (?), send it to him.
      */
     if (found && (bcast || dest_dev != d)) {
+        if (bcast) {
+            send_ad_hoc_bcast_hint(msg_buffer, msg_len - wrapper_len);
+        }
+
         if (db[52].d) {
             int len = msg_len - wrapper_len;
             ddprintf("    sending to client (abbreviated):\n");
@@ -713,15 +633,6 @@ void ad_hoc_client_forward_msg(message_t *message, int msg_len, int d)
         send_to_interface((byte *) msg_buffer, msg_len - wrapper_len,
                 device_type_wlan);
 
-        if (bcast) {
-            /* send all-clear message with the message's hash, so
-             * that other cloud boxes that heard this message can stop
-             * ignoring messages with the same hash.
-             */
-            block_msg.message_type = ad_hoc_bcast_unblock_msg;
-            send_cloud_message(&block_msg);
-        }
-
     } else {
         if (db[52].d) {
             ddprintf("   not sending it:  %d, %d =? %d\n", (int) found,
@@ -734,46 +645,79 @@ void ad_hoc_client_forward_msg(message_t *message, int msg_len, int d)
     }
 }
 
-/* see if the message is a broadcast message whose source mac address indicates
- * it is from an ad-hoc client we are supposed to ignore broadcast messages
- * from.
+/* see if the message is a broadcast message that we have passed along, or
+ * been told about, in the last RECENT_BCAST_MSEC.
  *
  * the message might have been sent out from another cloud box, attempting
  * to transmit broadcast messages to ad-hoc clients that are out of range
- * of the ad-hoc client that initiated the message.
- * to handle that situation, we have a little bit of protocol in which the
- * cloud box that sends the message first sends a cloud-protocol message
- * instructing other boxes to ignore it, and then sends an all-clear message
- * after sending it.
+ * of the ad-hoc client that initiated the message.  every box that gets a
+ * client broadcast over the cloud remembers its fingerprint (see
+ * ad_hoc_client_forward_msg()), so when we hear another box send it to its
+ * ad-hoc clients, we know it isn't from one of ours.
+ *
+ * the copy over the air can beat the one through the cloud, if our path
+ * through the spanning tree to where the broadcast came in is longer than
+ * the other box's.  so that box sends an ad_hoc_bcast_hint_msg with the
+ * fingerprint over the air just before its copy, and we remember that
+ * too (see process_ad_hoc_bcast_hint_msg()).
  */
 bool_t ignore_ad_hoc_bcast(message_t *msg, int msg_len)
 {
-    int i;
-
-    if (db[56].d) {
-        ddprintf("ignore_ad_hoc_bcast; message:\n");
-        fn_print_message(eprintf, stderr, (unsigned char *) msg, msg_len);
-        ddprintf("state:\n");
-        print_state();
-    }
-
     if (!mac_equal(msg->eth_header.h_dest, mac_address_bcast)
         && !mac_equal(msg->eth_header.h_dest, mac_address_zero))
     {
-        if (db[56].d) { ddprintf("not a bcast message; returning false.\n"); }
         return false;
     }
 
-    for (i = 0; i < locks_granted_count; i++) {
-        lockable_resource_t *l = &locks_granted[i];
-        if (l->type == ad_hoc_bcast_block_msg
-            && mac_equal(l->node_2, msg->eth_header.h_source))
-        {
-            if (db[56].d) { ddprintf("found lock; returning true.\n"); }
-            return true;
+    if (recent_bcast_seen(recent_bcast_fingerprint((byte *) msg, msg_len),
+        msec_now()))
+    {
+        if (db[56].d) {
+            ddprintf("ignore_ad_hoc_bcast; ignoring %s -> %s, %d bytes\n",
+                    mac_sprintf(mac_buf1, msg->eth_header.h_source),
+                    mac_sprintf(mac_buf2, msg->eth_header.h_dest), msg_len);
         }
+        return true;
     }
 
-    if (db[56].d) { ddprintf("returning false.\n"); }
     return false;
 }
+
+/* we are about to send client broadcast msg to our ad-hoc clients.  tell
+ * the cloud boxes that can hear us, first, so that they don't take our
+ * copy for a new broadcast from one of their own clients.
+ */
+static void send_ad_hoc_bcast_hint(message_t *msg, int msg_len)
+{
+    message_t hint_msg;
+    unsigned int fingerprint;
+
+    fingerprint = recent_bcast_fingerprint((byte *) msg, msg_len);
+
+    memset(&hint_msg, 0, sizeof(hint_msg));
+    hint_msg.message_type = ad_hoc_bcast_hint_msg;
+    memcpy(&hint_msg.v.msg.msg_body[0], &fingerprint, sizeof(fingerprint));
+    mac_copy(hint_msg.dest, mac_address_bcast);
+
+    if (db[56].d) {
+        ddprintf("sending ad_hoc_bcast_hint_msg for %08x\n", fingerprint);
+    }
+    send_cloud_message(&hint_msg);
+}
+
+/* another cloud box is about to send a client broadcast to its ad-hoc
+ * clients; remember the broadcast so that we ignore the copy we hear.
+ */
+void process_ad_hoc_bcast_hint_msg(message_t *message, int d)
+{
+    unsigned int fingerprint;
+
+    memcpy(&fingerprint, &message->v.msg.msg_body[0], sizeof(fingerprint));
+
+    if (db[56].d) {
+        ddprintf("process_ad_hoc_bcast_hint_msg; %08x from dev %d\n",
+                fingerprint, d);
+    }
+
+    recent_bcast_add(fingerprint, msec_now());
+}
@@ -42,13 +42,12 @@ extern void trim_ad_hoc_client(mac_address_t mac_address);
 extern void print_ad_hoc_clients();
 extern void update_sig_strength(ad_hoc_client_t *c);
 extern void check_ad_hoc_client_improvement();
-extern void process_ad_hoc_bcast_block_msg(message_t *message, int d);
-extern void process_ad_hoc_bcast_unblock_msg(message_t *message, int d);
 extern void ad_hoc_clients_unserved(stp_recv_beacon_t *b);
 extern void ad_hoc_client_add(mac_address_t client);
 extern void ad_hoc_client_update_my_beacon(int *count);
 extern void ad_hoc_client_process_stp_beacon(message_t *message);
 extern void ad_hoc_client_forward_msg(message_t *message, int msg_len, int d);
 extern bool_t ignore_ad_hoc_bcast(message_t *msg, int msg_len);
+extern void process_ad_hoc_bcast_hint_msg(message_t *message, int d);
 
 #endif
@@ -0,0 +1,448 @@
+/* arp_proxy.c - answer client arp and neighbor solicitations from a cache
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* client arp requests and ipv6 neighbor solicitations are broadcasts, so
+ * each one goes to every box in the cloud (and to the ad-hoc clients,
+ * with a block and an unblock message around it).  with db[75] set, every
+ * box watches the arp and neighbor discovery traffic going by, keeps the
+ * ip-to-mac mappings it sees, and answers a request from one of its own
+ * clients itself when it has a fresh (ARP_PROXY_FRESH) answer.
+ *
+ * arp requests and replies and neighbor solicitations and advertisements
+ * all say who sent them, so requests (which go everywhere) teach every
+ * box about every client that asks, and replies teach the boxes they pass.
+ *
+ * only broadcast arp requests and solicited-node multicast solicitations
+ * are proxied.  unicast requests are reachability probes, and only the
+ * real owner can say it is still there; they go through untouched.
+ *
+ * we don't answer duplicate address detection, or for a client that the
+ * bridge table says is one of our own; it will answer for itself.  we
+ * answer a neighbor solicitation only for targets we have seen advertise
+ * themselves, and copy their router and override flags into our answer,
+ * so that a host never drops a router from its default router list
+ * because of us.  requests we can't answer are flooded as before, but at
+ * most ARP_PROXY_RATE a second, and at most one per target per
+ * ARP_PROXY_REPEAT seconds.
+ */
+
+#include <string.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+
+#include "cloud.h"
+#include "device.h"
+#include "timer.h"
+#include "print.h"
+#include "bridge.h"
+#include "arp_proxy.h"
+
+#define ARP_PROXY_BUCKETS 64
+#define ARP_PROXY_WAYS 4
+
+/* offsets into an ethernet arp packet */
+#define ARP_OP (ETH_HLEN + 6)
+#define ARP_SHA (ETH_HLEN + 8)
+#define ARP_SPA (ETH_HLEN + 14)
+#define ARP_THA (ETH_HLEN + 18)
+#define ARP_TPA (ETH_HLEN + 24)
+#define ARP_LEN (ETH_HLEN + 28)
+
+/* offsets into an ethernet ipv6 icmp packet */
+#define IP6_PLEN (ETH_HLEN + 4)
+#define IP6_NEXT (ETH_HLEN + 6)
+#define IP6_HOPS (ETH_HLEN + 7)
+#define IP6_SRC (ETH_HLEN + 8)
+#define IP6_DST (ETH_HLEN + 24)
+#define ICMP6 (ETH_HLEN + 40)
+#define ICMP6_TARGET (ICMP6 + 8)
+#define ICMP6_OPTIONS (ICMP6 + 24)
+
+#define ND_SOLICIT 135
+#define ND_ADVERT 136
+#define ND_OPT_SOURCE 1
+#define ND_OPT_TARGET 2
+
+/* neighbor advertisement flags */
+#define NA_ROUTER 0x80
+#define NA_SOLICITED 0x40
+#define NA_OVERRIDE 0x20
+
+/* length of our neighbor advertisements */
+#define NA_LEN (ICMP6_OPTIONS + 8)
+
+/* shortest ethernet frame, without crc */
+#define MIN_FRAME 60
+
+typedef struct {
+    bool_t used;
+    bool_t ipv6;
+    byte addr[16];
+
+    /* the mac address for addr, if we know it, and when we learned it */
+    bool_t have_mac;
+    mac_address_t mac;
+    long sec;
+
+    /* for ipv6, the router and override flags of the last neighbor
+     * advertisement we saw for addr, if we have seen one since the mac
+     * address last changed
+     */
+    bool_t have_na_flags;
+    byte na_flags;
+
+    /* last time we flooded a request for addr */
+    long flooded_sec;
+} arp_entry_t;
+
+static arp_entry_t cache[ARP_PROXY_BUCKETS][ARP_PROXY_WAYS];
+
+/* flood rate limit */
+static int tokens = ARP_PROXY_RATE;
+static long tokens_sec;
+
+static int learned_count, answered_count, flooded_count, suppressed_count;
+
+static byte ip6_unspecified[16];
+
+/* the cache entry for addr; make one (taking the oldest in the bucket)
+ * if 'add'
+ */
+static arp_entry_t *find(byte *addr, bool_t ipv6, bool_t add)
+{
+    int len = ipv6 ? 16 : 4;
+    arp_entry_t *b = cache[hash_bytes(addr, len) % ARP_PROXY_BUCKETS];
+    arp_entry_t *e;
+    int i;
+
+    for (i = 0; i < ARP_PROXY_WAYS; i++) {
+        if (b[i].used && b[i].ipv6 == ipv6
+            && memcmp(b[i].addr, addr, len) == 0)
+        {
+            return &b[i];
+        }
+    }
+
+    if (!add) { return NULL; }
+
+    e = &b[0];
+    for (i = 0; i < ARP_PROXY_WAYS; i++) {
+        if (!b[i].used) { e = &b[i]; break; }
+        if (b[i].sec < e->sec) { e = &b[i]; }
+    }
+
+    memset(e, 0, sizeof(*e));
+    e->used = true;
+    e->ipv6 = ipv6;
+    memcpy(e->addr, addr, len);
+    e->flooded_sec = now.tv_sec - ARP_PROXY_REPEAT;
+
+    return e;
+}
+
+static arp_entry_t *learn(byte *addr, bool_t ipv6, byte *mac)
+{
+    arp_entry_t *e;
+
+    if (mac[0] & 1) { return NULL; }
+
+    e = find(addr, ipv6, true);
+    if (!e->have_mac) { learned_count++; }
+    if (!e->have_mac || !mac_equal(e->mac, mac)) { e->have_na_flags = false; }
+    e->have_mac = true;
+    mac_copy(e->mac, mac);
+    e->sec = now.tv_sec;
+
+    return e;
+}
+
+/* the cache entry for addr if it has a fresh answer we can give */
+static arp_entry_t *answer_for(byte *addr, bool_t ipv6, byte *requester)
+{
+    arp_entry_t *e = find(addr, ipv6, false);
+    byte *box;
+
+    if (e == NULL || !e->have_mac) { return NULL; }
+    if (ipv6 && !e->have_na_flags) { return NULL; }
+    if (now.tv_sec - e->sec > ARP_PROXY_FRESH) { return NULL; }
+    if (mac_equal(e->mac, requester)) { return NULL; }
+
+    /* if it's one of our own clients it can answer for itself */
+    box = bridge_box(e->mac);
+    if (box != NULL && mac_equal(box, my_wlan_mac_address)) { return NULL; }
+
+    return e;
+}
+
+/* may we flood a request for addr? */
+static bool_t may_flood(byte *addr, bool_t ipv6)
+{
+    arp_entry_t *e = find(addr, ipv6, true);
+
+    if (now.tv_sec != tokens_sec) {
+        tokens_sec = now.tv_sec;
+        tokens = ARP_PROXY_RATE;
+    }
+
+    if (now.tv_sec - e->flooded_sec < ARP_PROXY_REPEAT || tokens <= 0) {
+        suppressed_count++;
+        return false;
+    }
+
+    e->flooded_sec = now.tv_sec;
+    tokens--;
+    flooded_count++;
+
+    return true;
+}
+
+static void send_reply(byte *frame, int len, int dev)
+{
+    if (len < MIN_FRAME) {
+        memset(&frame[len], 0, MIN_FRAME - len);
+        len = MIN_FRAME;
+    }
+
+    sendum(frame, len, &device_list[dev]);
+    answered_count++;
+}
+
+/* returns true if we answered (or dropped) the request */
+static bool_t do_arp(byte *p, int len, int dev, bool_t originated_locally)
+{
+    byte reply[MIN_FRAME];
+    arp_entry_t *e;
+    byte *mac;
+    unsigned short op;
+
+    if (len < ARP_LEN) { return false; }
+
+    /* ethernet and ipv4 only */
+    if (p[ETH_HLEN] != 0 || p[ETH_HLEN + 1] != 1
+        || p[ETH_HLEN + 2] != 0x08 || p[ETH_HLEN + 3] != 0x00
+        || p[ETH_HLEN + 4] != 6 || p[ETH_HLEN + 5] != 4)
+    {
+        return false;
+    }
+
+    memcpy(&op, &p[ARP_OP], 2);
+    op = ntohs(op);
+
+    if (memcmp(&p[ARP_SPA], ip6_unspecified, 4) != 0) {
+        learn(&p[ARP_SPA], false, &p[ARP_SHA]);
+    }
+
+    if (op != 1 || !originated_locally) { return false; }
+
+    /* unicast requests are never flooded; let the owner answer them */
+    if (!mac_equal(&p[0], mac_address_bcast)) { return false; }
+
+    e = answer_for(&p[ARP_TPA], false, &p[ARP_SHA]);
+    if (e == NULL) {
+        return !may_flood(&p[ARP_TPA], false);
+    }
+    mac = e->mac;
+
+    if (db[76].d) {
+        ddprintf("arp_proxy; answering arp for %d.%d.%d.%d with %s\n",
+                p[ARP_TPA], p[ARP_TPA + 1], p[ARP_TPA + 2], p[ARP_TPA + 3],
+                mac_sprintf(mac_buf1, mac));
+    }
+
+    memcpy(reply, p, ARP_LEN);
+    mac_copy(&reply[0], &p[ARP_SHA]);
+    mac_copy(&reply[6], mac);
+    reply[ARP_OP] = 0;
+    reply[ARP_OP + 1] = 2;
+    mac_copy(&reply[ARP_SHA], mac);
+    memcpy(&reply[ARP_SPA], &p[ARP_TPA], 4);
+    mac_copy(&reply[ARP_THA], &p[ARP_SHA]);
+    memcpy(&reply[ARP_TPA], &p[ARP_SPA], 4);
+
+    send_reply(reply, ARP_LEN, dev);
+
+    return true;
+}
+
+/* the link-layer address option of the given type in a neighbor
+ * discovery message, or NULL
+ */
+static byte *nd_option(byte *p, int len, int type)
+{
+    int i = ICMP6_OPTIONS;
+
+    while (i + 8 <= len) {
+        int opt_len = p[i + 1] * 8;
+
+        if (opt_len == 0) { break; }
+        if (p[i] == type) { return &p[i + 2]; }
+        i += opt_len;
+    }
+
+    return NULL;
+}
+
+static unsigned short icmp6_checksum(byte *p, int len)
+{
+    unsigned int sum = 0;
+    int i;
+
+    /* pseudo-header:  addresses, upper-layer length, next header */
+    for (i = IP6_SRC; i < ICMP6; i += 2) {
+        sum += (p[i] << 8) | p[i + 1];
+    }
+    sum += len - ICMP6;
+    sum += IPPROTO_ICMPV6;
+
+    for (i = ICMP6; i + 1 < len; i += 2) {
+        sum += (p[i] << 8) | p[i + 1];
+    }
+    if (i < len) { sum += p[i] << 8; }
+
+    while (sum >> 16) { sum = (sum & 0xffff) + (sum >> 16); }
+
+    return htons(~sum & 0xffff);
+}
+
+/* returns true if we answered (or dropped) the request */
+static bool_t do_nd(byte *p, int len, int dev, bool_t originated_locally)
+{
+    byte reply[NA_LEN];
+    arp_entry_t *e;
+    byte *mac, *ll;
+    unsigned short checksum;
+
+    if (len < ICMP6_OPTIONS || p[IP6_NEXT] != IPPROTO_ICMPV6
+        || p[IP6_HOPS] != 255 || p[ICMP6 + 1] != 0)
+    {
+        return false;
+    }
+
+    if (p[ICMP6] == ND_ADVERT) {
+        ll = nd_option(p, len, ND_OPT_TARGET);
+        e = learn(&p[ICMP6_TARGET], true, ll != NULL ? ll : &p[6]);
+        if (e != NULL) {
+            e->have_na_flags = true;
+            e->na_flags = p[ICMP6 + 4] & (NA_ROUTER | NA_OVERRIDE);
+        }
+        return false;
+    }
+
+    if (p[ICMP6] != ND_SOLICIT) { return false; }
+
+    /* duplicate address detection goes everywhere */
+    if (memcmp(&p[IP6_SRC], ip6_unspecified, 16) == 0) { return false; }
+
+    ll = nd_option(p, len, ND_OPT_SOURCE);
+    learn(&p[IP6_SRC], true, ll != NULL ? ll : &p[6]);
+
+    if (!originated_locally) { return false; }
+
+    /* only solicited-node multicast; unicast solicitations are probes */
+    if (p[0] != 0x33 || p[1] != 0x33 || p[2] != 0xff) { return false; }
+
+    e = answer_for(&p[ICMP6_TARGET], true, &p[6]);
+    if (e == NULL) {
+        return !may_flood(&p[ICMP6_TARGET], true);
+    }
+    mac = e->mac;
+
+    if (db[76].d) {
+        ddprintf("arp_proxy; answering neighbor solicitation with %s\n",
+                mac_sprintf(mac_buf1, mac));
+    }
+
+    memset(reply, 0, sizeof(reply));
+    mac_copy(&reply[0], &p[6]);
+    mac_copy(&reply[6], mac);
+    reply[12] = 0x86;
+    reply[13] = 0xdd;
+    reply[ETH_HLEN] = 0x60;
+    reply[IP6_PLEN + 1] = NA_LEN - ICMP6;
+    reply[IP6_NEXT] = IPPROTO_ICMPV6;
+    reply[IP6_HOPS] = 255;
+    memcpy(&reply[IP6_SRC], &p[ICMP6_TARGET], 16);
+    memcpy(&reply[IP6_DST], &p[IP6_SRC], 16);
+    reply[ICMP6] = ND_ADVERT;
+    reply[ICMP6 + 4] = NA_SOLICITED | e->na_flags;
+    memcpy(&reply[ICMP6_TARGET], &p[ICMP6_TARGET], 16);
+    reply[ICMP6_OPTIONS] = ND_OPT_TARGET;
+    reply[ICMP6_OPTIONS + 1] = 1;
+    mac_copy(&reply[ICMP6_OPTIONS + 2], mac);
+
+    checksum = icmp6_checksum(reply, NA_LEN);
+    memcpy(&reply[ICMP6 + 2], &checksum, 2);
+
+    send_reply(reply, NA_LEN, dev);
+
+    return true;
+}
+
+/* called by bcast_forward_message() for every new client frame.  learn
+ * from it if it is arp or neighbor discovery.  returns true if it was a
+ * request from one of our clients that we answered, or that we aren't
+ * flooding; false if it should go on as usual.
+ */
+bool_t arp_proxy(message_t *message, int msg_len, int dev,
+        bool_t originated_locally)
+{
+    byte *p = message->v.msg.msg_body;
+    int len = msg_len - wrapper_len;
+
+    if (len < ETH_HLEN) { return false; }
+
+    if (p[12] == 0x08 && p[13] == 0x06) {
+        return do_arp(p, len, dev, originated_locally);
+    }
+
+    if (p[12] == 0x86 && p[13] == 0xdd) {
+        return do_nd(p, len, dev, originated_locally);
+    }
+
+    return false;
+}
+
+void arp_proxy_print(ddprintf_t *fn, FILE *f)
+{
+    int i, j;
+
+    fn(f, "arp proxy (learned %d, answered %d, flooded %d, suppressed %d):\n",
+            learned_count, answered_count, flooded_count, suppressed_count);
+
+    for (i = 0; i < ARP_PROXY_BUCKETS; i++) {
+        for (j = 0; j < ARP_PROXY_WAYS; j++) {
+            arp_entry_t *e = &cache[i][j];
+            char addr[48];
+            int k;
+
+            if (!e->used || !e->have_mac) { continue; }
+
+            if (e->ipv6) {
+                addr[0] = '\0';
+                for (k = 0; k < 16; k += 2) {
+                    sprintf(&addr[strlen(addr)], "%s%x", k ? ":" : "",
+                            (e->addr[k] << 8) | e->addr[k + 1]);
+                }
+            } else {
+                sprintf(addr, "%d.%d.%d.%d", e->addr[0], e->addr[1],
+                        e->addr[2], e->addr[3]);
+            }
+
+            fn(f, "    %-39s %s, %lds ago\n", addr,
+                    mac_sprintf(mac_buf1, e->mac),
+                    (long) (now.tv_sec - e->sec));
+        }
+    }
+} /* arp_proxy_print */
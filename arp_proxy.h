@@ -0,0 +1,33 @@
+/* arp_proxy.h - answer client arp and neighbor solicitations from a cache
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef ARP_PROXY_H
+#define ARP_PROXY_H
+
+#include <stdio.h>
+#include "util.h"
+#include "cloud.h"
+
+/* seconds a cached address is fresh enough to answer from */
+#define ARP_PROXY_FRESH 60
+
+/* requests we can't answer that we flood, per second, and at most one
+ * per target address per ARP_PROXY_REPEAT seconds
+ */
+#define ARP_PROXY_RATE 20
+#define ARP_PROXY_REPEAT 1
+
+extern bool_t arp_proxy(message_t *message, int msg_len, int dev,
+        bool_t originated_locally);
+extern void arp_proxy_print(ddprintf_t *fn, FILE *f);
+
+#endif
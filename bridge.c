@@ -0,0 +1,278 @@
+/* bridge.c - learn which cloud box each client mac address is behind
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* the cloud is one big hub:  every client frame goes everywhere.  this is
+ * the table a learning bridge would keep.  every wrapped frame says which
+ * cloud box it came into the cloud at (v.msg.originator), so its client
+ * source address is behind that box; a client frame that comes in on one
+ * of our own interfaces is behind us, on that interface.  vanilla ad-hoc
+ * clients are looked up in ad_hoc_clients[], which the beacons keep
+ * current.
+ *
+ * entries not refreshed in BRIDGE_AGE seconds are forgotten.  a client
+ * seen behind a different box (or interface) than before has moved; one
+ * that keeps moving (two boxes on the same wire both passing its frames
+ * along, say) isn't trusted until it has stayed put for a while.
+ *
+ * the table is a fixed set of small buckets, indexed by a hash of the
+ * mac address, so learning and lookup cost a few compares per frame.
+ * a new client takes the oldest slot in its bucket.
+ *
+ * with db[73] set, bcast_forward_message() uses bridge_dest() to send a
+ * unicast client frame only toward the part of the stp tree (or the one
+ * local interface) where its destination is.  route.c uses bridge_box()
+ * to find the cloud box to route a frame to.
+ */
+
+#include <string.h>
+#include <linux/if_ether.h>
+
+#include "cloud.h"
+#include "device.h"
+#include "stp_beacon.h"
+#include "ad_hoc_client.h"
+#include "timer.h"
+#include "print.h"
+#include "bridge.h"
+
+#define BRIDGE_BUCKETS 64
+#define BRIDGE_WAYS 4
+
+/* a client that moves more than BRIDGE_FLAP_MOVES times, each within
+ * BRIDGE_FLAP_SECS of the one before, is flapping; we don't use the
+ * entry until it has stayed put for BRIDGE_FLAP_SECS.
+ */
+#define BRIDGE_FLAP_MOVES 3
+#define BRIDGE_FLAP_SECS 10
+
+typedef struct {
+    bool_t used;
+    mac_address_t client;
+
+    /* the cloud box the client is behind, and if it's us, the type of
+     * the interface we hear it on
+     */
+    mac_address_t box;
+    device_type_t device_type;
+
+    /* when we last heard from it, and when it last moved */
+    long sec;
+    long moved_sec;
+
+    /* moves in a row, each soon after the one before */
+    int flaps;
+
+    /* total moves */
+    int moves;
+} bridge_entry_t;
+
+static bridge_entry_t table[BRIDGE_BUCKETS][BRIDGE_WAYS];
+
+static int learned_count, moved_count, pruned_count;
+
+static bridge_entry_t *bucket(mac_address_t client)
+{
+    return table[hash_bytes(client, 6) % BRIDGE_BUCKETS];
+}
+
+static bridge_entry_t *lookup(mac_address_t client)
+{
+    bridge_entry_t *b = bucket(client);
+    int i;
+
+    for (i = 0; i < BRIDGE_WAYS; i++) {
+        if (b[i].used && mac_equal(b[i].client, client)) {
+            if (now.tv_sec - b[i].sec > BRIDGE_AGE) { return NULL; }
+            return &b[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* learn from a new client frame that bcast_forward_message() is about to
+ * pass along (originated_locally as for that routine)
+ */
+void bridge_learn(message_t *message, int msg_len, int dev,
+        bool_t originated_locally)
+{
+    struct ethhdr *client = (struct ethhdr *) message->v.msg.msg_body;
+    bridge_entry_t *b, *e;
+    byte *box;
+    device_type_t device_type;
+    int i;
+
+    if (msg_len < wrapper_len + (int) sizeof(struct ethhdr)) { return; }
+    if (client->h_source[0] & 1) { return; }
+
+    if (originated_locally) {
+        box = my_wlan_mac_address;
+        device_type = device_list[dev].device_type;
+    } else {
+        box = message->v.msg.originator;
+        device_type = device_type_unknown;
+    }
+
+    b = bucket(client->h_source);
+    e = NULL;
+    for (i = 0; i < BRIDGE_WAYS; i++) {
+        if (b[i].used && mac_equal(b[i].client, client->h_source)) {
+            e = &b[i];
+            break;
+        }
+    }
+
+    if (e == NULL) {
+        e = &b[0];
+        for (i = 0; i < BRIDGE_WAYS; i++) {
+            if (!b[i].used) { e = &b[i]; break; }
+            if (b[i].sec < e->sec) { e = &b[i]; }
+        }
+        memset(e, 0, sizeof(*e));
+        e->used = true;
+        mac_copy(e->client, client->h_source);
+        mac_copy(e->box, box);
+        e->device_type = device_type;
+        e->moved_sec = now.tv_sec - BRIDGE_FLAP_SECS;
+        learned_count++;
+
+    } else if (!mac_equal(e->box, box) || e->device_type != device_type) {
+        if (now.tv_sec - e->sec <= BRIDGE_AGE) {
+            if (now.tv_sec - e->moved_sec < BRIDGE_FLAP_SECS) {
+                e->flaps++;
+            } else {
+                e->flaps = 0;
+            }
+            e->moved_sec = now.tv_sec;
+            e->moves++;
+            moved_count++;
+
+            if (db[74].d) {
+                ddprintf("bridge_learn; %s moved from %s to %s\n",
+                        mac_sprintf(mac_buf1, e->client),
+                        mac_sprintf(mac_buf2, e->box),
+                        mac_sprintf(mac_buf3, box));
+            }
+        }
+        mac_copy(e->box, box);
+        e->device_type = device_type;
+    }
+
+    e->sec = now.tv_sec;
+}
+
+/* the cloud box client is behind, or NULL if we don't know */
+byte *bridge_box(mac_address_t client)
+{
+    bridge_entry_t *e;
+    int i;
+
+    for (i = 0; i < ad_hoc_client_count; i++) {
+        ad_hoc_client_t *c = &ad_hoc_clients[i];
+
+        if (!mac_equal(c->client, client)) { continue; }
+        if (c->my_client == AD_HOC_CLIENT_MINE) { return my_wlan_mac_address; }
+        if (c->my_client == AD_HOC_CLIENT_OTHER) { return c->server; }
+        break;
+    }
+
+    e = lookup(client);
+    if (e == NULL) { return NULL; }
+
+    if (e->flaps >= BRIDGE_FLAP_MOVES
+        && now.tv_sec - e->moved_sec < BRIDGE_FLAP_SECS)
+    {
+        return NULL;
+    }
+
+    return e->box;
+}
+
+/* if the message is a unicast client frame whose destination we know
+ * about, say where it needs to go and return true.  return false if it
+ * should go everywhere.
+ */
+bool_t bridge_dest(message_t *message, int msg_len, bridge_dest_t *d)
+{
+    struct ethhdr *client = (struct ethhdr *) message->v.msg.msg_body;
+    bridge_entry_t *e;
+    byte *box;
+    int i, j;
+
+    if (msg_len < wrapper_len + (int) sizeof(struct ethhdr)) { return false; }
+    if (client->h_dest[0] & 1) { return false; }
+
+    box = bridge_box(client->h_dest);
+    if (box == NULL) { return false; }
+
+    memset(d, 0, sizeof(*d));
+    mac_copy(d->box, box);
+
+    if (mac_equal(box, my_wlan_mac_address)) {
+        d->local = true;
+        e = lookup(client->h_dest);
+        d->device_type = (e == NULL) ? device_type_ad_hoc : e->device_type;
+
+        pruned_count++;
+        return true;
+    }
+
+    /* the stp neighbor that box's beacons come to us through */
+    for (i = 0; i < stp_recv_beacon_count; i++) {
+        if (!mac_equal(stp_recv_beacons[i].stp_beacon.originator, box)) {
+            continue;
+        }
+
+        for (j = 0; j < stp_list_count; j++) {
+            if (mac_equal(stp_list[j].box.name, stp_recv_beacons[i].neighbor))
+            {
+                mac_copy(d->nbr, stp_recv_beacons[i].neighbor);
+                pruned_count++;
+                return true;
+            }
+        }
+        break;
+    }
+
+    return false;
+} /* bridge_dest */
+
+void bridge_print(ddprintf_t *fn, FILE *f)
+{
+    int i, j;
+
+    fn(f, "bridge table (learned %d, moved %d, pruned %d):\n",
+            learned_count, moved_count, pruned_count);
+
+    for (i = 0; i < BRIDGE_BUCKETS; i++) {
+        for (j = 0; j < BRIDGE_WAYS; j++) {
+            bridge_entry_t *e = &table[i][j];
+
+            if (!e->used) { continue; }
+
+            fn(f, "    %s behind %s", mac_sprintf(mac_buf1, e->client),
+                    mac_sprintf(mac_buf2, e->box));
+            if (e->device_type != device_type_unknown) {
+                fn(f, " (%s)", device_type_string(e->device_type));
+            }
+            fn(f, ", %lds ago, %d moves%s%s\n", (long) (now.tv_sec - e->sec),
+                    e->moves,
+                    now.tv_sec - e->sec > BRIDGE_AGE ? ", aged out" : "",
+                    e->flaps >= BRIDGE_FLAP_MOVES
+                        && now.tv_sec - e->moved_sec < BRIDGE_FLAP_SECS
+                        ? ", flapping" : "");
+        }
+    }
+} /* bridge_print */
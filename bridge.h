@@ -0,0 +1,43 @@
+/* bridge.h - learn which cloud box each client mac address is behind
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <stdio.h>
+#include "util.h"
+#include "cloud.h"
+#include "device_type.h"
+
+/* seconds a learned client is good for without our hearing from it */
+#define BRIDGE_AGE 300
+
+/* where a unicast client frame needs to go; see bridge_dest() */
+typedef struct {
+    /* the client is behind us, on our interface of this type */
+    bool_t local;
+    device_type_t device_type;
+
+    /* the client is behind the cloud box 'box', which is in the part of the
+     * stp tree hanging off our stp neighbor 'nbr'
+     */
+    mac_address_t box;
+    mac_address_t nbr;
+} bridge_dest_t;
+
+extern void bridge_learn(message_t *message, int msg_len, int dev,
+        bool_t originated_locally);
+extern byte *bridge_box(mac_address_t client);
+extern bool_t bridge_dest(message_t *message, int msg_len, bridge_dest_t *d);
+extern void bridge_print(ddprintf_t *fn, FILE *f);
+
+#endif
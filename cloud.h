@@ -27,6 +27,9 @@
 #include "scan_msg_data.h"
 #include "sequence_data.h"
 #include "parm_change_data.h"
+#include "dist_data.h"
+#include "rtt_data.h"
+#include "hello_data.h"
 
 // #define RETRY_TIMED_OUT_LOCKABLES
 
@@ -83,6 +86,9 @@
 /* largest number of bytes we will give to the "sendto" system call */
 #define MAX_SENDTO 1514
 
+/* message_t.sequence_num counts modulo this */
+#define SEQUENCE_MODULUS 65536
+
 /* payload message; a client packet that we are transporting */
 typedef struct {
     /* since we add a little bit to messages, we may need
@@ -95,6 +101,11 @@ typedef struct {
     mac_address_t originator;
     unsigned short originator_sequence_num;
 
+    /* for a frame routed to the cloud box in message_t.dest rather than
+     * flooded; hops it may still take.  see route.c.
+     */
+    byte hops;
+
     /* the payload data */
     byte msg_body[CLOUD_BUF_LEN];
 } payload_msg_t;
@@ -117,13 +128,15 @@ typedef struct {
     struct ethhdr eth_header;
 
     /* sequence number of this message for passive checking of
-     * received and dropped packets
+     * received and dropped packets.  (16 bits, so that a burst of lost
+     * packets or a high packet rate doesn't wrap it between two packets
+     * we do receive.)
      */
-    byte sequence_num;
+    unsigned short sequence_num;
 
     /* the cloud node we are trying to send a message to.  may not
      * be a neighbor; may need to pass it along via spanning tree
-     * neighbor.
+     * neighbor.  zero for a flooded client message.
      */
     mac_address_t dest;
 
@@ -150,6 +163,15 @@ typedef struct {
 
         /* change wifi parameters across the cloud */
         parm_change_msg_t parm_change;
+
+        /* distribute a file to the whole cloud */
+        dist_msg_t dist;
+
+        /* timestamps for measuring round trip times to neighbors */
+        ping_msg_t ping;
+
+        /* liveness of an stp arc */
+        hello_msg_t hello;
     } v;
 } message_t;
 
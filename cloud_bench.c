@@ -0,0 +1,409 @@
+/* cloud_bench.c - microbenchmarks of the message forwarding path
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* time the per-frame work merge_cloud does to receive and forward
+ * messages, using the real cloud_msg.o, sequence.o, device.o and nbr.o.
+ *
+ * merge_cloud.c is compiled with its main() renamed (see the Makefile), to
+ * get the globals the other modules use.  pio.o is left out, and the pio
+ * functions here stand in for it:  merge_cloud runs as if in pipe mode, and
+ * every frame it sends is counted and thrown away.  so, nothing here
+ * touches a socket, a pipe or a file.
+ *
+ * each benchmark sets up the device, neighbor, perm_io_stat, spanning tree
+ * and stp beacon tables with "size" entries, and calls one function over
+ * and over.  the report gives the best of BENCH_RUNS runs, each at least
+ * BENCH_MIN_TIME seconds long, and the number of frames the fake device
+ * layer was given per call.  the rows are always in the same order, so that
+ * reports from two builds can be diffed.
+ *
+ *     make bench
+ *
+ * or
+ *
+ *     cloud_bench [-q]
+ *
+ * with -q, do short runs, just to check that the benchmarks work.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "pio.h"
+#include "device.h"
+#include "nbr.h"
+#include "status.h"
+#include "sequence.h"
+#include "stp_beacon.h"
+#include "cloud_msg.h"
+
+#define BENCH_RUNS 5
+#define BENCH_MIN_TIME .05
+
+/* frames and bytes handed to the fake device layer */
+static unsigned long long sent_frames, sent_bytes;
+
+static double min_time = BENCH_MIN_TIME;
+
+/* the fake device layer; this replaces pio.o. */
+
+int pio_open(pio_t *pio, char *fname)
+{
+    memset(pio, 0, sizeof(*pio));
+    return 0;
+}
+
+int pio_init_from_fd(pio_t *pio, char *fname, int fd)
+{
+    memset(pio, 0, sizeof(*pio));
+    pio->fd = fd;
+    return 0;
+}
+
+int pio_read_ok(pio_t *pio) { return 0; }
+
+int pio_timed_read_ok(pio_t *pio, int seconds) { return 0; }
+
+int pio_write_ok(pio_t *pio, int n) { return 1; }
+
+int pio_read(pio_t *pio, unsigned char *buf, int buf_len) { return -1; }
+
+int pio_write(pio_t *pio, void *buf, int buf_len)
+{
+    sent_frames++;
+    sent_bytes += buf_len;
+
+    return buf_len;
+}
+
+void pio_print(FILE *f, pio_t *pio) { }
+
+int pio_select_fd(pio_t *pio) { return pio->fd; }
+
+int pio_ring_create(char *fname, int size) { return -1; }
+
+/* mac address of neighbor box i, and of box i that is not a neighbor */
+static void nbr_mac(mac_address_t mac, int i)
+{
+    mac[0] = 0x02;
+    mac[1] = 0;
+    mac[2] = 0;
+    mac[3] = 0;
+    mac[4] = 0;
+    mac[5] = i;
+}
+
+static void remote_mac(mac_address_t mac, int i)
+{
+    nbr_mac(mac, i);
+    mac[3] = 1;
+}
+
+/* a cloud in which we have n wds neighbors, all of them stp neighbors,
+ * with an stp beacon from each.
+ */
+static void setup_cloud(int n)
+{
+    int i;
+
+    memset(device_list, 0, sizeof(device_list));
+    memset(nbr_device_list, 0, MAX_CLOUD * sizeof(cloud_box_t));
+    memset(stp_list, 0, sizeof(stp_list));
+    memset(stp_recv_beacons, 0, MAX_CLOUD * sizeof(stp_recv_beacon_t));
+
+    perm_io_stat_count = 0;
+    memset(have_recv_sequence, 0, MAX_CLOUD * sizeof(bool_t));
+    memset(have_recv_data_sequence, 0, MAX_CLOUD * sizeof(bool_t));
+    memset(have_recv_ping_sequence, 0, MAX_CLOUD * sizeof(bool_t));
+
+    use_pipes = 1;
+    eth_device_name = NULL;
+    nbr_mac(my_wlan_mac_address, 0xfe);
+
+    for (i = 0; i < n; i++) {
+        mac_address_t mac;
+        device_t *d = &device_list[i];
+
+        nbr_mac(mac, i);
+
+        sprintf(d->device_name, "wds0.%d", i);
+        d->device_type = device_type_wds;
+        mac_copy(d->mac_address, mac);
+        d->stat_index = i;
+        d->expect_n = -1;
+
+        mac_copy(nbr_device_list[i].name, mac);
+        nbr_device_list[i].perm_io_stat_index =
+                status_add_by_mac(perm_io_stat, &perm_io_stat_count, mac,
+                        device_type_wds);
+
+        stp_list[i].type = node_type_cloud_box;
+        mac_copy(stp_list[i].box.name, mac);
+
+        mac_copy(stp_recv_beacons[i].stp_beacon.originator, mac);
+        mac_copy(stp_recv_beacons[i].neighbor, mac);
+    }
+
+    device_list_count = n;
+    nbr_device_list_count = n;
+    stp_list_count = n;
+    stp_recv_beacon_count = n;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef void (*bench_fn_t)(long count);
+
+/* time "count" calls; return nanoseconds per call, and set *sends to the
+ * number of frames sent per call.
+ */
+static double time_calls(bench_fn_t fn, long count, double *sends)
+{
+    double start;
+    unsigned long long frames = sent_frames;
+
+    start = now();
+    fn(count);
+    *sends = (sent_frames - frames) / (double) count;
+
+    return (now() - start) * 1e9 / count;
+}
+
+/* run fn long enough to get a steady number, and print a report line */
+static void bench(char *name, int size, bench_fn_t fn)
+{
+    long count = 1000;
+    double best = -1, sends = 0;
+    char size_str[16];
+    int i;
+
+    /* find a count that takes min_time */
+    while (1) {
+        double ns = time_calls(fn, count, &sends);
+        if (ns * count / 1e9 >= min_time || count >= 1000000000L) { break; }
+        count *= 2;
+    }
+
+    for (i = 0; i < BENCH_RUNS; i++) {
+        double ns = time_calls(fn, count, &sends);
+        if (best < 0 || ns < best) { best = ns; }
+    }
+
+    if (size > 0) {
+        sprintf(size_str, "%d", size);
+    } else {
+        sprintf(size_str, "-");
+    }
+
+    printf("%-32s %5s %14.0f %10.1f %8.2f\n", name, size_str,
+            1e9 / best, best, sends);
+    fflush(stdout);
+}
+
+/* sequence_check():  cloud messages from each neighbor in turn, in
+ * sequence.
+ */
+static int seq_n;
+
+static void bench_sequence_check(long count)
+{
+    static message_t message;
+    static unsigned short seq[MAX_CLOUD];
+    long c;
+    int i = 0;
+
+    message.eth_header.h_proto = htons(CLOUD_MSG);
+    mac_copy(message.eth_header.h_dest, my_wlan_mac_address);
+    message.message_type = ping_msg;
+
+    for (c = 0; c < count; c++) {
+        nbr_mac(message.eth_header.h_source, i);
+        message.sequence_num = seq[i]++;
+
+        sequence_check(&message, 0, 0);
+
+        if (++i == seq_n) { i = 0; }
+    }
+}
+
+/* update_k_for_n_state():  wrapped client messages that come in one
+ * piece, or in two.
+ */
+static int k_for_n_pieces;
+
+static void bench_k_for_n(long count)
+{
+    static message_t message;
+    long c;
+    int k = 1;
+
+    message.eth_header.h_proto = htons(WRAPPED_CLIENT_MSG);
+    message.v.msg.n = k_for_n_pieces;
+
+    for (c = 0; c < count; c++) {
+        int msg_len = wrapper_len + 700;
+
+        message.v.msg.k = k;
+        update_k_for_n_state(&message, &msg_len, 0);
+
+        if (++k > k_for_n_pieces) { k = 1; }
+    }
+}
+
+/* bcast_forward_message():  a wrapped client message that came in from
+ * neighbor 0, originated by the last neighbor, to be sent on to the other
+ * stp neighbors.
+ */
+static int bcast_n;
+
+static void bench_bcast_forward(long count)
+{
+    static message_t message;
+    static unsigned short orig_seq;
+    long c;
+
+    message.eth_header.h_proto = htons(WRAPPED_CLIENT_MSG);
+    message.v.msg.k = message.v.msg.n = 1;
+    nbr_mac(message.v.msg.originator, bcast_n - 1);
+
+    for (c = 0; c < count; c++) {
+        nbr_mac(message.eth_header.h_source, 0);
+        message.v.msg.originator_sequence_num = ++orig_seq;
+
+        bcast_forward_message(&message, wrapper_len + 200, 0, false);
+    }
+}
+
+/* send_cloud_message():  route a cloud message to the last neighbor, or
+ * to a box we only know from its stp beacon.
+ */
+static mac_address_t route_dest;
+
+static void bench_route(long count)
+{
+    static message_t message;
+    long c;
+
+    for (c = 0; c < count; c++) {
+        mac_copy(message.dest, route_dest);
+        message.message_type = ping_msg;
+
+        send_cloud_message(&message);
+    }
+}
+
+/* stp_nbr_needs_transmit():  the worst case; the message came from
+ * another neighbor, and the stp neighbor doesn't see the sender directly.
+ */
+static mac_address_t transmit_nbr;
+
+static void bench_nbr_transmit(long count)
+{
+    static message_t message;
+    long c;
+    int n = stp_recv_beacon_count;
+
+    nbr_mac(message.eth_header.h_source, n >= 2 ? n - 2 : 0);
+
+    for (c = 0; c < count; c++) {
+        stp_nbr_needs_transmit(&message, transmit_nbr);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int sizes[] = {4, 8, 16, MAX_CLOUD};
+    int nbrs[] = {1, 2, 4, 8, 16, MAX_CLOUD};
+    int i, j;
+    int c;
+
+    while ((c = getopt(argc, argv, "q")) != -1) {
+        switch (c) {
+        case 'q' : min_time = BENCH_MIN_TIME / 50; break;
+        default :
+            fprintf(stderr, "usage:  cloud_bench [-q]\n");
+            exit(1);
+        }
+    }
+
+    printf("%-32s %5s %14s %10s %8s\n", "benchmark", "size", "frames/sec",
+            "ns/frame", "sends");
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        setup_cloud(sizes[i]);
+        seq_n = sizes[i];
+        bench("sequence_check", sizes[i], bench_sequence_check);
+    }
+
+    setup_cloud(1);
+    k_for_n_pieces = 1;
+    bench("update_k_for_n_state 1 piece", 0, bench_k_for_n);
+    k_for_n_pieces = 2;
+    bench("update_k_for_n_state 2 pieces", 0, bench_k_for_n);
+
+    for (i = 0; i < sizeof(nbrs) / sizeof(nbrs[0]); i++) {
+        setup_cloud(nbrs[i]);
+        bcast_n = nbrs[i];
+        bench("bcast_forward_message", nbrs[i], bench_bcast_forward);
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        setup_cloud(sizes[i]);
+        nbr_mac(route_dest, sizes[i] - 1);
+        bench("send_cloud_message to nbr", sizes[i], bench_route);
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        setup_cloud(sizes[i]);
+
+        /* the last beacon is from a box that isn't a neighbor */
+        remote_mac(route_dest, 0);
+        mac_copy(stp_recv_beacons[sizes[i] - 1].stp_beacon.originator,
+                route_dest);
+        bench("send_cloud_message via beacon", sizes[i], bench_route);
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        setup_cloud(sizes[i]);
+
+        for (j = 0; j < sizes[i]; j++) {
+            int k;
+            stp_recv_beacon_t *b = &stp_recv_beacons[j];
+
+            b->direct_sight_count = sizes[i];
+            for (k = 0; k < sizes[i]; k++) {
+                remote_mac(b->direct_sight[k], k);
+            }
+        }
+
+        nbr_mac(transmit_nbr, sizes[i] - 1);
+        bench("stp_nbr_needs_transmit", sizes[i], bench_nbr_transmit);
+    }
+
+    return 0;
+}
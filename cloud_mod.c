@@ -14,6 +14,7 @@ static const char Version[] = "Version "
     "$Id: cloud_mod.c,v 1.16 2012-02-22 19:27:22 greg Exp $";
 
 #include <sys/time.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
@@ -27,10 +28,13 @@ static const char Version[] = "Version "
 #include "nbr.h"
 #include "stp_beacon.h"
 #include "cloud_box.h"
+#include "etx.h"
 
 char force_local_change = 0;
 char old_db5;
 
+static bool_t global_keeps(mac_address_ptr_t name);
+
 /* are we in the midst of a protocol activity to change the connectivity
  * of the stp tree?
  */
@@ -153,8 +157,17 @@ void check_local_improvement()
             continue;
         }
 
-        old_sig_strength = get_sig_strength(stp_list[k].box.name);
-        new_sig_strength = nbr_device_list[i].signal_strength;
+        /* with db[69], don't undo the global pass.  it weighs a link by
+         * both ends' signal strength and we weigh it by ours, so on an
+         * asymmetric link the two would swap the same arcs back and forth.
+         */
+        if (db[69].d && global_keeps(stp_list[k].box.name)) {
+            if (db[11].d) { ddprintf("arc is in the global best tree.\n"); }
+            continue;
+        }
+
+        old_sig_strength = get_link_strength(stp_list[k].box.name);
+        new_sig_strength = get_link_strength(nbr_device_list[i].name);
         if (db[11].d) {
             ddprintf("new %d, old %d.\n", new_sig_strength, old_sig_strength);
         }
@@ -218,6 +231,258 @@ void check_local_improvement()
     }
 } /* check_local_improvement */
 
+/* global improvement.
+ *
+ * check_local_improvement() looks at one arc at a time and leaves it to
+ * random_eval() whether to swap it in, so getting from a bad tree to a
+ * good one can take many beacon periods.  when stp beacons carry their
+ * originators' status (db[30], db[60] or db[69]), every box hears the
+ * signal strength of every link in the cloud, and which of them are stp
+ * arcs.  from that we work out the maximum weight spanning tree, which
+ * is also a maximum bottleneck spanning tree, and if an arc of ours is in
+ * it and the stp arc it would replace isn't, we go straight to the lock
+ * protocol to swap them.
+ *
+ * every box sorts the arcs the same way, so boxes that hear the same
+ * signal strengths agree on the tree.  an existing stp arc gets a little
+ * extra weight so that we don't flap between nearly equal trees.
+ */
+
+/* extra weight for arcs already in the stp tree */
+#define GLOBAL_STP_BONUS 4
+
+typedef struct {
+    int a, b;
+    int key;
+} global_arc_t;
+
+static stp_link_matrix_t global_links, global_prev_links;
+static bool_t global_prev_valid = false;
+
+/* the maximum spanning tree for global_prev_links */
+static bool_t global_best[STP_MATRIX_MAX][STP_MATRIX_MAX];
+
+/* weight for choosing the tree */
+static int global_key(int a, int b)
+{
+    return global_links.weight[a][b]
+            + (global_links.stp[a][b] ? GLOBAL_STP_BONUS : 0);
+}
+
+/* heaviest arcs first, and the same order on every cloud box */
+static int global_arc_cmp(const void *p1, const void *p2)
+{
+    const global_arc_t *a1 = p1, *a2 = p2;
+    byte *lo1, *hi1, *lo2, *hi2;
+    int result;
+
+    if (a1->key != a2->key) { return a2->key - a1->key; }
+
+    lo1 = global_links.box[a1->a]; hi1 = global_links.box[a1->b];
+    if (mac_cmp(lo1, hi1) > 0) { byte *t = lo1; lo1 = hi1; hi1 = t; }
+    lo2 = global_links.box[a2->a]; hi2 = global_links.box[a2->b];
+    if (mac_cmp(lo2, hi2) > 0) { byte *t = lo2; lo2 = hi2; hi2 = t; }
+
+    result = mac_cmp(lo1, lo2);
+    if (result != 0) { return result; }
+
+    return mac_cmp(hi1, hi2);
+}
+
+static int global_find(int *parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+
+    return i;
+}
+
+/* kruskal's algorithm on global_links, into global_best.  skipped if
+ * nothing has changed since the last time.
+ */
+static void global_build_tree()
+{
+    static global_arc_t arcs[STP_MATRIX_MAX * STP_MATRIX_MAX / 2];
+    int parent[STP_MATRIX_MAX];
+    int arc_count = 0;
+    int i, a, b;
+
+    if (global_prev_valid
+        && memcmp(&global_links, &global_prev_links, sizeof(global_links)) == 0)
+    {
+        return;
+    }
+
+    global_prev_links = global_links;
+    global_prev_valid = true;
+
+    for (a = 0; a < global_links.box_count; a++) {
+        for (b = a + 1; b < global_links.box_count; b++) {
+            if (global_links.weight[a][b] == 0) { continue; }
+            arcs[arc_count].a = a;
+            arcs[arc_count].b = b;
+            arcs[arc_count].key = global_key(a, b);
+            arc_count++;
+        }
+    }
+
+    qsort(arcs, arc_count, sizeof(arcs[0]), global_arc_cmp);
+
+    for (i = 0; i < global_links.box_count; i++) { parent[i] = i; }
+    memset(global_best, 0, sizeof(global_best));
+
+    for (i = 0; i < arc_count; i++) {
+        int ra = global_find(parent, arcs[i].a);
+        int rb = global_find(parent, arcs[i].b);
+
+        if (ra == rb) { continue; }
+        parent[ra] = rb;
+        global_best[arcs[i].a][arcs[i].b] = true;
+        global_best[arcs[i].b][arcs[i].a] = true;
+    }
+
+    if (db[70].d) {
+        ddprintf("global_build_tree; %d boxes, %d arcs; best tree:\n",
+                global_links.box_count, arc_count);
+        for (a = 0; a < global_links.box_count; a++) {
+            for (b = a + 1; b < global_links.box_count; b++) {
+                if (!global_best[a][b] && !global_links.stp[a][b]) { continue; }
+                ddprintf("    %s %s %3d%s%s\n",
+                        mac_sprintf(mac_buf1, global_links.box[a]),
+                        mac_sprintf(mac_buf2, global_links.box[b]),
+                        global_links.weight[a][b],
+                        global_best[a][b] ? " best" : "",
+                        global_links.stp[a][b] ? " stp" : "");
+            }
+        }
+    }
+} /* global_build_tree */
+
+/* the first box on the stp tree path from box 'from' to box 'to', as far
+ * as we can tell from global_links; -1 if there is no path.
+ */
+static int global_first_hop(int from, int to)
+{
+    int queue[STP_MATRIX_MAX], first[STP_MATRIX_MAX];
+    int head = 0, tail = 0;
+    int i;
+
+    for (i = 0; i < global_links.box_count; i++) { first[i] = -1; }
+
+    first[from] = from;
+    queue[tail++] = from;
+
+    while (head < tail) {
+        int a = queue[head++];
+
+        if (a == to) { return first[to]; }
+
+        for (i = 0; i < global_links.box_count; i++) {
+            if (!global_links.stp[a][i] || first[i] != -1) { continue; }
+            first[i] = (a == from) ? i : first[a];
+            queue[tail++] = i;
+        }
+    }
+
+    return -1;
+} /* global_first_hop */
+
+/* is our arc to box 'name' in the maximum spanning tree from the last
+ * check_global_improvement()?
+ */
+static bool_t global_keeps(mac_address_ptr_t name)
+{
+    int n;
+
+    if (!global_prev_valid) { return false; }
+
+    n = stp_link_matrix_index(&global_links, name);
+
+    return n > 0 && global_best[0][n];
+}
+
+/* if one of our arcs belongs in the maximum spanning tree and the stp arc
+ * it would replace doesn't, start swapping them with the lock protocol,
+ * as check_local_improvement() does.  the box at the other end of the
+ * new arc may see a swap at its end of the same arc; the bigger gain
+ * goes first, and the lower mac address on a tie.  returns true if we
+ * started a swap; if not, there may still be a local one to make.
+ */
+bool_t check_global_improvement()
+{
+    int i, j, k, n, o;
+    int gain, other_gain, max_gain;
+    mac_address_ptr_t old, new;
+
+    if (doing_stp_update()) { return false; }
+
+    stp_link_matrix(&global_links);
+    global_build_tree();
+
+    max_gain = 0;
+    for (i = 0; i < nbr_device_list_count; i++) {
+        n = stp_link_matrix_index(&global_links, nbr_device_list[i].name);
+        if (n <= 0 || !global_best[0][n] || global_links.stp[0][n]) {
+            continue;
+        }
+
+        /* our stp neighbor that this box's beacons arrive through */
+        for (j = 0; j < stp_recv_beacon_count; j++) {
+            if (mac_equal(nbr_device_list[i].name,
+                stp_recv_beacons[j].stp_beacon.originator))
+            { break; }
+        }
+        if (j == stp_recv_beacon_count) { continue; }
+
+        for (k = 0; k < stp_list_count; k++) {
+            if (mac_equal(stp_recv_beacons[j].neighbor, stp_list[k].box.name)) {
+                break;
+            }
+        }
+        if (k == stp_list_count) { continue; }
+
+        o = stp_link_matrix_index(&global_links, stp_list[k].box.name);
+        if (o <= 0 || global_best[0][o]) { continue; }
+
+        gain = global_key(0, n) - global_key(0, o);
+        if (gain <= 0) { continue; }
+
+        o = global_first_hop(n, 0);
+        if (o > 0 && !global_best[n][o]) {
+            other_gain = global_key(n, 0) - global_key(n, o);
+            if (other_gain > gain
+                || (other_gain == gain
+                    && mac_cmp(global_links.box[n], global_links.box[0]) < 0))
+            {
+                if (db[70].d) {
+                    ddprintf("check_global_improvement; leaving %s to %s\n",
+                            mac_sprintf(mac_buf1, global_links.box[n]),
+                            mac_sprintf(mac_buf2, global_links.box[o]));
+                }
+                continue;
+            }
+        }
+
+        if (gain > max_gain) {
+            max_gain = gain;
+            new = nbr_device_list[i].name;
+            old = stp_list[k].box.name;
+        }
+    }
+
+    if (max_gain == 0) { return false; }
+
+    ddprintf("check_global_improvement; swapping %s for %s (gain %d)\n",
+            mac_sprintf(mac_buf1, new), mac_sprintf(mac_buf2, old), max_gain);
+
+    add_local_lock_request(old, local_lock_req_old_msg);
+    add_local_lock_request(new, local_lock_req_new_msg);
+
+    return true;
+} /* check_global_improvement */
+
 /* during improvement, guy in the middle sends lock requests to the other
  * two guys using this routine.  (local_lock_req_{old,new}_msg).
  *
@@ -257,7 +522,7 @@ void add_local_lock_request(mac_address_t node_mac, message_type_t type)
         }
     }
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         printf("add_local_lock_request:  gettimeofday failed\n");
         return;
     }
@@ -307,7 +572,7 @@ void process_local_lock_req(message_t *message, int device_index)
 
     memset(&response, 0, sizeof(response));
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         printf("process_local_lock_req:  gettimeofday failed\n");
         return;
     }
@@ -957,7 +1222,7 @@ void process_local_stp_add_request(message_t *message, int device_index)
         mac_dprint(eprintf, stderr, message->eth_header.h_dest);
     }
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         printf("process_local_stp_add_request:  gettimeofday failed\n");
         return;
     }
@@ -1721,7 +1986,7 @@ void check_connectivity(void)
         print_stp_recv_beacons();
     }
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         printf("expire_timed_macs:  gettimeofday failed\n");
         goto finish;
     }
@@ -22,6 +22,7 @@ extern char force_local_change;
 extern char old_db5;
 
 extern void check_local_improvement();
+extern bool_t check_global_improvement();
 extern void add_local_lock_request(mac_address_t node_mac, message_type_t type);
 extern bool_t add_stp_link(mac_address_ptr_t sender);
 extern void local_stp_add_request(mac_address_t node_mac, message_type_t type);
@@ -35,7 +35,17 @@ static const char Version[] = "Version "
 #include "nbr.h"
 #include "scan_msg.h"
 #include "parm_change.h"
+#include "dist.h"
+#include "bridge.h"
+#include "route.h"
+#include "hello.h"
+#include "arp_proxy.h"
+#include "mcast.h"
 #include "timer.h"
+#include "latency.h"
+#include "msg_stat.h"
+#include "journal.h"
+#include "tap.h"
 
 unsigned short originator_sequence_num = 0;
 
@@ -86,6 +96,11 @@ char *message_type_string(message_type_t msg)
     case parm_change_ready_msg : p = "parm_change_ready_msg"; break;
     case parm_change_not_ready_msg : p = "parm_change_not_ready_msg"; break;
     case parm_change_go_msg : p = "parm_change_go_msg"; break;
+    case dist_data_msg : p = "dist_data_msg"; break;
+    case dist_end_msg : p = "dist_end_msg"; break;
+    case dist_status_msg : p = "dist_status_msg"; break;
+    case stp_hello_msg : p = "stp_hello_msg"; break;
+    case ad_hoc_bcast_hint_msg : p = "ad_hoc_bcast_hint_msg"; break;
     }
     return p;
 }
@@ -190,14 +205,6 @@ void process_cloud_message(message_t *message, int device_index)
         process_stp_beacon_recv_msg(message, device_index);
         break;
 
-    case ad_hoc_bcast_block_msg :
-        process_ad_hoc_bcast_block_msg(message, device_index);
-        break;
-
-    case ad_hoc_bcast_unblock_msg :
-        process_ad_hoc_bcast_unblock_msg(message, device_index);
-        break;
-
     case stp_beacon_nak_msg :
         process_stp_beacon_nak_msg(message, device_index);
         break;
@@ -250,6 +257,26 @@ void process_cloud_message(message_t *message, int device_index)
         process_scanresults_msg(message, device_index);
         break;
 
+    case dist_data_msg :
+        process_dist_data_msg(message, device_index);
+        break;
+
+    case dist_end_msg :
+        process_dist_end_msg(message, device_index);
+        break;
+
+    case dist_status_msg :
+        process_dist_status_msg(message, device_index);
+        break;
+
+    case stp_hello_msg :
+        process_stp_hello_msg(message, device_index);
+        break;
+
+    case ad_hoc_bcast_hint_msg :
+        process_ad_hoc_bcast_hint_msg(message, device_index);
+        break;
+
     default :
         ddprintf("process_cloud_message:  unknown message type %s\n",
                 message_type_string(message->message_type));
@@ -267,6 +294,7 @@ int send_cloud_message(message_t *message)
     mac_address_ptr_t next_step, eth_mac_addr;
     char has_eth_mac_addr;
     int msg_len;
+    lat_time_t t_send;
 
     errno = 0;
 
@@ -394,7 +422,7 @@ int send_cloud_message(message_t *message)
     message->eth_header.h_proto = htons(CLOUD_MSG);
 
     if (bcast && message->message_type == ping_response_msg) {
-        message->sequence_num = (send_ping_sequence[pind]++) % 256;
+        message->sequence_num = (send_ping_sequence[pind]++) % SEQUENCE_MODULUS;
 
     } else if (pind == -1) {
         if (!bcast) {
@@ -404,7 +432,7 @@ int send_cloud_message(message_t *message)
         message->sequence_num = 0;
 
     } else {
-        message->sequence_num = (send_sequence[pind]++) % 256;
+        message->sequence_num = (send_sequence[pind]++) % SEQUENCE_MODULUS;
     }
 
     if (db[48].d) {
@@ -418,6 +446,10 @@ int send_cloud_message(message_t *message)
     switch (message->message_type) {
     case ping_msg :
     case ping_response_msg :
+        msg_len = ((byte *) &message->v.ping.echo[message->v.ping.echo_count])
+                - ((byte *) message);
+        break;
+
     case local_stp_delete_request_msg :
     case local_stp_deleted_msg :
     case local_stp_add_request_msg :
@@ -442,6 +474,12 @@ int send_cloud_message(message_t *message)
                 - ((byte *) message);
         break;
 
+    case stp_hello_msg :
+        msg_len = ((byte *) &message->v.hello)
+                + sizeof(message->v.hello)
+                - ((byte *) message);
+        break;
+
     case scanresults_msg :
         msg_len = ((byte *) &message->v.scan)
                 + sizeof(message->v.scan)
@@ -457,6 +495,14 @@ int send_cloud_message(message_t *message)
                 - ((byte *) message);
         break;
 
+    case dist_data_msg :
+    case dist_end_msg :
+    case dist_status_msg :
+        msg_len = ((byte *) &message->v.dist.data[0])
+                + message->v.dist.len
+                - ((byte *) message);
+        break;
+
     case ack_sequence_msg :
     case sequence_msg :
         msg_len = ((byte *) &message->v.seq)
@@ -470,6 +516,11 @@ int send_cloud_message(message_t *message)
                 - ((byte *) message);
         break;
 
+    case ad_hoc_bcast_hint_msg :
+        msg_len = ((byte *) &message->v.msg.msg_body[sizeof(unsigned int)])
+                - ((byte *) message);
+        break;
+
     case stp_beacon_recv_msg :
     case stp_beacon_msg :
         msg_len = ((byte *) &message->v.stp_beacon.status[0])
@@ -501,15 +552,11 @@ int send_cloud_message(message_t *message)
         // )
     }
 
-    if (db[56].d && (message->message_type == ad_hoc_bcast_block_msg
-        || message->message_type == ad_hoc_bcast_unblock_msg))
-    {
-        ddprintf("send_cloud_message sending ad_hoc_bcast_(un)block_msg:\n");
-        fn_print_message(eprintf, stderr,
-                (unsigned char *) message, msg_len);
-    }
+    t_send = latency_start();
 
-    if (use_pipes) {
+    if (journal_mode == journal_replay) {
+        result = msg_len;
+    } else if (use_pipes) {
         result = pio_write(&device_list[j].out_pio, message, msg_len);
     } else {
         memset(&send_arg, 0, sizeof(send_arg));
@@ -524,6 +571,8 @@ int send_cloud_message(message_t *message)
         block_timer_interrupts(SIG_UNBLOCK);
     }
 
+    latency_record(device_list[j].stat_index, lat_sendto, t_send);
+
     if (result == -1) {
         ddprintf("send_cloud_message; sendto error:  %s", strerror(errno));
         if (errno == EMSGSIZE) {
@@ -537,6 +586,13 @@ int send_cloud_message(message_t *message)
         io_stat[device_list[j].stat_index].cloud_send_error++;
 
         return_value = -1;
+
+    } else {
+        msg_stat_count(device_list[j].stat_index, msg_stat_send,
+                message->message_type, msg_len);
+        tap(TAP_SENT, device_list[j].device_name, message, msg_len);
+
+        if (db[84].d) { hello_sent(message->eth_header.h_dest); }
     }
 
     io_stat[device_list[j].stat_index].cloud_send++;
@@ -569,15 +625,17 @@ int send_message(message_t *message, int msg_len, device_t *device)
 
     }
 
+    if (db[84].d) { hello_sent(message->eth_header.h_dest); }
+
     if (msg_len <= MAX_SENDTO) {
         if (db[44].d) { ddprintf("send_message; sending 1-for-1..\n"); }
         message->v.msg.n = 1;
         message->v.msg.k = 1;
         if (pind != -1) {
             if (message->eth_header.h_proto == htons(CLOUD_MSG)) {
-                message->sequence_num = (send_sequence[pind]++) % 256;
+                message->sequence_num = (send_sequence[pind]++) % SEQUENCE_MODULUS;
             } else {
-                message->sequence_num = (send_data_sequence[pind]++) % 256;
+                message->sequence_num = (send_data_sequence[pind]++) % SEQUENCE_MODULUS;
             }
         }
         if (db[48].d) {
@@ -601,9 +659,9 @@ int send_message(message_t *message, int msg_len, device_t *device)
     message->v.msg.n = 2;
     if (pind != -1) {
         if (message->eth_header.h_proto == htons(CLOUD_MSG)) {
-            message->sequence_num = (send_sequence[pind]++) % 256;
+            message->sequence_num = (send_sequence[pind]++) % SEQUENCE_MODULUS;
         } else {
-            message->sequence_num = (send_data_sequence[pind]++) % 256;
+            message->sequence_num = (send_data_sequence[pind]++) % SEQUENCE_MODULUS;
         }
     }
     if (db[48].d) {
@@ -627,9 +685,9 @@ int send_message(message_t *message, int msg_len, device_t *device)
     msg_tail.v.msg.k = 2;
     if (pind != -1) {
         if (msg_tail.eth_header.h_proto == htons(CLOUD_MSG)) {
-            msg_tail.sequence_num = (send_sequence[pind]++) % 256;
+            msg_tail.sequence_num = (send_sequence[pind]++) % SEQUENCE_MODULUS;
         } else {
-            msg_tail.sequence_num = (send_data_sequence[pind]++) % 256;
+            msg_tail.sequence_num = (send_data_sequence[pind]++) % SEQUENCE_MODULUS;
         }
     }
     p_body = ((byte *) message) + MAX_SENDTO;
@@ -834,6 +892,7 @@ static bool_t new_from_originator(message_t *message)
         goto done;
     } else {
         recv->orig_sequence_num = message->v.msg.originator_sequence_num;
+        result = true;
     }
 
     done:
@@ -853,7 +912,7 @@ static bool_t new_from_originator(message_t *message)
  * via which we would have gotten this message.  if so, he doesn't
  * need to hear about it from us.
  */
-static bool_t stp_nbr_needs_transmit(message_t *message, mac_address_t nbr)
+bool_t stp_nbr_needs_transmit(message_t *message, mac_address_t nbr)
 {
     int i;
     stp_recv_beacon_t *recv;
@@ -935,6 +994,10 @@ void bcast_forward_message(message_t *message, int msg_len, int dev,
     bool_t wlan_has_seen = false;
     bool_t eth_has_seen = false;
     bool_t wireless_has_seen = false;
+    bridge_dest_t where;
+    bool_t pruned = false;
+    mcast_dest_t members;
+    bool_t mpruned = false;
     int i, j, result;
 
     if (db[13].d) {
@@ -951,12 +1014,41 @@ void bcast_forward_message(message_t *message, int msg_len, int dev,
 
     if (!originated_locally && !new_from_originator(message)) {
         if (db[13].d) { ddprintf("    not new_from_originator; return\n"); }
+        tap(TAP_DUP, device_list[dev].device_name, message, msg_len);
         goto done;
     }
 
     if (originated_locally) {
         message->v.msg.originator_sequence_num = originator_sequence_num++;
         mac_copy(message->v.msg.originator, my_wlan_mac_address);
+        mac_copy(message->dest, mac_address_zero);
+        message->v.msg.hops = 0;
+    }
+
+    if (db[71].d || db[73].d) {
+        bridge_learn(message, msg_len, dev, originated_locally);
+    }
+
+    if (db[75].d && arp_proxy(message, msg_len, dev, originated_locally)) {
+        goto done;
+    }
+
+    if (db[71].d && route_forward(message, msg_len, dev, originated_locally)) {
+        goto done;
+    }
+
+    /* if we know where a unicast frame's destination is, send it only
+     * that way:  to the stp neighbor whose side of the tree it's on, or
+     * out the one local interface it's on.
+     */
+    if (db[73].d) {
+        pruned = bridge_dest(message, msg_len, &where);
+    }
+
+    /* and a multicast frame only toward members of its group */
+    if (db[77].d) {
+        mcast_snoop(message, msg_len, dev, originated_locally);
+        mpruned = mcast_dest(message, msg_len, &members);
     }
 
     if (device_list[dev].device_type == device_type_wlan) {
@@ -970,6 +1062,18 @@ void bcast_forward_message(message_t *message, int msg_len, int dev,
 
     for (i = 0; i < stp_list_count; i++) {
 
+        if (pruned
+            && (where.local || !mac_equal(stp_list[i].box.name, where.nbr)))
+        {
+            if (db[13].d) { ddprintf("    pruned stp neighbor %d\n", i); }
+            continue;
+        }
+
+        if (mpruned && !mcast_toward(&members, stp_list[i].box.name)) {
+            if (db[13].d) { ddprintf("    no members past stp nbr %d\n", i); }
+            continue;
+        }
+
         /* send to stp neighbors via our ethernet interface at most once.
          * this will look to them like a new client-originated message.
          */
@@ -1037,7 +1141,7 @@ void bcast_forward_message(message_t *message, int msg_len, int dev,
             }
 
             mac_copy(message->eth_header.h_dest,
-                    db[60].d
+                    db[60].d && !pruned && !mpruned
                         ? mac_address_bcast
                         : device_list[j].mac_address
                     );
@@ -1050,7 +1154,7 @@ void bcast_forward_message(message_t *message, int msg_len, int dev,
                 ddprintf("    did wireless broadcast..\n");
             }
 
-            if (db[60].d) { wireless_has_seen = true; }
+            if (db[60].d && !mpruned) { wireless_has_seen = true; }
         } else {
             if (db[13].d) {
                 ddprintf("    not sending.  has_eth %d, wireless_has_seen %d\n",
@@ -1059,6 +1163,26 @@ void bcast_forward_message(message_t *message, int msg_len, int dev,
         }
     }
 
+    if (pruned
+        && !(where.local && where.device_type == device_type_eth))
+    {
+        eth_has_seen = true;
+    }
+
+    if (pruned
+        && !(where.local && where.device_type == device_type_wlan))
+    {
+        wlan_has_seen = true;
+    }
+
+    if (mpruned && !(members.local & (1 << device_type_eth))) {
+        eth_has_seen = true;
+    }
+
+    if (mpruned && !(members.local & (1 << device_type_wlan))) {
+        wlan_has_seen = true;
+    }
+
     if (!eth_has_seen && eth_device_name != NULL && !db[20].d) {
         if (db[13].d) { ddprintf("    sending on eth0..\n"); }
         send_to_interface(message->v.msg.msg_body, msg_len - wrapper_len,
@@ -1073,7 +1197,11 @@ void bcast_forward_message(message_t *message, int msg_len, int dev,
                 device_type_wlan);
     }
 
-    if (ad_hoc_mode && db[50].d) {
+    if (ad_hoc_mode && db[50].d
+        && !(pruned
+            && !(where.local && where.device_type == device_type_ad_hoc))
+        && !(mpruned && !(members.local & (1 << device_type_ad_hoc))))
+    {
         ad_hoc_client_forward_msg(message, msg_len, dev);
     }
 
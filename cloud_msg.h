@@ -28,5 +28,6 @@ extern bool_t update_k_for_n_state(message_t *message, int *msg_len,
         int dev_index);
 extern void bcast_forward_message(message_t *message, int msg_len, int d,
         bool_t originated_locally);
+extern bool_t stp_nbr_needs_transmit(message_t *message, mac_address_t nbr);
 
 #endif
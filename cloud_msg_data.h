@@ -43,13 +43,21 @@ typedef enum {
     local_stp_deleted_msg = 26,
     local_stp_refused_msg = 27,
     stp_beacon_nak_msg = 28,
-    ad_hoc_bcast_block_msg = 29,
-    ad_hoc_bcast_unblock_msg = 30,
+    ad_hoc_bcast_block_msg = 29,        /* no longer sent */
+    ad_hoc_bcast_unblock_msg = 30,      /* no longer sent */
     scanresults_msg = 31,
     parm_change_start_msg = 32,
     parm_change_ready_msg = 33,
     parm_change_not_ready_msg = 34,
     parm_change_go_msg = 35,
+    dist_data_msg = 36,
+    dist_end_msg = 37,
+    dist_status_msg = 38,
+    stp_hello_msg = 39,
+    ad_hoc_bcast_hint_msg = 40,
 } message_type_t;
 
+/* one more than the largest message type; keep this up to date */
+#define MESSAGE_TYPE_COUNT (ad_hoc_bcast_hint_msg + 1)
+
 #endif
@@ -0,0 +1,1698 @@
+/* cloud_sim.c - simulate a cloud of boxes talking over pipes on one host
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* run a simulated cloud of N boxes on a development host.
+ *
+ * each box is a real merge_cloud process run with "-i <directory>", so it
+ * talks through named pipes (see pio.c) instead of raw sockets.  this
+ * program is the radio between them.  it reads every frame every box
+ * sends, decides which other boxes hear it, when, and whether it gets
+ * through, and delivers it into their input pipes at the scheduled time.
+ *
+ * this is a discrete-event simulation on a virtual clock.  each box runs
+ * with -V (see sim_clock.c), so its time is whatever we last told it, and
+ * its timer goes off only when we move its clock past it.  we keep the
+ * queue of frames in flight, and the boxes tell us when their next alarms
+ * are due.  each step, we move the clock to the earliest of those, write
+ * the frames that are due into the boxes' pipes, and tell every box that
+ * has a frame or an alarm due what time it is.  then we wait until each of
+ * them says it has nothing left to do at that time, and put the frames
+ * they sent on their way.  no time passes while the boxes work, so the
+ * results don't depend on how busy the host is, and two runs with the
+ * same seed and topology come out the same.
+ *
+ * with -w, the boxes instead run on their own real timers, and the event
+ * queue here runs on the wall clock too.  the results then depend on how
+ * busy the host is; compare such runs by their spread, not by single
+ * numbers.
+ *
+ * a cloud is limited to MAX_CLOUD boxes, since that is all a merge_cloud
+ * keeps track of (stp_recv_beacons[]); past that, the boxes drop each
+ * other's beacons and the numbers mean nothing.  each box has at most
+ * SIM_MAX_NBRS neighbors, so that its devices (also MAX_CLOUD) fit.
+ *
+ * the topology is either random (-n boxes scattered over a square) or read
+ * from a file (-t).  from it we get a signal strength for each pair of
+ * boxes, and a loss rate, delay and bandwidth for each link.  each box
+ * gets the same wds file and sig_strength file that check_devices(),
+ * check_nbr_devices() and update_nbr_signal_strength() read on a real box,
+ * listing the neighbors it can hear.
+ *
+ * box i's pipes live in <dir>/<i>/:
+ *     wlan0, eth0, eth0:1             its own interfaces
+ *     wds0.<j>, wds0.<j>:1            link to neighbor box j
+ * with <name>.cloud carrying frames to the box and <name>.cooked carrying
+ * frames from it.  with -R, these are pio rings rather than named pipes;
+ * the boxes inherit the rings' eventfds from us.
+ *
+ * frames a box sends on wds0.<j> arrive at box j on wds0.<i>; frames sent on
+ * wlan0 go to every neighbor's wlan0.  frames sent out eth0 leave the cloud,
+ * and are where we count client deliveries.  the simulator injects
+ * broadcast client frames into random boxes' eth0 at a fixed rate; every
+ * other box reachable from the sender should put each one out its eth0.
+ *
+ * at the end we report how long it took the spanning tree to settle, how
+ * many cloud protocol bytes were sent (by message type), and what fraction
+ * of the client frames were delivered and how long they took.
+ *
+ * command line arguments:
+ *
+ *  -n N:       number of boxes for a random topology (default 10, at
+ *              most MAX_CLOUD)
+ *  -t file:    read the topology from file instead.  lines are
+ *                  box <x> <y>
+ *                  link <i> <j> [sig N] [loss P] [delay MS] [bw KBPS] [down]
+ *              box indices count from 0 in the order the boxes are listed.
+ *              a link line forces a link whether or not the boxes are in
+ *              range of each other; "down" removes one.
+ *  -g meters:  spacing of boxes in a random topology (default 60)
+ *  -S N:       minimum signal strength to hear another box (default 80)
+ *  -b kbps:    default link bandwidth (default 5000)
+ *  -l ms:      default link delay (default 1)
+ *  -s seconds: how long to run (default 60)
+ *  -c rate:    client frames injected per second (default 10)
+ *  -z bytes:   size of client frames (default 200)
+ *  -r seed:    random number seed (default 1)
+ *  -d dir:     directory for pipes and per-box files (default /tmp/cloud_sim)
+ *  -m path:    merge_cloud program to run (default ./merge_cloud)
+ *  -w:         run on the wall clock rather than the virtual clock
+ *  -R:         use shared-memory rings (see pio_ring_create()) instead of
+ *              named pipes
+ *  -P:         don't run anything; print the boxes and links this topology
+ *              comes to, as a -t file with every link spelled out.
+ *              (cloud_netns uses this to build the same cloud out of
+ *              network namespaces.)
+ *  -- args:    pass the remaining arguments to every merge_cloud
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <netinet/in.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "pio.h"
+#include "sim_clock.h"
+
+/* merge_cloud handles a cloud of at most MAX_CLOUD boxes */
+#define SIM_MAX_BOXES MAX_CLOUD
+
+/* each neighbor takes two of merge_cloud's MAX_CLOUD device slots
+ * (wds0.N and wds0.N:1), and wlan0, eth0 and eth0:1 take three more.
+ */
+#define SIM_MAX_NBRS ((MAX_CLOUD - 3) / 2)
+
+/* pipes per box:  wlan0, eth0, eth0:1, and two per neighbor */
+#define SIM_MAX_PIPES (3 + 2 * SIM_MAX_NBRS)
+
+/* signal strength one meter away, and loss of signal per decade of
+ * distance
+ */
+#define SIM_SIG_1M 150.
+#define SIM_SIG_PER_DECADE 30.
+
+/* at or above this signal strength a link has only SIM_BASE_LOSS; below
+ * it, loss climbs linearly to SIM_WEAK_LOSS at the minimum signal strength.
+ */
+#define SIM_SIG_GOOD 120
+#define SIM_BASE_LOSS .01
+#define SIM_WEAK_LOSS .5
+
+/* protocol type and marker of the client frames we inject */
+#define SIM_CLIENT_PROTO 0x88b5
+#define SIM_CLIENT_MAGIC "SIMC"
+
+/* a frame that can't be delivered because the box's input pipe is full is
+ * retried this often, for this long, and then dropped.
+ */
+#define SIM_RETRY_TIME .001
+#define SIM_RETRY_LIMIT .05
+
+/* on the virtual clock, the boxes' time at the start of the run, in
+ * seconds since 1970.  (a fixed time, so that runs can be repeated.)
+ */
+#define SIM_EPOCH 1000000000LL
+
+/* how long to wait for a box to finish a step before checking that it
+ * hasn't died, in milliseconds
+ */
+#define SIM_STEP_CHECK 1000
+
+/* the tree is "converged" if no spanning tree change was seen in the last
+ * this many seconds of the run
+ */
+#define SIM_QUIET_TIME 10.
+
+#define MAX_FRAME (MAX_SENDTO_BUF)
+
+typedef enum {
+    pipe_wlan,
+    pipe_eth,
+    pipe_eth_cloud,
+    pipe_wds,
+    pipe_wds_cloud,
+} pipe_kind_t;
+
+typedef struct {
+    pipe_kind_t kind;
+
+    /* for wds pipes, the index of the link in the box's nbr[] */
+    int nbr;
+
+    /* <name>.cloud; we write frames to the box here */
+    int to_box_fd;
+
+    /* <name>.cooked; we read frames the box sends here */
+    int from_box_fd;
+
+    /* with -R, the rings instead of the fds */
+    pio_t *to_box_pio, *from_box_pio;
+
+    /* pio sequence byte for frames we write */
+    byte seq;
+} sim_pipe_t;
+
+typedef struct {
+    int box;
+
+    /* index of the reverse link in the neighbor's nbr[] */
+    int back;
+
+    int sig;
+    double loss;
+
+    /* seconds, and bits per second */
+    double delay, bw;
+
+    /* the link is sending until then */
+    double busy_until;
+
+    int wds_pipe, wds_cloud_pipe;
+} sim_nbr_t;
+
+typedef struct {
+    double x, y;
+    pid_t pid;
+
+    mac_address_t wlan_mac, eth_mac;
+
+    int nbr_count;
+    sim_nbr_t nbr[SIM_MAX_NBRS];
+
+    int pipe_count;
+    sim_pipe_t pipe[SIM_MAX_PIPES];
+
+    /* the box's wireless interface is broadcasting until then */
+    double air_busy_until;
+
+    /* connected component, for the number of expected client deliveries */
+    int component;
+
+    /* on the virtual clock:  clock.cloud and clock.cooked, when the box's
+     * alarm goes off (seconds; -1 if never), whether it is working on the
+     * current step, and whether it has a frame due in the next one.
+     */
+    int clock_to_fd, clock_from_fd;
+    double alarm;
+    bool_t running;
+    bool_t woken;
+    bool_t dead;
+} sim_box_t;
+
+/* a link given in the topology file */
+typedef struct {
+    int a, b;
+    int sig;
+    double loss, delay, bw;
+    bool_t down;
+} sim_link_t;
+
+/* a frame on its way to a box */
+typedef struct {
+    double t;
+    double give_up;
+    int box, pipe;
+    int len;
+    byte *data;
+} sim_event_t;
+
+/* on the virtual clock, a frame a box sent during a step; see
+ * take_frame()
+ */
+typedef struct {
+    int box, pipe;
+    unsigned int seq;
+    int len;
+    byte *data;
+} sim_staged_t;
+
+/* payload of an injected client frame */
+typedef struct {
+    char magic[4];
+    int src;
+    unsigned int id;
+    double sent;
+} sim_client_t;
+
+static sim_box_t *boxes;
+static int box_count = 10;
+
+static sim_link_t *links;
+static int link_count;
+
+static sim_event_t *events;
+static int event_count, event_max;
+
+static double spacing = 60;
+static int min_sig = 80;
+static double default_bw = 5000e3;
+static double default_delay = .001;
+static double run_time = 60;
+static double client_rate = 10;
+static int client_size = 200;
+static long seed = 1;
+static char *sim_dir = "/tmp/cloud_sim";
+static char *merge_cloud_path = "./merge_cloud";
+static char *topology_fname = NULL;
+static bool_t use_rings = false;
+static bool_t wall_clock = false;
+static bool_t print_only = false;
+static char **extra_args;
+static int extra_arg_count;
+
+static double start_time;
+static volatile sig_atomic_t got_stop;
+
+static sim_staged_t *staged;
+static int staged_count, staged_max;
+static unsigned int staged_seq;
+static int dead_boxes;
+
+/* statistics */
+static unsigned long long ctl_frames, ctl_bytes;
+static unsigned long long type_frames[MESSAGE_TYPE_COUNT];
+static unsigned long long type_bytes[MESSAGE_TYPE_COUNT];
+static unsigned long long data_frames, data_bytes;
+static unsigned long long lost_frames, overrun_frames;
+static double last_tree_change;
+
+static unsigned int client_sent;
+static unsigned long long client_expected, client_delivered, client_dups;
+static double client_latency_total, client_latency_max;
+static byte *delivered_bits;
+static unsigned int client_max;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage:\ncloud_sim [-n boxes | -t topology_file] "
+            "[-g spacing] [-S min_signal] \\\n"
+            "    [-b kbps] [-l delay_ms] [-s seconds] [-c client_rate] "
+            "[-z client_size] \\\n"
+            "    [-r seed] [-d directory] [-m merge_cloud] [-w] [-R] [-P] "
+            "[-- merge_cloud args]\n");
+    exit(1);
+}
+
+/* seconds since we started, on the wall clock */
+static double sim_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9 - start_time;
+}
+
+static void stop_handler(int sig)
+{
+    got_stop = 1;
+}
+
+static void process_args(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "n:t:g:S:b:l:s:c:z:r:d:m:wRP")) != -1) {
+        switch (c) {
+        case 'n' : box_count = atoi(optarg); break;
+        case 't' : topology_fname = strdup(optarg); break;
+        case 'g' : spacing = atof(optarg); break;
+        case 'S' : min_sig = atoi(optarg); break;
+        case 'b' : default_bw = atof(optarg) * 1000; break;
+        case 'l' : default_delay = atof(optarg) / 1000; break;
+        case 's' : run_time = atof(optarg); break;
+        case 'c' : client_rate = atof(optarg); break;
+        case 'z' : client_size = atoi(optarg); break;
+        case 'r' : seed = atol(optarg); break;
+        case 'd' : sim_dir = strdup(optarg); break;
+        case 'm' : merge_cloud_path = strdup(optarg); break;
+        case 'w' : wall_clock = true; break;
+        case 'R' : use_rings = true; break;
+        case 'P' : print_only = true; break;
+        default : usage();
+        }
+    }
+
+    extra_args = &argv[optind];
+    extra_arg_count = argc - optind;
+
+    if (client_size < (int) (sizeof(struct ethhdr) + sizeof(sim_client_t))) {
+        client_size = sizeof(struct ethhdr) + sizeof(sim_client_t);
+    }
+
+    if (client_size > MAX_SENDTO) { client_size = MAX_SENDTO; }
+}
+
+/* read box positions and link overrides from topology_fname */
+static void read_topology(void)
+{
+    char line[256];
+    int link_max = 0;
+    int line_num = 0;
+
+    FILE *f = fopen(topology_fname, "r");
+    if (f == NULL) {
+        fprintf(stderr, "cloud_sim; could not open %s:  %s\n",
+                topology_fname, strerror(errno));
+        exit(1);
+    }
+
+    box_count = 0;
+    boxes = calloc(SIM_MAX_BOXES, sizeof(sim_box_t));
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *p = line;
+        char word[32];
+        int n;
+
+        line_num++;
+
+        while (*p == ' ' || *p == '\t') { p++; }
+        if (*p == '#' || *p == '\n' || *p == '\0') { continue; }
+
+        if (sscanf(p, "%31s%n", word, &n) != 1) { continue; }
+        p += n;
+
+        if (strcmp(word, "box") == 0) {
+            if (box_count >= SIM_MAX_BOXES) {
+                fprintf(stderr, "cloud_sim; more than %d boxes; "
+                        "merge_cloud handles at most MAX_CLOUD\n",
+                        SIM_MAX_BOXES);
+                exit(1);
+            }
+            if (sscanf(p, "%lf %lf", &boxes[box_count].x,
+                    &boxes[box_count].y) != 2)
+            {
+                goto bad_line;
+            }
+            box_count++;
+
+        } else if (strcmp(word, "link") == 0) {
+            sim_link_t *l;
+            char key[32];
+
+            if (link_count >= link_max) {
+                link_max = 2 * link_max + 16;
+                links = realloc(links, link_max * sizeof(sim_link_t));
+            }
+
+            l = &links[link_count];
+            memset(l, 0, sizeof(*l));
+            l->sig = -1;
+            l->loss = l->delay = l->bw = -1;
+
+            if (sscanf(p, "%d %d%n", &l->a, &l->b, &n) != 2) {
+                goto bad_line;
+            }
+            p += n;
+
+            while (sscanf(p, "%31s%n", key, &n) == 1) {
+                double value;
+                p += n;
+
+                if (strcmp(key, "down") == 0) {
+                    l->down = true;
+                    continue;
+                }
+
+                if (sscanf(p, "%lf%n", &value, &n) != 1) { goto bad_line; }
+                p += n;
+
+                if (strcmp(key, "sig") == 0) {
+                    l->sig = (int) value;
+                } else if (strcmp(key, "loss") == 0) {
+                    l->loss = value;
+                } else if (strcmp(key, "delay") == 0) {
+                    l->delay = value / 1000;
+                } else if (strcmp(key, "bw") == 0) {
+                    l->bw = value * 1000;
+                } else {
+                    goto bad_line;
+                }
+            }
+
+            link_count++;
+
+        } else {
+            goto bad_line;
+        }
+    }
+
+    fclose(f);
+    return;
+
+    bad_line:
+    fprintf(stderr, "cloud_sim; %s line %d not understood:  %s",
+            topology_fname, line_num, line);
+    exit(1);
+}
+
+/* scatter box_count boxes at random over a square */
+static void random_topology(void)
+{
+    double side = spacing * sqrt((double) box_count);
+    int i;
+
+    if (box_count < 1 || box_count > SIM_MAX_BOXES) {
+        fprintf(stderr, "cloud_sim; need 1 to %d boxes "
+                "(merge_cloud handles at most MAX_CLOUD)\n", SIM_MAX_BOXES);
+        exit(1);
+    }
+
+    boxes = calloc(SIM_MAX_BOXES, sizeof(sim_box_t));
+
+    for (i = 0; i < box_count; i++) {
+        boxes[i].x = drand48() * side;
+        boxes[i].y = drand48() * side;
+    }
+}
+
+/* signal strength between two boxes from the distance between them */
+static int path_sig(sim_box_t *a, sim_box_t *b)
+{
+    double dx = a->x - b->x, dy = a->y - b->y;
+    double d = sqrt(dx * dx + dy * dy);
+    double sig;
+
+    if (d < 1) { d = 1; }
+
+    sig = SIM_SIG_1M - SIM_SIG_PER_DECADE * log10(d);
+
+    if (sig < 0) { sig = 0; }
+    if (sig > 255) { sig = 255; }
+
+    return (int) sig;
+}
+
+/* loss rate of a link with signal strength sig */
+static double sig_loss(int sig)
+{
+    if (sig >= SIM_SIG_GOOD) { return SIM_BASE_LOSS; }
+    if (sig <= min_sig) { return SIM_WEAK_LOSS; }
+
+    return SIM_BASE_LOSS + (SIM_WEAK_LOSS - SIM_BASE_LOSS)
+            * (SIM_SIG_GOOD - sig) / (double) (SIM_SIG_GOOD - min_sig);
+}
+
+/* the topology file's entry for boxes a and b, if any */
+static sim_link_t *find_link(int a, int b)
+{
+    int i;
+
+    for (i = 0; i < link_count; i++) {
+        if ((links[i].a == a && links[i].b == b)
+            || (links[i].a == b && links[i].b == a))
+        {
+            return &links[i];
+        }
+    }
+
+    return NULL;
+}
+
+typedef struct {
+    int a, b, sig;
+} candidate_t;
+
+static int candidate_cmp(const void *p1, const void *p2)
+{
+    const candidate_t *c1 = p1, *c2 = p2;
+
+    return c2->sig - c1->sig;
+}
+
+/* connect a and b in both directions */
+static void add_link(int a, int b, int sig, sim_link_t *l)
+{
+    sim_nbr_t *na = &boxes[a].nbr[boxes[a].nbr_count];
+    sim_nbr_t *nb = &boxes[b].nbr[boxes[b].nbr_count];
+
+    na->box = b;
+    nb->box = a;
+    na->back = boxes[b].nbr_count;
+    nb->back = boxes[a].nbr_count;
+
+    na->sig = nb->sig = sig;
+    na->loss = nb->loss = (l != NULL && l->loss >= 0) ? l->loss : sig_loss(sig);
+    na->delay = nb->delay
+            = (l != NULL && l->delay >= 0) ? l->delay : default_delay;
+    na->bw = nb->bw = (l != NULL && l->bw > 0) ? l->bw : default_bw;
+
+    boxes[a].nbr_count++;
+    boxes[b].nbr_count++;
+}
+
+/* decide who hears whom.  links in the topology file come first; then the
+ * strongest remaining pairs, as long as both boxes have room for another
+ * neighbor.
+ */
+static void make_links(void)
+{
+    candidate_t *cand = malloc(box_count * box_count / 2 * sizeof(candidate_t)
+            + sizeof(candidate_t));
+    int cand_count = 0;
+    int i, j;
+
+    for (i = 0; i < link_count; i++) {
+        sim_link_t *l = &links[i];
+
+        if (l->down) { continue; }
+
+        if (l->a < 0 || l->a >= box_count || l->b < 0 || l->b >= box_count
+            || l->a == l->b)
+        {
+            fprintf(stderr, "cloud_sim; bad link %d %d\n", l->a, l->b);
+            exit(1);
+        }
+
+        if (boxes[l->a].nbr_count >= SIM_MAX_NBRS
+            || boxes[l->b].nbr_count >= SIM_MAX_NBRS)
+        {
+            fprintf(stderr, "cloud_sim; too many links for box %d or %d\n",
+                    l->a, l->b);
+            continue;
+        }
+
+        add_link(l->a, l->b,
+                l->sig >= 0 ? l->sig : path_sig(&boxes[l->a], &boxes[l->b]),
+                l);
+    }
+
+    for (i = 0; i < box_count; i++) {
+        for (j = i + 1; j < box_count; j++) {
+            int sig = path_sig(&boxes[i], &boxes[j]);
+
+            if (sig < min_sig || find_link(i, j) != NULL) { continue; }
+
+            cand[cand_count].a = i;
+            cand[cand_count].b = j;
+            cand[cand_count].sig = sig;
+            cand_count++;
+        }
+    }
+
+    qsort(cand, cand_count, sizeof(candidate_t), candidate_cmp);
+
+    for (i = 0; i < cand_count; i++) {
+        if (boxes[cand[i].a].nbr_count < SIM_MAX_NBRS
+            && boxes[cand[i].b].nbr_count < SIM_MAX_NBRS)
+        {
+            add_link(cand[i].a, cand[i].b, cand[i].sig, NULL);
+        }
+    }
+
+    free(cand);
+}
+
+/* print the topology as a -t file, with the loss, delay and bandwidth each
+ * link ended up with
+ */
+static void print_topology(int components)
+{
+    int i, k;
+
+    printf("# %d boxes, %d connected component%s\n", box_count, components,
+            components == 1 ? "" : "s");
+
+    for (i = 0; i < box_count; i++) {
+        printf("box %.1f %.1f\n", boxes[i].x, boxes[i].y);
+    }
+
+    for (i = 0; i < box_count; i++) {
+        for (k = 0; k < boxes[i].nbr_count; k++) {
+            sim_nbr_t *n = &boxes[i].nbr[k];
+
+            if (n->box < i) { continue; }
+
+            printf("link %d %d sig %d loss %g delay %g bw %g\n", i, n->box,
+                    n->sig, n->loss, n->delay * 1000, n->bw / 1000);
+        }
+    }
+}
+
+/* label connected components, and return the number of them */
+static int find_components(void)
+{
+    int *stack = malloc(box_count * sizeof(int));
+    int count = 0;
+    int i;
+
+    for (i = 0; i < box_count; i++) { boxes[i].component = -1; }
+
+    for (i = 0; i < box_count; i++) {
+        int top = 0;
+
+        if (boxes[i].component != -1) { continue; }
+
+        boxes[i].component = count;
+        stack[top++] = i;
+
+        while (top > 0) {
+            int b = stack[--top];
+            int k;
+
+            for (k = 0; k < boxes[b].nbr_count; k++) {
+                int n = boxes[b].nbr[k].box;
+                if (boxes[n].component == -1) {
+                    boxes[n].component = count;
+                    stack[top++] = n;
+                }
+            }
+        }
+
+        count++;
+    }
+
+    free(stack);
+
+    return count;
+}
+
+/* make the fifo <dir>/<name>.<suffix> and open it */
+static int open_fifo(char *dir, char *name, char *suffix)
+{
+    char fname[PATH_MAX];
+    int fd;
+
+    snprintf(fname, sizeof(fname), "%s/%s.%s", dir, name, suffix);
+
+    unlink(fname);
+    if (mkfifo(fname, S_IRUSR|S_IWUSR | S_IRGRP|S_IWGRP) == -1) {
+        fprintf(stderr, "cloud_sim; mkfifo %s:  %s\n", fname, strerror(errno));
+        exit(1);
+    }
+
+    /* read/write, so that opening doesn't block */
+    fd = open(fname, O_RDWR | O_NONBLOCK);
+    if (fd == -1) {
+        fprintf(stderr, "cloud_sim; open %s:  %s\n", fname, strerror(errno));
+        exit(1);
+    }
+
+    return fd;
+}
+
+/* make the ring <dir>/<name>.<suffix> and open it */
+static pio_t *open_ring(char *dir, char *name, char *suffix)
+{
+    char fname[PATH_MAX];
+    pio_t *pio = malloc(sizeof(pio_t));
+
+    snprintf(fname, sizeof(fname), "%s/%s.%s", dir, name, suffix);
+
+    unlink(fname);
+    if (pio == NULL || pio_ring_create(fname, PIO_RING_SIZE) != 0
+        || pio_open(pio, fname) != 0)
+    {
+        fprintf(stderr, "cloud_sim; could not make ring %s\n", fname);
+        exit(1);
+    }
+
+    return pio;
+}
+
+/* add a pipe pair to box b */
+static int add_pipe(int b, char *dir, char *name, pipe_kind_t kind, int nbr)
+{
+    sim_box_t *box = &boxes[b];
+    sim_pipe_t *p = &box->pipe[box->pipe_count];
+
+    p->kind = kind;
+    p->nbr = nbr;
+    p->to_box_pio = p->from_box_pio = NULL;
+
+    if (use_rings) {
+        p->to_box_pio = open_ring(dir, name, "cloud");
+        p->from_box_pio = open_ring(dir, name, "cooked");
+        p->to_box_fd = p->to_box_pio->fd;
+        p->from_box_fd = pio_select_fd(p->from_box_pio);
+    } else {
+        p->to_box_fd = open_fifo(dir, name, "cloud");
+        p->from_box_fd = open_fifo(dir, name, "cooked");
+    }
+    p->seq = 0;
+
+    return box->pipe_count++;
+}
+
+static void make_mac(mac_address_t mac, int kind, int i)
+{
+    mac[0] = 0x02;
+    mac[1] = 0;
+    mac[2] = 0;
+    mac[3] = kind;
+    mac[4] = (i >> 8) & 0xff;
+    mac[5] = i & 0xff;
+}
+
+static void mac_string(char *buf, mac_address_t mac)
+{
+    sprintf(buf, "%02x:%02x:%02x:%02x:%02x:%02x",
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+/* make box i's directory, pipes, and the files merge_cloud reads */
+static void setup_box(int i)
+{
+    sim_box_t *box = &boxes[i];
+    char dir[PATH_MAX / 2], fname[PATH_MAX], name[64], mac[32];
+    FILE *wds, *sig;
+    int k;
+
+    snprintf(dir, sizeof(dir), "%s/%d", sim_dir, i);
+    mkdir(dir, 0755);
+
+    add_pipe(i, dir, "wlan0", pipe_wlan, -1);
+    add_pipe(i, dir, "eth0", pipe_eth, -1);
+    add_pipe(i, dir, "eth0:1", pipe_eth_cloud, -1);
+
+    snprintf(fname, sizeof(fname), "%s/wds", dir);
+    wds = fopen(fname, "w");
+
+    snprintf(fname, sizeof(fname), "%s/sig_strength", dir);
+    sig = fopen(fname, "w");
+
+    if (wds == NULL || sig == NULL) {
+        fprintf(stderr, "cloud_sim; could not write files in %s\n", dir);
+        exit(1);
+    }
+
+    fprintf(sig, "# mac chan signal noise rate\n");
+
+    for (k = 0; k < box->nbr_count; k++) {
+        sim_nbr_t *n = &box->nbr[k];
+
+        mac_string(mac, boxes[n->box].wlan_mac);
+
+        snprintf(name, sizeof(name), "wds0.%d", n->box);
+        n->wds_pipe = add_pipe(i, dir, name, pipe_wds, k);
+        fprintf(wds, "%s %s\n", name, mac);
+
+        snprintf(name, sizeof(name), "wds0.%d:1", n->box);
+        n->wds_cloud_pipe = add_pipe(i, dir, name, pipe_wds_cloud, k);
+
+        fprintf(sig, "%s 1 %d 0 11\n", mac, n->sig);
+    }
+
+    fclose(wds);
+    fclose(sig);
+
+    snprintf(fname, sizeof(fname), "%s/eth_beacons", dir);
+    fclose(fopen(fname, "w"));
+
+    box->clock_to_fd = box->clock_from_fd = -1;
+    box->alarm = -1;
+
+    if (!wall_clock) {
+        box->clock_to_fd = open_fifo(dir, "clock", "cloud");
+        box->clock_from_fd = open_fifo(dir, "clock", "cooked");
+    }
+}
+
+/* in box i's merge_cloud, before the exec:  close the other boxes' pipes
+ * and clocks, and (unless they are rings, whose eventfds it must inherit)
+ * its own, which it opens again by name.  otherwise a big cloud leaves
+ * the box with fds too big for select().
+ */
+static void close_other_fds(int i)
+{
+    int j, k;
+
+    for (j = 0; j < box_count; j++) {
+        for (k = 0; k < boxes[j].pipe_count; k++) {
+            sim_pipe_t *p = &boxes[j].pipe[k];
+
+            if (j == i && p->to_box_pio != NULL) { continue; }
+
+            if (p->to_box_pio != NULL) {
+                close(p->to_box_pio->fd);
+                close(p->to_box_pio->event_fd);
+                close(p->from_box_pio->fd);
+                close(p->from_box_pio->event_fd);
+            } else {
+                close(p->to_box_fd);
+                close(p->from_box_fd);
+            }
+        }
+
+        if (boxes[j].clock_to_fd != -1) {
+            close(boxes[j].clock_to_fd);
+            close(boxes[j].clock_from_fd);
+        }
+    }
+}
+
+/* start merge_cloud for box i */
+static void start_box(int i)
+{
+    sim_box_t *box = &boxes[i];
+    char dir[PATH_MAX / 2], wds[PATH_MAX], sig[PATH_MAX], eth[PATH_MAX];
+    char log[PATH_MAX], perm_log[PATH_MAX], status[PATH_MAX];
+    char wlan_mac[32], eth_mac[32];
+    char *args[32 + 64];
+    int a = 0, k;
+
+    snprintf(dir, sizeof(dir), "%s/%d", sim_dir, i);
+    snprintf(wds, sizeof(wds), "%s/wds", dir);
+    snprintf(sig, sizeof(sig), "%s/sig_strength", dir);
+    snprintf(eth, sizeof(eth), "%s/eth_beacons", dir);
+    snprintf(log, sizeof(log), "%s/log", dir);
+    snprintf(perm_log, sizeof(perm_log), "%s/perm_log", dir);
+    snprintf(status, sizeof(status), "%s/cloud_status", dir);
+    mac_string(wlan_mac, box->wlan_mac);
+    mac_string(eth_mac, box->eth_mac);
+
+    args[a++] = merge_cloud_path;
+    args[a++] = "-n";
+    args[a++] = "-i"; args[a++] = dir;
+    args[a++] = "-w"; args[a++] = "wlan0";
+    args[a++] = "-W"; args[a++] = wlan_mac;
+    args[a++] = "-e"; args[a++] = "eth0";
+    args[a++] = "-E"; args[a++] = eth_mac;
+    args[a++] = "-p"; args[a++] = wds;
+    args[a++] = "-a"; args[a++] = sig;
+    args[a++] = "-b"; args[a++] = eth;
+    args[a++] = "-L"; args[a++] = perm_log;
+    args[a++] = "-s"; args[a++] = status;
+    if (!wall_clock) { args[a++] = "-V"; }
+
+    for (k = 0; k < extra_arg_count && k < 64; k++) {
+        args[a++] = extra_args[k];
+    }
+    args[a] = NULL;
+
+    box->pid = fork();
+
+    if (box->pid == -1) {
+        fprintf(stderr, "cloud_sim; fork:  %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if (box->pid == 0) {
+        int fd = open(log, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        int null_fd = open("/dev/null", O_RDONLY);
+
+        if (fd != -1) {
+            dup2(fd, 1);
+            dup2(fd, 2);
+        }
+        if (null_fd != -1) { dup2(null_fd, 0); }
+
+        close_other_fds(i);
+
+        execv(merge_cloud_path, args);
+        fprintf(stderr, "cloud_sim; exec %s:  %s\n", merge_cloud_path,
+                strerror(errno));
+        _exit(1);
+    }
+}
+
+/* event queue; a binary heap ordered by delivery time */
+static void push_event(sim_event_t *e)
+{
+    int i;
+
+    if (event_count >= event_max) {
+        event_max = 2 * event_max + 1024;
+        events = realloc(events, event_max * sizeof(sim_event_t));
+    }
+
+    i = event_count++;
+
+    while (i > 0 && events[(i - 1) / 2].t > e->t) {
+        events[i] = events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    events[i] = *e;
+}
+
+static void pop_event(sim_event_t *e)
+{
+    sim_event_t last;
+    int i = 0;
+
+    *e = events[0];
+    last = events[--event_count];
+
+    while (1) {
+        int child = 2 * i + 1;
+
+        if (child >= event_count) { break; }
+        if (child + 1 < event_count && events[child + 1].t < events[child].t) {
+            child++;
+        }
+        if (last.t <= events[child].t) { break; }
+
+        events[i] = events[child];
+        i = child;
+    }
+
+    if (event_count > 0) { events[i] = last; }
+}
+
+/* schedule delivery of a copy of the frame to box's pipe at time t */
+static void schedule(int box, int pipe, byte *frame, int len, double t)
+{
+    sim_event_t e;
+
+    e.t = t;
+    e.give_up = t + SIM_RETRY_LIMIT;
+    e.box = box;
+    e.pipe = pipe;
+    e.len = len;
+    e.data = malloc(len);
+    memcpy(e.data, frame, len);
+
+    push_event(&e);
+}
+
+/* write a frame to a box, with the pio length and sequence header.
+ * return 0 if written, -1 if the box's pipe is too full right now.
+ */
+static int write_to_box(int b, int p, byte *frame, int len)
+{
+    sim_pipe_t *pipe = &boxes[b].pipe[p];
+    byte buf[MAX_FRAME + 3];
+    short net_len = htons((short) len);
+    int queued = 0;
+
+    if (pipe->to_box_pio != NULL) {
+        if (pio_write_ok(pipe->to_box_pio, len) != 1) { return -1; }
+        return pio_write(pipe->to_box_pio, frame, len) == len ? 0 : -1;
+    }
+
+    /* pio_read() reads at most PIPE_CAPACITY bytes at a time, and can't
+     * handle a read that ends part way through a frame.
+     */
+    if (ioctl(pipe->to_box_fd, FIONREAD, &queued) == 0
+        && queued + len + 3 > PIPE_CAPACITY)
+    {
+        return -1;
+    }
+
+    memcpy(buf, &net_len, 2);
+    buf[2] = pipe->seq++;
+    memcpy(&buf[3], frame, len);
+
+    if (write(pipe->to_box_fd, buf, len + 3) != len + 3) { return -1; }
+
+    return 0;
+}
+
+/* note a frame a box sent, for the report */
+static void count_frame(byte *frame, int len, double now)
+{
+    unsigned short proto;
+    message_t *m = (message_t *) frame;
+
+    if (len < (int) sizeof(struct ethhdr)) { return; }
+
+    proto = ntohs(m->eth_header.h_proto);
+
+    if (proto == CLOUD_MSG
+        && len >= (int) (offsetof(message_t, message_type)
+                + sizeof(message_type_t)))
+    {
+        message_type_t type;
+
+        memcpy(&type, &m->message_type, sizeof(type));
+
+        ctl_frames++;
+        ctl_bytes += len;
+
+        if (type >= 0 && type < MESSAGE_TYPE_COUNT) {
+            type_frames[type]++;
+            type_bytes[type] += len;
+        }
+
+        switch (type) {
+        case local_stp_added_msg :
+        case local_stp_added_changed_msg :
+        case local_stp_deleted_msg :
+        case stp_arc_delete_msg :
+            last_tree_change = now;
+            break;
+        default :
+            break;
+        }
+
+    } else {
+        data_frames++;
+        data_bytes += len;
+    }
+}
+
+/* a client frame came out of box b's eth0 */
+static void note_client_delivery(int b, byte *frame, int len, double now)
+{
+    sim_client_t c;
+    unsigned long long bit;
+
+    if (len < (int) (sizeof(struct ethhdr) + sizeof(c))) { return; }
+
+    memcpy(&c, frame + sizeof(struct ethhdr), sizeof(c));
+
+    if (memcmp(c.magic, SIM_CLIENT_MAGIC, 4) != 0) { return; }
+    if (c.id >= client_sent || c.src == b) { return; }
+
+    bit = (unsigned long long) c.id * box_count + b;
+
+    if (delivered_bits[bit / 8] & (1 << (bit % 8))) {
+        client_dups++;
+        return;
+    }
+
+    delivered_bits[bit / 8] |= 1 << (bit % 8);
+
+    client_delivered++;
+    client_latency_total += now - c.sent;
+    if (now - c.sent > client_latency_max) {
+        client_latency_max = now - c.sent;
+    }
+}
+
+/* box b sent a frame through its pipe p; send it on its way */
+static void route_frame(int b, int p, byte *frame, int len, double now)
+{
+    sim_box_t *box = &boxes[b];
+    sim_pipe_t *pipe = &box->pipe[p];
+    int k;
+
+    count_frame(frame, len, now);
+
+    switch (pipe->kind) {
+
+    case pipe_eth :
+    case pipe_eth_cloud :
+        if (len >= (int) sizeof(struct ethhdr)
+            && ntohs(((struct ethhdr *) frame)->h_proto) == SIM_CLIENT_PROTO)
+        {
+            note_client_delivery(b, frame, len, now);
+        }
+        break;
+
+    case pipe_wlan : {
+        /* everyone in range hears it, each through their own link */
+        double start = now > box->air_busy_until ? now : box->air_busy_until;
+        double airtime = len * 8. / default_bw;
+
+        box->air_busy_until = start + airtime;
+
+        for (k = 0; k < box->nbr_count; k++) {
+            sim_nbr_t *n = &box->nbr[k];
+
+            if (drand48() < n->loss) { lost_frames++; continue; }
+
+            schedule(n->box, 0, frame, len,
+                    start + len * 8. / n->bw + n->delay);
+        }
+        break;
+    }
+
+    case pipe_wds :
+    case pipe_wds_cloud : {
+        sim_nbr_t *n = &box->nbr[pipe->nbr];
+        sim_nbr_t *back = &boxes[n->box].nbr[n->back];
+        double start = now > n->busy_until ? now : n->busy_until;
+        double tx = len * 8. / n->bw;
+
+        n->busy_until = start + tx;
+
+        if (drand48() < n->loss) { lost_frames++; break; }
+
+        schedule(n->box,
+                pipe->kind == pipe_wds ? back->wds_pipe : back->wds_cloud_pipe,
+                frame, len, start + tx + n->delay);
+        break;
+    }
+    }
+}
+
+/* box b sent a frame through its pipe p.  on the wall clock, send it on
+ * its way now.  on the virtual clock, keep it until every box is done
+ * with the step, and then send them all on their way in order of box and
+ * pipe (see route_staged()), so that the order the boxes happened to
+ * finish in doesn't change what happens.
+ */
+static void take_frame(int b, int p, byte *frame, int len, double now)
+{
+    sim_staged_t *f;
+
+    if (wall_clock) {
+        route_frame(b, p, frame, len, now);
+        return;
+    }
+
+    if (staged_count >= staged_max) {
+        staged_max = 2 * staged_max + 1024;
+        staged = realloc(staged, staged_max * sizeof(sim_staged_t));
+    }
+
+    f = &staged[staged_count++];
+    f->box = b;
+    f->pipe = p;
+    f->seq = staged_seq++;
+    f->len = len;
+    f->data = malloc(len);
+    memcpy(f->data, frame, len);
+}
+
+static int staged_cmp(const void *p1, const void *p2)
+{
+    const sim_staged_t *f1 = p1, *f2 = p2;
+
+    if (f1->box != f2->box) { return f1->box - f2->box; }
+    if (f1->pipe != f2->pipe) { return f1->pipe - f2->pipe; }
+
+    return f1->seq < f2->seq ? -1 : f1->seq > f2->seq;
+}
+
+static void route_staged(double now)
+{
+    int i;
+
+    qsort(staged, staged_count, sizeof(sim_staged_t), staged_cmp);
+
+    for (i = 0; i < staged_count; i++) {
+        route_frame(staged[i].box, staged[i].pipe, staged[i].data,
+                staged[i].len, now);
+        free(staged[i].data);
+    }
+
+    staged_count = 0;
+}
+
+/* read every complete frame available from box b's pipe p */
+static void read_pipe(int b, int p, double now)
+{
+    int fd = boxes[b].pipe[p].from_box_fd;
+    pio_t *pio = boxes[b].pipe[p].from_box_pio;
+    byte header[3];
+    byte frame[MAX_FRAME];
+
+    /* this also leaves the ring asking for a wakeup when it's empty */
+    if (pio != NULL) {
+        while (pio_read_ok(pio) == 1) {
+            int len = pio_read(pio, frame, sizeof(frame));
+            if (len > 0) { take_frame(b, p, frame, len, now); }
+        }
+        return;
+    }
+
+    while (1) {
+        int len;
+
+        /* pio_write() writes each frame with one write(), so a frame is
+         * either all there or not there at all.
+         */
+        if (read(fd, header, 3) != 3) { return; }
+
+        len = ntohs(*(short *) header);
+
+        if (len <= 0 || len > MAX_FRAME || read(fd, frame, len) != len) {
+            fprintf(stderr, "cloud_sim; box %d pipe %d out of sync\n", b, p);
+            return;
+        }
+
+        take_frame(b, p, frame, len, now);
+    }
+}
+
+/* put a broadcast client frame into a random box's eth0 */
+static void inject_client_frame(double now)
+{
+    byte frame[MAX_FRAME];
+    struct ethhdr *eth = (struct ethhdr *) frame;
+    sim_client_t c;
+    int b = (int) (drand48() * box_count);
+    int i;
+
+    if (client_sent >= client_max) { return; }
+
+    memset(frame, 0, client_size);
+    memset(eth->h_dest, 0xff, 6);
+    make_mac(eth->h_source, 2, b);
+    eth->h_proto = htons(SIM_CLIENT_PROTO);
+
+    memcpy(c.magic, SIM_CLIENT_MAGIC, 4);
+    c.src = b;
+    c.id = client_sent;
+    c.sent = now;
+    memcpy(frame + sizeof(struct ethhdr), &c, sizeof(c));
+
+    boxes[b].woken = true;
+
+    if (write_to_box(b, 1, frame, client_size) != 0) {
+        overrun_frames++;
+        return;
+    }
+
+    client_sent++;
+
+    for (i = 0; i < box_count; i++) {
+        if (i != b && boxes[i].component == boxes[b].component) {
+            client_expected++;
+        }
+    }
+}
+
+static void print_report(double elapsed, int components)
+{
+    int i, k, links = 0;
+    double converged = last_tree_change;
+    unsigned long long box_drops = 0;
+
+    for (i = 0; i < box_count; i++) {
+        links += boxes[i].nbr_count;
+
+        for (k = 0; k < boxes[i].pipe_count; k++) {
+            if (boxes[i].pipe[k].from_box_pio != NULL) {
+                box_drops += boxes[i].pipe[k].from_box_pio->ring->drops;
+            }
+        }
+    }
+
+    printf("cloud_sim:  %d boxes, %d links, %d connected component%s, "
+            "%.1f seconds\n",
+            box_count, links / 2, components, components == 1 ? "" : "s",
+            elapsed);
+    if (wall_clock) {
+        printf("(wall clock times; repeated runs with the same seed vary)\n");
+    }
+    if (dead_boxes > 0) {
+        printf("%d box%s died during the run; see their logs\n", dead_boxes,
+                dead_boxes == 1 ? "" : "es");
+    }
+
+    if (elapsed - converged >= SIM_QUIET_TIME) {
+        printf("spanning tree converged at %.2f seconds\n", converged);
+    } else {
+        printf("spanning tree not converged; last change at %.2f seconds\n",
+                converged);
+    }
+
+    printf("\ncloud protocol:  %llu frames, %llu bytes "
+            "(%.0f bytes/s, %.0f bytes/s per box)\n",
+            ctl_frames, ctl_bytes, ctl_bytes / elapsed,
+            ctl_bytes / elapsed / box_count);
+
+    printf("    %-5s %10s %12s\n", "type", "frames", "bytes");
+    for (i = 0; i < MESSAGE_TYPE_COUNT; i++) {
+        if (type_frames[i] == 0) { continue; }
+        printf("    %-5d %10llu %12llu\n", i, type_frames[i], type_bytes[i]);
+    }
+
+    printf("other frames:  %llu frames, %llu bytes\n", data_frames,
+            data_bytes);
+    printf("medium:  %llu frames lost, %llu dropped on full input pipes\n",
+            lost_frames, overrun_frames);
+    if (use_rings) {
+        printf("boxes:  %llu frames dropped on full output rings\n",
+                box_drops);
+    }
+
+    printf("\nclient frames:  %u sent, %llu deliveries expected, "
+            "%llu delivered (%.1f%%), %llu duplicates\n",
+            client_sent, client_expected, client_delivered,
+            client_expected == 0 ? 0. : 100. * client_delivered
+                    / client_expected,
+            client_dups);
+
+    if (client_delivered > 0) {
+        printf("client latency:  mean %.2f ms, max %.2f ms\n",
+                1000. * client_latency_total / client_delivered,
+                1000. * client_latency_max);
+    }
+}
+
+/* deliver every frame that is due by now */
+static void deliver_due(double now)
+{
+    while (event_count > 0 && events[0].t <= now) {
+        sim_event_t e;
+        pop_event(&e);
+
+        boxes[e.box].woken = true;
+
+        if (write_to_box(e.box, e.pipe, e.data, e.len) == 0) {
+            free(e.data);
+
+        } else if (now + SIM_RETRY_TIME <= e.give_up) {
+            e.t = now + SIM_RETRY_TIME;
+            push_event(&e);
+
+        } else {
+            overrun_frames++;
+            free(e.data);
+        }
+    }
+}
+
+/* run until run_time on the wall clock; return the time we stopped */
+static double run_wall_clock(struct pollfd *fds, int *fd_box, int *fd_pipe,
+        int fd_count)
+{
+    double next_client, now;
+    int i;
+
+    next_client = client_rate > 0 ? 1. / client_rate : run_time + 1;
+
+    while (!got_stop && (now = sim_now()) < run_time) {
+        int timeout_ms = 10;
+        double next = next_client;
+
+        /* rings are cheap to look at, and must be looked at (and found
+         * empty) before their eventfds will wake us.
+         */
+        if (use_rings) {
+            now = sim_now();
+            for (i = 0; i < fd_count; i++) {
+                read_pipe(fd_box[i], fd_pipe[i], now);
+            }
+        }
+
+        if (event_count > 0 && events[0].t < next) { next = events[0].t; }
+
+        if (next <= now) {
+            timeout_ms = 0;
+        } else if (next - now < .01) {
+            timeout_ms = (int) ((next - now) * 1000);
+        }
+
+        if (poll(fds, fd_count, timeout_ms) > 0) {
+            now = sim_now();
+            for (i = 0; i < fd_count; i++) {
+                if (fds[i].revents & POLLIN) {
+                    read_pipe(fd_box[i], fd_pipe[i], now);
+                }
+            }
+        }
+
+        now = sim_now();
+
+        deliver_due(now);
+
+        while (next_client <= now) {
+            inject_client_frame(now);
+            next_client += 1. / client_rate;
+        }
+    }
+
+    return sim_now();
+}
+
+/* box b has exited on its own; leave it out from now on */
+static void box_died(int b)
+{
+    fprintf(stderr, "cloud_sim; box %d died\n", b);
+
+    boxes[b].dead = true;
+    boxes[b].running = false;
+    boxes[b].alarm = -1;
+    boxes[b].pid = 0;
+    dead_boxes++;
+}
+
+/* on the virtual clock, set box b's clock to now, and let it run */
+static void wake_box(int b, double now)
+{
+    sim_clock_msg_t t = SIM_EPOCH * 1000000 + llround(now * 1e6);
+
+    boxes[b].woken = false;
+
+    if (boxes[b].dead) { return; }
+
+    if (write(boxes[b].clock_to_fd, &t, sizeof(t)) != sizeof(t)) {
+        fprintf(stderr, "cloud_sim; setting box %d's clock:  %s\n", b,
+                strerror(errno));
+        exit(1);
+    }
+
+    boxes[b].running = true;
+}
+
+/* box b says it is done with this step; note when its alarm is due */
+static void read_box_clock(int b)
+{
+    sim_clock_msg_t t;
+
+    if (read(boxes[b].clock_from_fd, &t, sizeof(t)) != sizeof(t)) { return; }
+
+    boxes[b].running = false;
+    boxes[b].alarm = t == SIM_CLOCK_NO_ALARM
+            ? -1
+            : (t - SIM_EPOCH * 1000000) / 1e6;
+}
+
+/* wait until every box we woke is done with the step at time now, taking
+ * the frames they send as they go.  fds has room after the fd_count pipes
+ * for a clock pipe per box.
+ */
+static void finish_step(struct pollfd *fds, int *fd_box, int *fd_pipe,
+        int fd_count, double now)
+{
+    int i, running = 0;
+
+    for (i = 0; i < box_count; i++) {
+        fds[fd_count + i].fd = boxes[i].running ? boxes[i].clock_from_fd : -1;
+        fds[fd_count + i].events = POLLIN;
+        if (boxes[i].running) { running++; }
+    }
+
+    while (running > 0 && !got_stop) {
+        int result;
+
+        if (use_rings) {
+            for (i = 0; i < fd_count; i++) {
+                read_pipe(fd_box[i], fd_pipe[i], now);
+            }
+        }
+
+        result = poll(fds, fd_count + box_count, SIM_STEP_CHECK);
+
+        if (result == -1 && errno != EINTR) {
+            fprintf(stderr, "cloud_sim; poll:  %s\n", strerror(errno));
+            exit(1);
+        }
+
+        if (result > 0) {
+            for (i = 0; i < fd_count; i++) {
+                if (fds[i].revents & POLLIN) {
+                    read_pipe(fd_box[i], fd_pipe[i], now);
+                }
+            }
+
+            for (i = 0; i < box_count; i++) {
+                if (fds[fd_count + i].revents & POLLIN) {
+                    read_box_clock(i);
+                }
+            }
+
+        } else if (result == 0) {
+            for (i = 0; i < box_count; i++) {
+                if (boxes[i].running
+                    && waitpid(boxes[i].pid, NULL, WNOHANG) == boxes[i].pid)
+                {
+                    box_died(i);
+                }
+            }
+        }
+
+        running = 0;
+        for (i = 0; i < box_count; i++) {
+            if (!boxes[i].running) { fds[fd_count + i].fd = -1; }
+            if (boxes[i].running) { running++; }
+        }
+    }
+
+    /* a box writes its frames before it says it is done */
+    for (i = 0; i < fd_count; i++) {
+        read_pipe(fd_box[i], fd_pipe[i], now);
+    }
+}
+
+/* run until run_time on the virtual clock; return the time we stopped */
+static double run_virtual_clock(struct pollfd *fds, int *fd_box,
+        int *fd_pipe, int fd_count)
+{
+    double next_client, now = 0;
+    int i;
+
+    next_client = client_rate > 0 ? 1. / client_rate : run_time + 1;
+
+    for (i = 0; i < box_count; i++) { wake_box(i, now); }
+
+    while (!got_stop && dead_boxes < box_count) {
+        double next = next_client;
+
+        finish_step(fds, fd_box, fd_pipe, fd_count, now);
+        route_staged(now);
+
+        if (event_count > 0 && events[0].t < next) { next = events[0].t; }
+
+        for (i = 0; i < box_count; i++) {
+            if (boxes[i].alarm >= 0 && boxes[i].alarm < next) {
+                next = boxes[i].alarm;
+            }
+        }
+
+        if (next > run_time) { return run_time; }
+        if (next > now) { now = next; }
+
+        deliver_due(now);
+
+        while (next_client <= now) {
+            inject_client_frame(now);
+            next_client += 1. / client_rate;
+        }
+
+        for (i = 0; i < box_count; i++) {
+            if (boxes[i].alarm >= 0 && boxes[i].alarm <= now) {
+                boxes[i].woken = true;
+            }
+            if (boxes[i].woken) { wake_box(i, now); }
+        }
+    }
+
+    return now;
+}
+
+int main(int argc, char **argv)
+{
+    struct pollfd *fds;
+    int *fd_box, *fd_pipe;
+    int fd_count = 0;
+    int components;
+    double now;
+    struct rlimit rl;
+    struct timespec ts;
+    int i, k;
+
+    process_args(argc, argv);
+
+    srand48(seed);
+
+    if (topology_fname != NULL) {
+        read_topology();
+    } else {
+        random_topology();
+    }
+
+    make_links();
+    components = find_components();
+
+    if (print_only) {
+        print_topology(components);
+        return 0;
+    }
+
+    /* two fds per pipe */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    mkdir(sim_dir, 0755);
+
+    /* every box's macs first, since each box's files list its neighbors' */
+    for (i = 0; i < box_count; i++) {
+        make_mac(boxes[i].wlan_mac, 0, i);
+        make_mac(boxes[i].eth_mac, 1, i);
+    }
+
+    for (i = 0; i < box_count; i++) { setup_box(i); }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start_time = ts.tv_sec + ts.tv_nsec / 1e9;
+
+    for (i = 0; i < box_count; i++) { start_box(i); }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* and on the virtual clock, a clock pipe per box after the others */
+    fds = malloc(box_count * (SIM_MAX_PIPES + 1) * sizeof(struct pollfd));
+    fd_box = malloc(box_count * SIM_MAX_PIPES * sizeof(int));
+    fd_pipe = malloc(box_count * SIM_MAX_PIPES * sizeof(int));
+
+    for (i = 0; i < box_count; i++) {
+        for (k = 0; k < boxes[i].pipe_count; k++) {
+            fds[fd_count].fd = boxes[i].pipe[k].from_box_fd;
+            fds[fd_count].events = POLLIN;
+            fd_box[fd_count] = i;
+            fd_pipe[fd_count] = k;
+            fd_count++;
+        }
+    }
+
+    client_max = (unsigned int) (client_rate * run_time) + 1;
+    delivered_bits = calloc((unsigned long long) client_max * box_count / 8 + 1,
+            1);
+
+    if (wall_clock) {
+        now = run_wall_clock(fds, fd_box, fd_pipe, fd_count);
+    } else {
+        now = run_virtual_clock(fds, fd_box, fd_pipe, fd_count);
+    }
+
+    for (i = 0; i < box_count; i++) {
+        if (boxes[i].pid > 0) { kill(boxes[i].pid, SIGTERM); }
+    }
+    for (i = 0; i < box_count; i++) {
+        if (boxes[i].pid > 0) { waitpid(boxes[i].pid, NULL, 0); }
+    }
+
+    print_report(now, components);
+
+    return 0;
+}
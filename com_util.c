@@ -70,6 +70,9 @@ typedef struct {
 
 static int send_part_of_file(int fd);
 static void end_sending_file();
+static void window_get(message_t *msg);
+static void window_receive(message_t *msg);
+static void window_sender_reply(message_t *msg);
 
 static int new_stdin[2];
 static int new_stdout[2];
@@ -309,13 +312,13 @@ static void send_message(unsigned char *buf, int buflen, msg_type_t msg_type)
                     - (unsigned long) &msg);
         }
 
-        if (cooked_out_file == NULL) {
+        if (have_out_pio) {
+            result = pio_write(out_pio, (void *) &msg,
+                    (char *) &(msg.msg_body[next_gulp]) - (char *) &msg);
+        } else if (cooked_out_file == NULL) {
             result = sendto(packet_socket, (void *) &msg,
                     (char *) &(msg.msg_body[next_gulp]) - (char *) &msg, 0,
                     (struct sockaddr *) &send_arg, sizeof(send_arg));
-        } else if (have_out_pio) {
-            result = pio_write(out_pio, (void *) &msg,
-                    (char *) &(msg.msg_body[next_gulp]) - (char *) &msg);
         } else {
             result = write(out_fd, (void *) &msg,
                     (char *) &(msg.msg_body[next_gulp]) - (char *) &msg);
@@ -622,6 +625,8 @@ unsigned char byte_buf[TBUF_LEN];
  * find file /tmp/(file to send) on wrt54g and send that file.
  *
  * set state to "state_sending_file".
+ *
+ * a window_get_msg asks for the same thing with the windowed transfer.
  */
 static void start_sending_file(message_t *msg)
 {
@@ -629,6 +634,11 @@ static void start_sending_file(message_t *msg)
     char fname[PATH_MAX];
     unsigned char *p;
 
+    if (msg->msg_type == window_get_msg) {
+        window_get(msg);
+        return;
+    }
+
     p = &msg->msg_body[msg->msg_body_len - 1];
 
     while (p > &msg->msg_body[0] && *(p-1) != '/') { p--; }
@@ -775,6 +785,9 @@ static void start_receiving_file(message_t *buf)
 /* gulp the next chunk of the file from the other side.
  * send the other side back the length of the message we received, and
  * our sequence number.  he will re-send if he notices a problem.
+ *
+ * the windowed transfer's start, data and end messages go to
+ * window_receive().
  */
 static void continue_receiving_file(message_t *buf)
 {
@@ -785,6 +798,11 @@ static void continue_receiving_file(message_t *buf)
     int len;
     int seq;
 
+    if (buf->msg_type != transfer_cont_msg) {
+        window_receive(buf);
+        return;
+    }
+
     if (!receiving) {
         fprintf(stderr, "continue_receiving_file:  "
                 "got transfer_cont while not receiving.\n");
@@ -844,6 +862,730 @@ static void end_receiving_file(message_t *buf)
     state = state_nominal;
 }
 
+/* windowed file transfer.
+ *
+ * the stop-and-wait transfer above gets 996 bytes across per round trip,
+ * which makes pushing a firmware image take minutes.  this one keeps up
+ * to WINDOW_MAX chunks in flight.  the receiver answers every data message
+ * with the next chunk it needs and a bitmap of which of the chunks after
+ * that it is holding.  it writes only in order, to "name.CRC.part", so
+ * that file always holds exactly the chunks received so far; a later
+ * transfer of the same file (same whole-file crc) that was cut off picks
+ * up from there.
+ *
+ * links deliver in order, so when the ack for a chunk comes back, any
+ * chunk sent before it that is still missing was lost, and the sender
+ * resends just those.  a timeout (the sender's own, or a window_ack_msg
+ * with WINDOW_ACK_TIMEOUT from a receiver that has heard nothing for a
+ * while) resends the first missing chunk.  the window starts small, grows
+ * by a chunk for each chunk acked, and halves on a loss, so a slow link
+ * or a full simulation pipe doesn't get buried.
+ *
+ * messages, all fields 32 bits in network byte order:
+ *   window_start_msg  size, crc, chunk length, name
+ *   window_data_msg   chunk index, chunk crc, data
+ *   window_ack_msg    next chunk needed, bitmap (2 words), flags
+ *   window_end_msg    size, crc
+ *   window_done_msg   status (0 is ok)
+ *   window_get_msg    name; asks the other side to send it to us
+ *
+ * the old messages above are still handled, for boxes whose firmware
+ * predates these.
+ */
+
+#define WINDOW_CHUNK 1024
+#define WINDOW_MAX 64
+#define WINDOW_START 8
+
+/* give up after this many timeouts in a row */
+#define WINDOW_TIMEOUTS 25
+
+/* window_ack_msg flags */
+#define WINDOW_ACK_TIMEOUT 1
+
+typedef struct {
+    window_status_t status;
+    int fd;
+    char name[PATH_MAX];
+    unsigned int size, crc, chunks;
+    bool_t started;             /* the receiver has acked the start */
+    bool_t end_sent;
+
+    unsigned int base;          /* first chunk not acked */
+    unsigned int next;          /* first chunk never sent */
+    unsigned int cwnd;          /* chunks allowed in flight */
+    unsigned int recover;       /* don't halve cwnd again until base is here */
+
+    /* by chunk % WINDOW_MAX, for chunks base .. next - 1:  the serial
+     * number of the data message that last carried the chunk, and whether
+     * the receiver has it.
+     */
+    unsigned int serial;
+    unsigned int sent[WINDOW_MAX];
+    bool_t acked[WINDOW_MAX];
+
+    int timeouts;
+    unsigned int resent;
+    struct timeval start_time;
+} window_sender_t;
+
+typedef struct {
+    window_status_t status;
+    int fd;
+    char fname[PATH_MAX];
+    char part_fname[PATH_MAX];
+    unsigned int size, crc, chunks;
+    unsigned int next;          /* first chunk not yet written */
+
+    /* chunks after next that have arrived, by chunk % WINDOW_MAX */
+    bool_t have[WINDOW_MAX];
+    int len[WINDOW_MAX];
+    byte data[WINDOW_MAX][WINDOW_CHUNK];
+
+    /* client side of a get:  where to put the file, and whether we are
+     * still waiting for the window_start_msg.
+     */
+    char local_fname[PATH_MAX];
+    char get_name[PATH_MAX];
+    bool_t get_pending;
+
+    int timeouts;
+    unsigned int bad;
+} window_receiver_t;
+
+static window_sender_t sender = { .status = window_idle, .fd = -1 };
+static window_receiver_t receiver = { .status = window_idle, .fd = -1 };
+
+static void put32(byte *p, unsigned int n)
+{
+    n = htonl(n);
+    memcpy(p, (char *) &n, 4);
+}
+
+static unsigned int get32(byte *p)
+{
+    unsigned int n;
+    memcpy((char *) &n, p, 4);
+    return ntohl(n);
+}
+
+/* name of file "name" from the other side in our /tmp */
+static void tmp_file_name(char *fname, int len, char *name)
+{
+    char *p = strrchr(name, '/');
+    snprintf(fname, len, "/tmp/%s", (p == NULL) ? name : p + 1);
+}
+
+/* send the receiver a chunk, or send it again */
+static void window_send_chunk(unsigned int chunk)
+{
+    byte buf[8 + WINDOW_CHUNK];
+    int slot = chunk % WINDOW_MAX;
+    int len = pread(sender.fd, &buf[8], WINDOW_CHUNK,
+            (off_t) chunk * WINDOW_CHUNK);
+
+    if (len == -1) {
+        fprintf(stderr, "window_send_chunk; read of %s failed:  %s\n",
+                sender.name, strerror(errno));
+        return;
+    }
+
+    put32(&buf[0], chunk);
+    put32(&buf[4], crc32_bytes(0, &buf[8], len));
+    send_message(buf, 8 + len, window_data_msg);
+
+    sender.sent[slot] = ++sender.serial;
+    sender.acked[slot] = false;
+}
+
+static void window_send_start()
+{
+    byte buf[BUF_LEN];
+    int len = strlen(sender.name) + 1;
+
+    if (len > BUF_LEN - 12) { len = BUF_LEN - 12; }
+    put32(&buf[0], sender.size);
+    put32(&buf[4], sender.crc);
+    put32(&buf[8], WINDOW_CHUNK);
+    memcpy(&buf[12], sender.name, len);
+    buf[12 + len - 1] = '\0';
+    send_message(buf, 12 + len, window_start_msg);
+}
+
+static void window_send_end()
+{
+    byte buf[8];
+
+    put32(&buf[0], sender.size);
+    put32(&buf[4], sender.crc);
+    send_message(buf, 8, window_end_msg);
+    sender.end_sent = true;
+}
+
+/* send new chunks while the window allows; once everything is acked,
+ * tell the receiver we're done.
+ */
+static void window_fill()
+{
+    while (sender.next < sender.chunks
+        && sender.next - sender.base < sender.cwnd)
+    {
+        window_send_chunk(sender.next++);
+    }
+
+    if (sender.base == sender.chunks && !sender.end_sent) {
+        window_send_end();
+    }
+}
+
+/* nothing has come back for a while; resend the first thing the receiver
+ * is missing, and start the window over.
+ */
+static void window_resend_first()
+{
+    sender.cwnd = 2;
+    sender.recover = sender.next;
+
+    if (!sender.started) {
+        window_send_start();
+    } else if (sender.base == sender.chunks) {
+        window_send_end();
+    } else if (sender.base < sender.next) {
+        window_send_chunk(sender.base);
+        sender.resent++;
+    }
+}
+
+/* start sending local file fname to the other side, who will call it
+ * remote_name.
+ * return 0 if it's under way.
+ */
+static int window_start_sending(char *fname, char *remote_name)
+{
+    byte buf[WINDOW_CHUNK];
+    int len;
+
+    if (sender.fd != -1) { close(sender.fd); }
+    memset(&sender, 0, sizeof(sender));
+    sender.status = window_failed;
+
+    sender.fd = open(fname, O_RDONLY);
+    if (sender.fd == -1) {
+        fprintf(stderr, "window_start_sending; could not open %s:  %s\n",
+                fname, strerror(errno));
+        return -1;
+    }
+
+    while ((len = read(sender.fd, buf, WINDOW_CHUNK)) > 0) {
+        sender.crc = crc32_bytes(sender.crc, buf, len);
+        sender.size += len;
+    }
+    if (len == -1) {
+        fprintf(stderr, "window_start_sending; read of %s failed:  %s\n",
+                fname, strerror(errno));
+        close(sender.fd);
+        sender.fd = -1;
+        return -1;
+    }
+
+    copy_string(sender.name, remote_name, PATH_MAX);
+    sender.chunks = (sender.size + WINDOW_CHUNK - 1) / WINDOW_CHUNK;
+    sender.cwnd = WINDOW_START;
+    sender.status = window_running;
+    checked_gettimeofday(&sender.start_time);
+
+    window_send_start();
+    return 0;
+}
+
+static void window_send_done(int status)
+{
+    byte buf[4];
+    put32(&buf[0], status);
+    send_message(buf, 4, window_done_msg);
+}
+
+/* the other side asked us to send it a file from our /tmp */
+static void window_get(message_t *msg)
+{
+    char fname[PATH_MAX];
+
+    if (msg->msg_body_len < 1) { return; }
+    msg->msg_body[msg->msg_body_len - 1] = '\0';
+    tmp_file_name(fname, PATH_MAX, (char *) msg->msg_body);
+
+    if (window_start_sending(fname, (char *) msg->msg_body) != 0) {
+        window_send_done(1);
+    }
+}
+
+/* the receiver answered.  a window_done_msg ends the transfer; a
+ * window_ack_msg moves the window along and tells us what to resend.
+ */
+static void window_sender_reply(message_t *msg)
+{
+    unsigned int next, bits[2], flags, newest = 0, c;
+    bool_t lost = false;
+
+    if (sender.status != window_running) { return; }
+
+    if (msg->msg_type == window_done_msg) {
+        struct timeval now;
+        long long usecs;
+
+        if (msg->msg_body_len != 4) { return; }
+        sender.status = (get32(&msg->msg_body[0]) == 0)
+                ? window_ok : window_failed;
+        close(sender.fd);
+        sender.fd = -1;
+
+        checked_gettimeofday(&now);
+        usecs = timeval_diff(&now, &sender.start_time);
+        fprintf(stderr, "%s %s; %u bytes in %lld.%03lld seconds, "
+                "%u chunks resent\n",
+                (sender.status == window_ok) ? "sent" : "failed to send",
+                sender.name, sender.size, usecs / 1000000,
+                (usecs % 1000000) / 1000, sender.resent);
+        return;
+    }
+
+    if (msg->msg_body_len != 16) { return; }
+    next = get32(&msg->msg_body[0]);
+    bits[0] = get32(&msg->msg_body[4]);
+    bits[1] = get32(&msg->msg_body[8]);
+    flags = get32(&msg->msg_body[12]);
+
+    if (!sender.started) {
+        if (next > sender.chunks) { return; }
+        if (next > 0) {
+            fprintf(stderr, "resuming %s at byte %u\n", sender.name,
+                    next * WINDOW_CHUNK);
+        }
+        sender.started = true;
+        sender.base = sender.next = sender.recover = next;
+        sender.timeouts = 0;
+        window_fill();
+        return;
+    }
+
+    /* an old ack, or nonsense */
+    if (next < sender.base || next > sender.next) { return; }
+    sender.timeouts = 0;
+
+    for (c = sender.base; c < next; c++) {
+        int slot = c % WINDOW_MAX;
+        if (sender.sent[slot] > newest) { newest = sender.sent[slot]; }
+        sender.acked[slot] = false;
+        if (sender.cwnd < WINDOW_MAX) { sender.cwnd++; }
+    }
+    sender.base = next;
+
+    for (c = sender.base + 1; c < sender.next; c++) {
+        int i = c - sender.base - 1;
+        int slot = c % WINDOW_MAX;
+        if (i < 64 && (bits[i / 32] & (1U << (i % 32)))
+            && !sender.acked[slot])
+        {
+            sender.acked[slot] = true;
+            if (sender.sent[slot] > newest) { newest = sender.sent[slot]; }
+        }
+    }
+
+    /* whatever went out before the newest chunk acked and hasn't been
+     * acked itself was lost.
+     */
+    for (c = sender.base; c < sender.next; c++) {
+        int slot = c % WINDOW_MAX;
+        if (!sender.acked[slot] && sender.sent[slot] < newest) {
+            window_send_chunk(c);
+            sender.resent++;
+            lost = true;
+        }
+    }
+
+    if (flags & WINDOW_ACK_TIMEOUT) {
+        window_resend_first();
+
+    } else if (lost && sender.base >= sender.recover) {
+        sender.cwnd /= 2;
+        if (sender.cwnd < 2) { sender.cwnd = 2; }
+        sender.recover = sender.next;
+    }
+
+    window_fill();
+}
+
+/* tell the sender what we have.  bit i of the bitmap is chunk next + 1 + i.
+ */
+static void window_send_ack(unsigned int flags)
+{
+    byte buf[16];
+    unsigned int bits[2] = {0, 0};
+    int i;
+
+    for (i = 0; i < WINDOW_MAX - 1; i++) {
+        if (receiver.have[(receiver.next + 1 + i) % WINDOW_MAX]) {
+            bits[i / 32] |= 1U << (i % 32);
+        }
+    }
+
+    put32(&buf[0], receiver.next);
+    put32(&buf[4], bits[0]);
+    put32(&buf[8], bits[1]);
+    put32(&buf[12], flags);
+    send_message(buf, 16, window_ack_msg);
+}
+
+/* remove fname.XXXXXXXX.part files other than keep; they are left from
+ * transfers of other versions of fname that never finished.
+ */
+static void window_remove_stale_parts(char *fname, char *keep)
+{
+    char dir_name[PATH_MAX], path[PATH_MAX];
+    char *base = strrchr(fname, '/');
+    char *keep_base;
+    int base_len;
+    struct dirent *d;
+    DIR *dir;
+
+    if (base == NULL) {
+        strcpy(dir_name, ".");
+        base = fname;
+    } else {
+        snprintf(dir_name, PATH_MAX, "%.*s", (int) (base - fname), fname);
+        if (dir_name[0] == '\0') { strcpy(dir_name, "/"); }
+        base++;
+    }
+    base_len = strlen(base);
+    keep_base = keep + (base - fname);
+
+    if ((dir = opendir(dir_name)) == NULL) { return; }
+
+    while ((d = readdir(dir)) != NULL) {
+        if (strlen(d->d_name) != base_len + 14
+            || strncmp(d->d_name, base, base_len) != 0
+            || d->d_name[base_len] != '.'
+            || strcmp(&d->d_name[base_len + 9], ".part") != 0
+            || strcmp(d->d_name, keep_base) == 0)
+        {
+            continue;
+        }
+
+        /* don't unlink a cut-off name; it might be some other file */
+        if (snprintf(path, PATH_MAX, "%s/%s", dir_name, d->d_name)
+            >= PATH_MAX)
+        {
+            continue;
+        }
+
+        if (unlink(path) == -1) {
+            fprintf(stderr, "window_remove_stale_parts; unlink(%s) failed:"
+                    "  %s\n", path, strerror(errno));
+        }
+    }
+
+    closedir(dir);
+}
+
+/* the sender is starting a file.  pick up after the last whole chunk of
+ * any earlier try at the same file.
+ */
+static void window_receive_start(message_t *msg)
+{
+    struct stat st;
+    unsigned int size, crc;
+
+    if (msg->msg_body_len < 13) { return; }
+    size = get32(&msg->msg_body[0]);
+    crc = get32(&msg->msg_body[4]);
+
+    /* our ack got lost */
+    if (receiver.status == window_running && !receiver.get_pending
+        && size == receiver.size && crc == receiver.crc)
+    {
+        window_send_ack(0);
+        return;
+    }
+
+    if (receiver.fd != -1) {
+        close(receiver.fd);
+        receiver.fd = -1;
+    }
+    receiver.get_pending = false;
+    receiver.status = window_failed;
+
+    if (get32(&msg->msg_body[8]) != WINDOW_CHUNK) {
+        fprintf(stderr, "window_receive_start; chunk length %u, not %d\n",
+                get32(&msg->msg_body[8]), WINDOW_CHUNK);
+        window_send_done(1);
+        return;
+    }
+
+    msg->msg_body[msg->msg_body_len - 1] = '\0';
+    if (receiver.local_fname[0] != '\0') {
+        copy_string(receiver.fname, receiver.local_fname, PATH_MAX);
+    } else {
+        tmp_file_name(receiver.fname, PATH_MAX, (char *) &msg->msg_body[12]);
+    }
+    /* a cut-off name could lose ".part" and land on a real file */
+    if (snprintf(receiver.part_fname, PATH_MAX, "%s.%08x.part",
+        receiver.fname, crc) >= PATH_MAX)
+    {
+        fprintf(stderr, "window_receive_start; file name too long:  %s\n",
+                receiver.fname);
+        window_send_done(1);
+        return;
+    }
+    window_remove_stale_parts(receiver.fname, receiver.part_fname);
+
+    receiver.fd = open(receiver.part_fname, O_WRONLY | O_CREAT,
+            S_IRWXU | S_IRGRP | S_IROTH);
+    if (receiver.fd == -1 || fstat(receiver.fd, &st) == -1) {
+        fprintf(stderr, "window_receive_start; could not open %s:  %s\n",
+                receiver.part_fname, strerror(errno));
+        window_send_done(1);
+        return;
+    }
+
+    receiver.size = size;
+    receiver.crc = crc;
+    receiver.chunks = (size + WINDOW_CHUNK - 1) / WINDOW_CHUNK;
+    receiver.next = st.st_size / WINDOW_CHUNK;
+    if (receiver.next > receiver.chunks) { receiver.next = 0; }
+
+    if (ftruncate(receiver.fd, (off_t) receiver.next * WINDOW_CHUNK) == -1
+        || lseek(receiver.fd, (off_t) receiver.next * WINDOW_CHUNK, SEEK_SET)
+            == -1)
+    {
+        fprintf(stderr, "window_receive_start; could not set up %s:  %s\n",
+                receiver.part_fname, strerror(errno));
+        window_send_done(1);
+        return;
+    }
+
+    if (receiver.next > 0) {
+        fprintf(stderr, "resuming %s at byte %u\n", receiver.fname,
+                receiver.next * WINDOW_CHUNK);
+    }
+
+    memset(receiver.have, 0, sizeof(receiver.have));
+    receiver.timeouts = 0;
+    receiver.bad = 0;
+    receiver.status = window_running;
+    window_send_ack(0);
+}
+
+/* a chunk.  keep it if it's intact and new, write out whatever is now in
+ * order, and ack.
+ */
+static void window_receive_data(message_t *msg)
+{
+    unsigned int chunk, len, want;
+    byte *data = &msg->msg_body[8];
+    int slot;
+
+    if (receiver.status != window_running || msg->msg_body_len < 8) {
+        return;
+    }
+
+    chunk = get32(&msg->msg_body[0]);
+    len = msg->msg_body_len - 8;
+    want = (chunk == receiver.chunks - 1)
+            ? receiver.size - chunk * WINDOW_CHUNK : WINDOW_CHUNK;
+
+    /* treat it as lost; the sender will find out from the acks */
+    if (chunk >= receiver.chunks || len != want
+        || crc32_bytes(0, data, len) != get32(&msg->msg_body[4]))
+    {
+        receiver.bad++;
+        return;
+    }
+
+    receiver.timeouts = 0;
+    slot = chunk % WINDOW_MAX;
+
+    if (chunk >= receiver.next && chunk < receiver.next + WINDOW_MAX
+        && !receiver.have[slot])
+    {
+        memcpy(receiver.data[slot], data, len);
+        receiver.len[slot] = len;
+        receiver.have[slot] = true;
+    }
+
+    while (receiver.next < receiver.chunks
+        && receiver.have[slot = receiver.next % WINDOW_MAX])
+    {
+        if (write(receiver.fd, receiver.data[slot], receiver.len[slot])
+            != receiver.len[slot])
+        {
+            fprintf(stderr, "window_receive_data; write to %s failed:  %s\n",
+                    receiver.part_fname, strerror(errno));
+            close(receiver.fd);
+            receiver.fd = -1;
+            receiver.status = window_failed;
+            window_send_done(1);
+            return;
+        }
+        receiver.have[slot] = false;
+        receiver.next++;
+    }
+
+    window_send_ack(0);
+}
+
+/* the sender thinks we have it all.  check the whole file against the
+ * sender's crc, and if it's right, put it in place.
+ */
+static void window_receive_end(message_t *msg)
+{
+    byte buf[WINDOW_CHUNK];
+    unsigned int size, crc, my_crc = 0;
+    int len, fd;
+
+    if (msg->msg_body_len != 8) { return; }
+    size = get32(&msg->msg_body[0]);
+    crc = get32(&msg->msg_body[4]);
+
+    if (receiver.status != window_running
+        || size != receiver.size || crc != receiver.crc)
+    {
+        /* our window_done_msg got lost, or we don't know this file */
+        window_send_done((receiver.status == window_ok
+                && size == receiver.size && crc == receiver.crc) ? 0 : 1);
+        return;
+    }
+
+    if (receiver.next < receiver.chunks) {
+        window_send_ack(WINDOW_ACK_TIMEOUT);
+        return;
+    }
+
+    close(receiver.fd);
+    receiver.fd = -1;
+    receiver.status = window_failed;
+
+    if ((fd = open(receiver.part_fname, O_RDONLY)) != -1) {
+        while ((len = read(fd, buf, WINDOW_CHUNK)) > 0) {
+            my_crc = crc32_bytes(my_crc, buf, len);
+        }
+        close(fd);
+    }
+
+    /* rename() rather than writing in place, so that we can receive
+     * merge_cloud itself while it runs.
+     */
+    if (my_crc != crc) {
+        fprintf(stderr, "window_receive_end; %s crc %08x, expected %08x\n",
+                receiver.part_fname, my_crc, crc);
+        unlink(receiver.part_fname);
+    } else if (rename(receiver.part_fname, receiver.fname) == -1) {
+        fprintf(stderr, "window_receive_end; rename to %s failed:  %s\n",
+                receiver.fname, strerror(errno));
+    } else {
+        receiver.status = window_ok;
+    }
+
+    fprintf(stderr, "%s %s; %u bytes, %u bad chunks\n",
+            (receiver.status == window_ok) ? "received" : "failed to receive",
+            receiver.fname, receiver.size, receiver.bad);
+    window_send_done(receiver.status == window_ok ? 0 : 1);
+}
+
+static void window_receive(message_t *msg)
+{
+    if (msg->msg_type == window_start_msg) {
+        window_receive_start(msg);
+    } else if (msg->msg_type == window_data_msg) {
+        window_receive_data(msg);
+    } else if (msg->msg_type == window_end_msg) {
+        window_receive_end(msg);
+
+    /* the other side couldn't send what we asked for */
+    } else if (msg->msg_type == window_done_msg && receiver.get_pending) {
+        fprintf(stderr, "could not get %s\n", receiver.get_name);
+        receiver.get_pending = false;
+        receiver.status = window_failed;
+    }
+}
+
+/* client side of a windowed put:  start sending local file fname, to be
+ * called remote_name on the other side.  keep handing replies to
+ * com_util_process_message(), and call com_util_send_timeout() after
+ * WINDOW_TIMEOUT_MSECS of quiet, until com_util_send_status() says it's
+ * over.
+ * return 0 if it's under way.
+ */
+int com_util_send_file(char *fname, char *remote_name)
+{
+    return window_start_sending(fname, remote_name);
+}
+
+window_status_t com_util_send_status()
+{
+    return sender.status;
+}
+
+void com_util_send_timeout()
+{
+    if (sender.status != window_running) { return; }
+
+    if (++sender.timeouts > WINDOW_TIMEOUTS) {
+        fprintf(stderr, "com_util_send_timeout; giving up on %s\n",
+                sender.name);
+        close(sender.fd);
+        sender.fd = -1;
+        sender.status = window_failed;
+        return;
+    }
+
+    window_resend_first();
+}
+
+/* client side of a windowed get:  ask the other side to send remote_name
+ * from its /tmp, and save it as local file fname.  then as for
+ * com_util_send_file(), with com_util_receive_timeout() and
+ * com_util_receive_status().
+ */
+void com_util_get_file(char *fname, char *remote_name)
+{
+    copy_string(receiver.local_fname, fname, PATH_MAX);
+    copy_string(receiver.get_name, remote_name, PATH_MAX);
+    receiver.get_pending = true;
+    receiver.status = window_running;
+    receiver.timeouts = 0;
+
+    send_message((byte *) receiver.get_name, strlen(receiver.get_name) + 1,
+            window_get_msg);
+}
+
+window_status_t com_util_receive_status()
+{
+    return receiver.status;
+}
+
+void com_util_receive_timeout()
+{
+    if (receiver.status != window_running) { return; }
+
+    if (++receiver.timeouts > WINDOW_TIMEOUTS) {
+        fprintf(stderr, "com_util_receive_timeout; giving up on %s\n",
+                receiver.get_pending ? receiver.get_name : receiver.fname);
+        if (receiver.fd != -1) {
+            close(receiver.fd);
+            receiver.fd = -1;
+        }
+        receiver.status = window_failed;
+        return;
+    }
+
+    if (receiver.get_pending) {
+        send_message((byte *) receiver.get_name,
+                strlen(receiver.get_name) + 1, window_get_msg);
+    } else {
+        window_send_ack(WINDOW_ACK_TIMEOUT);
+    }
+}
+
 #if 0
 static void start_get_file()
 {
@@ -881,6 +1623,12 @@ static char *com_util_message_string(int msg_type)
     case recv_err_stop_msg:  c = "recv_err_stop_msg"; break;
     case start_shell_msg:  c = "start_shell_msg"; break;
     case no_op_msg_msg:  c = "no_op_msg_msg"; break;
+    case window_start_msg:  c = "window_start_msg"; break;
+    case window_data_msg:  c = "window_data_msg"; break;
+    case window_ack_msg:  c = "window_ack_msg"; break;
+    case window_end_msg:  c = "window_end_msg"; break;
+    case window_done_msg:  c = "window_done_msg"; break;
+    case window_get_msg:  c = "window_get_msg"; break;
     default : c = "unknown message"; break;
     }
 
@@ -942,6 +1690,22 @@ int com_util_process_message(unsigned char *buf)
             || message->msg_type == recv_err_stop_msg)
     {
         continue_sending_file(message);
+
+    } else if (message->msg_type == window_start_msg
+            || message->msg_type == window_data_msg
+            || message->msg_type == window_end_msg)
+    {
+        continue_receiving_file(message);
+
+    } else if (message->msg_type == window_get_msg) {
+        start_sending_file(message);
+
+    } else if (message->msg_type == window_ack_msg) {
+        window_sender_reply(message);
+
+    } else if (message->msg_type == window_done_msg) {
+        window_sender_reply(message);
+        window_receive(message);
     }
 
     return 0;
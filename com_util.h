@@ -33,8 +33,31 @@ typedef enum {
     recv_err_stop_msg,
     start_shell_msg,
     no_op_msg_msg,
+
+    /* windowed file transfer; see com_util.c */
+    window_start_msg,
+    window_data_msg,
+    window_ack_msg,
+    window_end_msg,
+    window_done_msg,
+    window_get_msg,
 } msg_type_t;
 
+/* where a windowed transfer is, for com_util_send_status() and
+ * com_util_receive_status().
+ */
+typedef enum {
+    window_idle,
+    window_running,
+    window_ok,
+    window_failed,
+} window_status_t;
+
+/* how long a client waits to hear something before calling
+ * com_util_send_timeout() or com_util_receive_timeout().
+ */
+#define WINDOW_TIMEOUT_MSECS 200
+
 extern void com_util_init(int socket, int if_index, pio_t *pio,
         mac_address_t eth_mac_addr, mac_address_t client_mac_addr);
 extern int com_util_exit();
@@ -48,5 +71,11 @@ extern void com_util_get_server_pid(char *fname);
 extern FILE *com_util_open_temp_file(char *fname);
 extern void com_util_close_temp_file(char *fname, FILE **f);
 extern void com_util_send_temp_files(char *fname);
+extern int com_util_send_file(char *fname, char *remote_name);
+extern window_status_t com_util_send_status();
+extern void com_util_send_timeout();
+extern void com_util_get_file(char *fname, char *remote_name);
+extern window_status_t com_util_receive_status();
+extern void com_util_receive_timeout();
 
 #endif
@@ -29,6 +29,8 @@ static const char Version[] = "Version "
 #include <sys/socket.h>
 #include <netpacket/packet.h>
 #include <net/ethernet.h>     /* the L2 protocols */
+#include <sys/uio.h>
+#include <time.h>
 
 #include "cloud.h"
 #include "print.h"
@@ -36,6 +38,20 @@ static const char Version[] = "Version "
 #include "ad_hoc_client.h"
 #include "io_stat.h"
 #include "timer.h"
+#include "latency.h"
+#include "msg_stat.h"
+#include "journal.h"
+#include "tap.h"
+
+/* for older kernel headers */
+#ifndef SO_TIMESTAMPNS
+#define SO_TIMESTAMPNS 35
+#define SCM_TIMESTAMPNS SO_TIMESTAMPNS
+#endif
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
 
 /* the devices on this box; eth0, wlan0, wlan0wds_i.
  * but note; wland0wds_i correspond to remote boxes.
@@ -77,7 +93,7 @@ char check_devices(void)
     int w, d;
     char buf[64];
 
-    FILE *wds = fopen(wds_file, "r");
+    FILE *wds = journal_fopen(wds_file);
     if (wds == NULL) {
         ddprintf("check_devices; fopen failed:  %s\n", strerror(errno));
         ddprintf("    file:  '%s'\n", wds_file);
@@ -144,7 +160,7 @@ char check_devices(void)
             goto top;
         }
 
-        if (!use_pipes) {
+        if (!use_pipes && journal_mode != journal_replay) {
             /* check to see that the if_index is still the same.
              * (if "wds0.2" gets deleted and then re-created, it probably
              * has a different if_index.)
@@ -209,6 +225,82 @@ char check_devices(void)
 
 } /* check_devices */
 
+/* turn on the socket options that let us see what happened to frames
+ * before we read them:  the socket's count of frames dropped for lack of
+ * buffer space (SO_RXQ_OVFL) and the time the kernel received each frame
+ * (SO_TIMESTAMPNS).  both come back as control messages from recvmsg();
+ * see device_recv().
+ */
+static void enable_kernel_stats(device_t *device)
+{
+    int on = 1;
+
+    if (setsockopt(device->fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on))
+        == -1 && db[0].d)
+    {
+        ddprintf("enable_kernel_stats; SO_RXQ_OVFL failed:  %s\n",
+                strerror(errno));
+    }
+
+    if (setsockopt(device->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on))
+        == -1 && db[0].d)
+    {
+        ddprintf("enable_kernel_stats; SO_TIMESTAMPNS failed:  %s\n",
+                strerror(errno));
+    }
+}
+
+/* read a frame from device's socket into buf, like recvfrom().
+ * also pick up the kernel's receive timestamp and drop count for the frame,
+ * and account for them in the device's io_stat entry.
+ */
+int device_recv(device_t *device, void *buf, int buf_len,
+        struct sockaddr_ll *from, socklen_t *from_len)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(struct timespec))
+            + CMSG_SPACE(sizeof(unsigned int))];
+    io_stat_t *stat = &io_stat[device->stat_index];
+    int result;
+
+    iov.iov_base = buf;
+    iov.iov_len = buf_len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = from;
+    msg.msg_namelen = *from_len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    result = recvmsg(device->fd, &msg, 0);
+    if (result == -1) { return -1; }
+
+    *from_len = msg.msg_namelen;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+        cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET) { continue; }
+
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            io_stat_note_queue_delay(stat, &ts);
+
+        } else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+            unsigned int drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            stat->rxq_ovfl = drops;
+        }
+    }
+
+    return result;
+}
+
 /* for interface "device_name" (i.e., eth0 etc.), open a raw socket to
  * the interface and get a file descriptor for the socket.  add the
  * interface (file descriptor and all) to device_list[].
@@ -294,7 +386,7 @@ void add_device(char *device_name, mac_address_t mac_address,
     }
 
     if (mac_address == 0) {
-        result = mac_get(mac_addr, device_name);
+        result = journal_mac_get(mac_addr, device_name);
         if (result != 0) {
             ddprintf("add_device:  mac_get on %s failed.\n",
                     device_name);
@@ -312,7 +404,12 @@ void add_device(char *device_name, mac_address_t mac_address,
 
     mac_copy(device->mac_address, mac_addr);
 
-    if (use_pipes) {
+    if (journal_mode == journal_replay) {
+        /* frames come from the journal, and go nowhere */
+        device->fd = -1;
+        device->out_fd = -1;
+
+    } else if (use_pipes) {
         char fname[PATH_MAX];
         int fd;
         sprintf(fname, "%s/%s.cloud", pipe_directory, device_name);
@@ -323,8 +420,14 @@ void add_device(char *device_name, mac_address_t mac_address,
                     fname, strerror(errno));
             goto finish;
         }
-        device->fd = fd;
-        pio_init_from_fd(&device->in_pio, fname, fd);
+        if (pio_init_from_fd(&device->in_pio, fname, fd) != 0) {
+            ddprintf("add_device; could not use %s as a pipe or ring\n",
+                    fname);
+            goto finish;
+        }
+
+        /* for a ring, this is its eventfd rather than the file */
+        device->fd = pio_select_fd(&device->in_pio);
         ddprintf("done..\n");
 
         sprintf(fname, "%s/%s.cooked", pipe_directory, device_name);
@@ -336,7 +439,11 @@ void add_device(char *device_name, mac_address_t mac_address,
             goto finish;
         }
         device->out_fd = fd;
-        pio_init_from_fd(&device->out_pio, fname, fd);
+        if (pio_init_from_fd(&device->out_pio, fname, fd) != 0) {
+            ddprintf("add_device; could not use %s as a pipe or ring\n",
+                    fname);
+            goto finish;
+        }
         ddprintf("done..\n");
 
     } else if (ad_hoc_mode && device_type == device_type_ad_hoc) {
@@ -387,6 +494,8 @@ void add_device(char *device_name, mac_address_t mac_address,
             ddprintf("add_device:  bind failed\n");
             goto finish;
         }
+
+        enable_kernel_stats(device);
     }
 
     if (db[50].d && device_type == device_type_ad_hoc) {
@@ -418,7 +527,8 @@ void delete_device(int d)
     
     if (db[0].d) { ddprintf("hi from delete_device..\n"); }
 
-    result = close(device_list[d].fd);
+    /* replay opens no sockets */
+    result = (journal_mode == journal_replay) ? 0 : close(device_list[d].fd);
     if (result != 0) {
         ddprintf("delete_device:  could not close %s\n",
                 device_list[d].device_name);
@@ -493,6 +603,7 @@ int sendum(byte *message, int msg_len, device_t *device)
 {
     struct sockaddr_ll send_arg;
     int result;
+    lat_time_t t_send;
 
     // noncloud_message_count++;
 
@@ -511,7 +622,11 @@ int sendum(byte *message, int msg_len, device_t *device)
     if (db[14].d && is_wlan(device)) {
         ddprintf("sendum..\n");
     }
-    if (use_pipes) {
+    t_send = latency_start();
+
+    if (journal_mode == journal_replay) {
+        result = msg_len;
+    } else if (use_pipes) {
         result = pio_write(&device->out_pio, message, msg_len);
         if (db[14].d && is_wlan(device)) {
             ddprintf("sendum; ");
@@ -532,6 +647,8 @@ int sendum(byte *message, int msg_len, device_t *device)
         block_timer_interrupts(SIG_UNBLOCK);
         if (db[1].d) { ddprintf("sendto result:  %d\n", result); }
     }
+
+    latency_record(device->stat_index, lat_sendto, t_send);
     if (db[1].d) {
         DEBUG_SPARSE_PRINT(
             ddprintf("sending to ");
@@ -545,6 +662,11 @@ int sendum(byte *message, int msg_len, device_t *device)
         }
         ddprintf("\n");
         io_stat[device->stat_index].noncloud_send_error++;
+
+    } else {
+        msg_stat_count(device->stat_index, msg_stat_send, MSG_STAT_DATA,
+                msg_len);
+        tap(TAP_SENT, device->device_name, message, msg_len);
     }
 
     io_stat[device->stat_index].noncloud_send++;
@@ -589,7 +711,7 @@ void promiscuous(char *device_name, bool_t on)
     struct packet_mreq mreq;
     int result;
 
-    if (use_pipes) { return; }
+    if (use_pipes || journal_mode == journal_replay) { return; }
 
     found = 0;
     for (i = 0; i < device_list_count; i++) {
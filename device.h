@@ -13,6 +13,8 @@
 #ifndef DEVICE_H
 #define DEVICE_H
 
+#include <sys/socket.h>
+
 #include "mac.h"
 #include "device_type.h"
 #include "print.h"
@@ -59,6 +61,9 @@ extern void print_devices(void);
 extern void print_device(ddprintf_t *fn, FILE *f, device_t *device);
 extern void test_devices(void);
 extern int sendum(byte *message, int msg_len, device_t *device);
+struct sockaddr_ll;
+extern int device_recv(device_t *device, void *buf, int buf_len,
+        struct sockaddr_ll *from, socklen_t *from_len);
 extern int send_to_interface(byte *message, int msg_len,
         device_type_t device_type);
 extern int is_eth(device_t *device);
@@ -0,0 +1,800 @@
+/* dist.c - distribute a file to every box in the cloud
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* get a file (a firmware image, say) onto every box in the cloud without
+ * sending it to each box separately.
+ *
+ * the originating box cuts the file into DIST_CHUNK-byte chunks and floods
+ * each chunk once through the spanning tree, a few chunks every
+ * DIST_SEND_INTERVAL milliseconds.  a box forwards a chunk to its stp
+ * neighbors (other than the one it came from) the first time it gets it,
+ * the same way bcast_forward_message() passes along client broadcasts:
+ * wired neighbors each get a copy, and with db[60] set, one wireless
+ * broadcast does for all of the wireless neighbors that need it.
+ *
+ * each box keeps a bitmap of the chunks it has, writing them into
+ * /tmp/dist.<crc>.part as they arrive.  once the originator has flooded
+ * the whole file, it floods a dist_end_msg every DIST_END_TICKS intervals,
+ * and every box answers with a dist_status_msg carrying its bitmap.  the
+ * originator sends each box, unicast, just the chunks that box is missing.
+ * when a box has every chunk and the crc of the file checks, it moves
+ * the file to /tmp/<name> and says so in its next status.  if it can't,
+ * its status says that it failed.
+ *
+ * the originator keeps track of which boxes are done or failed, prints
+ * each one as it finishes, and keeps a report in DIST_STATUS_FILE.  it
+ * stops when every box has finished, or when DIST_END_MAX rounds of
+ * dist_end_msg's go by without any box getting closer.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "cloud.h"
+#include "cloud_msg.h"
+#include "device.h"
+#include "nbr.h"
+#include "stp_beacon.h"
+#include "print.h"
+#include "timer.h"
+#include "dist.h"
+
+/* chunks the originator sends every DIST_SEND_INTERVAL */
+#define DIST_BURST 8
+
+/* DIST_SEND_INTERVALs between dist_end_msg's */
+#define DIST_END_TICKS 50
+
+/* give up after this many rounds of dist_end_msg's in a row with no
+ * box getting any closer to having the file
+ */
+#define DIST_END_MAX 20
+
+#define HAVE_CHUNK(map, i) ((map)[(i) / 8] & (1 << ((i) % 8)))
+#define SET_CHUNK(map, i) ((map)[(i) / 8] |= (1 << ((i) % 8)))
+
+/* the originator's view of one of the other boxes */
+typedef struct {
+    mac_address_t name;
+
+    /* we have had a dist_status_msg from the box */
+    bool_t heard;
+
+    bool_t done;
+    bool_t failed;
+
+    /* milliseconds from the start of the distribution to the box being
+     * done
+     */
+    long long done_msecs;
+
+    int missing;
+
+    /* the chunks the box said it had in its last dist_status_msg */
+    byte have[DIST_CHUNK];
+
+    /* the next chunk to think about sending the box */
+    int next;
+} dist_box_t;
+
+/* the distribution this box originated */
+static struct {
+    bool_t active;
+    int fd;
+    char fname[256];
+
+    /* the template for every message we send */
+    message_t msg;
+
+    /* the next chunk to flood */
+    int next_chunk;
+
+    /* DIST_SEND_INTERVALs till the next dist_end_msg */
+    int ticks;
+
+    /* rounds of dist_end_msg's, and rounds since some box got closer */
+    int round;
+    int idle_rounds;
+
+    struct timeval start;
+
+    dist_box_t boxes[MAX_CLOUD];
+    int box_count;
+} out = { .fd = -1 };
+
+/* the distribution this box is receiving */
+static struct {
+    bool_t active;
+    bool_t done;
+    bool_t failed;
+    int fd;
+    dist_msg_t desc;
+    char part_name[64];
+
+    int have_count;
+    byte have[DIST_CHUNK];
+
+    /* the last round of dist_end_msg's we passed along */
+    bool_t got_round;
+    unsigned short round;
+} in = { .fd = -1 };
+
+/* how many bytes of msg to send */
+static int dist_msg_len(message_t *msg)
+{
+    return ((byte *) &msg->v.dist.data[0]) + msg->v.dist.len
+            - ((byte *) msg);
+}
+
+/* bytes of the file in chunk number "chunk" */
+static int chunk_len(dist_msg_t *d, int chunk)
+{
+    if (chunk == d->chunks - 1) {
+        return d->size - chunk * DIST_CHUNK;
+    }
+    return DIST_CHUNK;
+}
+
+/* the name of the neighboring cloud box we got msg from.  messages over
+ * the wire come from the box's eth mac address.
+ */
+static mac_address_ptr_t from_neighbor(message_t *msg)
+{
+    int i;
+    cloud_box_t *b;
+
+    for (i = 0; i < nbr_device_list_count; i++) {
+        b = &nbr_device_list[i];
+
+        if (mac_equal(msg->eth_header.h_source, b->name)
+            || (b->has_eth_mac_addr
+                && mac_equal(msg->eth_header.h_source, b->eth_mac_addr)))
+        {
+            return b->name;
+        }
+    }
+
+    return msg->eth_header.h_source;
+}
+
+/* send msg to our stp neighbors other than "from", the one we got it from
+ * (NULL if we originated it).
+ */
+static void flood(message_t *msg, mac_address_ptr_t from)
+{
+    int i, j, len;
+    bool_t wireless_has_seen = false;
+    cloud_box_t *box;
+    message_t copy;
+
+    len = dist_msg_len(msg);
+
+    for (i = 0; i < stp_list_count; i++) {
+        box = &stp_list[i].box;
+
+        if (from != NULL && mac_equal(box->name, from)) { continue; }
+
+        memcpy(&copy, msg, len);
+
+        if (box->has_eth_mac_addr || !db[60].d) {
+            mac_copy(copy.dest, box->name);
+            send_cloud_message(&copy);
+            continue;
+        }
+
+        if (wireless_has_seen) { continue; }
+
+        if (from != NULL && !stp_nbr_needs_transmit(msg, box->name)) {
+            if (db[68].d) {
+                ddprintf("dist flood; nbr %s doesn't need transmit\n",
+                        mac_sprintf(mac_buf1, box->name));
+            }
+            continue;
+        }
+
+        for (j = 0; j < device_list_count; j++) {
+            if (device_list[j].device_type == device_type_wds
+                && mac_equal(box->name, device_list[j].mac_address))
+            {
+                break;
+            }
+        }
+
+        if (j == device_list_count) {
+            mac_copy(copy.dest, box->name);
+            send_cloud_message(&copy);
+            continue;
+        }
+
+        /* not send_message(); it would write k-for-n numbers over the
+         * start of the dist message.
+         */
+        mac_copy(copy.dest, mac_address_bcast);
+        mac_copy(copy.eth_header.h_dest, mac_address_bcast);
+        mac_copy(copy.eth_header.h_source, my_wlan_mac_address);
+        copy.eth_header.h_proto = htons(CLOUD_MSG);
+        copy.sequence_num = 0;
+
+        sendum((byte *) &copy, len, &device_list[j]);
+
+        wireless_has_seen = true;
+    }
+}
+
+/* print where the distributions this box is involved in stand */
+void dist_print(ddprintf_t *fn, FILE *f)
+{
+    int i, done = 0;
+    dist_box_t *b;
+    dist_msg_t *d = &out.msg.v.dist;
+
+    if (out.fname[0] != '\0') {
+        for (i = 0; i < out.box_count; i++) {
+            if (out.boxes[i].done) { done++; }
+        }
+
+        fn(f, "%s %s; %d bytes, %d chunks, crc %08x, id %08x\n",
+                out.active ? "distributing" : "distributed",
+                out.fname, d->size, d->chunks, d->crc, d->id);
+        fn(f, "    flooded %d of %d chunks, %d end rounds; "
+                "%d of %d boxes done\n",
+                out.next_chunk, d->chunks, out.round, done, out.box_count);
+
+        for (i = 0; i < out.box_count; i++) {
+            b = &out.boxes[i];
+
+            fn(f, "    %s  ", mac_sprintf(mac_buf1, b->name));
+            if (b->done) {
+                fn(f, "done in %lld msec\n", b->done_msecs);
+            } else if (b->failed) {
+                fn(f, "failed; could not move the file into place\n");
+            } else if (b->heard) {
+                fn(f, "missing %d chunks\n", b->missing);
+            } else {
+                fn(f, "not heard from\n");
+            }
+        }
+    }
+
+    if (in.active) {
+        fn(f, "%s %s from %s; %d of %d chunks\n",
+                in.done ? "received"
+                        : in.failed ? "could not store" : "receiving",
+                in.desc.name, mac_sprintf(mac_buf1, in.desc.originator),
+                in.have_count, in.desc.chunks);
+    }
+
+    if (out.fname[0] == '\0' && !in.active) {
+        fn(f, "no file distribution\n");
+    }
+}
+
+/* rewrite the originator's report */
+static void dist_report(void)
+{
+    FILE *f = fopen(DIST_STATUS_FILE, "w");
+
+    if (f == NULL) {
+        ddprintf("dist_report; could not open %s:  %s\n", DIST_STATUS_FILE,
+                strerror(errno));
+        return;
+    }
+
+    dist_print(fprintf, f);
+    fclose(f);
+}
+
+/* stop receiving; throw away what we have of the file if it isn't done */
+static void in_stop(void)
+{
+    if (in.fd != -1) {
+        close(in.fd);
+        in.fd = -1;
+    }
+
+    if (in.active && !in.done) { unlink(in.part_name); }
+
+    in.active = false;
+}
+
+/* is d about the distribution we are receiving? */
+static bool_t in_matches(dist_msg_t *d)
+{
+    return in.active
+        && mac_equal(in.desc.originator, d->originator)
+        && in.desc.id == d->id;
+}
+
+/* tell the originator which chunks we have */
+static void in_send_status(void)
+{
+    message_t msg;
+    dist_msg_t *d = &msg.v.dist;
+
+    memcpy(d, &in.desc, sizeof(*d) - sizeof(d->data));
+    mac_copy(d->box, my_wlan_mac_address);
+    d->chunk = in.desc.chunks - in.have_count;
+    d->flood = false;
+    d->done = in.done;
+    d->failed = in.failed;
+    d->len = (in.desc.chunks + 7) / 8;
+    memcpy(d->data, in.have, d->len);
+
+    mac_copy(msg.dest, in.desc.originator);
+    msg.message_type = dist_status_msg;
+
+    if (db[68].d) {
+        ddprintf("dist; status to %s, missing %d%s\n",
+                mac_sprintf(mac_buf1, msg.dest), d->chunk,
+                d->done ? ", done" : d->failed ? ", failed" : "");
+    }
+
+    send_cloud_message(&msg);
+}
+
+/* start receiving the distribution d describes, unless we already are.
+ * returns false if we can't.
+ */
+static bool_t in_start(dist_msg_t *d)
+{
+    if (in_matches(d)) { return true; }
+
+    d->name[DIST_MAX_NAME - 1] = '\0';
+
+    if (d->chunks > DIST_MAX_CHUNKS
+        || d->chunks != (d->size + DIST_CHUNK - 1) / DIST_CHUNK
+        || d->name[0] == '\0' || d->name[0] == '.'
+        || strchr(d->name, '/') != NULL)
+    {
+        ddprintf("dist; bad distribution '%s' from %s\n", d->name,
+                mac_sprintf(mac_buf1, d->originator));
+        return false;
+    }
+
+    in_stop();
+
+    memset(&in, 0, sizeof(in));
+    memcpy(&in.desc, d, sizeof(*d) - sizeof(d->data));
+    in.desc.len = 0;
+
+    sprintf(in.part_name, "/tmp/dist.%08x.part", d->crc);
+
+    in.fd = open(in.part_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (in.fd == -1) {
+        ddprintf("dist; could not open %s:  %s\n", in.part_name,
+                strerror(errno));
+        return false;
+    }
+
+    in.active = true;
+
+    ddprintf("dist; receiving %s (%d bytes) from %s\n", d->name, d->size,
+            mac_sprintf(mac_buf1, d->originator));
+
+    return true;
+}
+
+/* we have every chunk.  if the file is right, move it into place. */
+static void in_finish(void)
+{
+    byte buf[DIST_CHUNK];
+    char fname[sizeof("/tmp/") + DIST_MAX_NAME];
+    unsigned int crc = 0;
+    int n;
+
+    lseek(in.fd, 0, SEEK_SET);
+    while ((n = read(in.fd, buf, sizeof(buf))) > 0) {
+        crc = crc32_bytes(crc, buf, n);
+    }
+
+    if (n == -1 || crc != in.desc.crc) {
+        ddprintf("dist; %s crc %08x, expected %08x; starting over\n",
+                in.desc.name, crc, in.desc.crc);
+        memset(in.have, 0, sizeof(in.have));
+        in.have_count = 0;
+        if (ftruncate(in.fd, 0) == -1) {
+            ddprintf("dist; ftruncate failed:  %s\n", strerror(errno));
+        }
+        return;
+    }
+
+    sprintf(fname, "/tmp/%s", in.desc.name);
+    if (rename(in.part_name, fname) == -1) {
+        ddprintf("dist; could not rename %s to %s:  %s\n", in.part_name,
+                fname, strerror(errno));
+        close(in.fd);
+        in.fd = -1;
+        in.failed = true;
+        return;
+    }
+
+    close(in.fd);
+    in.fd = -1;
+    in.done = true;
+
+    ddprintf("dist; received %s\n", fname);
+}
+
+/* save the chunk in d if it is one we don't have yet.  returns true if
+ * it was new.
+ */
+static bool_t in_store(dist_msg_t *d)
+{
+    int chunk = d->chunk;
+
+    if (in.done || in.failed || chunk >= in.desc.chunks) { return false; }
+    if (HAVE_CHUNK(in.have, chunk)) { return false; }
+
+    if (d->len != chunk_len(&in.desc, chunk)) {
+        ddprintf("dist; chunk %d has length %d\n", chunk, d->len);
+        return false;
+    }
+
+    if (pwrite(in.fd, d->data, d->len, (off_t) chunk * DIST_CHUNK)
+        != d->len)
+    {
+        ddprintf("dist; write to %s failed:  %s\n", in.part_name,
+                strerror(errno));
+        return false;
+    }
+
+    SET_CHUNK(in.have, chunk);
+    in.have_count++;
+
+    if (in.have_count == in.desc.chunks) {
+        in_finish();
+        in_send_status();
+    }
+
+    return true;
+}
+
+/* someone is flooding a chunk of a file through the cloud, or sending
+ * one to a box that is missing it.
+ */
+void process_dist_data_msg(message_t *msg, int device_index)
+{
+    dist_msg_t *d = &msg->v.dist;
+    bool_t for_me, new_chunk = false;
+
+    if (mac_equal(d->originator, my_wlan_mac_address)) { return; }
+
+    for_me = d->flood || mac_equal(msg->dest, my_wlan_mac_address);
+
+    /* a chunk on its way to some other box is worth keeping if it is
+     * part of what we are getting anyway.
+     */
+    if (for_me ? in_start(d) : in_matches(d)) {
+        new_chunk = in_store(d);
+    }
+
+    if (d->flood) {
+        if (new_chunk) { flood(msg, from_neighbor(msg)); }
+
+    } else if (!for_me) {
+        send_cloud_message(msg);
+    }
+}
+
+/* the originator has sent the whole file.  pass that along if it is
+ * being flooded, and tell the originator what we are missing.
+ */
+void process_dist_end_msg(message_t *msg, int device_index)
+{
+    dist_msg_t *d = &msg->v.dist;
+
+    if (mac_equal(d->originator, my_wlan_mac_address)) { return; }
+
+    if (!d->flood && !mac_equal(msg->dest, my_wlan_mac_address)) {
+        send_cloud_message(msg);
+        return;
+    }
+
+    if (!in_start(d)) { return; }
+
+    if (d->flood) {
+        if (in.got_round && in.round == d->chunk) { return; }
+        in.got_round = true;
+        in.round = d->chunk;
+
+        flood(msg, from_neighbor(msg));
+    }
+
+    /* an empty file has no chunks to finish it off */
+    if (!in.done && !in.failed && in.desc.chunks == 0) { in_finish(); }
+
+    in_send_status();
+}
+
+/* stop distributing; every box is done, or we have given up on the rest */
+static void out_finish(void)
+{
+    int i, done = 0, failed = 0;
+
+    for (i = 0; i < out.box_count; i++) {
+        if (out.boxes[i].done) { done++; }
+        if (out.boxes[i].failed) { failed++; }
+    }
+
+    ddprintf("dist; %s reached %d of %d boxes, %d failed\n", out.fname, done,
+            out.box_count, failed);
+
+    close(out.fd);
+    out.fd = -1;
+    out.active = false;
+
+    dist_report();
+}
+
+/* a box telling us, the originator, which chunks it has */
+void process_dist_status_msg(message_t *msg, int device_index)
+{
+    dist_msg_t *d = &msg->v.dist;
+    dist_box_t *b = NULL;
+    struct timeval tv;
+    int i;
+
+    if (!mac_equal(msg->dest, my_wlan_mac_address)) {
+        send_cloud_message(msg);
+        return;
+    }
+
+    if (!out.active || d->id != out.msg.v.dist.id
+        || !mac_equal(d->originator, my_wlan_mac_address))
+    {
+        return;
+    }
+
+    for (i = 0; i < out.box_count; i++) {
+        if (mac_equal(out.boxes[i].name, d->box)) {
+            b = &out.boxes[i];
+            break;
+        }
+    }
+
+    if (b == NULL) {
+        if (out.box_count >= MAX_CLOUD) { return; }
+        b = &out.boxes[out.box_count++];
+        memset(b, 0, sizeof(*b));
+        mac_copy(b->name, d->box);
+    }
+
+    if (!b->heard || d->chunk < b->missing || (d->done && !b->done)
+        || (d->failed && !b->failed))
+    {
+        out.idle_rounds = 0;
+    }
+
+    b->heard = true;
+    b->missing = d->chunk;
+    b->next = 0;
+    memcpy(b->have, d->data,
+            d->len < sizeof(b->have) ? d->len : sizeof(b->have));
+
+    if (db[68].d) {
+        ddprintf("dist; status from %s, missing %d%s\n",
+                mac_sprintf(mac_buf1, b->name), b->missing,
+                d->done ? ", done" : d->failed ? ", failed" : "");
+    }
+
+    if (d->done && !b->done) {
+        b->done = true;
+        while (!checked_gettimeofday(&tv));
+        b->done_msecs = usec_diff(tv.tv_sec, tv.tv_usec,
+                out.start.tv_sec, out.start.tv_usec) / 1000;
+
+        ddprintf("dist; %s has %s, %lld msec\n",
+                mac_sprintf(mac_buf1, b->name), out.fname, b->done_msecs);
+
+        dist_report();
+    }
+
+    if (d->failed && !b->failed) {
+        b->failed = true;
+
+        ddprintf("dist; %s could not store %s\n",
+                mac_sprintf(mac_buf1, b->name), out.fname);
+
+        dist_report();
+    }
+}
+
+/* send chunk number "chunk" to box "dest", or flood it if dest is NULL */
+static void out_send_chunk(int chunk, mac_address_ptr_t dest)
+{
+    message_t *msg = &out.msg;
+    dist_msg_t *d = &msg->v.dist;
+    int len = chunk_len(d, chunk);
+
+    if (pread(out.fd, d->data, len, (off_t) chunk * DIST_CHUNK) != len) {
+        ddprintf("dist; read of %s failed:  %s\n", out.fname,
+                strerror(errno));
+        return;
+    }
+
+    msg->message_type = dist_data_msg;
+    d->chunk = chunk;
+    d->len = len;
+
+    if (dest == NULL) {
+        d->flood = true;
+        flood(msg, NULL);
+
+    } else {
+        d->flood = false;
+        mac_copy(msg->dest, dest);
+        send_cloud_message(msg);
+    }
+}
+
+/* start distributing fname to the whole cloud */
+bool_t dist_start(char *fname)
+{
+    struct stat st;
+    byte buf[DIST_CHUNK];
+    unsigned int crc = 0;
+    int fd, n, i;
+    char *base;
+    dist_msg_t *d;
+
+    if (out.active) {
+        ddprintf("dist_start; already distributing %s\n", out.fname);
+        return false;
+    }
+
+    base = strrchr(fname, '/');
+    base = (base == NULL) ? fname : base + 1;
+
+    if (base[0] == '\0' || base[0] == '.' || strlen(base) >= DIST_MAX_NAME) {
+        ddprintf("dist_start; bad file name '%s'\n", fname);
+        return false;
+    }
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1) {
+        ddprintf("dist_start; could not open %s:  %s\n", fname,
+                strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &st) == -1
+        || st.st_size > (off_t) DIST_MAX_CHUNKS * DIST_CHUNK)
+    {
+        ddprintf("dist_start; %s is too big\n", fname);
+        close(fd);
+        return false;
+    }
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        crc = crc32_bytes(crc, buf, n);
+    }
+
+    memset(&out, 0, sizeof(out));
+    out.fd = fd;
+    copy_string(out.fname, fname, sizeof(out.fname));
+
+    while (!checked_gettimeofday(&out.start));
+
+    d = &out.msg.v.dist;
+    mac_copy(d->originator, my_wlan_mac_address);
+    d->id = out.start.tv_sec ^ out.start.tv_usec;
+    d->size = st.st_size;
+    d->crc = crc;
+    d->chunks = (d->size + DIST_CHUNK - 1) / DIST_CHUNK;
+    strcpy(d->name, base);
+
+    /* every box in the cloud is expected to end up with the file */
+    for (i = 0; i < stp_recv_beacon_count; i++) {
+        stp_beacon_t *b = &stp_recv_beacons[i].stp_beacon;
+
+        if (out.box_count >= MAX_CLOUD) { continue; }
+        if (mac_equal(b->originator, my_wlan_mac_address)) { continue; }
+
+        mac_copy(out.boxes[out.box_count++].name, b->originator);
+    }
+
+    out.active = true;
+
+    ddprintf("dist_start; %s, %d bytes in %d chunks, crc %08x, to %d boxes\n",
+            fname, d->size, d->chunks, d->crc, out.box_count);
+
+    dist_report();
+
+    set_next_dist_alarm(0);
+
+    return true;
+}
+
+/* send the next burst of chunks:  the next part of the flood, and once
+ * that is done, the chunks each box is missing.
+ */
+void dist_timer(void)
+{
+    int budget = DIST_BURST;
+    int i, chunks;
+    bool_t sent, done;
+    dist_box_t *b;
+
+    if (!out.active) { return; }
+
+    chunks = out.msg.v.dist.chunks;
+
+    while (budget > 0 && out.next_chunk < chunks) {
+        out_send_chunk(out.next_chunk++, NULL);
+        budget--;
+    }
+
+    if (out.next_chunk < chunks) { goto finish; }
+
+    done = true;
+    for (i = 0; i < out.box_count; i++) {
+        if (!out.boxes[i].done && !out.boxes[i].failed) { done = false; }
+    }
+
+    if (done || out.idle_rounds >= DIST_END_MAX) {
+        out_finish();
+        return;
+    }
+
+    if (--out.ticks <= 0) {
+        out.msg.message_type = dist_end_msg;
+        out.msg.v.dist.chunk = out.round++;
+        out.msg.v.dist.len = 0;
+        out.msg.v.dist.flood = true;
+        flood(&out.msg, NULL);
+
+        /* a box that heard none of the flood may not have heard that
+         * either.
+         */
+        out.msg.v.dist.flood = false;
+        for (i = 0; i < out.box_count; i++) {
+            if (out.boxes[i].heard) { continue; }
+            mac_copy(out.msg.dest, out.boxes[i].name);
+            send_cloud_message(&out.msg);
+        }
+
+        out.idle_rounds++;
+        out.ticks = DIST_END_TICKS;
+    }
+
+    /* take turns sending each box the next chunk it is missing */
+    sent = true;
+    while (budget > 0 && sent) {
+        sent = false;
+        for (i = 0; i < out.box_count && budget > 0; i++) {
+            b = &out.boxes[i];
+
+            if (!b->heard || b->done || b->failed) { continue; }
+
+            while (b->next < chunks && HAVE_CHUNK(b->have, b->next)) {
+                b->next++;
+            }
+            if (b->next >= chunks) { continue; }
+
+            out_send_chunk(b->next++, b->name);
+            budget--;
+            sent = true;
+        }
+    }
+
+    finish:
+    set_next_dist_alarm(DIST_SEND_INTERVAL);
+}
@@ -0,0 +1,30 @@
+/* dist.h - distribute a file to every box in the cloud
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef DIST_H
+#define DIST_H
+
+#include <stdio.h>
+#include "cloud.h"
+#include "dist_data.h"
+
+/* where the originator writes its per-box report */
+#define DIST_STATUS_FILE "/tmp/dist_status"
+
+extern bool_t dist_start(char *fname);
+extern void dist_timer(void);
+extern void dist_print(ddprintf_t *fn, FILE *f);
+extern void process_dist_data_msg(message_t *msg, int device_index);
+extern void process_dist_end_msg(message_t *msg, int device_index);
+extern void process_dist_status_msg(message_t *msg, int device_index);
+
+#endif
@@ -0,0 +1,79 @@
+/* dist_data.h - distribute a file to every box in the cloud
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef DIST_DATA_H
+#define DIST_DATA_H
+
+#include "util.h"
+#include "mac.h"
+
+/* bytes of file per dist_data_msg */
+#define DIST_CHUNK 1024
+
+/* a dist_status_msg carries a bitmap of the chunks a box has in data[];
+ * that limits a file to DIST_MAX_CHUNKS * DIST_CHUNK (8MB).
+ */
+#define DIST_MAX_CHUNKS (DIST_CHUNK * 8)
+
+#define DIST_MAX_NAME 64
+
+/* every dist message carries the whole description of the file, so that
+ * a box that missed the beginning of a distribution can still join in.
+ */
+typedef struct {
+    mac_address_t originator;
+
+    /* dist_status_msg:  the box reporting */
+    mac_address_t box;
+
+    /* which distribution from the originator this is */
+    unsigned int id;
+
+    /* file length, and crc32_bytes() of the whole file */
+    unsigned int size;
+    unsigned int crc;
+
+    unsigned short chunks;
+
+    /* dist_data_msg:  which chunk is in data[].
+     * dist_end_msg:  which round of end messages this is.
+     * dist_status_msg:  how many chunks the box is still missing.
+     */
+    unsigned short chunk;
+
+    /* how much of data[] is used */
+    unsigned short len;
+
+    /* dist_data_msg and dist_end_msg:  true if being flooded through the
+     * spanning tree, false if going to just msg->dest.
+     */
+    byte flood;
+
+    /* dist_status_msg:  the box has the whole file and its crc checks */
+    byte done;
+
+    /* dist_status_msg:  the box has the whole file, but couldn't move it
+     * into place
+     */
+    byte failed;
+
+    /* base name of the file; it lands in /tmp on every box */
+    char name[DIST_MAX_NAME];
+
+    /* dist_data_msg:  the chunk.
+     * dist_status_msg:  bitmap of chunks the box has.
+     */
+    byte data[DIST_CHUNK];
+
+} dist_msg_t;
+
+#endif
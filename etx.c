@@ -0,0 +1,152 @@
+/* etx.c - expected transmission count of links, from delivery ratios
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* links are otherwise judged by the signal strength in the prism header
+ * (see update_nbr_signal_strength()), which can't see a link with a good
+ * signal that loses a lot of packets:  interference, or a neighbor that
+ * hears us well but that we hear badly.
+ *
+ * each box keeps, for each neighbor, the percent of the neighbor's pings
+ * and data packets that got to it lately (status_t.delivery; see
+ * link_hist.c), and sends it with the rest of its status in its stp
+ * beacons.  the expected transmission count of a link is 1 / (df * dr),
+ * with df the delivery ratio the other end reports for packets from us
+ * and dr ours for packets from it.  a direction we have no numbers for
+ * counts as perfect.
+ *
+ * with db[79] set, a link's strength, for picking stp arcs (locally and
+ * globally), for weakest_stp_link and so for status_lights, is its signal
+ * strength less ETX_PENALTY for every expected transmission past the
+ * first.  so a link that needs two tries per packet is as good as one
+ * with 20 less signal and no loss, and the thresholds in nbr.h still mean
+ * what they did.
+ */
+
+#include "cloud.h"
+#include "nbr.h"
+#include "status.h"
+#include "stp_beacon.h"
+#include "print.h"
+#include "etx.h"
+
+/* etx of a link with the given delivery percentages each way */
+int etx(byte delivery_there, byte delivery_back)
+{
+    int there = delivery_there == LINK_HIST_NO_DATA ? 100 : delivery_there;
+    int back = delivery_back == LINK_HIST_NO_DATA ? 100 : delivery_back;
+    int result;
+
+    if (there == 0 || back == 0) { return ETX_MAX; }
+
+    result = (ETX_SCALE * 100 * 100 + there * back / 2) / (there * back);
+
+    return result > ETX_MAX ? ETX_MAX : result;
+}
+
+/* signal strength less the penalty for etx */
+int etx_strength(int sig_strength, int etx)
+{
+    int result;
+
+    /* 1 is the default weak signal (no real reading); leave it be */
+    if (sig_strength <= 1) { return sig_strength; }
+
+    result = sig_strength - ETX_PENALTY * (etx - ETX_SCALE) / ETX_SCALE;
+
+    return result < 2 ? 2 : result;
+}
+
+/* percent of nbr's packets we have gotten lately */
+byte etx_delivery_from(mac_address_t nbr)
+{
+    int pind = status_find_by_mac(perm_io_stat, perm_io_stat_count, nbr);
+
+    if (pind == -1) { return LINK_HIST_NO_DATA; }
+
+    return perm_io_stat[pind].delivery;
+}
+
+/* percent of our packets nbr says it has gotten lately */
+byte etx_delivery_to(mac_address_t nbr)
+{
+    int i, j;
+
+    for (i = 0; i < stp_recv_beacon_count; i++) {
+        stp_recv_beacon_t *recv = &stp_recv_beacons[i];
+
+        if (!mac_equal(recv->stp_beacon.originator, nbr)) { continue; }
+
+        for (j = 0; j < recv->link_count; j++) {
+            if (mac_equal(recv->links[j].name, my_wlan_mac_address)) {
+                return recv->links[j].delivery;
+            }
+        }
+        break;
+    }
+
+    return LINK_HIST_NO_DATA;
+}
+
+/* etx of our link to nbr */
+int etx_nbr(mac_address_t nbr)
+{
+    return etx(etx_delivery_to(nbr), etx_delivery_from(nbr));
+}
+
+/* how good our link to nbr is, for comparing with other links and with
+ * the thresholds in nbr.h:  its signal strength, less the etx penalty if
+ * db[79] is set.
+ */
+int get_link_strength(mac_address_t nbr)
+{
+    int sig_strength = get_sig_strength(nbr);
+
+    if (!db[79].d) { return sig_strength; }
+
+    return etx_strength(sig_strength, etx_nbr(nbr));
+}
+
+static char *sprint_delivery(char *buf, byte delivery)
+{
+    if (delivery == LINK_HIST_NO_DATA) {
+        sprintf(buf, "-");
+    } else {
+        sprintf(buf, "%d%%", delivery);
+    }
+
+    return buf;
+}
+
+void etx_print(ddprintf_t *fn, FILE *f)
+{
+    char to[8], from[8];
+    int i;
+
+    fn(f, "etx (delivery to and from each neighbor over the last %ds):\n",
+            LINK_HIST_DELIVERY_SECS);
+
+    for (i = 0; i < nbr_device_list_count; i++) {
+        cloud_box_t *nbr = &nbr_device_list[i];
+        int e = etx_nbr(nbr->name);
+
+        fn(f, "    %s  sig %3d  to %4s  from %4s  etx %d.%d  strength %d\n",
+                mac_sprintf(mac_buf1, nbr->name),
+                nbr->signal_strength,
+                sprint_delivery(to, etx_delivery_to(nbr->name)),
+                sprint_delivery(from, etx_delivery_from(nbr->name)),
+                e / ETX_SCALE, e % ETX_SCALE,
+                etx_strength(nbr->signal_strength, e));
+    }
+} /* etx_print */
@@ -0,0 +1,37 @@
+/* etx.h - expected transmission count of links, from delivery ratios
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef ETX_H
+#define ETX_H
+
+#include <stdio.h>
+#include "util.h"
+#include "mac.h"
+
+/* etx values are in units of 1 / ETX_SCALE transmissions; a perfect link
+ * is ETX_SCALE.  links worse than ETX_MAX count as ETX_MAX.
+ */
+#define ETX_SCALE 10
+#define ETX_MAX (10 * ETX_SCALE)
+
+/* signal strength a link loses for each expected transmission past one */
+#define ETX_PENALTY 20
+
+extern int etx(byte delivery_there, byte delivery_back);
+extern int etx_strength(int sig_strength, int etx);
+extern byte etx_delivery_from(mac_address_t nbr);
+extern byte etx_delivery_to(mac_address_t nbr);
+extern int etx_nbr(mac_address_t nbr);
+extern int get_link_strength(mac_address_t nbr);
+extern void etx_print(ddprintf_t *fn, FILE *f);
+
+#endif
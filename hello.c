@@ -0,0 +1,412 @@
+/* hello.c - fast failure detection on stp arcs
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* otherwise, a dead stp neighbor is noticed only when its stp beacons
+ * time out (STP_TIMEOUT, five seconds or more) or when sending to it
+ * fails UNROUTABLE_MAX times, and until then client traffic into its
+ * subtree goes nowhere.
+ *
+ * with db[84], we keep a session with each stp neighbor along the lines
+ * of bfd (rfc 5880).  every hello_interval msec (100, or -H), we send an
+ * stp_hello_msg to each stp neighbor we haven't sent anything to in the
+ * meantime; any cloud message or wrapped client frame counts, so a busy
+ * arc carries no hellos.  likewise, anything we get from the neighbor
+ * counts as hearing from it.
+ *
+ * hellos carry our session state, so a session comes up only when each
+ * end has heard the other:  down -> init when we hear a neighbor that is
+ * down, init -> up when it says init or up.  once a session is up, if
+ * we don't hear from the neighbor for its detect_mult intervals, or it
+ * says it is down (it has stopped hearing us, or restarted), we delete
+ * the arc as though we had detected a circularity:  clear_state(), and
+ * an stp_arc_delete_msg to the neighbor in case it can still hear us.
+ * check_connectivity() then reconnects what was on the other side.
+ *
+ * detect_mult is 3, or what -H says.  as bfd leaves it to each end
+ * to choose the multiplier it sends, we raise it for a neighbor whose
+ * link has been losing packets lately (link_hist.c), so that a few lost
+ * hellos in a row don't take down a working arc.
+ *
+ * with the defaults, a neighbor that goes away over a clean link is
+ * noticed in 300 to 400 msec.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "print.h"
+#include "timer.h"
+#include "random.h"
+#include "nbr.h"
+#include "cloud_msg.h"
+#include "trickle.h"
+#include "status.h"
+#include "etx.h"
+#include "link_hist.h"
+#include "hello.h"
+
+typedef struct {
+    mac_address_t name;
+
+    /* so that we can recognize frames sent to the neighbor's eth card */
+    mac_address_t eth_mac_addr;
+    bool_t has_eth_mac_addr;
+
+    byte state;
+
+    /* from the neighbor's latest hello */
+    byte remote_state;
+    byte remote_mult;
+    unsigned short remote_interval;
+
+    struct timeval last_heard;
+    struct timeval last_sent;
+
+    unsigned int hellos_sent;
+    unsigned int hellos_suppressed;
+
+} hello_nbr_t;
+
+int hello_interval = HELLO_INTERVAL;
+int hello_detect_mult = HELLO_DETECT_MULT;
+
+static hello_nbr_t hello_nbrs[MAX_CLOUD];
+static int hello_nbr_count = 0;
+
+static bool_t running = false;
+
+static unsigned int failure_count = 0;
+
+static char *state_names[] = { "down", "init", "up" };
+
+static char *state_name(byte state)
+{
+    return state <= HELLO_UP ? state_names[state] : "?";
+}
+
+static hello_nbr_t *hello_find(mac_address_t name)
+{
+    int i;
+
+    for (i = 0; i < hello_nbr_count; i++) {
+        if (mac_equal(hello_nbrs[i].name, name)) { return &hello_nbrs[i]; }
+    }
+
+    return NULL;
+}
+
+/* make hello_nbrs[] match stp_list:  new stp neighbors start out down,
+ * and neighbors that are no longer stp neighbors are dropped.
+ */
+static void hello_sync(void)
+{
+    hello_nbr_t old[MAX_CLOUD];
+    int old_count = hello_nbr_count;
+    int i, j;
+
+    memcpy(old, hello_nbrs, sizeof(old[0]) * old_count);
+    hello_nbr_count = 0;
+
+    for (i = 0; i < stp_list_count && i < MAX_CLOUD; i++) {
+        cloud_box_t *box = &stp_list[i].box;
+        hello_nbr_t *h = &hello_nbrs[hello_nbr_count++];
+
+        for (j = 0; j < old_count; j++) {
+            if (mac_equal(old[j].name, box->name)) { break; }
+        }
+
+        if (j < old_count) {
+            *h = old[j];
+        } else {
+            memset(h, 0, sizeof(*h));
+            mac_copy(h->name, box->name);
+            h->state = HELLO_DOWN;
+            h->remote_state = HELLO_DOWN;
+            while (!checked_gettimeofday(&h->last_heard));
+            h->last_sent.tv_sec = -1;
+        }
+
+        h->has_eth_mac_addr = box->has_eth_mac_addr;
+        mac_copy(h->eth_mac_addr, box->eth_mac_addr);
+    }
+}
+
+/* the detect multiplier for our link to h:  hello_detect_mult, or enough
+ * that the loss lately in the worse direction makes missing that many
+ * hellos in a row no more likely than HELLO_FALSE_DETECT.  what we get
+ * from h counts cloud messages, hellos among them; what h gets from us
+ * we only know for ping and data packets, from its beacons.
+ */
+static int hello_mult(hello_nbr_t *h)
+{
+    byte to = etx_delivery_to(h->name);
+    byte from = link_hist_delivery(
+            status_find_by_mac(perm_io_stat, perm_io_stat_count, h->name));
+    int delivery = 100;
+    double loss, miss;
+    int mult;
+
+    if (to != LINK_HIST_NO_DATA && to < delivery) { delivery = to; }
+    if (from != LINK_HIST_NO_DATA && from < delivery) { delivery = from; }
+
+    loss = (100 - delivery) / 100.;
+    miss = 1.;
+    for (mult = 0; mult < HELLO_DETECT_MULT_MAX; mult++) {
+        if (mult >= hello_detect_mult && miss <= HELLO_FALSE_DETECT) { break; }
+        miss *= loss;
+    }
+
+    return mult;
+}
+
+/* how long we wait to hear from h before giving up on it, in usec */
+static long long detect_usec(hello_nbr_t *h)
+{
+    int mult = h->remote_mult != 0 ? h->remote_mult : hello_mult(h);
+    int interval = h->remote_interval > hello_interval
+            ? h->remote_interval : hello_interval;
+
+    return mult * interval * 1000LL;
+}
+
+static void send_hello(hello_nbr_t *h)
+{
+    message_t message;
+
+    memset(&message, 0, sizeof(message));
+
+    message.message_type = stp_hello_msg;
+    mac_copy(message.dest, h->name);
+    message.v.hello.state = h->state;
+    message.v.hello.detect_mult = (byte) hello_mult(h);
+    message.v.hello.interval = (unsigned short) hello_interval;
+
+    h->hellos_sent++;
+    send_cloud_message(&message);
+}
+
+/* the session with h has failed; delete the arc */
+static void hello_failed(hello_nbr_t *h, char *why)
+{
+    message_t msg;
+
+    ddprintf("\nhello; stp neighbor %s %s.  DELETING STP ARC.\n",
+            mac_sprintf(mac_buf1, h->name), why);
+
+    failure_count++;
+    h->state = HELLO_DOWN;
+
+    clear_state(h->name);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.message_type = stp_arc_delete_msg;
+    mac_copy(msg.dest, h->name);
+    send_cloud_message(&msg);
+
+    trickle_reset("stp neighbor failed");
+}
+
+/* called with every send_stp interrupt:  start or stop the hello timer
+ * to follow db[84].
+ */
+void hello_check(void)
+{
+    if (!db[84].d) {
+        if (running) {
+            running = false;
+            hello_nbr_count = 0;
+            set_hello_alarm(-1);
+        }
+        return;
+    }
+
+    if (!running) {
+        running = true;
+        hello_sync();
+        set_hello_alarm(hello_interval);
+    }
+}
+
+/* the hello timer went off.  time out neighbors we haven't heard from,
+ * and send hellos to neighbors we haven't sent anything to.
+ */
+void hello_timer(void)
+{
+    struct timeval tv;
+    int i;
+
+    if (!db[84].d || !running) { return; }
+
+    hello_sync();
+
+    while (!checked_gettimeofday(&tv));
+
+    for (i = 0; i < hello_nbr_count; i++) {
+        hello_nbr_t *h = &hello_nbrs[i];
+
+        if (h->state == HELLO_UP
+            && timeval_diff(&tv, &h->last_heard) > detect_usec(h))
+        {
+            hello_failed(h, "timed out");
+            continue;
+        }
+
+        /* until the session is up, the neighbor needs our state */
+        if (h->state != HELLO_UP || h->last_sent.tv_sec == -1
+            || timeval_diff(&tv, &h->last_sent) >= hello_interval * 750LL)
+        {
+            send_hello(h);
+        } else {
+            h->hellos_suppressed++;
+        }
+    }
+
+    /* jitter the interval down by up to a quarter, as bfd does, so that
+     * neighbors don't fall into step.
+     */
+    set_hello_alarm(hello_interval - discrete_unif(hello_interval / 4 + 1));
+}
+
+/* we got a cloud message or wrapped client frame from device_index and
+ * h_source; if it is from an stp neighbor, we have heard from it.
+ */
+void hello_heard(int device_index, mac_address_t h_source)
+{
+    mac_address_ptr_t sender;
+    hello_nbr_t *h;
+
+    if (!running) { return; }
+
+    sender = get_name(device_index, h_source);
+    if (sender == NULL) { return; }
+
+    h = hello_find(sender);
+    if (h == NULL) { return; }
+
+    while (!checked_gettimeofday(&h->last_heard));
+}
+
+/* we sent a frame to the ethernet address h_dest; if it went to an stp
+ * neighbor, the neighbor will have heard from us.
+ */
+void hello_sent(mac_address_t h_dest)
+{
+    int i;
+
+    if (!running) { return; }
+
+    for (i = 0; i < hello_nbr_count; i++) {
+        hello_nbr_t *h = &hello_nbrs[i];
+
+        if (mac_equal(h->name, h_dest)
+            || (h->has_eth_mac_addr && mac_equal(h->eth_mac_addr, h_dest)))
+        {
+            while (!checked_gettimeofday(&h->last_sent));
+            return;
+        }
+    }
+}
+
+/* an stp neighbor sent us a hello; move our session with it along */
+void process_stp_hello_msg(message_t *message, int device_index)
+{
+    mac_address_ptr_t sender;
+    hello_nbr_t *h;
+    byte old_state;
+
+    if (!running) { return; }
+
+    sender = get_name(device_index, message->eth_header.h_source);
+    if (sender == NULL) { return; }
+
+    h = hello_find(sender);
+    if (h == NULL) { return; }
+
+    old_state = h->state;
+
+    while (!checked_gettimeofday(&h->last_heard));
+    h->remote_state = message->v.hello.state;
+    h->remote_mult = message->v.hello.detect_mult;
+    h->remote_interval = message->v.hello.interval;
+
+    switch (h->state) {
+    case HELLO_DOWN :
+        if (h->remote_state == HELLO_DOWN) {
+            h->state = HELLO_INIT;
+        } else if (h->remote_state == HELLO_INIT) {
+            h->state = HELLO_UP;
+        }
+        break;
+
+    case HELLO_INIT :
+        if (h->remote_state != HELLO_DOWN) { h->state = HELLO_UP; }
+        break;
+
+    case HELLO_UP :
+        if (h->remote_state == HELLO_DOWN) {
+            hello_failed(h, "stopped hearing us");
+            return;
+        }
+        break;
+    }
+
+    if (h->state != old_state) {
+        if (db[85].d) {
+            ddprintf("hello; session with %s %s -> %s\n",
+                    mac_sprintf(mac_buf1, h->name), state_name(old_state),
+                    state_name(h->state));
+        }
+
+        /* let the neighbor know right away */
+        send_hello(h);
+    }
+}
+
+void hello_print(ddprintf_t *fn, FILE *f)
+{
+    struct timeval tv;
+    int i;
+
+    if (!running) {
+        fn(f, "stp neighbor hellos off (db[84])\n");
+        return;
+    }
+
+    while (!checked_gettimeofday(&tv));
+
+    fn(f, "stp neighbor hellos every %d msec, detect mult %d; "
+            "%u failures\n", hello_interval, hello_detect_mult,
+            failure_count);
+    fn(f, "    neighbor           state  remote  mult   heard    sent"
+            "   hellos suppressed\n");
+
+    for (i = 0; i < hello_nbr_count; i++) {
+        hello_nbr_t *h = &hello_nbrs[i];
+
+        fn(f, "    ");
+        mac_dprint_no_eoln(fn, f, h->name);
+        fn(f, "  %-5s  %-5s  %2d/%-2d  %6lld  ", state_name(h->state),
+                state_name(h->remote_state), hello_mult(h), h->remote_mult,
+                timeval_diff(&tv, &h->last_heard) / 1000);
+        if (h->last_sent.tv_sec == -1) {
+            fn(f, "     -");
+        } else {
+            fn(f, "%6lld", timeval_diff(&tv, &h->last_sent) / 1000);
+        }
+        fn(f, "  %7u %10u\n", h->hellos_sent, h->hellos_suppressed);
+    }
+}
@@ -0,0 +1,34 @@
+/* hello.h - fast failure detection on stp arcs
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef HELLO_H
+#define HELLO_H
+
+#include <stdio.h>
+#include "util.h"
+#include "mac.h"
+#include "cloud.h"
+
+/* in milliseconds; from -H, else HELLO_INTERVAL */
+extern int hello_interval;
+
+/* from -H, else HELLO_DETECT_MULT */
+extern int hello_detect_mult;
+
+extern void hello_check(void);
+extern void hello_timer(void);
+extern void hello_heard(int device_index, mac_address_t h_source);
+extern void hello_sent(mac_address_t h_dest);
+extern void process_stp_hello_msg(message_t *message, int device_index);
+extern void hello_print(ddprintf_t *fn, FILE *f);
+
+#endif
@@ -0,0 +1,37 @@
+/* hello_data.h - liveness hellos between stp neighbors
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef HELLO_DATA_H
+#define HELLO_DATA_H
+
+#include "util.h"
+
+/* session states, as in bfd (rfc 5880) */
+#define HELLO_DOWN 0
+#define HELLO_INIT 1
+#define HELLO_UP 2
+
+typedef struct {
+    /* the sender's session state toward the receiver */
+    byte state;
+
+    /* the sender gives up on the receiver after this many of its own
+     * hello intervals without hearing from it
+     */
+    byte detect_mult;
+
+    /* the sender's hello interval in milliseconds */
+    unsigned short interval;
+
+} hello_msg_t;
+
+#endif
@@ -30,6 +30,9 @@ static const char Version[] = "Version "
 #include "graphit.h"
 #include "timer.h"
 #include "html_status.h"
+#include "latency.h"
+#include "msg_stat.h"
+#include "link_hist.h"
 
 /* this is a set of work data structures used while updating cloud_stp_list */
 static message_t new_stp_list[MAX_CLOUD];
@@ -580,6 +583,13 @@ void do_print_cloud(void)
 
     fprintf(f, "</pre>\n");
 
+    if (db[66].d) { latency_html(f); }
+
+    if (db[67].d) {
+        msg_stat_html(f);
+        msg_stat_snapshot();
+    }
+
     if (!db[38].d) { goto almost_done; }
 
     /* add all of the cloud_stp_list entries to mac_list, a temporary
@@ -592,8 +602,10 @@ void do_print_cloud(void)
         add_mac_addr(beacon->originator);
     }
 
-    /* do the two matrices (packets sent and signal strength) */
-    for (r = 0; r < 2; r++) {
+    /* do the three matrices (packets sent, signal strength, and recent
+     * loss history)
+     */
+    for (r = 0; r < 3; r++) {
         /* print the title of the packet matrix */
         fprintf(f, "<p>\n");
         fprintf(f, "<h3>\n");
@@ -603,11 +615,18 @@ void do_print_cloud(void)
                     "percent packets received\n");
             fprintf(f, "<br>\n");
             fprintf(f, "(sender at top of column, receiver at start of row)\n");
-        } else {
+        } else if (r == 1) {
             fprintf(f, "Signal strength\n");
             fprintf(f, "<br>\n");
             fprintf(f, "(how strongly each row entry sees each column entry)\n"
             );
+        } else {
+            fprintf(f, "Recent percent packets lost, oldest first, "
+                    "by %d-second interval\n",
+                    LINK_HIST_LEN * LINK_HIST_INTERVAL / LINK_HIST_SUMMARY);
+            fprintf(f, "<br>\n");
+            fprintf(f, "(sender at top of column, receiver at start of row; "
+                    "\"-\" is no packets)\n");
         }
 
         fprintf(f, "</h3>\n");
@@ -621,8 +640,10 @@ void do_print_cloud(void)
         fprintf(f, "        <td> </td>");
 
         for (j = 0; j < mac_count; j++) {
-            /* skip ad-hoc clients for column headers of first matrix */
-            if (r == 0 && node_names[j][0] == '(') { continue; }
+            /* skip ad-hoc clients for column headers of the packet
+             * matrices
+             */
+            if (r != 1 && node_names[j][0] == '(') { continue; }
 
             fprintf(f, " <td> ");
             //mac_dprint_no_eoln(eprintf, f, mac_list[j]);
@@ -655,8 +676,10 @@ void do_print_cloud(void)
             for (j = 0; j < mac_count; j++) {
                 bool_t did_something = false;
 
-                /* for column entries, ignore ad-hoc clients in first matrix */
-                if (r == 0 && node_names[j][0] == '(') { continue; }
+                /* for column entries, ignore ad-hoc clients in the packet
+                 * matrices
+                 */
+                if (r != 1 && node_names[j][0] == '(') { continue; }
 
                 if (src != NULL) {
                     for (k = 0; k < src->status_count; k++) {
@@ -687,10 +710,17 @@ void do_print_cloud(void)
                                         percent, '%');
                                 did_something = true;
                                 break;
-                            } else {
+                            } else if (r == 1) {
                                 fprintf(f, " <td> %d </td> ", s->sig_strength);
                                 did_something = true;
                                 break;
+                            } else {
+                                char summary[64];
+                                fprintf(f, " <td> %s </td> ",
+                                        link_hist_summary_sprint(summary,
+                                                s->loss_hist));
+                                did_something = true;
+                                break;
                             }
                         }
                     }
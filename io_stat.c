@@ -14,11 +14,18 @@ static const char Version[] = "Version "
     "$Id: io_stat.c,v 1.10 2012-02-22 19:27:22 greg Exp $";
 
 #include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/if_packet.h>
+#include <linux/sockios.h>
 
 #include "util.h"
 #include "io_stat.h"
 #include "print.h"
 #include "device.h"
+#include "latency.h"
+#include "msg_stat.h"
 
 io_stat_t io_stat[MAX_CLOUD];
 int io_stat_count = 0;
@@ -54,6 +61,9 @@ void short_print_io_stats(ddprintf_t *fn, FILE *f)
         fn(f, "%s: ", s->device_name);
         if (db[25].d) { fn(f, "<%d %d>", s->noncloud_recv, s->noncloud_send); }
         if (db[26].d) { fn(f, "<%d %d>", s->cloud_recv, s->cloud_send); }
+        if (s->kernel_drops != 0 || s->rxq_ovfl != 0) {
+            fn(f, "<kd %u %u>", s->kernel_drops, s->rxq_ovfl);
+        }
     }
     fn(f, "\r");
 }
@@ -71,6 +81,24 @@ void io_stat_print_fn(ddprintf_t fn, FILE *f, io_stat_t *stat)
             stat->delivery_error);
 }
 
+/* print what the kernel did with frames for the interface associated with
+ * stat, using print function.
+ */
+static void io_stat_print_kernel_fn(ddprintf_t fn, FILE *f, io_stat_t *stat)
+{
+    int mean_delay = 0;
+
+    if (stat->queue_delay_count > 0) {
+        mean_delay = (int) (stat->queue_delay_total / stat->queue_delay_count);
+    }
+
+    fn(f, "    %-8s%8u%8u%8u%8d%8d%8d%8d%8d%8d\n",
+            stat->device_name,
+            stat->kernel_packets, stat->kernel_drops, stat->rxq_ovfl,
+            stat->inq, stat->max_inq, stat->outq, stat->max_outq,
+            mean_delay, stat->max_queue_delay);
+}
+
 /* print comm stats for for interface associated with stat to stream f */
 void io_stat_print(FILE *f, io_stat_t *stat)
 {
@@ -92,9 +120,32 @@ void print_io_stats(ddprintf_t *fn, FILE *f)
     for (i = 0; i < io_stat_count; i++) {
         io_stat_print_fn(fn, f, &io_stat[i]);
     }
+
+    fn(f, "kernel statistics (queue delays in usec):\n");
+    fn(f,
+"    dev        kpkts  kdrops  rxqovf     inq  maxinq    outq maxoutq  "
+    "qdelay  maxqdl\n"
+    );
+
+    for (i = 0; i < io_stat_count; i++) {
+        io_stat_print_kernel_fn(fn, f, &io_stat[i]);
+    }
+
     fn(f, "max_packet_len:  %d\n", max_packet_len);
 }
 
+/* zero the kernel-derived statistics in s */
+static void clear_kernel_stats(io_stat_t *s)
+{
+    s->kernel_packets = s->kernel_drops = 0;
+    s->rxq_ovfl = 0;
+    s->inq = s->outq = 0;
+    s->max_inq = s->max_outq = 0;
+    s->queue_delay_total = 0;
+    s->queue_delay_count = 0;
+    s->max_queue_delay = 0;
+}
+
 /* if not already present, add a comm-statistics gathering struct for the
  * device, which may be a local interface or another cloud box that
  * we know about.
@@ -145,7 +196,10 @@ void add_io_stat(device_t *device)
     io_stat[i].cloud_send_error = io_stat[i].noncloud_send_error = 0;
     io_stat[i].recv_error = 0;
     io_stat[i].delivery_error = 0;
+    clear_kernel_stats(&io_stat[i]);
     strcpy(io_stat[i].device_name, device->device_name);
+    latency_clear(i);
+    msg_stat_clear(i);
 
     device->stat_index = i;
 }
@@ -163,6 +217,69 @@ void reset_io_stats()
         io_stat[i].cloud_send_error = io_stat[i].noncloud_send_error = 0;
         io_stat[i].delivery_error = 0;
         io_stat[i].recv_error = 0;
+        clear_kernel_stats(&io_stat[i]);
+    }
+}
+
+/* sample the kernel's view of each device socket:  frames it handed us and
+ * frames it dropped (PACKET_STATISTICS), and how many bytes are sitting in
+ * the receive and transmit queues right now.
+ */
+void update_kernel_io_stats(void)
+{
+    int i;
+
+    if (use_pipes) { return; }
+
+    for (i = 0; i < device_list_count; i++) {
+        device_t *device = &device_list[i];
+        io_stat_t *s = &io_stat[device->stat_index];
+        struct tpacket_stats stats;
+        socklen_t len = sizeof(stats);
+        int bytes;
+
+        /* ad-hoc pseudo-devices share the wlan device's socket */
+        if (device->device_type == device_type_ad_hoc) { continue; }
+
+        if (device->fd < 0) { continue; }
+
+        if (getsockopt(device->fd, SOL_PACKET, PACKET_STATISTICS,
+                &stats, &len) == 0)
+        {
+            s->kernel_packets += stats.tp_packets;
+            s->kernel_drops += stats.tp_drops;
+        }
+
+        if (ioctl(device->fd, SIOCINQ, &bytes) == 0) {
+            s->inq = bytes;
+            if (bytes > s->max_inq) { s->max_inq = bytes; }
+        }
+
+        if (ioctl(device->fd, SIOCOUTQ, &bytes) == 0) {
+            s->outq = bytes;
+            if (bytes > s->max_outq) { s->max_outq = bytes; }
+        }
     }
 }
 
+/* a frame the kernel timestamped at *ts has just been read; account for
+ * how long it sat in the socket.
+ */
+void io_stat_note_queue_delay(io_stat_t *stat, struct timespec *ts)
+{
+    struct timespec now;
+    long long delay;
+
+    if (clock_gettime(CLOCK_REALTIME, &now) != 0) { return; }
+
+    delay = (now.tv_sec - ts->tv_sec) * 1000000LL
+            + (now.tv_nsec - ts->tv_nsec) / 1000;
+
+    /* the clock got set backwards, or something else odd */
+    if (delay < 0) { return; }
+
+    stat->queue_delay_total += delay;
+    stat->queue_delay_count++;
+    if (delay > stat->max_queue_delay) { stat->max_queue_delay = (int) delay; }
+}
+
@@ -13,6 +13,8 @@
 #ifndef IO_STAT_T
 #define IO_STAT_T
 
+#include <time.h>
+
 #include "print.h"
 #include "device.h"
 
@@ -35,6 +37,25 @@ typedef struct {
 
     int delivery_error;
 
+    /* what the kernel saw before we read anything.  kernel_packets and
+     * kernel_drops accumulate PACKET_STATISTICS (which the kernel zeroes
+     * each time we read it); rxq_ovfl is the socket's SO_RXQ_OVFL drop
+     * count from the most recent frame received.
+     */
+    unsigned int kernel_packets, kernel_drops;
+    unsigned int rxq_ovfl;
+
+    /* bytes queued in the socket (SIOCINQ, SIOCOUTQ) at the last sample,
+     * and the largest values seen.
+     */
+    int inq, outq;
+    int max_inq, max_outq;
+
+    /* time from kernel receive timestamp (SO_TIMESTAMPNS) to our read */
+    long long queue_delay_total;
+    int queue_delay_count;
+    int max_queue_delay;
+
     char device_name[64];
 } io_stat_t;
 
@@ -47,5 +68,7 @@ extern void io_stat_print(FILE *f, io_stat_t *stat);
 extern void print_io_stats(ddprintf_t *fn, FILE *f);
 extern void add_io_stat(device_t *device);
 extern void reset_io_stats();
+extern void update_kernel_io_stats(void);
+extern void io_stat_note_queue_delay(io_stat_t *stat, struct timespec *ts);
 
 #endif
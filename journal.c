@@ -0,0 +1,778 @@
+/* journal.c - record merge_cloud's inputs, and replay them later
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* what merge_cloud does depends on the order frames arrive in, when its
+ * timers go off, what random() says, and what is in the wds, sig_strength
+ * and similar files when it looks.  with "-R journal", merge_cloud writes
+ * all of that to a journal file as it runs; with "-r journal", it runs the
+ * same code again with the journal as its only input:  no sockets, no
+ * timer interrupts, and as fast as it can go.  so a problem caught on a
+ * box can be profiled on a workstation, or run through two builds.
+ *
+ * the journal is a header (magic number, start time, and merge_cloud's
+ * command line) followed by records.  each record is a type byte and
+ * fields in variable-length integers.  there are two kinds of records.
+ *
+ * events drive the main loop:
+ *     J_PASS      the start of a pass of the main loop
+ *     J_TIMER     the start of a pass of the main loop, where the timer
+ *                 interrupt ran since the last pass:  whether the interrupt
+ *                 pipe showed up in select(), got_interrupt[], times[] and
+ *                 now, as the interrupt left them
+ *     J_FRAME     a frame read from a device during the pass:  device
+ *                 index, time, bytes
+ *
+ * answers are what the main loop asked for between events, in order:
+ *     J_TIME      a checked_gettimeofday() or util_gettimeofday()
+ *     J_RANDOM    a random() from random.c
+ *     J_FILE      the contents of a file opened with journal_fopen()
+ *     J_MAC       the result of a mac_get()
+ *
+ * while recording, the timer interrupt is held off during each pass of
+ * the main loop (see repeated()), so its effects land between passes, and
+ * a J_TIMER record can restore them exactly.  its own calls for the time
+ * and random numbers are not recorded.
+ *
+ * on replay, a question with no answer recorded before the next event gets
+ * a live answer (or, for the time, the last time replayed), and answers
+ * that nobody asks for are skipped when the next event is taken.  so a
+ * build whose code asks different questions can still replay a journal,
+ * though it will drift from the recording; the summary at the end counts
+ * both.
+ *
+ * not journaled:  commands from stdin, /tmp/cloud.db and the ll_shell
+ * (replay turns off stdin and the ll_shell), db[] changes made by
+ * set_merge_cloud_db, and anything the wrt beacon code reads.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "print.h"
+#include "timer.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC "CLJ9"
+
+#define J_PASS 'P'
+#define J_TIMER 'T'
+#define J_FRAME 'F'
+#define J_TIME 't'
+#define J_RANDOM 'r'
+#define J_FILE 'f'
+#define J_MAC 'm'
+
+#define is_event(type) \
+    ((type) == J_PASS || (type) == J_TIMER || (type) == J_FRAME)
+#define is_pass(type) ((type) == J_PASS || (type) == J_TIMER)
+
+/* room for whole-file reads in journal_fopen() */
+#define JOURNAL_FILE_MAX 65536
+
+journal_mode_t journal_mode = journal_off;
+volatile bool_t journal_hold_timer = false;
+volatile bool_t journal_timer_pending = false;
+volatile int journal_untracked = 0;
+
+/* the timer state the timer interrupt changes */
+typedef struct {
+    char got_interrupt[TIMER_COUNT];
+    struct timeval times[TIMER_COUNT];
+    struct timeval now;
+} timer_state_t;
+
+/* one record in a journal being replayed */
+typedef struct {
+    char type;
+    int dev;
+    long offset;
+} journal_rec_t;
+
+static FILE *out = NULL;
+static long base_sec;
+
+/* the recording, for replay */
+static byte *data = NULL;
+static long data_len;
+static journal_rec_t *recs = NULL;
+static int rec_count;
+static int cursor;
+static int journal_argc;
+static char **journal_argv;
+
+/* timer state at the end of the last pass of the main loop */
+static timer_state_t marked;
+
+/* replay; where the timer state for this pass is, or -1 */
+static long pass_timer = -1;
+
+/* the last time given out during replay, in microseconds since base_sec */
+static long long replay_time;
+
+static struct timespec wall_start;
+
+static struct {
+    unsigned long long frames, frame_bytes, timers, times, randoms, files,
+            macs;
+
+    /* replay:  frames no pass read, answers nobody asked for,
+     * and questions with no recorded answer
+     */
+    unsigned long long skipped_frames, unused, unanswered;
+} stats;
+
+/* write an unsigned variable-length integer:  seven bits a byte, low bits
+ * first, high bit set on all but the last byte.
+ */
+static void put_varint(unsigned long long v)
+{
+    while (v >= 0x80) {
+        putc((int) (v & 0x7f) | 0x80, out);
+        v >>= 7;
+    }
+    putc((int) v, out);
+}
+
+/* signed, zig-zag encoded so small negative numbers stay small */
+static void put_svarint(long long v)
+{
+    put_varint(((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63));
+}
+
+static void put_bytes(void *buf, int len)
+{
+    put_varint(len);
+    fwrite(buf, 1, len, out);
+}
+
+static unsigned long long get_varint(long *pos)
+{
+    unsigned long long v = 0;
+    int shift = 0;
+
+    while (*pos < data_len) {
+        byte b = data[(*pos)++];
+        v |= (unsigned long long) (b & 0x7f) << shift;
+        if (!(b & 0x80)) { break; }
+        shift += 7;
+    }
+
+    return v;
+}
+
+static long long get_svarint(long *pos)
+{
+    unsigned long long v = get_varint(pos);
+
+    return (long long) (v >> 1) ^ -(long long) (v & 1);
+}
+
+/* return a pointer to the next len-prefixed field, and its length */
+static byte *get_bytes(long *pos, int *len)
+{
+    byte *p;
+
+    *len = (int) get_varint(pos);
+    p = &data[*pos];
+    *pos += *len;
+
+    if (*pos > data_len) {
+        *len = 0;
+        *pos = data_len;
+    }
+
+    return p;
+}
+
+static long long usec_since_base(struct timeval *tv)
+{
+    return (tv->tv_sec - base_sec) * 1000000LL + tv->tv_usec;
+}
+
+static void put_timeval(struct timeval *tv)
+{
+    put_svarint(tv->tv_sec == -1 ? -1 : usec_since_base(tv));
+}
+
+static void get_timeval(long *pos, struct timeval *tv)
+{
+    long long usec = get_svarint(pos);
+
+    if (usec == -1) {
+        tv->tv_sec = -1;
+        tv->tv_usec = 0;
+    } else {
+        tv->tv_sec = base_sec + usec / 1000000;
+        tv->tv_usec = usec % 1000000;
+    }
+}
+
+static void get_timer_state(timer_state_t *s)
+{
+    int i;
+
+    memcpy(s->got_interrupt, got_interrupt, sizeof(s->got_interrupt));
+    for (i = 0; i < TIMER_COUNT; i++) { s->times[i] = times[i]; }
+    s->now = now;
+}
+
+static bool_t timer_state_equal(timer_state_t *a, timer_state_t *b)
+{
+    int i;
+
+    if (memcmp(a->got_interrupt, b->got_interrupt, sizeof(a->got_interrupt))
+        != 0)
+    {
+        return false;
+    }
+
+    for (i = 0; i < TIMER_COUNT; i++) {
+        if (a->times[i].tv_sec != b->times[i].tv_sec
+            || a->times[i].tv_usec != b->times[i].tv_usec)
+        {
+            return false;
+        }
+    }
+
+    return a->now.tv_sec == b->now.tv_sec && a->now.tv_usec == b->now.tv_usec;
+}
+
+/* skip over the fields of the record of type "type" at *pos */
+static bool_t skip_record(char type, long *pos, int *dev)
+{
+    int i, len;
+
+    *dev = -1;
+
+    switch (type) {
+
+    case J_PASS :
+        break;
+
+    case J_FRAME :
+        *dev = (int) get_varint(pos);
+        get_varint(pos);
+        get_bytes(pos, &len);
+        break;
+
+    case J_TIMER :
+        (*pos)++;
+        get_varint(pos);
+        for (i = 0; i < TIMER_COUNT + 1; i++) { get_svarint(pos); }
+        break;
+
+    case J_TIME :
+        get_svarint(pos);
+        break;
+
+    case J_RANDOM :
+        get_varint(pos);
+        break;
+
+    case J_FILE :
+        get_bytes(pos, &len);
+        (*pos)++;
+        get_bytes(pos, &len);
+        break;
+
+    case J_MAC :
+        *pos += 1 + 6;
+        break;
+
+    default :
+        return false;
+    }
+
+    return *pos <= data_len;
+}
+
+/* index of the next event record at or after the cursor */
+static int next_event(void)
+{
+    int j = cursor;
+
+    while (j < rec_count && !is_event(recs[j].type)) { j++; }
+
+    return j;
+}
+
+/* move the cursor past record j, counting the answers skipped on the way */
+static void take(int j)
+{
+    for (; cursor < j; cursor++) {
+        if (!is_event(recs[cursor].type)) { stats.unused++; }
+    }
+    cursor = j + 1;
+}
+
+/* find the next answer of this type before the next event, and take it.
+ * return its offset, or -1 if there isn't one.
+ */
+static long take_answer(char type)
+{
+    int j;
+
+    for (j = cursor; j < rec_count && !is_event(recs[j].type); j++) {
+        if (recs[j].type == type) {
+            take(j);
+            return recs[j].offset;
+        }
+    }
+
+    stats.unanswered++;
+
+    return -1;
+}
+
+/* the time, from the journal or into it */
+static int journal_gettimeofday(struct timeval *tv)
+{
+    long pos;
+
+    if (journal_untracked || journal_mode == journal_off) {
+        return gettimeofday(tv, NULL);
+    }
+
+    if (journal_mode == journal_record) {
+        int result = gettimeofday(tv, NULL);
+        putc(J_TIME, out);
+        put_svarint(usec_since_base(tv));
+        stats.times++;
+        return result;
+    }
+
+    pos = take_answer(J_TIME);
+    if (pos != -1) {
+        replay_time = get_svarint(&pos);
+        stats.times++;
+    }
+
+    tv->tv_sec = base_sec + replay_time / 1000000;
+    tv->tv_usec = replay_time % 1000000;
+
+    return 0;
+}
+
+/* start recording to, or replaying from, fname.  when recording, argc and
+ * argv are merge_cloud's command line, saved for replay.
+ */
+int journal_open(char *fname, journal_mode_t mode, int argc, char **argv)
+{
+    struct timeval tv;
+    FILE *f;
+    long pos;
+    int i, rec_max = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    if (mode == journal_record) {
+        out = fopen(fname, "w");
+        if (out == NULL) {
+            ddprintf("journal_open; could not create %s:  %s\n", fname,
+                    strerror(errno));
+            return -1;
+        }
+
+        gettimeofday(&tv, NULL);
+        base_sec = tv.tv_sec;
+
+        fwrite(JOURNAL_MAGIC, 1, 4, out);
+        put_varint(base_sec);
+        put_varint(argc);
+        for (i = 0; i < argc; i++) { put_bytes(argv[i], strlen(argv[i])); }
+
+        journal_mode = journal_record;
+        util_gettimeofday_hook = journal_gettimeofday;
+
+        return 0;
+    }
+
+    f = fopen(fname, "r");
+    if (f == NULL) {
+        ddprintf("journal_open; could not open %s:  %s\n", fname,
+                strerror(errno));
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    data_len = ftell(f);
+    rewind(f);
+
+    data = malloc(data_len + 1);
+    if (data == NULL || fread(data, 1, data_len, f) != (size_t) data_len
+        || data_len < 4 || memcmp(data, JOURNAL_MAGIC, 4) != 0)
+    {
+        ddprintf("journal_open; %s is not a journal\n", fname);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    pos = 4;
+    base_sec = (long) get_varint(&pos);
+
+    journal_argc = (int) get_varint(&pos);
+    journal_argv = calloc(journal_argc + 1, sizeof(char *));
+    for (i = 0; i < journal_argc; i++) {
+        int len;
+        byte *p = get_bytes(&pos, &len);
+
+        journal_argv[i] = malloc(len + 1);
+        memcpy(journal_argv[i], p, len);
+        journal_argv[i][len] = '\0';
+    }
+
+    /* index the records */
+    rec_count = 0;
+    while (pos < data_len) {
+        journal_rec_t *r;
+
+        if (rec_count >= rec_max) {
+            rec_max = 2 * rec_max + 4096;
+            recs = realloc(recs, rec_max * sizeof(journal_rec_t));
+        }
+
+        r = &recs[rec_count];
+        r->type = data[pos++];
+        r->offset = pos;
+
+        /* (a journal cut off by a crash just ends early) */
+        if (!skip_record(r->type, &pos, &r->dev)) { break; }
+
+        rec_count++;
+    }
+
+    cursor = 0;
+    replay_time = 0;
+
+    journal_mode = journal_replay;
+    util_gettimeofday_hook = journal_gettimeofday;
+
+    ddprintf("journal_open; %d records in %s\n", rec_count, fname);
+
+    return 0;
+}
+
+/* the command line the journal being replayed was recorded with */
+void journal_get_args(int *argc, char ***argv)
+{
+    *argc = journal_argc;
+    *argv = journal_argv;
+}
+
+void journal_flush(void)
+{
+    if (out != NULL) { fflush(out); }
+}
+
+void journal_close(void)
+{
+    if (out != NULL) {
+        fclose(out);
+        out = NULL;
+    }
+}
+
+/* record a frame just read from device dev_index */
+void journal_frame(int dev_index, void *buf, int len)
+{
+    struct timeval tv;
+
+    if (journal_mode != journal_record) { return; }
+
+    gettimeofday(&tv, NULL);
+
+    putc(J_FRAME, out);
+    put_varint(dev_index);
+    put_varint(usec_since_base(&tv));
+    put_bytes(buf, len);
+
+    stats.frames++;
+    stats.frame_bytes += len;
+}
+
+/* replay; is the next event a frame for device dev_index? */
+bool_t journal_frame_ready(int dev_index)
+{
+    int j = next_event();
+
+    return j < rec_count && recs[j].type == J_FRAME
+            && recs[j].dev == dev_index;
+}
+
+/* replay; read the next frame (which is for dev_index) into buf */
+int journal_read_frame(int dev_index, void *buf, int len)
+{
+    int j = next_event();
+    long pos;
+    int frame_len;
+    byte *p;
+
+    if (!journal_frame_ready(dev_index)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    take(j);
+
+    pos = recs[j].offset;
+    get_varint(&pos);
+    get_varint(&pos);
+    p = get_bytes(&pos, &frame_len);
+
+    if (frame_len > len) { frame_len = len; }
+    memcpy(buf, p, frame_len);
+
+    stats.frames++;
+    stats.frame_bytes += frame_len;
+
+    return frame_len;
+}
+
+/* replay; start the next pass of the main loop.  frames the last pass
+ * didn't read (for a device we don't have, or because the replay wandered
+ * off from the recording) are dropped.  return false when the journal is
+ * used up.
+ */
+bool_t journal_replay_next(void)
+{
+    int j;
+
+    while ((j = next_event()) < rec_count && !is_pass(recs[j].type)) {
+        take(j);
+        stats.skipped_frames++;
+    }
+
+    if (j >= rec_count) { return false; }
+
+    take(j);
+    pass_timer = (recs[j].type == J_TIMER) ? recs[j].offset : -1;
+
+    return true;
+}
+
+/* once per pass of the main loop, after select().  recording, note any
+ * change the timer interrupt made since journal_timer_mark(), and whether
+ * select() saw the interrupt pipe.  replaying, make the same changes, and
+ * set or clear interrupt_fd in read_set to match.
+ */
+void journal_timer_state(fd_set *read_set, int interrupt_fd)
+{
+    timer_state_t s;
+    unsigned long long flags = 0;
+    long pos;
+    int i;
+
+    if (journal_mode == journal_record) {
+        bool_t pipe = FD_ISSET(interrupt_fd, read_set);
+
+        journal_hold_timer = true;
+
+        get_timer_state(&s);
+        if (!pipe && timer_state_equal(&s, &marked)) {
+            putc(J_PASS, out);
+            return;
+        }
+
+        for (i = 0; i < TIMER_COUNT; i++) {
+            if (s.got_interrupt[i]) { flags |= 1ULL << i; }
+        }
+
+        putc(J_TIMER, out);
+        putc(pipe, out);
+        put_varint(flags);
+        for (i = 0; i < TIMER_COUNT; i++) { put_timeval(&s.times[i]); }
+        put_timeval(&s.now);
+
+        stats.timers++;
+        return;
+    }
+
+    if (journal_mode != journal_replay) { return; }
+
+    FD_CLR(interrupt_fd, read_set);
+
+    if (pass_timer == -1) { return; }
+
+    pos = pass_timer;
+
+    if (data[pos++]) { FD_SET(interrupt_fd, read_set); }
+
+    flags = get_varint(&pos);
+    for (i = 0; i < TIMER_COUNT; i++) {
+        got_interrupt[i] = (flags & (1ULL << i)) != 0;
+    }
+    for (i = 0; i < TIMER_COUNT; i++) { get_timeval(&pos, &times[i]); }
+    get_timeval(&pos, &now);
+
+    stats.timers++;
+}
+
+/* at the end of each pass of the main loop; remember the timer state, and
+ * let the timer interrupt do whatever it was held off from doing.
+ */
+void journal_timer_mark(void)
+{
+    if (journal_mode != journal_record) { return; }
+
+    get_timer_state(&marked);
+
+    journal_hold_timer = false;
+    if (journal_timer_pending) {
+        journal_timer_pending = false;
+        repeated(0);
+    }
+}
+
+/* random() for random.c */
+long journal_random(void)
+{
+    long r;
+    long pos;
+
+    if (journal_untracked || journal_mode == journal_off) { return random(); }
+
+    if (journal_mode == journal_record) {
+        r = random();
+        putc(J_RANDOM, out);
+        put_varint(r);
+        stats.randoms++;
+        return r;
+    }
+
+    pos = take_answer(J_RANDOM);
+    if (pos == -1) { return random(); }
+
+    stats.randoms++;
+
+    return (long) get_varint(&pos);
+}
+
+/* fopen(fname, "r"), for the files merge_cloud polls.  on replay, the
+ * result is a temporary file holding what the recording read.
+ */
+FILE *journal_fopen(char *fname)
+{
+    static byte buf[JOURNAL_FILE_MAX];
+    FILE *f;
+    long pos;
+    int len;
+
+    if (journal_mode == journal_off) { return fopen(fname, "r"); }
+
+    if (journal_mode == journal_record) {
+        f = fopen(fname, "r");
+
+        putc(J_FILE, out);
+        put_bytes(fname, strlen(fname));
+        putc(f != NULL, out);
+
+        len = (f == NULL) ? 0 : fread(buf, 1, sizeof(buf), f);
+        put_bytes(buf, len);
+
+        if (f != NULL) { rewind(f); }
+        stats.files++;
+
+        return f;
+    }
+
+    pos = take_answer(J_FILE);
+    if (pos == -1) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    stats.files++;
+
+    get_bytes(&pos, &len);
+    if (!data[pos++]) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    {
+        byte *p = get_bytes(&pos, &len);
+
+        f = tmpfile();
+        if (f == NULL) { return NULL; }
+
+        fwrite(p, 1, len, f);
+        rewind(f);
+    }
+
+    return f;
+}
+
+/* mac_get(), for the interfaces whose addresses weren't on the command
+ * line
+ */
+int journal_mac_get(mac_address_t mac_address, char *device_name)
+{
+    int result;
+    long pos;
+
+    if (journal_mode == journal_off) {
+        return mac_get(mac_address, device_name);
+    }
+
+    if (journal_mode == journal_record) {
+        result = mac_get(mac_address, device_name);
+        putc(J_MAC, out);
+        putc(result == 0, out);
+        fwrite(mac_address, 1, 6, out);
+        stats.macs++;
+        return result;
+    }
+
+    pos = take_answer(J_MAC);
+    if (pos == -1) {
+        mac_copy(mac_address, NULL);
+        return -1;
+    }
+
+    stats.macs++;
+    mac_copy(mac_address, &data[pos + 1]);
+
+    return data[pos] ? 0 : -1;
+}
+
+void journal_print_summary(ddprintf_t *fn, FILE *f)
+{
+    struct timespec ts;
+    double elapsed;
+
+    if (journal_mode == journal_off) { return; }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    elapsed = ts.tv_sec - wall_start.tv_sec
+            + (ts.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    fn(f, "journal %s:  %llu frames (%llu bytes), %llu timer events, "
+            "%llu times, %llu random numbers, %llu files, %llu macs\n",
+            journal_mode == journal_record ? "recorded" : "replayed",
+            stats.frames, stats.frame_bytes, stats.timers, stats.times,
+            stats.randoms, stats.files, stats.macs);
+
+    if (journal_mode == journal_replay) {
+        fn(f, "    %.3f seconds, %.0f frames/sec; %llu frames not read, "
+                "%llu answers unused, %llu questions unanswered\n",
+                elapsed, elapsed > 0 ? stats.frames / elapsed : 0.,
+                stats.skipped_frames, stats.unused, stats.unanswered);
+    }
+}
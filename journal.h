@@ -0,0 +1,61 @@
+/* journal.h - record merge_cloud's inputs, and replay them later
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include "util.h"
+#include "mac.h"
+
+typedef enum {
+    journal_off,
+    journal_record,
+    journal_replay,
+} journal_mode_t;
+
+extern journal_mode_t journal_mode;
+
+/* while recording, the main loop sets this during each pass, and the timer
+ * interrupt just sets journal_timer_pending instead of doing its work.
+ */
+extern volatile bool_t journal_hold_timer;
+extern volatile bool_t journal_timer_pending;
+
+/* non-zero while in the timer interrupt; its random numbers and times
+ * aren't journaled, since replay restores its effects wholesale.
+ */
+extern volatile int journal_untracked;
+
+extern int journal_open(char *fname, journal_mode_t mode, int argc,
+        char **argv);
+extern void journal_get_args(int *argc, char ***argv);
+extern void journal_flush(void);
+extern void journal_close(void);
+
+extern void journal_frame(int dev_index, void *buf, int len);
+extern bool_t journal_frame_ready(int dev_index);
+extern int journal_read_frame(int dev_index, void *buf, int len);
+extern bool_t journal_replay_next(void);
+
+extern void journal_timer_state(fd_set *read_set, int interrupt_fd);
+extern void journal_timer_mark(void);
+
+extern long journal_random(void);
+extern FILE *journal_fopen(char *fname);
+extern int journal_mac_get(mac_address_t mac_address, char *device_name);
+
+extern void journal_print_summary(ddprintf_t *fn, FILE *f);
+
+#endif
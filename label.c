@@ -19,8 +19,12 @@ static const char Version[] = "Version "
  * cloud_hub project.
  *
  * the file can optionally be specified to be trimmed, in which case
- * older log messages are deleted and the file never gets longer than
- * MAX_FILE_SIZE (currently 16K bytes).
+ * it is a fixed-size circular file of MAX_FILE_SIZE (currently 16K bytes)
+ * written through an mmap; older log messages are overwritten by newer
+ * ones.  (see log_ring.c.)
+ *
+ * each labeled line is collected in memory and written out in one piece,
+ * rather than a byte at a time.
  *
  * each line is labeled by date and time, and a hostname identifier string.
  *
@@ -36,10 +40,19 @@ static const char Version[] = "Version "
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include "log_ring.h"
+
 // #define MAX_FILE_SIZE 4096
 #define MAX_FILE_SIZE 16384
 
+/* longer lines are written out in pieces of this size */
+#define LINE_BUF_LEN 1024
+
 static int trim = 0;
+static log_ring_t ring;
+
+static char line_buf[LINE_BUF_LEN];
+static int line_len = 0;
 
 static int last_msec = -1;
 static long last_sec_since_midnight_gmt = -1;
@@ -48,6 +61,36 @@ static int sequence;
 static char *out_fname;
 static int out_fd;
 
+/* write out the line collected so far */
+static void flush_line()
+{
+    if (line_len == 0) { return; }
+
+    if (trim) {
+        log_ring_write(&ring, line_buf, line_len);
+    } else if (write(out_fd, line_buf, line_len) == -1) {
+        perror("write problem");
+    }
+
+    line_len = 0;
+}
+
+/* add len bytes to the line being collected */
+static void add_to_line(char *buf, int len)
+{
+    while (len > 0) {
+        int n = LINE_BUF_LEN - line_len;
+        if (n > len) { n = len; }
+
+        memcpy(&line_buf[line_len], buf, n);
+        line_len += n;
+        buf += n;
+        len -= n;
+
+        if (line_len == LINE_BUF_LEN) { flush_line(); }
+    }
+}
+
 #if 0
 /* debugging breakpoint routine */
 static void bp1() { }
@@ -90,7 +133,7 @@ static void print_time(FILE *f)
     sprintf(buf, "%02d:%02d:%02d.%03ld.%02d", hour, min, sec,
             tv.tv_usec / 1000,
             sequence);
-    write(out_fd, buf, strlen(buf));
+    add_to_line(buf, strlen(buf));
 }
 
 static char *hostname = "";
@@ -101,50 +144,11 @@ static void print_prefix(FILE *f)
     static char c = ' ';
     static char *colon = ":  ";
     if (strlen(hostname) > 0) {
-        write(out_fd, hostname, strlen(hostname));
-        write(out_fd, &c, 1);
+        add_to_line(hostname, strlen(hostname));
+        add_to_line(&c, 1);
     }
     print_time(f);
-    write(out_fd, colon, strlen(colon));
-}
-
-/* rewrite the output file to make it small if it's starting to get too big.
- * we grab the last half of the file from disk, then write that out.
- */
-static void trim_output()
-{
-    char buf[MAX_FILE_SIZE / 2];
-    struct stat stat_buf;
-    int result = fstat(out_fd, &stat_buf);
-    if (stat_buf.st_size < MAX_FILE_SIZE) { goto done; }
-
-    result = lseek(out_fd, -MAX_FILE_SIZE / 2, SEEK_END);
-    if (result == -1) {
-        perror("lseek problem");
-        return;
-    }
-    result = read(out_fd, buf, MAX_FILE_SIZE / 2);
-    if (result == -1) {
-        perror("read problem");
-        return;
-    }
-    result = close(out_fd);
-    if (result == -1) {
-        perror("read problem");
-        return;
-    }
-    out_fd = open(out_fname, O_RDWR|O_TRUNC);
-    if (out_fd == -1) {
-        perror("open problem");
-        return;
-    }
-    result = write(out_fd, buf, MAX_FILE_SIZE / 2);
-    if (result == -1) {
-        perror("write problem");
-        return;
-    }
-
-    done:;
+    add_to_line(colon, strlen(colon));
 }
 
 static void usage()
@@ -185,6 +189,11 @@ static void process_args(int argc, char **argv)
     if (!got_outfile) {
         fprintf(stderr, "outfile required.\n");
         usage();
+    } else if (trim) {
+        if (log_ring_open(&ring, out_fname, MAX_FILE_SIZE) == -1) {
+            perror("log_ring_open problem");
+            exit(1);
+        }
     } else {
         out_fd = open(out_fname, O_RDWR|O_CREAT|O_TRUNC,
                 S_IRUSR|S_IWUSR | S_IRGRP | S_IROTH);
@@ -194,6 +203,7 @@ static void process_args(int argc, char **argv)
 int main(int argc, char **argv)
 {
     int c;
+    char ch;
     int new_line = 1;
 
     process_args(argc, argv);
@@ -205,13 +215,16 @@ int main(int argc, char **argv)
             print_prefix(stdout);
             new_line = 0;
         }
-        write(out_fd, &c, 1);
+        ch = c;
+        add_to_line(&ch, 1);
         if (c == '\n') {
+            flush_line();
             new_line = 1;
         }
-
-        if (trim) { trim_output(); }
     }
 
+    flush_line();
+    if (trim) { log_ring_close(&ring); }
+
     return 0;
 }
@@ -0,0 +1,232 @@
+/* latency.c - per-stage, per-device latency histograms for the packet path
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* lightweight timing of the stages a frame goes through in merge_cloud:
+ * the recvfrom, classifying it (accept switch and h_source device lookup),
+ * sequence_check, update_k_for_n_state, bcast_forward_message, and each
+ * sendto.
+ *
+ * each stage gets a histogram with power-of-two buckets, kept separately
+ * for each io_stat entry (i.e., each local interface or other cloud box),
+ * so a sample costs two clock reads and an increment.
+ *
+ * timing is only done when db[66] is set.
+ */
+
+#include <time.h>
+#include <string.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "print.h"
+#include "io_stat.h"
+#include "latency.h"
+
+static unsigned int histogram[MAX_CLOUD][LAT_STAGE_COUNT][LAT_BUCKETS];
+
+static char *stage_names[LAT_STAGE_COUNT] = {
+    "recv",
+    "classify",
+    "seq_check",
+    "k_for_n",
+    "forward",
+    "sendto",
+};
+
+/* read the monotonic clock in nanoseconds */
+static lat_time_t lat_now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) { return 0; }
+
+    return ((lat_time_t) ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/* if we are timing, return the start time of a stage; 0 otherwise */
+lat_time_t latency_start(void)
+{
+    if (!db[66].d) { return 0; }
+
+    return lat_now();
+}
+
+/* the stage that started at "start" is done; count it for the io_stat
+ * entry stat_index.
+ */
+void latency_record(int stat_index, lat_stage_t stage, lat_time_t start)
+{
+    lat_time_t elapsed;
+    int bucket = 0;
+
+    if (start == 0) { return; }
+    if (stat_index < 0 || stat_index >= MAX_CLOUD) { return; }
+
+    elapsed = lat_now() - start;
+
+    while ((elapsed >>= 1) != 0 && bucket < LAT_BUCKETS - 1) { bucket++; }
+
+    histogram[stat_index][stage][bucket]++;
+}
+
+/* zero the histograms for one io_stat entry */
+void latency_clear(int stat_index)
+{
+    if (stat_index < 0 || stat_index >= MAX_CLOUD) { return; }
+
+    memset(histogram[stat_index], 0, sizeof(histogram[stat_index]));
+}
+
+/* zero all of the histograms */
+void latency_reset(void)
+{
+    memset(histogram, 0, sizeof(histogram));
+}
+
+/* put a human-readable version of 2^bucket nanoseconds into buf */
+static char *bucket_sprint(char *buf, int bucket)
+{
+    lat_time_t ns = 1ULL << bucket;
+
+    if (ns < 1000ULL) {
+        sprintf(buf, "%lluns", ns);
+    } else if (ns < 1000000ULL) {
+        sprintf(buf, "%lluus", ns / 1000ULL);
+    } else {
+        sprintf(buf, "%llums", ns / 1000000ULL);
+    }
+
+    return buf;
+}
+
+/* total count in a histogram */
+static unsigned int hist_count(unsigned int *hist)
+{
+    unsigned int count = 0;
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++) { count += hist[i]; }
+
+    return count;
+}
+
+/* the bucket whose upper bound is at or above the given fraction of samples.
+ * (so, the returned bucket's upper bound 2^(bucket+1) bounds the quantile.)
+ */
+static int hist_quantile(unsigned int *hist, unsigned int count, double q)
+{
+    unsigned int so_far = 0;
+    unsigned int want = (unsigned int) (q * count + .5);
+    int i;
+
+    if (want == 0) { want = 1; }
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        so_far += hist[i];
+        if (so_far >= want) { break; }
+    }
+
+    if (i == LAT_BUCKETS) { i = LAT_BUCKETS - 1; }
+
+    return i;
+}
+
+/* the largest non-empty bucket */
+static int hist_max(unsigned int *hist)
+{
+    int i;
+
+    for (i = LAT_BUCKETS - 1; i > 0; i--) {
+        if (hist[i] != 0) { break; }
+    }
+
+    return i;
+}
+
+/* print one line per non-empty (device, stage) histogram:  sample count,
+ * upper bounds for the median, 90th and 99th percentile and max, and the
+ * non-empty buckets as [log2 ns]:count.
+ */
+void latency_print(ddprintf_t *fn, FILE *f)
+{
+    int i, j, k;
+    char b1[16], b2[16], b3[16], b4[16];
+
+    fn(f, "latency histograms%s:\n", db[66].d ? "" : " (db[66] is off)");
+    fn(f, "    dev       stage          n     p50     p90     p99     max\n");
+
+    for (i = 0; i < io_stat_count; i++) {
+        for (j = 0; j < LAT_STAGE_COUNT; j++) {
+            unsigned int *hist = histogram[i][j];
+            unsigned int count = hist_count(hist);
+
+            if (count == 0) { continue; }
+
+            fn(f, "    %-8s  %-9s %7u %7s %7s %7s %7s ",
+                    io_stat[i].device_name, stage_names[j], count,
+                    bucket_sprint(b1, hist_quantile(hist, count, .5) + 1),
+                    bucket_sprint(b2, hist_quantile(hist, count, .9) + 1),
+                    bucket_sprint(b3, hist_quantile(hist, count, .99) + 1),
+                    bucket_sprint(b4, hist_max(hist) + 1));
+
+            for (k = 0; k < LAT_BUCKETS; k++) {
+                if (hist[k] != 0) { fn(f, " [%d]:%u", k, hist[k]); }
+            }
+            fn(f, "\n");
+        }
+    }
+}
+
+/* write the histograms to the cloud status page as an html table */
+void latency_html(FILE *f)
+{
+    int i, j;
+    char b1[16], b2[16], b3[16], b4[16];
+
+    fprintf(f, "<p>\n");
+    fprintf(f, "<h3>\n");
+    fprintf(f, "Packet handling latency\n");
+    fprintf(f, "<br>\n");
+    fprintf(f, "(upper bounds of power-of-two buckets)\n");
+    fprintf(f, "</h3>\n");
+
+    fprintf(f, "<table frame=box rules=all>\n");
+    fprintf(f, "    <tr>\n");
+    fprintf(f, "        <td> device </td> <td> stage </td> <td> count </td> "
+            "<td> p50 </td> <td> p90 </td> <td> p99 </td> <td> max </td>\n");
+    fprintf(f, "    </tr>\n");
+
+    for (i = 0; i < io_stat_count; i++) {
+        for (j = 0; j < LAT_STAGE_COUNT; j++) {
+            unsigned int *hist = histogram[i][j];
+            unsigned int count = hist_count(hist);
+
+            if (count == 0) { continue; }
+
+            fprintf(f, "    <tr>\n");
+            fprintf(f, "        <td> %s </td> <td> %s </td> <td> %u </td> "
+                    "<td> %s </td> <td> %s </td> <td> %s </td> "
+                    "<td> %s </td>\n",
+                    io_stat[i].device_name, stage_names[j], count,
+                    bucket_sprint(b1, hist_quantile(hist, count, .5) + 1),
+                    bucket_sprint(b2, hist_quantile(hist, count, .9) + 1),
+                    bucket_sprint(b3, hist_quantile(hist, count, .99) + 1),
+                    bucket_sprint(b4, hist_max(hist) + 1));
+            fprintf(f, "    </tr>\n");
+        }
+    }
+
+    fprintf(f, "</table>\n");
+}
@@ -0,0 +1,47 @@
+/* latency.h - per-stage, per-device latency histograms for the packet path
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include "util.h"
+
+/* the stages of handling a frame that we time */
+typedef enum {
+    lat_recv,
+    lat_classify,
+    lat_sequence_check,
+    lat_k_for_n,
+    lat_forward,
+    lat_sendto,
+    LAT_STAGE_COUNT,
+} lat_stage_t;
+
+/* bucket i counts durations of [2^i .. 2^(i+1)) nanoseconds
+ * (bucket 0 also gets zero-length durations; the last bucket gets
+ * everything too long to fit elsewhere.)
+ */
+#define LAT_BUCKETS 32
+
+/* monotonic time in nanoseconds; 0 means "not timing" */
+typedef unsigned long long lat_time_t;
+
+extern lat_time_t latency_start(void);
+extern void latency_record(int stat_index, lat_stage_t stage,
+        lat_time_t start);
+extern void latency_clear(int stat_index);
+extern void latency_reset(void);
+extern void latency_print(ddprintf_t *fn, FILE *f);
+extern void latency_html(FILE *f);
+
+#endif
@@ -0,0 +1,286 @@
+/* link_hist.c - per-neighbor history of packets received and lost
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* the counts in perm_io_stat are totals since the box started, which
+ * can't tell a link that was bad for a minute an hour ago from one that
+ * is bad right now.  so, sequence_check() also counts received and lost
+ * packets here, in a ring of LINK_HIST_INTERVAL-second buckets for each
+ * perm_io_stat entry and each traffic class.  the ring covers the last
+ * LINK_HIST_LEN buckets.
+ *
+ * on the maintenance tick, each perm_io_stat entry gets a summary of its
+ * ring in loss_hist[], a few bytes which go out with our stp beacons
+ * along with the rest of the status_t.  so every box can show the recent
+ * history of every link in the cloud.  it also gets its recent delivery
+ * ratio, from which etx.c works out how many tries a packet takes.
+ */
+
+#include <sys/time.h>
+#include <string.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "print.h"
+#include "status.h"
+#include "link_hist.h"
+
+typedef struct {
+    unsigned short received, lost;
+} link_bucket_t;
+
+typedef struct {
+    link_bucket_t bucket[LINK_HIST_LEN][LINK_HIST_CLASSES];
+
+    /* number (time / LINK_HIST_INTERVAL) of the newest bucket; 0 means
+     * the ring is empty
+     */
+    long newest;
+} link_ring_t;
+
+/* indices match those of perm_io_stat */
+static link_ring_t rings[MAX_CLOUD];
+
+static char *class_names[LINK_HIST_CLASSES] = {
+    "cloud",
+    "data",
+    "ping",
+};
+
+/* current bucket number.  this goes through checked_gettimeofday() so
+ * that a journal replays the same history, and so the delivery ratios
+ * and etx worked out from it.
+ */
+static long link_hist_now(void)
+{
+    struct timeval tv;
+
+    if (!checked_gettimeofday(&tv)) { return 0; }
+
+    /* never 0, since that marks an empty ring */
+    return tv.tv_sec / LINK_HIST_INTERVAL + 1;
+}
+
+/* index in the ring of bucket number t (which may be negative when
+ * looking back from soon after boot)
+ */
+static int slot(long t)
+{
+    return (int) (((t % LINK_HIST_LEN) + LINK_HIST_LEN) % LINK_HIST_LEN);
+}
+
+/* move ring's newest bucket up to now, zeroing the buckets in between.
+ * if the clock was set back, start the ring over.
+ */
+static void advance(link_ring_t *ring, long now)
+{
+    long t;
+
+    if (ring->newest == 0 || now < ring->newest
+        || now - ring->newest >= LINK_HIST_LEN)
+    {
+        memset(ring->bucket, 0, sizeof(ring->bucket));
+        ring->newest = now;
+        return;
+    }
+
+    for (t = ring->newest + 1; t <= now; t++) {
+        memset(ring->bucket[slot(t)], 0, sizeof(ring->bucket[slot(t)]));
+    }
+
+    ring->newest = now;
+}
+
+/* add to the current bucket for perm_io_stat entry pind */
+void link_hist_record(int pind, link_hist_class_t class, int received,
+        int lost)
+{
+    link_ring_t *ring;
+    link_bucket_t *b;
+    long now = link_hist_now();
+
+    if (pind < 0 || pind >= MAX_CLOUD) { return; }
+
+    ring = &rings[pind];
+    advance(ring, now);
+
+    b = &ring->bucket[slot(now)][class];
+
+    /* saturate rather than wrap */
+    if (b->received + received > 0xffff) {
+        b->received = 0xffff;
+    } else {
+        b->received += received;
+    }
+
+    if (b->lost + lost > 0xffff) {
+        b->lost = 0xffff;
+    } else {
+        b->lost += lost;
+    }
+}
+
+/* total the buckets "from" through "to" seconds ago (inclusive) in ring,
+ * for one class or (if class is LINK_HIST_CLASSES) for all of them.
+ */
+static void total(link_ring_t *ring, int from, int to, int class,
+        int *received, int *lost)
+{
+    int i, c;
+
+    *received = *lost = 0;
+
+    if (ring->newest == 0) { return; }
+
+    for (i = from; i <= to && i < LINK_HIST_LEN; i++) {
+        link_bucket_t *b = ring->bucket[slot(ring->newest - i)];
+
+        for (c = 0; c < LINK_HIST_CLASSES; c++) {
+            if (class != LINK_HIST_CLASSES && c != class) { continue; }
+            *received += b[c].received;
+            *lost += b[c].lost;
+        }
+    }
+}
+
+/* encode a loss rate in one byte for the beacon */
+static byte encode_loss(int received, int lost)
+{
+    double pct;
+
+    if (received + lost == 0) { return LINK_HIST_NO_DATA; }
+
+    pct = 100. * lost / (received + lost);
+
+    return (byte) (pct / LINK_HIST_SCALE + .5);
+}
+
+/* percent of the ping and data packets in the last LINK_HIST_DELIVERY_SECS
+ * of ring that got to us
+ */
+static byte delivery(link_ring_t *ring)
+{
+    int received, lost, r, l;
+    int secs = LINK_HIST_DELIVERY_SECS / LINK_HIST_INTERVAL;
+
+    total(ring, 0, secs - 1, link_hist_data, &received, &lost);
+    total(ring, 0, secs - 1, link_hist_ping, &r, &l);
+    received += r;
+    lost += l;
+
+    if (received + lost == 0) { return LINK_HIST_NO_DATA; }
+
+    return (byte) ((100 * received + (received + lost) / 2)
+            / (received + lost));
+}
+
+/* percent of every kind of packet from perm_io_stat entry pind, cloud
+ * messages included, in the last LINK_HIST_DELIVERY_SECS that got to us
+ */
+byte link_hist_delivery(int pind)
+{
+    int received, lost;
+    int secs = LINK_HIST_DELIVERY_SECS / LINK_HIST_INTERVAL;
+
+    if (pind < 0 || pind >= MAX_CLOUD) { return LINK_HIST_NO_DATA; }
+
+    advance(&rings[pind], link_hist_now());
+    total(&rings[pind], 0, secs - 1, LINK_HIST_CLASSES, &received, &lost);
+
+    if (received + lost == 0) { return LINK_HIST_NO_DATA; }
+
+    return (byte) ((100 * received + (received + lost) / 2)
+            / (received + lost));
+}
+
+/* bring every ring up to date, and put its summary into perm_io_stat */
+void link_hist_update_summaries(void)
+{
+    long now = link_hist_now();
+    int slice = LINK_HIST_LEN / LINK_HIST_SUMMARY;
+    int i, j;
+
+    for (i = 0; i < perm_io_stat_count; i++) {
+        advance(&rings[i], now);
+
+        perm_io_stat[i].delivery = delivery(&rings[i]);
+
+        for (j = 0; j < LINK_HIST_SUMMARY; j++) {
+            int received, lost;
+            int newest_ago = (LINK_HIST_SUMMARY - 1 - j) * slice;
+
+            total(&rings[i], newest_ago, newest_ago + slice - 1,
+                    LINK_HIST_CLASSES, &received, &lost);
+
+            perm_io_stat[i].loss_hist[j] = encode_loss(received, lost);
+        }
+    }
+}
+
+/* print a loss_hist[] summary into buf, e.g. "0 0 12.5 - 1" */
+char *link_hist_summary_sprint(char *buf, byte *summary)
+{
+    char *p = buf;
+    int i;
+
+    *p = '\0';
+
+    for (i = 0; i < LINK_HIST_SUMMARY; i++) {
+        if (i > 0) { *p++ = ' '; }
+
+        if (summary[i] == LINK_HIST_NO_DATA) {
+            p += sprintf(p, "-");
+        } else {
+            p += sprintf(p, "%g", summary[i] * LINK_HIST_SCALE);
+        }
+    }
+
+    return buf;
+}
+
+/* print received/lost for the last 10 seconds, minute, and whole history
+ * for each neighbor and class.
+ */
+void link_hist_print(ddprintf_t *fn, FILE *f)
+{
+    int windows[] = {10, 60, LINK_HIST_LEN};
+    char mac_address[32];
+    char summary[64];
+    int i, j, k;
+
+    link_hist_update_summaries();
+
+    fn(f, "link history (received/lost over the last %ds, %ds, %ds):\n",
+            windows[0] * LINK_HIST_INTERVAL, windows[1] * LINK_HIST_INTERVAL,
+            windows[2] * LINK_HIST_INTERVAL);
+
+    for (i = 0; i < perm_io_stat_count; i++) {
+        mac_sprintf(mac_address, perm_io_stat[i].name);
+
+        fn(f, "    %s  loss %% by %ds slice:  %s\n", mac_address,
+                LINK_HIST_LEN * LINK_HIST_INTERVAL / LINK_HIST_SUMMARY,
+                link_hist_summary_sprint(summary, perm_io_stat[i].loss_hist));
+
+        for (j = 0; j < LINK_HIST_CLASSES; j++) {
+            fn(f, "        %-6s", class_names[j]);
+
+            for (k = 0; k < 3; k++) {
+                int received, lost;
+                total(&rings[i], 0, windows[k] - 1, j, &received, &lost);
+                fn(f, " %8d/%-6d", received, lost);
+            }
+            fn(f, "\n");
+        }
+    }
+}
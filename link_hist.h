@@ -0,0 +1,52 @@
+/* link_hist.h - per-neighbor history of packets received and lost
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef LINK_HIST_H
+#define LINK_HIST_H
+
+#include <stdio.h>
+#include "util.h"
+
+/* the kinds of sequence-numbered traffic that sequence_check() counts */
+typedef enum {
+    link_hist_cloud,
+    link_hist_data,
+    link_hist_ping,
+    LINK_HIST_CLASSES,
+} link_hist_class_t;
+
+/* seconds per bucket, and number of buckets kept (ten minutes) */
+#define LINK_HIST_INTERVAL 1
+#define LINK_HIST_LEN 600
+
+/* the compact form sent in stp beacons (status_t.loss_hist):  loss rate
+ * over LINK_HIST_SUMMARY equal slices of the history, oldest first, in
+ * units of LINK_HIST_SCALE percent.  LINK_HIST_NO_DATA means nothing was
+ * received or lost in that slice.
+ */
+#define LINK_HIST_SUMMARY 5
+#define LINK_HIST_SCALE .5
+#define LINK_HIST_NO_DATA 255
+
+/* status_t.delivery is the percent of ping and data packets received
+ * over the last LINK_HIST_DELIVERY_SECS, or LINK_HIST_NO_DATA
+ */
+#define LINK_HIST_DELIVERY_SECS 60
+
+extern void link_hist_record(int pind, link_hist_class_t class,
+        int received, int lost);
+extern void link_hist_update_summaries(void);
+extern byte link_hist_delivery(int pind);
+extern char *link_hist_summary_sprint(char *buf, byte *summary);
+extern void link_hist_print(ddprintf_t *fn, FILE *f);
+
+#endif
@@ -16,8 +16,8 @@ static const char Version[] = "Version "
 /* a tiny program to monitor activity on an interface.
  * sorta like tcpdump or tethereal, but very small for embedded applications.
  *
- * this program is usable generically and is not specific to the
- * cloud_hub project.
+ * this program is usable generically; the only cloud_hub-specific part is
+ * the decoding of cloud_hub's own frames with -d.
  *
  * can be run in batch mode or interactive mode, and can monitor up to two
  * interfaces.
@@ -25,17 +25,51 @@ static const char Version[] = "Version "
  * example batch invocation that prints all packets on eth0:
  *     ll_dump -e eth0 -p
  *
+ * example that captures everything on wds0.1 at full speed into 16 megabyte
+ * pcapng files, keeping the last 8, for wireshark:
+ *     ll_dump -e wds0.1 -r -w /tmp/wds.pcapng -N -C 16 -W 8
+ *
+ * frames are filtered in the kernel, by the program given with -F or, if
+ * there isn't one, by one built from the -X protocols.  -F takes what
+ * "tcpdump -ddd" prints (a count, then "code jt jf k" for each instruction),
+ * separated by newlines or commas, either inline or in a file.  for example,
+ * only cloud_hub frames:
+ *     ll_dump -e wlan0 -d -F "5,40 0 0 12,53 0 2 10627,37 1 0 10630,6 0 0 65535,6 0 0 0"
+ *
+ * with -r, frames come through a TPACKET_V3 ring shared with the kernel
+ * instead of a recvfrom() each.  the ring (-B) is the only buffering; if
+ * ll_dump can't keep up, the kernel drops frames and counts them, and the
+ * count is printed at exit.  if the kernel or its headers are too old for
+ * TPACKET_V3 (as on the wrt54g), -r falls back to recvfrom().
+ *
  * command line arguments:
  *
  *  -i:  interactive
  *  -p:  print packets (by default, just print counts of packets)
+ *  -d:  decode cloud_hub frames, one line each (others get one line too)
  *  -a:  use promiscuous mode even if only looking for one protocol type
  *       (without this, only see packets with our mac address as destination)
  *  -l:  limit length of packets read (normally, read and print whole packet)
  *  -X:  exclude a protocol type.  can have multiple instances of this arg.
  *  -P:  only print packets of this protocol type.
+ *  -F:  bpf filter program, inline or in a file
  *  -e:  first interface to read
  *  -E:  second interface to read
+ *  -r:  read through a TPACKET_V3 ring
+ *  -B:  ring size per interface, in kilobytes (default 1024)
+ *  -w:  write frames to this pcap file (no per-packet counts unless -p
+ *       or -d)
+ *  -N:  with -w, write pcapng; frames from both interfaces go to one file,
+ *       and with -d, each gets its decoding as a comment
+ *  -C:  with -w, start a new file after this many megabytes
+ *  -G:  with -w, start a new file after this many seconds
+ *  -W:  with -C or -G, keep at most this many files, reusing the names
+ *  -f:  read frames from this pcap or pcapng file instead of an interface;
+ *       with -d, a frame's pcapng comment (merge_cloud -x puts the verdict
+ *       there) is printed before its decoding
+ *  -c:  stop after this many packets
+ *  -S:  at exit, print frame and byte counts by protocol and cloud message
+ *       type
  *
  * in interactive mode, commands:
  *  y:  start reading packets
@@ -48,14 +82,19 @@ static const char Version[] = "Version "
 
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <features.h>    /* for the glibc version number */
 #include <asm/types.h>
 #include <sys/types.h>
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>   /* The L2 protocols */
+#include <linux/filter.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
@@ -63,24 +102,58 @@ static const char Version[] = "Version "
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "util.h"
+#include "mac.h"
+#include "cloud.h"
+#include "com_util.h"
+#include "pcap_file.h"
+
+/* TPACKET_V3 needs linux 3.2 or later */
+#if !defined(WRT54G) && defined(TPACKET3_HDRLEN)
+#define LL_DUMP_RING
+#endif
 
 #define MAX_DEBUG 10
 static bool_t debug[MAX_DEBUG];
 
-static struct ifreq get_index;
-static int dev1_socket, dev2_socket = -1, max_socket;
 #define BUF_LEN 10000
 static char buf[BUF_LEN];
-static struct ethhdr *eth_header = (struct ethhdr *) buf;
 static int read_len = BUF_LEN;
 
-static char *dev1_name = NULL;
-static char *dev2_name = NULL;
-
-static int dev1_ifindex;
-static int dev2_ifindex;
+/* a TPACKET_V3 receive ring:  block_count blocks that the kernel fills
+ * and hands to us, and we hand back when we've read every frame in them.
+ */
+typedef struct {
+    byte *map;
+    int block_size, block_count;
+
+    /* the block we are reading, whether we have it from the kernel, and
+     * where we are in it
+     */
+    int block;
+    bool_t held;
+    struct tpacket3_hdr *pkt;
+    int pkts_left;
+} ring_t;
+
+/* an interface we are monitoring */
+typedef struct {
+    char *name;
+    int socket;
+    int ifindex;
+    bool_t use_ring;
+    ring_t ring;
+
+    /* from PACKET_STATISTICS, which resets on every read */
+    unsigned long long kernel_packets, kernel_drops;
+} capture_dev_t;
+
+#define MAX_DEV 2
+static capture_dev_t devs[MAX_DEV];
+static int dev_count = 0;
+static int max_socket;
 
 /* by default, look at all message types
  * if this gets changed via command-line argument, we will only see
@@ -94,56 +167,771 @@ static int exclude_protocols[MAX_EXCL];
 static int exclude_protocols_count = 0;
 static bool_t promiscuous = false;
 
+/* the -F program; if there isn't one, the -X exclusions become one */
+#define MAX_BPF 512
+static struct sock_filter user_filter[MAX_BPF];
+static int user_filter_len = 0;
+
+static bool_t use_ring = false;
+static int ring_kbytes = 1024;
+
+/* -w output file */
+static char *out_fname = NULL;
+static bool_t out_pcapng = false;
+static pcap_file_t out;
+
+static bool_t decode = false;
+static bool_t summarize = false;
+static volatile bool_t got_stop = false;
+
+/* one line of -S summary:  frames and bytes for a protocol, or for a
+ * message type within a cloud_hub protocol
+ */
+typedef struct {
+    int proto;
+    int type;
+    unsigned long long frames, bytes;
+} summary_t;
+
+#define MAX_SUMMARY 128
+static summary_t summary[MAX_SUMMARY];
+static int summary_count = 0;
+
+static char *cloud_msg_names[MESSAGE_TYPE_COUNT] = {
+    [unknown_msg] = "unknown_msg",
+    [local_lock_grant_msg] = "local_lock_grant_msg",
+    [local_lock_deny_msg] = "local_lock_deny_msg",
+    [local_delete_release_msg] = "local_delete_release_msg",
+    [local_add_release_msg] = "local_add_release_msg",
+    [local_lock_release_msg] = "local_lock_release_msg",
+    [stp_beacon_msg] = "stp_beacon_msg",
+    [stp_beacon_recv_msg] = "stp_beacon_recv_msg",
+    [nonlocal_lock_req_msg] = "nonlocal_lock_req_msg",
+    [nonlocal_lock_grant_msg] = "nonlocal_lock_grant_msg",
+    [nonlocal_lock_deny_msg] = "nonlocal_lock_deny_msg",
+    [nonlocal_delete_release_msg] = "nonlocal_delete_release_msg",
+    [nonlocal_add_release_msg] = "nonlocal_add_release_msg",
+    [ping_msg] = "ping_msg",
+    [ping_response_msg] = "ping_response_msg",
+    [local_lock_req_new_msg] = "local_lock_req_new_msg",
+    [local_lock_req_old_msg] = "local_lock_req_old_msg",
+    [stp_arc_delete_msg] = "stp_arc_delete_msg",
+    [sequence_msg] = "sequence_msg",
+    [ack_sequence_msg] = "ack_sequence_msg",
+    [local_stp_add_request_msg] = "local_stp_add_request_msg",
+    [local_stp_added_msg] = "local_stp_added_msg",
+    [local_stp_add_changed_request_msg] = "local_stp_add_changed_request_msg",
+    [local_stp_added_changed_msg] = "local_stp_added_changed_msg",
+    [local_stp_delete_request_msg] = "local_stp_delete_request_msg",
+    [local_stp_deleted_msg] = "local_stp_deleted_msg",
+    [local_stp_refused_msg] = "local_stp_refused_msg",
+    [stp_beacon_nak_msg] = "stp_beacon_nak_msg",
+    [ad_hoc_bcast_block_msg] = "ad_hoc_bcast_block_msg",
+    [ad_hoc_bcast_unblock_msg] = "ad_hoc_bcast_unblock_msg",
+    [scanresults_msg] = "scanresults_msg",
+    [parm_change_start_msg] = "parm_change_start_msg",
+    [parm_change_ready_msg] = "parm_change_ready_msg",
+    [parm_change_not_ready_msg] = "parm_change_not_ready_msg",
+    [parm_change_go_msg] = "parm_change_go_msg",
+    [dist_data_msg] = "dist_data_msg",
+    [dist_end_msg] = "dist_end_msg",
+    [dist_status_msg] = "dist_status_msg",
+    [stp_hello_msg] = "stp_hello_msg",
+    [ad_hoc_bcast_hint_msg] = "ad_hoc_bcast_hint_msg",
+};
+
+static char *ll_shell_msg_names[] = {
+    [shell_cmd_msg] = "shell_cmd_msg",
+    [shell_response_msg] = "shell_response_msg",
+    [put_name_msg] = "put_name_msg",
+    [get_name_msg] = "get_name_msg",
+    [transfer_cont_msg] = "transfer_cont_msg",
+    [transfer_end_msg] = "transfer_end_msg",
+    [recv_ok_msg] = "recv_ok_msg",
+    [recv_err_msg] = "recv_err_msg",
+    [recv_err_stop_msg] = "recv_err_stop_msg",
+    [start_shell_msg] = "start_shell_msg",
+    [no_op_msg_msg] = "no_op_msg_msg",
+    [window_start_msg] = "window_start_msg",
+    [window_data_msg] = "window_data_msg",
+    [window_ack_msg] = "window_ack_msg",
+    [window_end_msg] = "window_end_msg",
+    [window_done_msg] = "window_done_msg",
+    [window_get_msg] = "window_get_msg",
+};
+
+#define LL_SHELL_MSG_TYPE_COUNT \
+    ((int) (sizeof(ll_shell_msg_names) / sizeof(ll_shell_msg_names[0])))
+
+/* the front of com_util.c's message_t, which isn't in a header */
+typedef struct {
+    struct ethhdr eth_header;
+    msg_type_t msg_type;
+    int msg_body_len;
+} ll_shell_header_t;
+
+static void stop_handler(int sig)
+{
+    got_stop = true;
+}
+
+/* does a frame of length len hold all of field "f" of struct type "t"? */
+#define HAS_FIELD(len, t, f) \
+    ((len) >= (int) (offsetof(t, f) + sizeof(((t *) 0)->f)))
+
+static char *cloud_msg_name(int type)
+{
+    if (type < 0 || type >= MESSAGE_TYPE_COUNT
+        || cloud_msg_names[type] == NULL)
+    {
+        return "unknown_msg";
+    }
+
+    return cloud_msg_names[type];
+}
+
+static char *ll_shell_msg_name(int type)
+{
+    if (type < 0 || type >= LL_SHELL_MSG_TYPE_COUNT) { return "unknown_msg"; }
+
+    return ll_shell_msg_names[type];
+}
+
+/* append to a decoding in progress */
+static void add(char *s, int size, const char *fmt, ...)
+{
+    int len = strlen(s);
+    va_list ap;
+
+    if (len >= size - 1) { return; }
+
+    va_start(ap, fmt);
+    vsnprintf(s + len, size - len, fmt, ap);
+    va_end(ap);
+}
+
+/* the message-specific part of a CLOUD_MSG frame */
+static void decode_cloud_msg(char *s, int size, message_t *m, int len)
+{
+    switch (m->message_type) {
+
+    case stp_beacon_msg :
+    case stp_beacon_recv_msg :
+    case stp_beacon_nak_msg :
+        if (!HAS_FIELD(len, message_t, v.stp_beacon.status_count)) { break; }
+        add(s, size, " originator %s weakest %d status %d",
+                mac_sprintf(mac_buf3, m->v.stp_beacon.originator),
+                m->v.stp_beacon.weakest_stp_link,
+                m->v.stp_beacon.status_count);
+        if (m->v.stp_beacon.tweak_db != 0) {
+            add(s, size, " tweak_db %d", m->v.stp_beacon.tweak_db);
+        }
+        break;
+
+    case local_lock_grant_msg :
+    case local_lock_deny_msg :
+    case local_delete_release_msg :
+    case local_add_release_msg :
+    case local_lock_release_msg :
+    case nonlocal_lock_req_msg :
+    case nonlocal_lock_grant_msg :
+    case nonlocal_lock_deny_msg :
+    case nonlocal_delete_release_msg :
+    case nonlocal_add_release_msg :
+    case local_lock_req_new_msg :
+    case local_lock_req_old_msg :
+    case stp_arc_delete_msg :
+    case local_stp_add_request_msg :
+    case local_stp_added_msg :
+    case local_stp_add_changed_request_msg :
+    case local_stp_added_changed_msg :
+    case local_stp_delete_request_msg :
+    case local_stp_deleted_msg :
+    case local_stp_refused_msg :
+        if (!HAS_FIELD(len, message_t, v.lock_message.node_2)) { break; }
+        add(s, size, " originator %s",
+                mac_sprintf(mac_buf3, m->v.lock_message.originator));
+        add(s, size, " arc %s",
+                mac_sprintf(mac_buf3, m->v.lock_message.node_1));
+        add(s, size, "-%s",
+                mac_sprintf(mac_buf3, m->v.lock_message.node_2));
+        break;
+
+    case sequence_msg :
+    case ack_sequence_msg :
+        if (!HAS_FIELD(len, message_t, v.seq.message_len)) { break; }
+        add(s, size, " seq %d len %d", m->v.seq.sequence_num,
+                m->v.seq.message_len);
+        break;
+
+    case scanresults_msg :
+        if (!HAS_FIELD(len, message_t, v.scan.count)) { break; }
+        add(s, size, " scan count %d", m->v.scan.count);
+        break;
+
+    case dist_data_msg :
+    case dist_end_msg :
+    case dist_status_msg :
+        if (!HAS_FIELD(len, message_t, v.dist.name)) { break; }
+        add(s, size, " originator %s id %08x %s",
+                mac_sprintf(mac_buf3, m->v.dist.originator),
+                m->v.dist.id, m->v.dist.flood ? "flood" : "unicast");
+        if (m->message_type == dist_data_msg) {
+            add(s, size, " chunk %d/%d len %d", m->v.dist.chunk,
+                    m->v.dist.chunks, m->v.dist.len);
+        } else if (m->message_type == dist_end_msg) {
+            add(s, size, " round %d", m->v.dist.chunk);
+        } else {
+            add(s, size, " missing %d%s", m->v.dist.chunk,
+                    m->v.dist.done ? " done" : "");
+        }
+        break;
+
+    case stp_hello_msg :
+        if (!HAS_FIELD(len, message_t, v.hello.interval)) { break; }
+        add(s, size, " state %d mult %d interval %d", m->v.hello.state,
+                m->v.hello.detect_mult, m->v.hello.interval);
+        break;
+
+    default :
+        break;
+    }
+}
+
+/* a one-line description of a frame, into s */
+static void decode_frame(char *s, int size, byte *frame, int len)
+{
+    message_t *m = (message_t *) frame;
+    int proto;
+
+    s[0] = '\0';
+
+    if (len < (int) sizeof(struct ethhdr)) {
+        add(s, size, "runt frame, %d bytes", len);
+        return;
+    }
+
+    proto = ntohs(m->eth_header.h_proto);
+    add(s, size, "%s > ", mac_sprintf(mac_buf1, m->eth_header.h_source));
+    add(s, size, "%s ", mac_sprintf(mac_buf2, m->eth_header.h_dest));
+
+    switch (proto) {
+
+    case CLOUD_MSG :
+        if (!HAS_FIELD(len, message_t, message_type)) { break; }
+        add(s, size, "cloud %s seq %u dest %s",
+                cloud_msg_name(m->message_type), m->sequence_num,
+                mac_sprintf(mac_buf3, m->dest));
+        decode_cloud_msg(s, size, m, len);
+        break;
+
+    case ETH_BCN_MSG :
+        /* eth_util.c sends the lan mac address, then the wlan one */
+        if (len < (int) sizeof(struct ethhdr) + 12) { break; }
+        add(s, size, "eth_beacon eth %s",
+                mac_sprintf(mac_buf3, frame + sizeof(struct ethhdr)));
+        add(s, size, " wlan %s",
+                mac_sprintf(mac_buf3, frame + sizeof(struct ethhdr) + 6));
+        break;
+
+    case LL_SHELL_MSG : {
+        ll_shell_header_t *h = (ll_shell_header_t *) frame;
+        if (!HAS_FIELD(len, ll_shell_header_t, msg_body_len)) { break; }
+        add(s, size, "ll_shell %s body %d", ll_shell_msg_name(h->msg_type),
+                h->msg_body_len);
+        break;
+    }
+
+    case WRAPPED_CLIENT_MSG : {
+        struct ethhdr *client;
+
+        if (!HAS_FIELD(len, message_t, v.msg.originator_sequence_num)) {
+            break;
+        }
+        add(s, size, "wrapped seq %u dest %s", m->sequence_num,
+                mac_sprintf(mac_buf3, m->dest));
+        add(s, size, " part %d/%d originator %s seq %u", m->v.msg.k,
+                m->v.msg.n, mac_sprintf(mac_buf3, m->v.msg.originator),
+                m->v.msg.originator_sequence_num);
+        if (!mac_equal(m->dest, mac_address_zero)) {
+            add(s, size, " hops %d", m->v.msg.hops);
+        }
+
+        client = (struct ethhdr *) m->v.msg.msg_body;
+        if (len < (int) (offsetof(message_t, v.msg.msg_body)
+            + sizeof(struct ethhdr)))
+        {
+            break;
+        }
+        add(s, size, "; client %s",
+                mac_sprintf(mac_buf3, client->h_source));
+        add(s, size, " > %s proto %04x",
+                mac_sprintf(mac_buf3, client->h_dest),
+                ntohs(client->h_proto));
+        break;
+    }
+
+    default :
+        add(s, size, "proto %04x", proto);
+        break;
+    }
+
+    add(s, size, ", %d bytes", len);
+}
+
+/* count a frame for -S */
+static void summary_add(int proto, int type, int len)
+{
+    int i;
+
+    for (i = 0; i < summary_count; i++) {
+        if (summary[i].proto == proto && summary[i].type == type) { break; }
+    }
+
+    if (i == summary_count) {
+        if (summary_count >= MAX_SUMMARY) { return; }
+        summary[i].proto = proto;
+        summary[i].type = type;
+        summary[i].frames = summary[i].bytes = 0;
+        summary_count++;
+    }
+
+    summary[i].frames++;
+    summary[i].bytes += len;
+}
+
+static void summary_frame(byte *frame, int len)
+{
+    struct ethhdr *eth = (struct ethhdr *) frame;
+    int proto;
+
+    if (len < (int) sizeof(struct ethhdr)) {
+        summary_add(-1, -1, len);
+        return;
+    }
+
+    proto = ntohs(eth->h_proto);
+    summary_add(proto, -1, len);
+
+    if (proto == CLOUD_MSG && HAS_FIELD(len, message_t, message_type)) {
+        summary_add(proto, ((message_t *) frame)->message_type, len);
+
+    } else if (proto == LL_SHELL_MSG
+        && HAS_FIELD(len, ll_shell_header_t, msg_type))
+    {
+        summary_add(proto, ((ll_shell_header_t *) frame)->msg_type, len);
+    }
+}
+
+static int summary_cmp(const void *a, const void *b)
+{
+    const summary_t *x = a, *y = b;
+
+    if (x->proto != y->proto) { return x->proto - y->proto; }
+
+    return x->type - y->type;
+}
+
+static void print_summary(void)
+{
+    int i;
+
+    qsort(summary, summary_count, sizeof(summary[0]), summary_cmp);
+
+    fprintf(stderr, "%-40s %12s %14s\n", "protocol", "frames", "bytes");
+
+    for (i = 0; i < summary_count; i++) {
+        summary_t *p = &summary[i];
+        char name[64];
+
+        if (p->proto == -1) {
+            sprintf(name, "runt");
+        } else if (p->type == -1) {
+            sprintf(name, "%04x", p->proto);
+        } else if (p->proto == CLOUD_MSG) {
+            sprintf(name, "    %s", cloud_msg_name(p->type));
+        } else {
+            sprintf(name, "    %s", ll_shell_msg_name(p->type));
+        }
+
+        fprintf(stderr, "%-40s %12llu %14llu\n", name, p->frames, p->bytes);
+    }
+}
+
+/* parse a bpf program in "tcpdump -ddd" form into user_filter[] */
+static void parse_filter(char *arg)
+{
+    static char text[MAX_BPF * 32];
+    char *p;
+    int count, i, n;
+
+    if (file_exists(arg)) {
+        FILE *f = fopen(arg, "r");
+        if (f == NULL) {
+            fprintf(stderr, "can't open filter file '%s'\n", arg);
+            exit(1);
+        }
+        n = fread(text, 1, sizeof(text) - 1, f);
+        text[n] = '\0';
+        fclose(f);
+    } else {
+        copy_string(text, arg, sizeof(text));
+    }
+
+    for (p = text; *p != '\0'; p++) {
+        if (*p == ',') { *p = ' '; }
+    }
+
+    p = text;
+    if (sscanf(p, "%d%n", &count, &n) != 1 || count <= 0 || count > MAX_BPF) {
+        fprintf(stderr, "invalid filter; it should start with an "
+                "instruction count\n");
+        exit(1);
+    }
+    p += n;
+
+    for (i = 0; i < count; i++) {
+        unsigned int code, jt, jf, k;
+
+        if (sscanf(p, "%u %u %u %u%n", &code, &jt, &jf, &k, &n) != 4) {
+            fprintf(stderr, "invalid filter; instruction %d of %d is "
+                    "missing or not \"code jt jf k\"\n", i + 1, count);
+            exit(1);
+        }
+        p += n;
+
+        user_filter[i].code = code;
+        user_filter[i].jt = jt;
+        user_filter[i].jf = jf;
+        user_filter[i].k = k;
+    }
+
+    user_filter_len = count;
+}
+
+/* give the -F program, or one for the -X exclusions, to the kernel.  the
+ * -X program keeps read_len bytes of each frame it passes.
+ */
+static void attach_filter(capture_dev_t *dev)
+{
+    struct sock_filter excl[MAX_EXCL + 3];
+    struct sock_fprog prog;
+    int i, n = exclude_protocols_count;
+
+    if (user_filter_len > 0) {
+        prog.len = user_filter_len;
+        prog.filter = user_filter;
+
+    } else if (n > 0) {
+        /* ldh [12]; jeq #proto, drop (one for each); ret #read_len;
+         * drop: ret #0
+         */
+        excl[0] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12);
+        for (i = 0; i < n; i++) {
+            excl[i + 1] = (struct sock_filter) BPF_JUMP(
+                    BPF_JMP | BPF_JEQ | BPF_K, exclude_protocols[i],
+                    n - i, 0);
+        }
+        excl[n + 1] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, read_len);
+        excl[n + 2] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+        prog.len = n + 3;
+        prog.filter = excl;
+
+    } else {
+        /* nothing to filter; fails harmlessly if there was no filter */
+        setsockopt(dev->socket, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+        return;
+    }
+
+    if (setsockopt(dev->socket, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+            sizeof(prog)) == -1)
+    {
+        fprintf(stderr, "could not attach filter to %s:  %s\n", dev->name,
+                strerror(errno));
+        exit(1);
+    }
+}
+
+#ifdef LL_DUMP_RING
+
+/* set up a TPACKET_V3 receive ring of about ring_kbytes on dev.  if the
+ * kernel won't give us one, leave dev to recvfrom().
+ */
+static void setup_ring(capture_dev_t *dev)
+{
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+    ring_t *ring = &dev->ring;
+
+    if (setsockopt(dev->socket, SOL_PACKET, PACKET_VERSION, &version,
+            sizeof(version)) == -1)
+    {
+        fprintf(stderr, "%s:  no TPACKET_V3 (%s); using recvfrom()\n",
+                dev->name, strerror(errno));
+        return;
+    }
+
+    /* blocks big enough to hold a few jumbo frames.  the kernel hands a
+     * block over when it is full, or after tp_retire_blk_tov msecs.
+     */
+    ring->block_size = 64 * 1024;
+    ring->block_count = ring_kbytes / 64;
+    if (ring->block_count < 2) { ring->block_count = 2; }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = ring->block_size;
+    req.tp_block_nr = ring->block_count;
+    req.tp_frame_size = 2048;
+    req.tp_frame_nr = ring->block_size / req.tp_frame_size * ring->block_count;
+    req.tp_retire_blk_tov = 50;
+
+    if (setsockopt(dev->socket, SOL_PACKET, PACKET_RX_RING, &req,
+            sizeof(req)) == -1)
+    {
+        fprintf(stderr, "%s:  PACKET_RX_RING failed (%s); using "
+                "recvfrom()\n", dev->name, strerror(errno));
+        return;
+    }
+
+    ring->map = mmap(NULL, ring->block_size * ring->block_count,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, dev->socket, 0);
+    if (ring->map == MAP_FAILED) {
+        /* MAP_LOCKED can fail for want of RLIMIT_MEMLOCK; do without */
+        ring->map = mmap(NULL, ring->block_size * ring->block_count,
+                PROT_READ | PROT_WRITE, MAP_SHARED, dev->socket, 0);
+    }
+    if (ring->map == MAP_FAILED) {
+        fprintf(stderr, "%s:  could not map ring (%s)\n", dev->name,
+                strerror(errno));
+        exit(1);
+    }
+
+    ring->block = 0;
+    ring->held = false;
+    ring->pkt = NULL;
+    ring->pkts_left = 0;
+    dev->use_ring = true;
+}
+
+/* the next frame in the ring, or NULL if the kernel hasn't given us one */
+static struct tpacket3_hdr *ring_next(ring_t *ring)
+{
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *hdr;
+
+    while (ring->pkts_left == 0) {
+        bd = (struct tpacket_block_desc *)
+                (ring->map + ring->block * ring->block_size);
+
+        if (ring->held) {
+            /* done with this block; hand it back to the kernel */
+            __sync_synchronize();
+            bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+            ring->held = false;
+            ring->block = (ring->block + 1) % ring->block_count;
+            continue;
+        }
+
+        if (!(bd->hdr.bh1.block_status & TP_STATUS_USER)) { return NULL; }
+        __sync_synchronize();
+
+        ring->held = true;
+        ring->pkts_left = bd->hdr.bh1.num_pkts;
+        ring->pkt = (struct tpacket3_hdr *)
+                ((byte *) bd + bd->hdr.bh1.offset_to_first_pkt);
+    }
+
+    hdr = ring->pkt;
+    ring->pkts_left--;
+    ring->pkt = (struct tpacket3_hdr *) ((byte *) hdr + hdr->tp_next_offset);
+
+    return hdr;
+}
+
+#else
+
+static void setup_ring(capture_dev_t *dev)
+{
+    fprintf(stderr, "%s:  no TPACKET_V3 in this build; using recvfrom()\n",
+            dev->name);
+}
+
+#endif // LL_DUMP_RING
+
+/* pick up the kernel's received and dropped counts for dev */
+static void update_kernel_stats(capture_dev_t *dev)
+{
+#ifdef LL_DUMP_RING
+    struct tpacket_stats_v3 stats;
+#else
+    struct tpacket_stats stats;
+#endif
+    socklen_t len = sizeof(stats);
+
+    memset(&stats, 0, sizeof(stats));
+    if (getsockopt(dev->socket, SOL_PACKET, PACKET_STATISTICS, &stats, &len)
+        == 0)
+    {
+        dev->kernel_packets += stats.tp_packets;
+        dev->kernel_drops += stats.tp_drops;
+    }
+}
+
 /* open the interface "dev_name" (i.e., eth0 etc.) for message monitoring.
  */
-static void setup_interface(char *dev_name, int *dev_socket, int *dev_ifindex,
-    int protocol)
+static void setup_interface(char *dev_name, int protocol)
 {
+    capture_dev_t *dev = &devs[dev_count++];
+    struct ifreq get_index;
     int result;
     struct sockaddr_ll bind_arg;
     struct packet_mreq mreq;
 
+    memset(dev, 0, sizeof(*dev));
+    dev->name = dev_name;
+
     fprintf(stderr, "setup_interface(%s)..\n", dev_name);
-    *dev_socket = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-    fprintf(stderr, "socket result %d\n", *dev_socket);
 
-    sprintf(get_index.ifr_name, dev_name);
-    result  = ioctl(*dev_socket, SIOCGIFINDEX, &get_index);
+    /* protocol 0 receives nothing until the bind, so the filter and ring
+     * are in place before the first frame arrives
+     */
+    dev->socket = socket(PF_PACKET, SOCK_RAW, 0);
+    fprintf(stderr, "socket result %d\n", dev->socket);
+    if (dev->socket == -1) {
+        perror("socket");
+        exit(1);
+    }
+
+    memset(&get_index, 0, sizeof(get_index));
+    copy_string(get_index.ifr_name, dev_name, IFNAMSIZ);
+    result  = ioctl(dev->socket, SIOCGIFINDEX, &get_index);
     fprintf(stderr, "ioctl result %d, ifindex %d\n", result,
             get_index.ifr_ifindex);
-    *dev_ifindex = get_index.ifr_ifindex;
+    dev->ifindex = get_index.ifr_ifindex;
+
+    attach_filter(dev);
+    if (use_ring) { setup_ring(dev); }
 
     memset(&bind_arg, 0, sizeof(bind_arg));
     bind_arg.sll_family = AF_PACKET;
     bind_arg.sll_ifindex = get_index.ifr_ifindex;
     bind_arg.sll_protocol = htons(protocol);
 
-    result = bind(*dev_socket, (struct sockaddr *) &bind_arg, sizeof(bind_arg));
+    result = bind(dev->socket, (struct sockaddr *) &bind_arg, sizeof(bind_arg));
     fprintf(stderr, "bind result %d; errno %d\n", result, errno);
     perror("bind xxx ");
 
     if (protocol == ETH_P_ALL || promiscuous) {
         memset(&mreq, 0, sizeof(mreq));
-        mreq.mr_ifindex = *dev_ifindex;
+        mreq.mr_ifindex = dev->ifindex;
         mreq.mr_type = PACKET_MR_PROMISC;
-        result = setsockopt(dev1_socket, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+        result = setsockopt(dev->socket, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
                 &mreq, sizeof(mreq));
         fprintf(stderr, "promiscuous setsockopt result %d\n", result);
     }
+
+    if (dev->socket > max_socket) { max_socket = dev->socket; }
+}
+
+/* everything we do with a frame once we have it.  comment is the one it
+ * had in a pcapng file we're reading, or null.
+ */
+static void handle_frame(int dev_index, byte *frame, int caplen, int len,
+        struct timespec *ts, char *comment, int count, bool_t printum)
+{
+    char line[512];
+
+    if (caplen > read_len) { caplen = read_len; }
+
+    if (decode) { decode_frame(line, sizeof(line), frame, caplen); }
+
+    if (out_fname != NULL) {
+        if (pcap_file_write(&out, dev_index, frame, caplen, len, ts, 0,
+                (decode && out_pcapng) ? line : comment) != 0)
+        {
+            exit(1);
+        }
+    }
+
+    if (summarize) { summary_frame(frame, caplen); }
+
+    if (out_fname == NULL || printum || decode) {
+        fprintf(stderr, "count %d\n", count);
+    }
+
+    if (decode) {
+        fprintf(stderr, "%ld.%06ld %s%s%s%s%s\n", (long) ts->tv_sec,
+                ts->tv_nsec / 1000, (dev_count > 1)
+                ? (dev_index == 0 ? "1 " : "2 ") : "",
+                (comment != NULL) ? "(" : "",
+                (comment != NULL) ? comment : "",
+                (comment != NULL) ? ") " : "", line);
+    }
+
+    if (printum) {
+        print_message(stderr, frame, caplen);
+    }
+}
+
+static void finish(unsigned long long count)
+{
+    int i;
+
+    pcap_file_close(&out);
+
+    for (i = 0; i < dev_count; i++) {
+        update_kernel_stats(&devs[i]);
+        fprintf(stderr, "%s:  %llu received by filter, %llu dropped by "
+                "kernel\n", devs[i].name, devs[i].kernel_packets,
+                devs[i].kernel_drops);
+    }
+    fprintf(stderr, "%llu packets\n", count);
+
+    if (summarize) { print_summary(); }
+}
+
+/* -f:  go through a capture file, then quit */
+static void read_file(char *fname, bool_t printum, int max_count)
+{
+    pcap_reader_t r;
+    struct timespec ts;
+    int dev_index, caplen, len;
+    int count = 0;
+
+    if (pcap_reader_open(&r, fname) != 0) { exit(1); }
+
+    while (!got_stop && (max_count == 0 || count < max_count)
+        && (caplen = pcap_reader_next(&r, (byte *) buf, BUF_LEN, &dev_index,
+                &len, &ts)) != -1)
+    {
+        count++;
+        handle_frame(dev_index, (byte *) buf, caplen, len, &ts,
+                (r.comment[0] != '\0') ? r.comment : NULL, count,
+                printum);
+    }
+
+    pcap_reader_close(&r);
+    finish(count);
+    exit(0);
 }
 
 int main(int argc, char **argv)
 {
     int i;
-    // struct sockaddr_ll bind_arg;
     struct sockaddr_ll recv_arg;
     socklen_t recv_arg_len;
     int result;
-    // struct packet_mreq mreq;
     char *device = NULL;
+    char *dev2_name = NULL;
+    char *in_fname = NULL;
+    long long rotate_bytes = 0;
+    int rotate_secs = 0;
+    int rotate_files = 0;
     bool_t interactive = false;
     bool_t readum = true;
     int count = 0;
+    int max_count = 0;
     bool_t printum = false;
     int get_lines = 0;
     bool_t print_prompt = true;
@@ -161,15 +949,29 @@ int main(int argc, char **argv)
         } else if (strcmp(argv[i], "-p") == 0) {
             printum = true;
 
+        } else if (strcmp(argv[i], "-d") == 0) {
+            decode = true;
+
         } else if (strcmp(argv[i], "-a") == 0) {
             promiscuous = true;
 
+        } else if (strcmp(argv[i], "-r") == 0) {
+            use_ring = true;
+
+        } else if (strcmp(argv[i], "-N") == 0) {
+            out_pcapng = true;
+
+        } else if (strcmp(argv[i], "-S") == 0) {
+            summarize = true;
+
         } else if (strcmp(argv[i], "-l") == 0) {
             if (++i >= argc) {
                 fprintf(stderr, "-l needs a length argument\n");
                 exit(1);
             }
-            if (sscanf(argv[i], "%x", &read_len) != 1) {
+            if (sscanf(argv[i], "%x", &read_len) != 1
+                || read_len <= 0 || read_len > BUF_LEN)
+            {
                 fprintf(stderr, "invalid read length '%s'\n", argv[i]);
                 exit(1);
             }
@@ -189,6 +991,13 @@ int main(int argc, char **argv)
             }
             exclude_protocols[exclude_protocols_count++] = excl;
 
+        } else if (strcmp(argv[i], "-F") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "-F needs a filter argument\n");
+                exit(1);
+            }
+            parse_filter(argv[i]);
+
         } else if (strcmp(argv[i], "-D") == 0) {
             int ind;
             if (++i >= argc) {
@@ -226,38 +1035,93 @@ int main(int argc, char **argv)
                 exit(1);
             }
             dev2_name = strdup(argv[i]);
+
+        } else if (strcmp(argv[i], "-w") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "-w needs a file argument\n");
+                exit(1);
+            }
+            out_fname = argv[i];
+
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "-f needs a file argument\n");
+                exit(1);
+            }
+            in_fname = argv[i];
+
+        } else if (strcmp(argv[i], "-B") == 0 || strcmp(argv[i], "-C") == 0
+            || strcmp(argv[i], "-G") == 0 || strcmp(argv[i], "-W") == 0
+            || strcmp(argv[i], "-c") == 0)
+        {
+            char opt = argv[i][1];
+            int n;
+            if (++i >= argc) {
+                fprintf(stderr, "-%c needs a number\n", opt);
+                exit(1);
+            }
+            if (sscanf(argv[i], "%d", &n) != 1 || n <= 0) {
+                fprintf(stderr, "invalid -%c value '%s'\n", opt, argv[i]);
+                exit(1);
+            }
+            switch (opt) {
+            case 'B' : ring_kbytes = n; break;
+            case 'C' : rotate_bytes = n * 1000000LL; break;
+            case 'G' : rotate_secs = n; break;
+            case 'W' : rotate_files = n; break;
+            case 'c' : max_count = n; break;
+            }
         }
     }
 
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    if (out_fname != NULL) {
+        pcap_file_init(&out, out_fname, out_pcapng, read_len);
+        out.rotate_bytes = rotate_bytes;
+        out.rotate_secs = rotate_secs;
+        out.rotate_files = rotate_files;
+    }
+
+    if (in_fname != NULL) {
+        if (out_fname != NULL) { pcap_file_add_if(&out, "unknown"); }
+        read_file(in_fname, printum, max_count);
+    }
+
     if (device == NULL) {
         fprintf(stderr, "give me a device\n");
         return(1);
     }
 
-    dev1_name = strdup(device);
+    if (out_fname != NULL && !out_pcapng && dev2_name != NULL) {
+        fprintf(stderr, "pcap files can't say which interface a frame "
+                "came from; use -N for pcapng\n");
+    }
 
     /* open the interface(s) for reading */
-    setup_interface(dev1_name, &dev1_socket, &dev1_ifindex, protocol);
+    setup_interface(strdup(device), protocol);
 
     if (dev2_name != NULL) {
-        setup_interface(dev2_name, &dev2_socket, &dev2_ifindex, 0x1234);
+        setup_interface(dev2_name, 0x1234);
     }
 
-    max_socket = dev1_socket;
-    if (dev2_socket > max_socket) { max_socket = dev2_socket; }
+    /* a frame's pcapng interface id is its index in devs[] */
+    for (i = 0; i < dev_count && out_fname != NULL; i++) {
+        pcap_file_add_if(&out, devs[i].name);
+    }
 
-    while (1) {
-        bool_t skip;
-        int read_ifindex;
-        int read_socket;
+    while (!got_stop && (max_count == 0 || count < max_count)) {
+        int dev_index;
         fd_set read_set;
 
         FD_ZERO(&read_set);
 
         /* if we are supposed to read packets, set the select bits to do so */
         if (readum || (get_lines > 0)) {
-            FD_SET(dev1_socket, &read_set);
-            if (dev2_socket != -1) { FD_SET(dev2_socket, &read_set); }
+            for (i = 0; i < dev_count; i++) {
+                FD_SET(devs[i].socket, &read_set);
+            }
         }
 
         /* if we are interactive, set the select bit to read stdin */
@@ -273,6 +1137,7 @@ int main(int argc, char **argv)
 
         result = select((readum || (get_lines > 0)) ? (max_socket + 1) : 1,
                 &read_set, 0, 0, 0);
+        if (result == -1) { continue; }
 
         /* if there is interactive input, parse it and do it. */
         if (FD_ISSET(0, &read_set)) {
@@ -301,6 +1166,9 @@ int main(int argc, char **argv)
 
                 } else {
                     exclude_protocols[exclude_protocols_count++] = excl;
+                    for (i = 0; i < dev_count; i++) {
+                        attach_filter(&devs[i]);
+                    }
                 }
 
             } else if (c == 'D') {
@@ -340,6 +1208,9 @@ int main(int argc, char **argv)
                     fprintf(stderr, "%x ", exclude_protocols[i]);
                 }
                 fprintf(stderr, "\n");
+                for (i = 0; i < dev_count; i++) {
+                    attach_filter(&devs[i]);
+                }
 
             } else if (c == 'n') {
                 readum = false;
@@ -359,69 +1230,80 @@ int main(int argc, char **argv)
 
             } else if (c == 'q') {
                 fprintf(stderr, "bye..\n");
-                exit(0);
+                break;
             }
         }
 
         /* see if there is something on an interface being monitored */
 
-        if (FD_ISSET(dev1_socket, &read_set)) {
-            read_socket = dev1_socket;
-            read_ifindex = dev1_ifindex;
-
-        } else if (dev2_socket != -1 && FD_ISSET(dev2_socket, &read_set)) {
-            read_socket = dev2_socket;
-            read_ifindex = dev2_ifindex;
-
-        } else {
-            continue;
-        }
-
-        /* read the packet in from the interface */
-        memset(&recv_arg, 0, sizeof(recv_arg));
-        recv_arg.sll_family = AF_PACKET;
-        recv_arg.sll_ifindex = read_ifindex;
-        recv_arg.sll_protocol = htons(ETH_P_ALL);
-
-        result = recvfrom(read_socket, buf, read_len, 0,
-                (struct sockaddr *) &recv_arg, &recv_arg_len);
-        if (result == -1) {
-            fprintf(stderr, "recvfrom errno %d\n", errno);
-            perror("recvfrom xxx ");
-        }
+        for (dev_index = 0; dev_index < dev_count; dev_index++) {
+            capture_dev_t *dev = &devs[dev_index];
+            struct timespec ts;
+
+            if (!FD_ISSET(dev->socket, &read_set)) { continue; }
+
+#ifdef LL_DUMP_RING
+            if (dev->use_ring) {
+                struct tpacket3_hdr *hdr;
+
+                /* everything the kernel has for us, unless we're just
+                 * reading N packets
+                 */
+                while ((readum || get_lines > 0)
+                    && (max_count == 0 || count < max_count)
+                    && (hdr = ring_next(&dev->ring)) != NULL)
+                {
+                    count++;
+                    if (!readum && (get_lines > 0)) { get_lines--; }
+
+                    ts.tv_sec = hdr->tp_sec;
+                    ts.tv_nsec = hdr->tp_nsec;
+                    handle_frame(dev_index, (byte *) hdr + hdr->tp_mac,
+                            hdr->tp_snaplen, hdr->tp_len, &ts, NULL, count,
+                            printum);
+                }
 
-        if (debug[0]) { fprintf(stderr, "proto %x\n", eth_header->h_proto); }
+                continue;
+            }
+#endif
+
+            /* read the packet in from the interface */
+            memset(&recv_arg, 0, sizeof(recv_arg));
+            recv_arg.sll_family = AF_PACKET;
+            recv_arg.sll_ifindex = dev->ifindex;
+            recv_arg.sll_protocol = htons(ETH_P_ALL);
+            recv_arg_len = sizeof(recv_arg);
+
+            result = recvfrom(dev->socket, buf, read_len, MSG_TRUNC,
+                    (struct sockaddr *) &recv_arg, &recv_arg_len);
+            if (result == -1) {
+                fprintf(stderr, "recvfrom errno %d\n", errno);
+                perror("recvfrom xxx ");
+                continue;
+            }
 
-        /* is its protocol type one of the ones we are supposed to ignore? */
-        skip = false;
-        for (i = 0; i < exclude_protocols_count; i++) {
             if (debug[0]) {
-                fprintf(stderr, "compare %x to %x\n", eth_header->h_proto,
-                        htons(exclude_protocols[i]));
+                fprintf(stderr, "proto %x\n",
+                        ((struct ethhdr *) buf)->h_proto);
             }
-            if (eth_header->h_proto == htons(exclude_protocols[i])) {
-                if (debug[0]) { fprintf(stderr, "match.\n"); }
 
-                skip = true;
+            /* if we are reading just N lines, decrement the line count */
+            count++;
+            if (!readum && (get_lines > 0)) {
+                get_lines--;
             }
-        }
-        if (skip) {
-            continue;
-        }
 
-        /* if we are reading just N lines, decrement the line count */
-        count++;
-        if (!readum && (get_lines > 0)) {
-            get_lines--;
-        }
+            /* print output for this message */
 
-        /* print output for this message */
-
-        fprintf(stderr, "count %d\n", count);
-        print_prompt = true;
-
-        if (printum) {
-            print_message(stderr, (byte *) buf, result);
+            clock_gettime(CLOCK_REALTIME, &ts);
+            handle_frame(dev_index, (byte *) buf,
+                    (result < read_len) ? result : read_len, result, &ts,
+                    NULL, count, printum);
+            print_prompt = true;
         }
     }
+
+    finish(count);
+
+    return 0;
 }
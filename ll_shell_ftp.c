@@ -29,7 +29,7 @@ static const char Version[] = "Version "
  *
  *   - batch file transfer "receive file" mode:  request that remote server
  *         send a file over the wire.  exit when file is received.
- *         (as of 2005/12/03 receive file seems broken.)
+ *         (as of 2005/12/03 receive file seems broken with -O.)
  *
  * Typical calling sequence (become super user on machine_a and machine_b):
  *    Assume eth1 is the device to use on machine_a, with mac address
@@ -49,6 +49,10 @@ static const char Version[] = "Version "
  *    send a file:
  *    machine_b; ll_shell_ftp -e eth2 -d 00:10:5A:81:E4:D2 -p foo
  *        (file ends up in /tmp/foo on server side)
+ *
+ *    files go with com_util's windowed transfer, which picks up where an
+ *    interrupted transfer of the same file left off.  -O uses the old
+ *    stop-and-wait transfer instead, for a server that predates it.
  */
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -122,6 +126,11 @@ static int put_file_count = 0;
 
 static bool_t passive_receive_client = false;
 
+/* use the old stop-and-wait transfer, for servers that predate the
+ * windowed one.
+ */
+static bool_t stop_and_wait = false;
+
 static mac_address_t my_mac_addr = {0x00, 0x0C, 0x41, 0x76, 0x6C, 0x28 };
 static mac_address_t dest_mac_addr = {0,0,0,0,0,0,};
 
@@ -579,14 +588,90 @@ static int transfer_file(int fd, char *put_file_name)
     return(0);
 }
 
+/* wait up to msecs for a message from the other side.
+ * return 1 if there is one, 0 if not, -1 on error.
+ */
+static int wait_for_message(int msecs)
+{
+    struct timeval timer;
+    fd_set read_set;
+    int fd, result;
+
+    if (have_in_pio) {
+        /* pio only does whole seconds */
+        return pio_timed_read_ok(&in_pio, (msecs + 999) / 1000);
+    }
+
+    timer.tv_sec = msecs / 1000;
+    timer.tv_usec = (msecs % 1000) * 1000;
+    fd = (cooked_in_file == NULL) ? packet_socket : in_fd;
+    FD_ZERO(&read_set);
+    FD_SET(fd, &read_set);
+
+    if ((result = select(fd + 1, &read_set, 0, 0, &timer)) == -1) {
+        perror("wait_for_message:  select failed");
+    }
+    return result;
+}
+
+/* hand com_util the messages for a windowed transfer until status() says
+ * it's over.  call timeout() when the other side has been quiet for
+ * WINDOW_TIMEOUT_MSECS; other traffic on the device doesn't count.
+ * return 0 iff the transfer worked.
+ */
+static int run_windowed_transfer(window_status_t (*status)(),
+        void (*timeout)())
+{
+    struct timeval last, now;
+
+    checked_gettimeofday(&last);
+
+    while (status() == window_running) {
+        long long quiet;
+
+        checked_gettimeofday(&now);
+        quiet = timeval_diff(&now, &last) / 1000;
+        if (quiet >= WINDOW_TIMEOUT_MSECS) {
+            timeout();
+            last = now;
+            continue;
+        }
+
+        if (wait_for_message(WINDOW_TIMEOUT_MSECS - quiet) <= 0) { continue; }
+
+        if (receive_message(&buf) <= 0) { continue; }
+
+        if (buf.msg_type >= window_start_msg) {
+            com_util_process_message((void *) &buf);
+            checked_gettimeofday(&last);
+        }
+    }
+
+    return (status() == window_ok) ? 0 : -1;
+}
+
 /* open the local file "fname", and send it to the other side in chunks, using
  * sequence numbers to validate reception of each chunk.
+ * unless we were told to use stop-and-wait, com_util does this with its
+ * windowed transfer.
  */
 static void put_file(char *fname)
 {
-    int fd = open(fname, O_RDONLY);
+    int fd;
 
     fprintf(stderr, "putting %s\n", fname);
+
+    if (!stop_and_wait) {
+        if (com_util_send_file(fname, fname) != 0
+            || run_windowed_transfer(com_util_send_status,
+                    com_util_send_timeout) != 0)
+        {
+            fprintf(stderr, "put_file:  could not send %s\n", fname);
+        }
+        return;
+    }
+
+    fd = open(fname, O_RDONLY);
     if (fd == -1) {
         perror("put_file:  open failed");
         fprintf(stderr, "file that could not be opened:  %s\n", fname);
@@ -600,9 +685,23 @@ static void put_file(char *fname)
     close(fd);
 }
 
-/* set up to receive a file from the other side. */
+/* set up to receive a file from the other side.
+ * unless we were told to use stop-and-wait, com_util does the whole thing
+ * with its windowed transfer.
+ */
 static void start_get_file()
 {
+    if (!stop_and_wait) {
+        com_util_get_file(get_file_name, get_file_name);
+        if (run_windowed_transfer(com_util_receive_status,
+                com_util_receive_timeout) != 0)
+        {
+            fprintf(stderr, "start_get_file:  could not get %s\n",
+                    get_file_name);
+        }
+        exit_program(0);
+    }
+
     fd = open(get_file_name, O_WRONLY | O_CREAT | O_TRUNC,
             S_IRWXU | S_IRGRP | S_IROTH);
 
@@ -625,7 +724,7 @@ static void usage()
             "    [-d dest_mac_address] \\\n"
             "    [-i cooked_input_pseudo-device] \\\n"
             "    [-o cooked_output_pseudo-device] \\\n"
-            "    [-r | -s | -p put_file | -g get_file]\n");
+            "    [-O] [-r | -s | -p put_file | -g get_file]\n");
     exit(1);
 }
 
@@ -634,7 +733,7 @@ static void process_args(int argc, char **argv)
     char got_my_mac_addr = 0;
     int c;
 
-    while ((c = getopt(argc, argv, "ci:o:g:p:e:E:n:t:P:rscb:d:D:")) != -1) {
+    while ((c = getopt(argc, argv, "ci:o:g:p:e:E:n:t:P:rscb:d:D:O")) != -1) {
         switch (c) {
 
         case 'i' :
@@ -691,6 +790,10 @@ static void process_args(int argc, char **argv)
             cloud_db = 1;
             break;
 
+        case 'O' :
+            stop_and_wait = true;
+            break;
+
         case 's' :
             server = 1;
             shell_client = 0;
@@ -0,0 +1,652 @@
+/* ll_traffic.c - link-level traffic generator and receiver
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* put client load through the mesh, and measure what comes out the far end.
+ *
+ * ll_shell_ftp's test_send() sends one frame; this sends a stream of raw
+ * ethernet frames on an interface, at a given rate, with a mix of frame
+ * sizes, from one or more source mac addresses, to a unicast address, the
+ * broadcast address, or a mix of the two.  run it with -s on a client
+ * interface of one cloud box, and without -s on a client interface of
+ * another, to see what the cloud does with the traffic.
+ *
+ * each frame carries a run id, the index of its source mac address, a
+ * sequence number for that source, and the time it was sent.  the receiver
+ * uses these to report throughput, lost, reordered and duplicate frames,
+ * and percentiles of one-way latency.  (one-way latency is only meaningful
+ * if the sender's and receiver's clocks agree; e.g., both ends on the same
+ * host, connected by veth pairs.)
+ *
+ * example; send 1000 frames/sec for 30 seconds, a third of them 1400 bytes,
+ * from 8 source addresses, 10% of them broadcast:
+ *
+ *     ll_traffic -s -e veth1 -d 02:00:00:00:00:02 -r 1000 -t 30 \
+ *             -z 64:1,512:1,1400:1 -m 8 -b 10
+ *     ll_traffic -e veth4
+ *
+ * command line arguments:
+ *
+ *  -e dev:     interface to send or receive on (required)
+ *  -s:         send (by default, receive)
+ *  -d mac:     destination mac address (default broadcast)
+ *  -b pct:     percent of frames to send to the broadcast address instead
+ *              of the -d address (default 0)
+ *  -z sizes:   frame sizes (including the ethernet header), as a comma-
+ *              separated list of size[:weight] (default 512)
+ *  -r rate:    frames per second; 0 means as fast as possible (default 100)
+ *  -m N:       number of source mac addresses (default 1)
+ *  -M mac:     first source mac address (default the interface's);
+ *              the others count up from it
+ *  -P proto:   protocol type, in hex (default 88b6)
+ *  -t secs:    stop after this many seconds (default 10 for the sender;
+ *              the receiver runs until interrupted)
+ *  -c N:       stop after sending or receiving N frames
+ *  -i secs:    receiver; print a report this often (default 1)
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+
+#include "util.h"
+#include "mac.h"
+
+#define TRAFFIC_PROTO 0x88b6
+#define TRAFFIC_MAGIC 0x4c4c5447
+
+#define MAX_SIZES 16
+#define MAX_SOURCES 256
+#define MAX_FRAME 1514
+
+/* latency samples kept for percentiles; after this many, keep a random
+ * subset of this size.
+ */
+#define MAX_SAMPLES 100000
+
+/* what goes in each frame after the ethernet header; all fields in
+ * network byte order.
+ */
+typedef struct {
+    unsigned int magic;
+    unsigned int run_id;
+    unsigned int source;
+    unsigned int sequence;
+    unsigned int sec, nsec;
+} traffic_header_t;
+
+/* receiver state for one source of one run */
+typedef struct {
+    unsigned int run_id, source;
+    bool_t in_use;
+
+    /* highest sequence number seen, and how many frames are missing below
+     * it; a late frame fills in a gap.
+     */
+    unsigned int highest;
+    bool_t have_highest;
+    long long missing;
+
+    unsigned long long received, reordered, duplicates;
+
+    /* the last few sequence numbers seen, to tell a late frame from a
+     * duplicate
+     */
+    #define RECENT 64
+    unsigned int recent[RECENT];
+    int recent_next;
+} flow_t;
+
+typedef struct {
+    unsigned long long frames, bytes;
+    unsigned long long reordered, duplicates;
+    long long missing;
+} totals_t;
+
+static char *dev_name = NULL;
+static bool_t sender = false;
+static mac_address_t dest_mac;
+static int bcast_pct = 0;
+static int sizes[MAX_SIZES], weights[MAX_SIZES];
+static int size_count = 0, weight_total = 0;
+static double rate = 100;
+static int source_count = 1;
+static mac_address_t first_source;
+static bool_t have_first_source = false;
+static int protocol = TRAFFIC_PROTO;
+static double run_time = -1;
+static long long frame_limit = -1;
+static double report_interval = 1;
+
+static int sock = -1;
+static int if_index;
+static volatile sig_atomic_t got_stop = 0;
+
+static flow_t flows[MAX_SOURCES];
+
+static double samples[MAX_SAMPLES];
+static long long sample_count = 0;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage:\n"
+            "ll_traffic -s -e dev [-d mac] [-b bcast_pct] "
+            "[-z size[:weight],..] [-r rate]\n"
+            "    [-m sources] [-M first_source_mac] [-P proto] [-t secs] "
+            "[-c count]\n"
+            "ll_traffic -e dev [-P proto] [-t secs] [-c count] "
+            "[-i report_secs]\n");
+    exit(1);
+}
+
+static void stop_handler(int sig)
+{
+    got_stop = 1;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* parse "size[:weight],..." into sizes[] and weights[] */
+static void parse_sizes(char *arg)
+{
+    char *s = strdup(arg);
+    char *tok;
+
+    size_count = weight_total = 0;
+
+    for (tok = strtok(s, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        int size, weight = 1;
+
+        if (size_count >= MAX_SIZES
+            || sscanf(tok, "%d:%d", &size, &weight) < 1
+            || weight < 1)
+        {
+            fprintf(stderr, "invalid size list '%s'\n", arg);
+            exit(1);
+        }
+
+        if (size < (int) (sizeof(struct ethhdr) + sizeof(traffic_header_t))) {
+            size = sizeof(struct ethhdr) + sizeof(traffic_header_t);
+        }
+        if (size > MAX_FRAME) { size = MAX_FRAME; }
+
+        sizes[size_count] = size;
+        weights[size_count] = weight;
+        weight_total += weight;
+        size_count++;
+    }
+
+    free(s);
+}
+
+static void process_args(int argc, char **argv)
+{
+    int c;
+
+    mac_copy(dest_mac, mac_address_bcast);
+
+    while ((c = getopt(argc, argv, "e:sd:b:z:r:m:M:P:t:c:i:")) != -1) {
+        switch (c) {
+
+        case 'e' : dev_name = strdup(optarg); break;
+        case 's' : sender = true; break;
+
+        case 'd' :
+            if (mac_sscanf(dest_mac, optarg) != 1) {
+                fprintf(stderr, "invalid mac address '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'M' :
+            if (mac_sscanf(first_source, optarg) != 1) {
+                fprintf(stderr, "invalid mac address '%s'\n", optarg);
+                exit(1);
+            }
+            have_first_source = true;
+            break;
+
+        case 'P' :
+            if (sscanf(optarg, "%x", &protocol) != 1) {
+                fprintf(stderr, "invalid protocol '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'b' : bcast_pct = atoi(optarg); break;
+        case 'z' : parse_sizes(optarg); break;
+        case 'r' : rate = atof(optarg); break;
+        case 'm' : source_count = atoi(optarg); break;
+        case 't' : run_time = atof(optarg); break;
+        case 'c' : frame_limit = atoll(optarg); break;
+        case 'i' : report_interval = atof(optarg); break;
+        default : usage();
+        }
+    }
+
+    if (dev_name == NULL) { usage(); }
+
+    if (size_count == 0) { parse_sizes("512"); }
+
+    if (source_count < 1 || source_count > MAX_SOURCES) {
+        fprintf(stderr, "number of sources must be 1 to %d\n", MAX_SOURCES);
+        exit(1);
+    }
+
+    if (sender && run_time < 0 && frame_limit < 0) { run_time = 10; }
+}
+
+/* open a packet socket on dev_name for our protocol */
+static void setup_interface(void)
+{
+    struct ifreq get_index;
+    struct sockaddr_ll bind_arg;
+    struct packet_mreq mreq;
+
+    sock = socket(PF_PACKET, SOCK_RAW, htons(protocol));
+    if (sock == -1) {
+        fprintf(stderr, "socket failed:  %s\n", strerror(errno));
+        exit(1);
+    }
+
+    memset(&get_index, 0, sizeof(get_index));
+    copy_string(get_index.ifr_name, dev_name, sizeof(get_index.ifr_name));
+    if (ioctl(sock, SIOCGIFINDEX, &get_index) == -1) {
+        fprintf(stderr, "could not get index of %s:  %s\n", dev_name,
+                strerror(errno));
+        exit(1);
+    }
+    if_index = get_index.ifr_ifindex;
+
+    /* (mac_get() wants the old ifconfig output format; ask directly) */
+    if (!have_first_source) {
+        if (ioctl(sock, SIOCGIFHWADDR, &get_index) == -1) {
+            fprintf(stderr, "could not get mac address of %s:  %s\n",
+                    dev_name, strerror(errno));
+            exit(1);
+        }
+        mac_copy(first_source, (byte *) get_index.ifr_hwaddr.sa_data);
+    }
+
+    memset(&bind_arg, 0, sizeof(bind_arg));
+    bind_arg.sll_family = AF_PACKET;
+    bind_arg.sll_ifindex = if_index;
+    bind_arg.sll_protocol = htons(protocol);
+
+    if (bind(sock, (struct sockaddr *) &bind_arg, sizeof(bind_arg)) == -1) {
+        fprintf(stderr, "bind to %s failed:  %s\n", dev_name, strerror(errno));
+        exit(1);
+    }
+
+    /* the receiver wants frames for any of the sender's destinations */
+    if (!sender) {
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = if_index;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(sock, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
+            sizeof(mreq)) == -1)
+        {
+            fprintf(stderr, "could not make %s promiscuous:  %s\n", dev_name,
+                    strerror(errno));
+        }
+    }
+}
+
+/* pick a frame size according to the weights */
+static int pick_size(void)
+{
+    int r = random() % weight_total;
+    int i;
+
+    for (i = 0; i < size_count - 1; i++) {
+        if (r < weights[i]) { break; }
+        r -= weights[i];
+    }
+
+    return sizes[i];
+}
+
+static void send_traffic(void)
+{
+    byte frame[MAX_FRAME];
+    struct ethhdr *eth = (struct ethhdr *) frame;
+    traffic_header_t *h = (traffic_header_t *) (frame + sizeof(*eth));
+    struct sockaddr_ll send_arg;
+    unsigned int sequence[MAX_SOURCES];
+    unsigned int run_id;
+    unsigned long long sent = 0, bytes = 0, errors = 0;
+    double start, t;
+    long long n;
+    int i;
+
+    memset(sequence, 0, sizeof(sequence));
+    memset(frame, 0, sizeof(frame));
+
+    for (i = sizeof(*eth) + sizeof(*h); i < MAX_FRAME; i++) {
+        frame[i] = (byte) i;
+    }
+
+    memset(&send_arg, 0, sizeof(send_arg));
+    send_arg.sll_family = AF_PACKET;
+    send_arg.sll_ifindex = if_index;
+    send_arg.sll_halen = 6;
+
+    eth->h_proto = htons(protocol);
+
+    start = now();
+    srandom((unsigned int) (start * 1000));
+    run_id = random();
+
+    h->magic = htonl(TRAFFIC_MAGIC);
+    h->run_id = htonl(run_id);
+
+    for (n = 0; !got_stop; n++) {
+        int source = n % source_count;
+        int size = pick_size();
+        unsigned int low;
+        struct timespec ts;
+
+        if (frame_limit >= 0 && n >= frame_limit) { break; }
+
+        t = now();
+        if (run_time >= 0 && t - start >= run_time) { break; }
+
+        /* pace to the rate; sleep if we're ahead by much */
+        if (rate > 0) {
+            double due = start + n / rate;
+
+            if (due - t > .0002) {
+                struct timespec delay;
+                delay.tv_sec = (time_t) (due - t);
+                delay.tv_nsec = (long) ((due - t - delay.tv_sec) * 1e9);
+                nanosleep(&delay, NULL);
+            }
+            while (now() < due) { }
+        }
+
+        if (bcast_pct > 0 && random() % 100 < bcast_pct) {
+            mac_copy(eth->h_dest, mac_address_bcast);
+        } else {
+            mac_copy(eth->h_dest, dest_mac);
+        }
+        mac_copy(send_arg.sll_addr, eth->h_dest);
+
+        mac_copy(eth->h_source, first_source);
+        low = ((first_source[4] << 8) | first_source[5]) + source;
+        eth->h_source[4] = (low >> 8) & 0xff;
+        eth->h_source[5] = low & 0xff;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        h->source = htonl(source);
+        h->sequence = htonl(sequence[source]);
+        h->sec = htonl((unsigned int) ts.tv_sec);
+        h->nsec = htonl((unsigned int) ts.tv_nsec);
+
+        if (sendto(sock, frame, size, 0, (struct sockaddr *) &send_arg,
+            sizeof(send_arg)) == -1)
+        {
+            errors++;
+            if (errors == 1) {
+                fprintf(stderr, "sendto failed:  %s\n", strerror(errno));
+            }
+            continue;
+        }
+
+        sequence[source]++;
+        sent++;
+        bytes += size;
+    }
+
+    t = now() - start;
+
+    printf("run %08x:  sent %llu frames, %llu bytes in %.2f seconds; "
+            "%.0f frames/sec, %.3f Mbit/sec; %llu send errors\n",
+            run_id, sent, bytes, t, sent / t, bytes * 8 / t / 1e6, errors);
+}
+
+/* find (or start) the flow for source of run_id */
+static flow_t *get_flow(unsigned int run_id, unsigned int source)
+{
+    flow_t *f = &flows[source % MAX_SOURCES];
+
+    if (!f->in_use || f->run_id != run_id || f->source != source) {
+        memset(f, 0, sizeof(*f));
+        f->in_use = true;
+        f->run_id = run_id;
+        f->source = source;
+    }
+
+    return f;
+}
+
+static bool_t seen_recently(flow_t *f, unsigned int sequence)
+{
+    int i;
+
+    for (i = 0; i < RECENT; i++) {
+        if (f->recent[i] == sequence + 1) { return true; }
+    }
+
+    return false;
+}
+
+/* count a frame with sequence number "sequence" for flow f */
+static void flow_receive(flow_t *f, unsigned int sequence)
+{
+    if (seen_recently(f, sequence)) {
+        f->duplicates++;
+        return;
+    }
+
+    /* (store sequence + 1, so that 0 means empty) */
+    f->recent[f->recent_next] = sequence + 1;
+    f->recent_next = (f->recent_next + 1) % RECENT;
+
+    f->received++;
+
+    if (!f->have_highest) {
+        f->highest = sequence;
+        f->have_highest = true;
+        f->missing += sequence;
+
+    } else if ((int) (sequence - f->highest) > 0) {
+        f->missing += sequence - f->highest - 1;
+        f->highest = sequence;
+
+    } else {
+        /* late; it fills in a gap */
+        f->reordered++;
+        if (f->missing > 0) { f->missing--; }
+    }
+}
+
+static void add_sample(double latency)
+{
+    if (sample_count < MAX_SAMPLES) {
+        samples[sample_count] = latency;
+    } else {
+        long long r = random() % (sample_count + 1);
+        if (r < MAX_SAMPLES) { samples[r] = latency; }
+    }
+
+    sample_count++;
+}
+
+static int double_cmp(const void *p1, const void *p2)
+{
+    double d1 = *(double *) p1, d2 = *(double *) p2;
+
+    return (d1 < d2) ? -1 : (d1 > d2) ? 1 : 0;
+}
+
+static void get_totals(totals_t *t)
+{
+    int i;
+
+    memset(t, 0, sizeof(*t));
+
+    for (i = 0; i < MAX_SOURCES; i++) {
+        if (!flows[i].in_use) { continue; }
+        t->frames += flows[i].received;
+        t->reordered += flows[i].reordered;
+        t->duplicates += flows[i].duplicates;
+        t->missing += flows[i].missing;
+    }
+}
+
+/* print frames and throughput for the last interval, or, if final, for the
+ * whole run along with loss and latency.
+ */
+static void report(totals_t *last, unsigned long long bytes,
+        double elapsed, bool_t final)
+{
+    totals_t t;
+    double lost_pct;
+
+    get_totals(&t);
+    t.bytes = bytes;
+
+    if (!final) {
+        printf("%7.1f s  %8.0f frames/sec  %8.3f Mbit/sec  lost %lld  "
+                "reordered %llu\n", elapsed,
+                (t.frames - last->frames) / report_interval,
+                (t.bytes - last->bytes) * 8 / report_interval / 1e6,
+                t.missing - last->missing, t.reordered - last->reordered);
+        *last = t;
+        return;
+    }
+
+    lost_pct = (t.frames + t.missing == 0) ? 0
+            : 100. * t.missing / (t.frames + t.missing);
+
+    printf("received %llu frames, %llu bytes in %.2f seconds; "
+            "%.0f frames/sec, %.3f Mbit/sec\n",
+            t.frames, t.bytes, elapsed,
+            elapsed > 0 ? t.frames / elapsed : 0,
+            elapsed > 0 ? t.bytes * 8 / elapsed / 1e6 : 0);
+    printf("lost %lld (%.2f%%), reordered %llu, duplicates %llu\n",
+            t.missing, lost_pct, t.reordered, t.duplicates);
+
+    if (sample_count > 0) {
+        long long n = sample_count < MAX_SAMPLES ? sample_count : MAX_SAMPLES;
+
+        qsort(samples, n, sizeof(double), double_cmp);
+
+        printf("one-way latency (ms):  min %.3f  p50 %.3f  p90 %.3f  "
+                "p99 %.3f  p99.9 %.3f  max %.3f\n",
+                samples[0] * 1000,
+                samples[n * 50 / 100] * 1000,
+                samples[n * 90 / 100] * 1000,
+                samples[n * 99 / 100] * 1000,
+                samples[n * 999 / 1000] * 1000,
+                samples[n - 1] * 1000);
+    }
+}
+
+static void receive_traffic(void)
+{
+    byte frame[MAX_FRAME + 100];
+    traffic_header_t h;
+    totals_t last;
+    unsigned long long received = 0, bytes = 0;
+    double begin = now(), start = -1, latest = -1, next_report = 0, t;
+    struct pollfd pfd;
+
+    memset(&last, 0, sizeof(last));
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+
+    while (!got_stop) {
+        int len;
+        flow_t *f;
+
+        t = now();
+
+        if (start >= 0 && t >= next_report) {
+            report(&last, bytes, t - start, false);
+            next_report += report_interval;
+        }
+
+        if (run_time >= 0 && t - begin >= run_time) { break; }
+        if (frame_limit >= 0 && (long long) received >= frame_limit) { break; }
+
+        if (poll(&pfd, 1, 100) <= 0) { continue; }
+
+        len = recv(sock, frame, sizeof(frame), 0);
+        t = now();
+
+        if (len < (int) (sizeof(struct ethhdr) + sizeof(h))) { continue; }
+
+        memcpy(&h, frame + sizeof(struct ethhdr), sizeof(h));
+        if (ntohl(h.magic) != TRAFFIC_MAGIC) { continue; }
+
+        /* start the clock at the first frame */
+        if (start < 0) {
+            start = t;
+            next_report = start + report_interval;
+        }
+
+        f = get_flow(ntohl(h.run_id), ntohl(h.source));
+        flow_receive(f, ntohl(h.sequence));
+        received++;
+        bytes += len;
+        latest = t;
+
+        add_sample(t - (ntohl(h.sec) + ntohl(h.nsec) / 1e9));
+    }
+
+    /* (the final numbers cover first frame to last frame) */
+    report(&last, bytes, start >= 0 ? latest - start : 0, true);
+}
+
+int main(int argc, char **argv)
+{
+    process_args(argc, argv);
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    setup_interface();
+
+    if (sender) {
+        send_traffic();
+    } else {
+        receive_traffic();
+    }
+
+    close(sock);
+
+    return 0;
+}
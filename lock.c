@@ -23,6 +23,7 @@ static const char Version[] = "Version "
 #include "cloud_mod.h"
 #include "stp_beacon.h"
 #include "parm_change.h"
+#include "rtt.h"
 
 /* locks we are asking for from other nodes */
 lockable_resource_t pending_requests[MAX_CLOUD];
@@ -217,7 +218,7 @@ void timeout_lockable(lockable_resource_t *lock_vector, int *len,
     /* right after midnight, things are temporarily messed up.  everything
      * will time out.  but that's ok.  we'll try again shortly.
      */
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         printf("timeout_lockable:  gettimeofday failed\n");
         return;
     }
@@ -229,7 +230,9 @@ void timeout_lockable(lockable_resource_t *lock_vector, int *len,
     past_packed = 0;
     for (next = 0; next < *len; next++) {
         lockable_resource_t *l = &lock_vector[next];
-        if (usec_diff(tv.tv_sec, tv.tv_usec, l->sec, l->usec) <= recv_timeout) {
+        if (usec_diff(tv.tv_sec, tv.tv_usec, l->sec, l->usec)
+            <= rtt_lock_timeout_usec(l->node_1, recv_timeout))
+        {
             /* keep it. */
             if (past_packed != next) {
                 lock_vector[past_packed] = *l;
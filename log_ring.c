@@ -0,0 +1,128 @@
+/* log_ring.c - fixed-size circular log file, written through an mmap
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* a log file that never grows past a fixed size.  the file is created at
+ * its full size and mapped into memory; log text is copied into the
+ * mapping, wrapping around to the start of the file when it reaches the
+ * end.  the oldest text is simply overwritten, so there is never a need
+ * to read and rewrite the file to trim it, and a log "write" is a memcpy
+ * rather than a system call.  the kernel writes the dirty pages back to
+ * the file in its own time.
+ *
+ * until the log wraps for the first time, the part of the file past the
+ * newest text is zero bytes.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "log_ring.h"
+
+/* create (or truncate) fname, make it "size" bytes long, and map it.
+ * return 0 on success, -1 with errno set otherwise.
+ */
+int log_ring_open(log_ring_t *ring, char *fname, int size)
+{
+    void *p;
+
+    ring->fd = -1;
+    ring->base = NULL;
+    ring->size = 0;
+    ring->pos = 0;
+
+    if (size <= (int) sizeof(LOG_RING_MARK)) { return -1; }
+
+    ring->fd = open(fname, O_RDWR|O_CREAT|O_TRUNC,
+            S_IRUSR|S_IWUSR | S_IRGRP | S_IROTH);
+    if (ring->fd == -1) { return -1; }
+
+    if (ftruncate(ring->fd, size) == -1) { goto error; }
+
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (p == MAP_FAILED) { goto error; }
+
+    ring->base = (char *) p;
+    ring->size = size;
+
+    return 0;
+
+    error:
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+}
+
+/* copy buf into the ring starting at *pos, wrapping as needed. */
+static void ring_copy(log_ring_t *ring, int *pos, const char *buf, int len)
+{
+    while (len > 0) {
+        int n = ring->size - *pos;
+        if (n > len) { n = len; }
+
+        memcpy(ring->base + *pos, buf, n);
+
+        *pos += n;
+        if (*pos >= ring->size) { *pos = 0; }
+        buf += n;
+        len -= n;
+    }
+}
+
+/* append buf to the log, overwriting the oldest text if necessary. */
+void log_ring_write(log_ring_t *ring, const char *buf, int len)
+{
+    int mark_pos;
+
+    if (ring->base == NULL || len <= 0) { return; }
+
+    /* only the last part of a huge buffer could survive anyway */
+    if (len > ring->size - (int) sizeof(LOG_RING_MARK)) {
+        buf += len - (ring->size - sizeof(LOG_RING_MARK));
+        len = ring->size - sizeof(LOG_RING_MARK);
+    }
+
+    ring_copy(ring, &ring->pos, buf, len);
+
+    /* the mark is overwritten by the next write */
+    mark_pos = ring->pos;
+    ring_copy(ring, &mark_pos, LOG_RING_MARK, sizeof(LOG_RING_MARK) - 1);
+}
+
+/* ask the kernel to start writing dirty pages back to the file; don't wait */
+void log_ring_sync(log_ring_t *ring)
+{
+    if (ring->base == NULL) { return; }
+
+    msync(ring->base, ring->size, MS_ASYNC);
+}
+
+/* write everything back to the file and release it. */
+void log_ring_close(log_ring_t *ring)
+{
+    if (ring->base != NULL) {
+        msync(ring->base, ring->size, MS_SYNC);
+        munmap(ring->base, ring->size);
+        ring->base = NULL;
+    }
+
+    if (ring->fd != -1) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
@@ -0,0 +1,33 @@
+/* log_ring.h - fixed-size circular log file, written through an mmap
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+/* written just after the newest byte in the file, so that someone looking
+ * at the file can see where the log wraps around.
+ */
+#define LOG_RING_MARK "\n---- end of log ----\n"
+
+typedef struct {
+    int fd;
+    char *base;
+    int size;
+    int pos;
+} log_ring_t;
+
+extern int log_ring_open(log_ring_t *ring, char *fname, int size);
+extern void log_ring_write(log_ring_t *ring, const char *buf, int len);
+extern void log_ring_sync(log_ring_t *ring);
+extern void log_ring_close(log_ring_t *ring);
+
+#endif
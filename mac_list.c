@@ -69,7 +69,7 @@ int mac_list_expire_timed_macs(mac_list_t *mac_list)
 
     if (mac_list->timeout == -1) { return 0; }
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         fprintf(stderr, "expire_timed_macs:  gettimeofday failed\n");
         return -1;
     }
@@ -122,7 +122,7 @@ int mac_list_read(mac_list_t *mac_list)
     struct timezone tz;
     FILE *f;
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         fprintf(stderr, "mac_list_read; gettimeofday failed\n");
         return -1;
     }
@@ -251,7 +251,7 @@ int mac_list_write(mac_list_t *mac_list)
     FILE *f;
     int i;
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         fprintf(stderr, "mac_list_write:  gettimeofday failed\n");
         return -1;
     }
@@ -398,7 +398,7 @@ void mac_list_add(mac_list_t *mac_list, mac_address_t mac_addr,
     struct timeval tv;
     struct timezone tz;
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         fprintf(stderr, "mac_list_add; gettimeofday failed\n");
         return;
     }
@@ -463,7 +463,7 @@ void mac_list_db_msg(char *msg)
         struct timeval tv;
         struct timezone tz;
 
-        if (gettimeofday(&tv, &tz)) {
+        if (util_gettimeofday(&tv, &tz)) {
             fprintf(stderr, "mac_list_db_msg; gettimeofday failed\n");
             return;
         }
@@ -0,0 +1,644 @@
+/* mcast.c - igmp and mld snooping; forward multicast only toward members
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* without this, a multicast client frame is flooded like a broadcast:  to
+ * every box in the cloud and out every interface.  with db[77] set, each
+ * box watches its own clients' igmp and mld membership reports, keeps the
+ * groups they have joined, and lists them in its stp beacons.  a multicast
+ * frame then goes only to the stp neighbors whose part of the tree has a
+ * box with members, and only out our own interfaces that have members.
+ *
+ * groups are kept by ethernet address, since that's what we forward by.
+ * a few groups always go everywhere:  the ones for link-local control
+ * traffic (224.0.0.x and ff02::x), the ipv6 solicited-node groups, and
+ * igmp and mld queries.
+ *
+ * a box whose clients include a querier (a multicast router) gets every
+ * group, and says so with mac_address_bcast in its list of groups.
+ *
+ * membership reports and leaves go only toward multicast routers (rfc
+ * 4541 2.1.1):  to every box in the cloud, but out only the interfaces
+ * of each box that have a querier behind them.  igmpv2 and mldv1 hosts
+ * keep quiet when they hear another member report a group, so a report
+ * that reached the other boxes' clients would keep their members from
+ * reporting, and their memberships would age out.
+ *
+ * hosts report again only when a querier asks, so memberships age out
+ * (MCAST_AGE) only if we have seen a query somewhere in the cloud lately.
+ * otherwise they last until the host leaves.
+ */
+
+#include <string.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+
+#include "cloud.h"
+#include "device.h"
+#include "stp_beacon.h"
+#include "timer.h"
+#include "print.h"
+#include "mcast.h"
+
+#define MCAST_MAX_LOCAL 32
+
+#define IGMP_QUERY 0x11
+#define IGMP_V1_REPORT 0x12
+#define IGMP_V2_REPORT 0x16
+#define IGMP_LEAVE 0x17
+#define IGMP_V3_REPORT 0x22
+
+#define MLD_QUERY 130
+#define MLD_V1_REPORT 131
+#define MLD_DONE 132
+#define MLD_V2_REPORT 143
+
+/* v3 group record types */
+#define MODE_IS_INCLUDE 1
+#define MODE_IS_EXCLUDE 2
+#define CHANGE_TO_INCLUDE 3
+#define CHANGE_TO_EXCLUDE 4
+#define ALLOW_NEW_SOURCES 5
+
+#define IP6_HOP_BY_HOP 0
+
+/* a group one of our interfaces has members of */
+typedef struct {
+    bool_t used;
+    mac_address_t group;
+    device_type_t device_type;
+
+    /* last report, and leave (0 if none since) */
+    long sec;
+    long leave_sec;
+} mcast_group_t;
+
+static mcast_group_t local_groups[MCAST_MAX_LOCAL];
+
+/* last time we saw a query anywhere; 0 if never */
+static long query_sec;
+
+/* last time we saw a query from one of our clients, by device type; 0
+ * if never
+ */
+static long router_sec[device_type_unknown + 1];
+
+static int report_count, leave_count, pruned_count, flooded_count;
+static int collapse_count, to_router_count;
+
+/* groups whose frames always go everywhere */
+static bool_t flood_group(byte *group)
+{
+    /* 224.0.0.x */
+    if (group[0] == 0x01 && group[1] == 0x00 && group[2] == 0x5e
+        && group[3] == 0x00 && group[4] == 0x00)
+    {
+        return true;
+    }
+
+    if (group[0] == 0x33 && group[1] == 0x33) {
+        /* all-nodes, all-routers, mld v2 routers and so on */
+        if (group[2] == 0x00 && group[3] == 0x00 && group[4] == 0x00) {
+            return true;
+        }
+
+        /* solicited-node */
+        if (group[2] == 0xff) { return true; }
+    }
+
+    return false;
+}
+
+static void ipv4_group(byte *group, byte *addr)
+{
+    group[0] = 0x01;
+    group[1] = 0x00;
+    group[2] = 0x5e;
+    group[3] = addr[1] & 0x7f;
+    group[4] = addr[2];
+    group[5] = addr[3];
+}
+
+static void ipv6_group(byte *group, byte *addr)
+{
+    group[0] = 0x33;
+    group[1] = 0x33;
+    memcpy(&group[2], &addr[12], 4);
+}
+
+static bool_t expired(mcast_group_t *g)
+{
+    if (g->leave_sec != 0 && now.tv_sec - g->leave_sec >= MCAST_LEAVE) {
+        return true;
+    }
+
+    return now.tv_sec - query_sec < MCAST_AGE
+        && now.tv_sec - g->sec > MCAST_AGE;
+}
+
+/* the slot for group on device_type:  the one it already has, or a free
+ * one; NULL if there is no room.
+ */
+static mcast_group_t *find_slot(byte *group, device_type_t device_type)
+{
+    mcast_group_t *g = NULL;
+    int i;
+
+    for (i = 0; i < MCAST_MAX_LOCAL; i++) {
+        mcast_group_t *l = &local_groups[i];
+
+        if (l->used && expired(l)) { l->used = false; }
+
+        if (l->used && mac_equal(l->group, group)
+            && l->device_type == device_type)
+        {
+            return l;
+        }
+
+        if (!l->used && g == NULL) { g = l; }
+    }
+
+    return g;
+}
+
+/* local_groups[] is full.  rather than drop a membership (and with it
+ * every frame for the group), make the interface type with the most
+ * groups want every group, as a box with a querier does, and free the
+ * slots its groups took.  the "want everything" entry ages out like the
+ * memberships it stands for.
+ */
+static void collapse(void)
+{
+    int count[device_type_unknown + 1];
+    mcast_group_t *keep = NULL;
+    device_type_t most = device_type_unknown;
+    int i;
+
+    memset(count, 0, sizeof(count));
+
+    for (i = 0; i < MCAST_MAX_LOCAL; i++) {
+        if (local_groups[i].used) { count[local_groups[i].device_type]++; }
+    }
+
+    for (i = 0; i <= device_type_unknown; i++) {
+        if (count[i] > count[most]) { most = i; }
+    }
+
+    for (i = 0; i < MCAST_MAX_LOCAL; i++) {
+        mcast_group_t *l = &local_groups[i];
+
+        if (!l->used || l->device_type != most) { continue; }
+
+        if (keep == NULL) {
+            keep = l;
+            mac_copy(keep->group, mac_address_bcast);
+            keep->leave_sec = 0;
+            continue;
+        }
+
+        if (l->sec > keep->sec) { keep->sec = l->sec; }
+        l->used = false;
+    }
+
+    collapse_count++;
+
+    if (db[78].d) {
+        ddprintf("mcast; too many groups; %s now gets all of them\n",
+                device_type_string(most));
+    }
+}
+
+static void join(byte *group, device_type_t device_type)
+{
+    mcast_group_t *g;
+
+    if (flood_group(group)) { return; }
+
+    report_count++;
+
+    g = find_slot(group, device_type);
+
+    if (g == NULL) {
+        collapse();
+        g = find_slot(group, device_type);
+        if (g == NULL) { return; }
+    }
+
+    if (db[78].d && !g->used) {
+        ddprintf("mcast; join %s on %s\n", mac_sprintf(mac_buf1, group),
+                device_type_string(device_type));
+    }
+
+    g->used = true;
+    mac_copy(g->group, group);
+    g->device_type = device_type;
+    g->sec = now.tv_sec;
+    g->leave_sec = 0;
+}
+
+static void leave(byte *group, device_type_t device_type)
+{
+    int i;
+
+    leave_count++;
+
+    for (i = 0; i < MCAST_MAX_LOCAL; i++) {
+        mcast_group_t *l = &local_groups[i];
+
+        if (l->used && mac_equal(l->group, group)
+            && l->device_type == device_type && l->leave_sec == 0)
+        {
+            if (db[78].d) {
+                ddprintf("mcast; leave %s on %s\n",
+                        mac_sprintf(mac_buf1, group),
+                        device_type_string(device_type));
+            }
+            l->leave_sec = now.tv_sec;
+        }
+    }
+}
+
+/* an igmp message at p */
+static void snoop_igmp(byte *p, int len, bool_t local,
+        device_type_t device_type)
+{
+    byte group[6];
+    int i, records;
+
+    if (len < 8) { return; }
+
+    if (p[0] == IGMP_QUERY) {
+        query_sec = now.tv_sec;
+        if (local) {
+            router_sec[device_type] = now.tv_sec;
+            join(mac_address_bcast, device_type);
+        }
+        return;
+    }
+
+    if (!local) { return; }
+
+    switch (p[0]) {
+
+    case IGMP_V1_REPORT :
+    case IGMP_V2_REPORT :
+        ipv4_group(group, &p[4]);
+        join(group, device_type);
+        break;
+
+    case IGMP_LEAVE :
+        ipv4_group(group, &p[4]);
+        leave(group, device_type);
+        break;
+
+    case IGMP_V3_REPORT :
+        records = (p[6] << 8) | p[7];
+        i = 8;
+        while (records-- > 0 && i + 8 <= len) {
+            int sources = (p[i + 2] << 8) | p[i + 3];
+
+            ipv4_group(group, &p[i + 4]);
+
+            if (p[i] == MODE_IS_EXCLUDE || p[i] == CHANGE_TO_EXCLUDE
+                || (sources > 0 && (p[i] == MODE_IS_INCLUDE
+                    || p[i] == ALLOW_NEW_SOURCES)))
+            {
+                join(group, device_type);
+
+            } else if (sources == 0 && (p[i] == MODE_IS_INCLUDE
+                    || p[i] == CHANGE_TO_INCLUDE))
+            {
+                leave(group, device_type);
+            }
+
+            i += 8 + 4 * sources + 4 * p[i + 1];
+        }
+        break;
+    }
+} /* snoop_igmp */
+
+/* an mld message at p */
+static void snoop_mld(byte *p, int len, bool_t local,
+        device_type_t device_type)
+{
+    byte group[6];
+    int i, records;
+
+    if (len < 8) { return; }
+
+    if (p[0] == MLD_QUERY) {
+        query_sec = now.tv_sec;
+        if (local) {
+            router_sec[device_type] = now.tv_sec;
+            join(mac_address_bcast, device_type);
+        }
+        return;
+    }
+
+    if (!local) { return; }
+
+    switch (p[0]) {
+
+    case MLD_V1_REPORT :
+        if (len < 24) { break; }
+        ipv6_group(group, &p[8]);
+        join(group, device_type);
+        break;
+
+    case MLD_DONE :
+        if (len < 24) { break; }
+        ipv6_group(group, &p[8]);
+        leave(group, device_type);
+        break;
+
+    case MLD_V2_REPORT :
+        records = (p[6] << 8) | p[7];
+        i = 8;
+        while (records-- > 0 && i + 20 <= len) {
+            int sources = (p[i + 2] << 8) | p[i + 3];
+
+            ipv6_group(group, &p[i + 4]);
+
+            if (p[i] == MODE_IS_EXCLUDE || p[i] == CHANGE_TO_EXCLUDE
+                || (sources > 0 && (p[i] == MODE_IS_INCLUDE
+                    || p[i] == ALLOW_NEW_SOURCES)))
+            {
+                join(group, device_type);
+
+            } else if (sources == 0 && (p[i] == MODE_IS_INCLUDE
+                    || p[i] == CHANGE_TO_INCLUDE))
+            {
+                leave(group, device_type);
+            }
+
+            i += 20 + 16 * sources + 4 * p[i + 1];
+        }
+        break;
+    }
+} /* snoop_mld */
+
+/* the igmp or mld message in a client frame, and its length; NULL if
+ * there isn't one
+ */
+static byte *membership_msg(byte *p, int len, bool_t *ipv6, int *msg_len)
+{
+    int i;
+
+    if (len < ETH_HLEN + 20) { return NULL; }
+
+    if (p[12] == 0x08 && p[13] == 0x00) {
+        if (p[ETH_HLEN + 9] != IPPROTO_IGMP) { return NULL; }
+        i = ETH_HLEN + (p[ETH_HLEN] & 0x0f) * 4;
+        *ipv6 = false;
+
+    } else if (p[12] == 0x86 && p[13] == 0xdd) {
+        int next;
+
+        if (len < ETH_HLEN + 48) { return NULL; }
+
+        /* mld always comes with a hop-by-hop router alert */
+        next = p[ETH_HLEN + 6];
+        if (next != IP6_HOP_BY_HOP) { return NULL; }
+
+        i = ETH_HLEN + 40;
+        next = p[i];
+        i += (p[i + 1] + 1) * 8;
+        if (next != IPPROTO_ICMPV6) { return NULL; }
+        *ipv6 = true;
+
+    } else {
+        return NULL;
+    }
+
+    if (i >= len) { return NULL; }
+
+    *msg_len = len - i;
+    return &p[i];
+}
+
+/* is the igmp or mld message at m a report or leave, rather than a query
+ * (or something we don't know)?
+ */
+static bool_t is_report(byte *m, int m_len, bool_t ipv6)
+{
+    if (m_len < 1) { return false; }
+
+    if (ipv6) {
+        return m[0] == MLD_V1_REPORT || m[0] == MLD_DONE
+            || m[0] == MLD_V2_REPORT;
+    }
+
+    return m[0] == IGMP_V1_REPORT || m[0] == IGMP_V2_REPORT
+        || m[0] == IGMP_LEAVE || m[0] == IGMP_V3_REPORT;
+}
+
+/* called by bcast_forward_message() for every new client frame.  learn
+ * group memberships from our own clients' reports, and note queries.
+ */
+void mcast_snoop(message_t *message, int msg_len, int dev,
+        bool_t originated_locally)
+{
+    byte *p = message->v.msg.msg_body;
+    int len = msg_len - wrapper_len;
+    bool_t ipv6;
+    byte *m;
+    int m_len;
+
+    if (len < ETH_HLEN || !(p[0] & 1)) { return; }
+
+    m = membership_msg(p, len, &ipv6, &m_len);
+    if (m == NULL) { return; }
+
+    if (ipv6) {
+        snoop_mld(m, m_len, originated_locally, device_list[dev].device_type);
+    } else {
+        snoop_igmp(m, m_len, originated_locally, device_list[dev].device_type);
+    }
+}
+
+static bool_t has_group(stp_beacon_t *b, byte *group)
+{
+    int i;
+
+    for (i = 0; i < b->group_count && i < STP_BEACON_GROUPS; i++) {
+        if (mac_equal(b->groups[i], group)
+            || mac_equal(b->groups[i], mac_address_bcast))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* if message is a multicast client frame that needs to go only to members
+ * of its group, fill in d with where they are and return true.
+ */
+bool_t mcast_dest(message_t *message, int msg_len, mcast_dest_t *d)
+{
+    byte *p = message->v.msg.msg_body;
+    int len = msg_len - wrapper_len;
+    bool_t ipv6;
+    byte *m;
+    int i, j, m_len;
+
+    if (len < ETH_HLEN || !(p[0] & 1)) { return false; }
+    if (mac_equal(p, mac_address_bcast)) { return false; }
+
+    m = membership_msg(p, len, &ipv6, &m_len);
+
+    /* reports and leaves:  every box, but only our interfaces with a
+     * querier behind them
+     */
+    if (m != NULL && is_report(m, m_len, ipv6)) {
+        memset(d, 0, sizeof(*d));
+
+        for (i = 0; i <= device_type_unknown; i++) {
+            if (router_sec[i] != 0 && now.tv_sec - router_sec[i] <= MCAST_AGE)
+            {
+                d->local |= 1 << i;
+            }
+        }
+
+        for (i = 0; i < stp_list_count; i++) {
+            mac_copy(d->nbr[d->nbr_count++], stp_list[i].box.name);
+        }
+
+        to_router_count++;
+        return true;
+    }
+
+    if (m != NULL || flood_group(p)) {
+        if (m != NULL) { flooded_count++; }
+        return false;
+    }
+
+    memset(d, 0, sizeof(*d));
+
+    for (i = 0; i < MCAST_MAX_LOCAL; i++) {
+        mcast_group_t *l = &local_groups[i];
+
+        if (!l->used) { continue; }
+        if (expired(l)) { l->used = false; continue; }
+
+        if (mac_equal(l->group, p) || mac_equal(l->group, mac_address_bcast)) {
+            d->local |= 1 << l->device_type;
+        }
+    }
+
+    /* the stp neighbors that the beacons of boxes with members come to us
+     * through
+     */
+    for (i = 0; i < stp_recv_beacon_count; i++) {
+        stp_recv_beacon_t *b = &stp_recv_beacons[i];
+
+        if (!has_group(&b->stp_beacon, p) || mcast_toward(d, b->neighbor)) {
+            continue;
+        }
+
+        for (j = 0; j < stp_list_count; j++) {
+            if (mac_equal(stp_list[j].box.name, b->neighbor)) {
+                mac_copy(d->nbr[d->nbr_count++], b->neighbor);
+                break;
+            }
+        }
+    }
+
+    pruned_count++;
+    return true;
+} /* mcast_dest */
+
+/* does the frame d is for need to go to stp neighbor nbr? */
+bool_t mcast_toward(mcast_dest_t *d, mac_address_t nbr)
+{
+    int i;
+
+    for (i = 0; i < d->nbr_count; i++) {
+        if (mac_equal(d->nbr[i], nbr)) { return true; }
+    }
+
+    return false;
+}
+
+/* list our groups in the stp beacon we are about to send */
+void mcast_update_beacon(stp_beacon_t *beacon)
+{
+    int i, j;
+
+    beacon->group_count = 0;
+
+    for (i = 0; i < MCAST_MAX_LOCAL; i++) {
+        mcast_group_t *l = &local_groups[i];
+
+        if (!l->used) { continue; }
+        if (expired(l)) { l->used = false; continue; }
+
+        for (j = 0; j < beacon->group_count; j++) {
+            if (mac_equal(beacon->groups[j], l->group)) { break; }
+        }
+        if (j < beacon->group_count) { continue; }
+
+        /* too many to list; say we want them all */
+        if (beacon->group_count >= STP_BEACON_GROUPS) {
+            mac_copy(beacon->groups[0], mac_address_bcast);
+            beacon->group_count = 1;
+            break;
+        }
+
+        mac_copy(beacon->groups[beacon->group_count++], l->group);
+    }
+} /* mcast_update_beacon */
+
+void mcast_print(ddprintf_t *fn, FILE *f)
+{
+    int i, j;
+
+    fn(f, "multicast (reports %d, leaves %d, pruned %d, flooded %d, "
+            "to routers %d, overflows %d):\n", report_count, leave_count,
+            pruned_count, flooded_count, to_router_count, collapse_count);
+
+    if (query_sec != 0) {
+        fn(f, "    last query %lds ago\n", (long) (now.tv_sec - query_sec));
+    }
+
+    for (i = 0; i <= device_type_unknown; i++) {
+        if (router_sec[i] == 0) { continue; }
+        fn(f, "    querier on %s, %lds ago\n", device_type_string(i),
+                (long) (now.tv_sec - router_sec[i]));
+    }
+
+    for (i = 0; i < MCAST_MAX_LOCAL; i++) {
+        mcast_group_t *l = &local_groups[i];
+
+        if (!l->used) { continue; }
+
+        fn(f, "    %s on %s, %lds ago%s\n",
+                mac_sprintf(mac_buf1, l->group),
+                device_type_string(l->device_type),
+                (long) (now.tv_sec - l->sec),
+                l->leave_sec != 0 ? ", leaving" : "");
+    }
+
+    for (i = 0; i < stp_recv_beacon_count; i++) {
+        stp_beacon_t *b = &stp_recv_beacons[i].stp_beacon;
+
+        if (b->group_count == 0) { continue; }
+
+        fn(f, "    %s:", mac_sprintf(mac_buf1, b->originator));
+        for (j = 0; j < b->group_count && j < STP_BEACON_GROUPS; j++) {
+            fn(f, " %s", mac_sprintf(mac_buf1, b->groups[j]));
+        }
+        fn(f, "\n");
+    }
+} /* mcast_print */
@@ -0,0 +1,44 @@
+/* mcast.h - igmp and mld snooping; forward multicast only toward members
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef MCAST_H
+#define MCAST_H
+
+#include <stdio.h>
+#include "util.h"
+#include "cloud.h"
+#include "stp_beacon_data.h"
+
+/* seconds a membership report is good for, if there is a querier */
+#define MCAST_AGE 260
+
+/* seconds a group is kept after a leave, for other members to report */
+#define MCAST_LEAVE 2
+
+/* where a multicast client frame needs to go; see mcast_dest() */
+typedef struct {
+    /* our interfaces with members, a bit per device_type_t */
+    int local;
+
+    /* our stp neighbors with members in their part of the stp tree */
+    int nbr_count;
+    mac_address_t nbr[MAX_CLOUD];
+} mcast_dest_t;
+
+extern void mcast_snoop(message_t *message, int msg_len, int dev,
+        bool_t originated_locally);
+extern bool_t mcast_dest(message_t *message, int msg_len, mcast_dest_t *d);
+extern bool_t mcast_toward(mcast_dest_t *d, mac_address_t nbr);
+extern void mcast_update_beacon(stp_beacon_t *beacon);
+extern void mcast_print(ddprintf_t *fn, FILE *f);
+
+#endif
@@ -45,9 +45,13 @@ static const char Version[] = "Version "
  *           mesh, but communicating via "infinitely high signal strength"
  *           cat-5 connection
  *
+ *      -H 100[,3]:  turn on fast failure detection on stp arcs (db[84]),
+ *          sending hellos every 100 msec and giving up on a neighbor
+ *          after 3 of its intervals (or more on a lossy link).  see
+ *          hello.c.
+ *
  *      -i /tmp:  run in simulation mode, using pipes for communication to
- *          simulate wireless traffic.  this is old, probably broken, and
- *          would be worth getting working again at some point.
+ *          simulate wireless traffic.  cloud_sim runs boxes this way.
  *
  *      -l:  run an ll_shell_ftp service out of merge_cloud on the
  *           LAN cat-5 interface
@@ -78,6 +82,13 @@ static const char Version[] = "Version "
  *           messages.  this is the default, and is a very good idea to always
  *           leave on.
  *
+ *      -r /tmp/journal:  replay a journal recorded with -R, with no sockets
+ *          or timer interrupts, using the command line it was recorded
+ *          with.  see journal.c.
+ *
+ *      -R /tmp/journal:  record our inputs (frames, times, random numbers,
+ *          files read) to a journal, to be replayed later with -r
+ *
  *      -s /tmp/cloud_status:
  *          specify the file that mesh status is written to, so that
  *          the status_lights utility can read it and blink lights on the
@@ -87,12 +98,19 @@ static const char Version[] = "Version "
  *          name of temporary log file (we use this to send debug messages
  *          to the internet interface)
  *
+ *      -V:  with -i, run on a virtual clock that cloud_sim advances,
+ *          rather than on the real one.  see sim_clock.c.
+ *
  *      -w eth0:  the wireless interface (i.e., "wlan0" etc.)
  *
  *      -W nn:nn:nn:nn:nn:nn
  *          specify the mac address of the wireless interface
  *          (we figure it out on our own using ifconfig if this isn't given)
  *
+ *      -x /tmp/tap.pcapng[,v=verdict+...][,d=device+...][,m=type+...]:
+ *          write the frames we handle, with what we did with each, to a
+ *          pcapng file.  see tap.c for the options.
+ *
  *      -y: detect signal strength by looking at wireless beacons
  *          (alternative is debugging mode where we look in signal 
  *          strength file and ignore wireless beacons)
@@ -146,6 +164,21 @@ static const char Version[] = "Version "
 #include "nbr.h"
 #include "scan_msg.h"
 #include "parm_change.h"
+#include "dist.h"
+#include "bridge.h"
+#include "route.h"
+#include "arp_proxy.h"
+#include "mcast.h"
+#include "etx.h"
+#include "rtt.h"
+#include "trickle.h"
+#include "hello.h"
+#include "sim_clock.h"
+#include "latency.h"
+#include "msg_stat.h"
+#include "link_hist.h"
+#include "journal.h"
+#include "tap.h"
 
 #ifdef WRT54G
     #include "pcritical_section.h"
@@ -223,6 +256,26 @@ char_str_t db[] = {
     /* 63 */ {0, "debug wifi scanning"},
     /* 64 */ {1, "debug global wifi paramater changing"},
     /* 65 */ {0, "don't really do global wifi paramater change for debugging"},
+    /* 66 */ {0, "per-stage packet latency histograms"},
+    /* 67 */ {0, "message type counts in status page and " MSG_STAT_FILE},
+    /* 68 */ {0, "debug cloud-wide file distribution"},
+    /* 69 */ {0, "global improvement toward the maximum spanning tree"},
+    /* 70 */ {0, "debug global improvement"},
+    /* 71 */ {0, "route unicast client frames by link state"},
+    /* 72 */ {0, "debug link-state routing"},
+    /* 73 */ {0, "send unicast client frames only toward their destination"},
+    /* 74 */ {0, "debug learning bridge table"},
+    /* 75 */ {0, "answer client arp and neighbor solicitations from a cache"},
+    /* 76 */ {0, "debug arp proxy"},
+    /* 77 */ {0, "forward client multicast only toward group members"},
+    /* 78 */ {0, "debug multicast snooping"},
+    /* 79 */ {0, "judge links by signal strength less an etx penalty"},
+    /* 80 */ {0, "ack, stp beacon and lock timeouts from round trip times"},
+    /* 81 */ {0, "debug round trip times"},
+    /* 82 */ {0, "send stp beacons on a trickle timer"},
+    /* 83 */ {0, "debug trickle stp beacons"},
+    /* 84 */ {0, "detect stp neighbor failure quickly with hellos"},
+    /* 85 */ {0, "debug stp neighbor hellos"},
              {-1, NULL},
 };
 
@@ -391,8 +444,10 @@ static void update_cloud_status()
         }
 
         if (found) {
-            if (my_weakest_stp_link > nbr_device_list[j].signal_strength) {
-                my_weakest_stp_link = nbr_device_list[j].signal_strength;
+            int strength = get_link_strength(nbr_device_list[j].name);
+
+            if (my_weakest_stp_link > strength) {
+                my_weakest_stp_link = strength;
             }
         }
     }
@@ -460,6 +515,10 @@ static bool_t pre_repeated_cloud_maint()
 
     update_nbr_signal_strength();
 
+    update_kernel_io_stats();
+    msg_stat_update_rates();
+    link_hist_update_summaries();
+
     if (db[16].d) { ddprintf("    changed %d..\n", result); }
     return result;
 }
@@ -476,9 +535,18 @@ static void post_repeated_cloud_maint()
     if (db[3].d) { ddprintf("post_repeated_cloud_maint..\n"); }
     timeout_lockables();
     check_connectivity();
-    send_stp_beacon(false /* no disconnected nbr */);
+    trickle_check();
+    hello_check();
+    if (!db[82].d) {
+        send_stp_beacon(false /* no disconnected nbr */);
+    }
+    if (db[71].d) {
+        route_update();
+    }
     if (db[5].d) {
-        check_local_improvement();
+        if (!db[69].d || !check_global_improvement()) {
+            check_local_improvement();
+        }
     }
     if (db[50].d) {
         check_ad_hoc_client_improvement();
@@ -535,6 +603,15 @@ void clear_state(mac_address_ptr_t name)
     delete_stp_beacon(name);
 }
 
+/* journal to replay, from -r */
+static char *replay_fname = NULL;
+
+/* -x tap spec; see tap.c */
+static char *tap_spec = NULL;
+
+/* -V; take our time from cloud_sim (see sim_clock.c) */
+static bool_t use_sim_clock = false;
+
 static void usage()
 {
     ddprintf("usage:\ncloud [-e ethN] \\\n"
@@ -548,7 +625,10 @@ static void usage()
             "    [-c message_count] \\\n"
             "    [-D debug_index] \\\n"
             "    [-n] \\\n"
-            "    [-i pipe_directory]\n");
+            "    [-i pipe_directory [-V]] \\\n"
+            "    [-R record_journal | -r replay_journal] \\\n"
+            "    [-H hello_msec[,detect_mult]] \\\n"
+            "    [-x tap_file[,v=verdict+...][,d=device+...][,m=type+...]]\n");
     exit(1);
 }
 
@@ -563,7 +643,7 @@ static void process_args(int argc, char **argv)
     }
     ddprintf("\n");
 
-    while ((c = getopt(argc, argv, "Alfm:yc:np:a:w:W:b:d:e:E:D:i:N:s:L:P"))
+    while ((c = getopt(argc, argv, "Alfm:yc:np:a:w:W:b:d:e:E:D:i:N:s:L:Pr:R:x:H:V"))
         != -1)
     {
         switch (c) {
@@ -651,6 +731,19 @@ static void process_args(int argc, char **argv)
             db[47].d = true;
             break;
 
+        case 'r' :
+            replay_fname = strdup(optarg);
+            break;
+
+        case 'R' :
+            /* ignored when replaying a recording's own arguments */
+            if (journal_mode == journal_off
+                && journal_open(optarg, journal_record, argc, argv) != 0)
+            {
+                exit(1);
+            }
+            break;
+
         case 's' :
             cloud_status_file = strdup(optarg);
             strncpy(cloud_status_tmp_file, cloud_status_file, PATH_MAX);
@@ -664,6 +757,25 @@ static void process_args(int argc, char **argv)
             wlan_device_name = strdup(optarg);
             break;
 
+        case 'x' :
+            tap_spec = strdup(optarg);
+            break;
+
+        case 'H' :
+            if (sscanf(optarg, "%d,%d", &hello_interval,
+                    &hello_detect_mult) < 1
+                || hello_interval <= 0 || hello_detect_mult <= 0
+                || hello_detect_mult > HELLO_DETECT_MULT_MAX)
+            {
+                usage();
+            }
+            db[84].d = true;
+            break;
+
+        case 'V' :
+            use_sim_clock = true;
+            break;
+
         case 'W' :
             if (1 != mac_sscanf(my_wlan_mac_address, optarg)) {
                 ddprintf("invalid wlan mac address '%s'\n", optarg);
@@ -724,6 +836,26 @@ static void cleanup()
     if (do_ll_shell) {
         com_util_exit();
     }
+
+    print_close_log();
+
+    journal_print_summary(eprintf, stderr);
+    journal_close();
+
+    tap_close();
+    tap_print_summary(eprintf, stderr);
+}
+
+/* is there a message to read on device i? */
+static bool_t device_readable(int i, fd_set *read_set)
+{
+    if (journal_mode == journal_replay) {
+        return journal_frame_ready(i);
+    } else if (use_pipes) {
+        return pio_read_ok(&device_list[i].in_pio);
+    } else {
+        return FD_ISSET(device_list[i].fd, read_set);
+    }
 }
 
 int main(int argc, char **argv)
@@ -740,6 +872,51 @@ int main(int argc, char **argv)
     /* avoid compiler warnings */
     (void) mac_buf1; (void) mac_buf2; (void) mac_buf3;
 
+    process_args(argc, argv);
+
+    /* replay with the recorded arguments, and then any given here (-D, -L,
+     * -s) on top of them.  there are no live inputs; what the helpers for
+     * -b, -y and the ll shell would have done shows up in the journaled
+     * files.
+     */
+    if (replay_fname != NULL) {
+        int j_argc;
+        char **j_argv;
+
+        if (journal_open(replay_fname, journal_replay, 0, NULL) != 0) {
+            exit(1);
+        }
+
+        journal_get_args(&j_argc, &j_argv);
+        optind = 1;
+        process_args(j_argc, j_argv);
+
+        /* don't overwrite the recording's own tap file */
+        tap_spec = NULL;
+
+        optind = 1;
+        process_args(argc, argv);
+
+        use_pipes = 0;
+        stdin_input = 0;
+        do_ll_shell = 0;
+        do_eth_beacon = 0;
+        do_wrt_beacon = 0;
+    }
+
+    if (tap_spec != NULL && tap_open(tap_spec) != 0) {
+        exit(1);
+    }
+
+    if (use_sim_clock) {
+        if (!use_pipes || journal_mode != journal_off) {
+            ddprintf("-V needs -i, and can't be used with -R or -r\n");
+            exit(1);
+        }
+        if (sim_clock_open(pipe_directory) != 0) { exit(1); }
+    }
+
+    /* after the journal is open, so that these times are in it */
     while (!checked_gettimeofday(&now));
     start = now;
 
@@ -747,8 +924,7 @@ int main(int argc, char **argv)
     times[0] = now;
     times[1] = now;
     times[2] = now;
-
-    process_args(argc, argv);
+    times[flush_log] = now;
 
     #ifdef WRT54G
         pcritical_section_init();
@@ -784,7 +960,7 @@ int main(int argc, char **argv)
     improve_prob_init(stp_recv_beacon_count);
 
     if (!got_wlan_mac_addr) {
-        mac_get(my_wlan_mac_address, wlan_device_name);
+        journal_mac_get(my_wlan_mac_address, wlan_device_name);
     }
 
     init_cloud_stp_tree();
@@ -808,7 +984,7 @@ int main(int argc, char **argv)
 
     if (eth_device_name != 0) {
         if (!got_eth_mac_addr) {
-            mac_get(my_eth_mac_address, eth_device_name);
+            journal_mac_get(my_eth_mac_address, eth_device_name);
         }
 
         /* for consistency with above; process ethN:1 messages before ethN
@@ -912,6 +1088,7 @@ int main(int argc, char **argv)
         sigaction(SIGALRM, &action, NULL);
 
         set_next_alarm();
+        journal_timer_mark();
 
         memset(&action, 0, sizeof(action));
         action.sa_handler = catch_hup;
@@ -932,6 +1109,7 @@ int main(int argc, char **argv)
         int max_fd = -1;
         int dev, dev_index;
         fd_set read_set;
+        struct timeval no_wait;
         int select_result;
 
         /* set up the read_set for the select */
@@ -955,7 +1133,14 @@ int main(int argc, char **argv)
          * an ack from one or more downstream devices, only read input from 
          * the devices that may give us the ack's we are waiting for.
          */
-        if (!input_available) {
+        if (journal_mode == journal_replay) {
+            /* no select; the journal says what happens next */
+            if (!journal_replay_next()) {
+                cleanup();
+                exit(0);
+            }
+
+        } else if (!input_available) {
             int i;
 
             for (i = 0; i < device_list_count; i++) {
@@ -981,7 +1166,14 @@ int main(int argc, char **argv)
                 com_util_set_select(&max_fd, &read_set);
             }
 
-            select_result = select(max_fd + 1, &read_set, 0, 0, 0);
+            /* on cloud_sim's clock, we don't wait for input here; once
+             * there's none, we're done with this moment.
+             */
+            no_wait.tv_sec = 0;
+            no_wait.tv_usec = 0;
+
+            select_result = select(max_fd + 1, &read_set, 0, 0,
+                    sim_clock_active ? &no_wait : 0);
 
             if (select_result == -1) {
                 if (errno != EINTR) {
@@ -990,6 +1182,11 @@ int main(int argc, char **argv)
                 continue;
 
             }
+
+            if (select_result == 0 && sim_clock_active) {
+                sim_clock_wait();
+                continue;
+            }
             
             if (db[53].d) {
                 bool_t prt = false;
@@ -1008,6 +1205,8 @@ int main(int argc, char **argv)
             }
         }
 
+        journal_timer_state(&read_set, interrupt_pipe[0]);
+
         fake_interrupt = false;
 
         #ifdef WRT54G
@@ -1148,7 +1347,26 @@ int main(int argc, char **argv)
                 start_parm_change("/tmp/parm_change");
                 goto done;
 
+            /* "F<file>" sends the file to every box in the cloud;
+             * "F" by itself says how that is going.
+             */
+            case 'F' : {
+                char fname[256];
+                char *p = &buf[1];
+
+                while (*p == ' ') { p++; }
+                copy_string(fname, p, sizeof(fname));
+
+                if (fname[0] == '\0') {
+                    dist_print(eprintf, stderr);
+                } else {
+                    dist_start(fname);
+                }
+                goto done;
+            }
+
             case 'c' :
+                update_kernel_io_stats();
                 print_io_stats(eprintf, stderr);
                 goto done;
 
@@ -1244,6 +1462,38 @@ int main(int argc, char **argv)
                 dprint_cloud_stats(eprintf, stderr);
                 goto done;
 
+            case 'U' :
+                route_print(eprintf, stderr);
+                goto done;
+
+            case 'B' :
+                bridge_print(eprintf, stderr);
+                goto done;
+
+            case 'Y' :
+                arp_proxy_print(eprintf, stderr);
+                goto done;
+
+            case 'G' :
+                mcast_print(eprintf, stderr);
+                goto done;
+
+            case 'E' :
+                etx_print(eprintf, stderr);
+                goto done;
+
+            case 'k' :
+                rtt_print(eprintf, stderr);
+                goto done;
+
+            case 'K' :
+                trickle_print(eprintf, stderr);
+                goto done;
+
+            case 'O' :
+                hello_print(eprintf, stderr);
+                goto done;
+
             case 'l' :
                 force_local_change = 1;
                 old_db5 = db[5].d;
@@ -1271,8 +1521,22 @@ int main(int argc, char **argv)
                 cleanup();
                 exit(0);
 
+            case 'L' :
+                latency_print(eprintf, stderr);
+                goto done;
+
+            case 'H' :
+                link_hist_print(eprintf, stderr);
+                goto done;
+
+            case 'M' :
+                msg_stat_print(eprintf, stderr);
+                goto done;
+
             case 'r' :
                 reset_io_stats();
+                latency_reset();
+                msg_stat_reset();
                 goto done;
 
             case 'R' :
@@ -1352,9 +1616,7 @@ int main(int argc, char **argv)
 
         input_available = 0;
         for (i = 0; i < device_list_count; i++) {
-            if ((use_pipes && pio_read_ok(&device_list[i].in_pio))
-                || (!use_pipes && FD_ISSET(device_list[i].fd, &read_set)))
-            {
+            if (device_readable(i, &read_set)) {
                 input_available = 1;
                 break;
             }
@@ -1383,6 +1645,9 @@ int main(int argc, char **argv)
                 bool_t oops;
                 bool_t forward_packet;
 
+                /* start time of the stage being timed, if db[66] */
+                lat_time_t t_stage;
+
                 /* if we are waiting for an ack from a payload message we
                  * sent to another cloud box, don't read from any input device
                  * except ones we are waiting for acks from.
@@ -1392,9 +1657,7 @@ int main(int argc, char **argv)
                  * so don't try to read the ad-hoc device's fd, which is really
                  * just the wlan device's fd.
                  */
-                if (((use_pipes && !pio_read_ok(&device_list[dev_index].in_pio))
-                    || (!use_pipes && !FD_ISSET(device_list[dev_index].fd,
-                    &read_set)))
+                if (!device_readable(dev_index, &read_set)
                     || (ad_hoc_mode && device_list[dev_index].device_type
                         == device_type_ad_hoc))
                 {
@@ -1408,10 +1671,15 @@ int main(int argc, char **argv)
 
                 check_msg_count();
 
-                if (use_pipes) {
+                t_stage = latency_start();
+
+                if (journal_mode == journal_replay) {
+                    result = journal_read_frame(dev_index,
+                            (void *) msg_buffer, sizeof(*msg_buffer));
+                } else if (use_pipes) {
                     result = pio_read(&device_list[dev_index].in_pio,
-                            (void *) &msg_buffer,
-                            sizeof(msg_buffer));
+                            (void *) msg_buffer,
+                            sizeof(*msg_buffer));
                     if (db[14].d && is_wlan(&device_list[dev_index])) {
                         pio_print(stderr, &device_list[dev_index].in_pio);
                     }
@@ -1456,11 +1724,11 @@ int main(int argc, char **argv)
 
                         block_timer_interrupts(SIG_BLOCK);
 
-                        result = recvfrom(device_list[dev_index].fd,
+                        recv_arg_len = sizeof(recv_arg);
+                        result = device_recv(&device_list[dev_index],
                                 (void *) msg_buffer,
-                                sizeof(*msg_buffer), 0,
-                                (struct sockaddr *) &recv_arg,
-                                &recv_arg_len);
+                                sizeof(*msg_buffer),
+                                &recv_arg, &recv_arg_len);
 
                         block_timer_interrupts(SIG_UNBLOCK);
 
@@ -1480,6 +1748,15 @@ int main(int argc, char **argv)
                     continue;
                 }
 
+                journal_frame(dev_index, msg_buffer, result);
+
+                tap(TAP_RECV, device_list[dev_index].device_name, msg_buffer,
+                        result);
+
+                latency_record(device_list[dev_index].stat_index, lat_recv,
+                        t_stage);
+                t_stage = latency_start();
+
                 if (db[57].d) {
                     ddprintf("from device %d:\n", dev_index);
                     fn_print_message(eprintf, stderr,
@@ -1680,10 +1957,16 @@ int main(int argc, char **argv)
                             device_type_string(device_list[dev_index].
                                     device_type),
                             msg_type);
+                    tap(TAP_REJECT, device_list[dev_index].device_name,
+                            msg_buffer, is_298x_msg ? result
+                                    : result - wrapper_len);
                     continue;
                 }
 
                 if (!accept) {
+                    tap(TAP_REJECT, device_list[dev_index].device_name,
+                            msg_buffer, is_298x_msg ? result
+                                    : result - wrapper_len);
                     continue;
                 }
                 }
@@ -1764,6 +2047,9 @@ int main(int argc, char **argv)
                     dev = dev_index;
                 }
 
+                latency_record(device_list[dev_index].stat_index, lat_classify,
+                        t_stage);
+
                 /* if debugging dev:1 packet accounting.. */
                 if (db[48].d && device_list[dev_index].device_type
                     != device_type_wlan_mon)
@@ -1831,14 +2117,28 @@ int main(int argc, char **argv)
                         == htons(WRAPPED_CLIENT_MSG)))
                 {
                     if (db[48].d) { ddprintf("to sequence_check 1..\n"); }
+                    t_stage = latency_start();
                     sequence_check(message, dev, dev_index);
+                    latency_record(device_list[dev].stat_index,
+                            lat_sequence_check, t_stage);
+
+                    if (db[84].d) {
+                        hello_heard(dev, message->eth_header.h_source);
+                    }
                 }
 
                 /* if this was a k-for-n message and not the last one,
                  * save it and hope for the rest of it eventually.
                  */
                 if (is_298x_msg) {
-                    if (!update_k_for_n_state(message, &result, dev)) {
+                    bool_t done_k_for_n;
+
+                    t_stage = latency_start();
+                    done_k_for_n = update_k_for_n_state(message, &result, dev);
+                    latency_record(device_list[dev].stat_index, lat_k_for_n,
+                            t_stage);
+
+                    if (!done_k_for_n) {
                         continue;
                     }
                 }
@@ -1945,6 +2245,8 @@ int main(int argc, char **argv)
                     == htons(CLOUD_MSG))
                 {
                     io_stat[device_list[dev].stat_index].cloud_recv++;
+                    msg_stat_count(device_list[dev].stat_index, msg_stat_recv,
+                            message->message_type, result);
 
                     process_cloud_message(message, dev);
 
@@ -1990,14 +2292,23 @@ int main(int argc, char **argv)
                     }
 
                     io_stat[device_list[dev].stat_index].noncloud_recv++;
+                    msg_stat_count(device_list[dev].stat_index, msg_stat_recv,
+                            MSG_STAT_DATA, result);
 
                     if (result > max_packet_len) {
                         max_packet_len = result;
                     }
 
                     if (message_ok(dev, result)) {
+                        t_stage = latency_start();
                         bcast_forward_message(message, result, dev,
                                 msg_type == OTHER_MSG);
+                        latency_record(device_list[dev].stat_index,
+                                lat_forward, t_stage);
+                    } else {
+                        tap(TAP_BAD, device_list[dev].device_name,
+                                msg_buffer, is_298x_msg ? result
+                                        : result - wrapper_len);
                     }
                 }
             }
@@ -2055,6 +2366,29 @@ int main(int argc, char **argv)
             scan_timer();
         }
 
+        if (got_interrupt[flush_log]) {
+            got_interrupt[flush_log] = 0;
+            print_flush_log();
+            journal_flush();
+        }
+
+        if (got_interrupt[dist_send]) {
+            got_interrupt[dist_send] = 0;
+            dist_timer();
+        }
+
+        if (got_interrupt[stp_trickle]) {
+            got_interrupt[stp_trickle] = 0;
+            trickle_timer();
+        }
+
+        if (got_interrupt[stp_hello]) {
+            got_interrupt[stp_hello] = 0;
+            hello_timer();
+        }
+
+        journal_timer_mark();
+
         #ifdef WRT54G
             pcritical_section_exit();
         #else
@@ -0,0 +1,245 @@
+/* msg_stat.c - frame and byte counts by message type and device
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* count every frame we send or receive, by io_stat entry (local interface
+ * or other cloud box), by direction, and by cloud message type (with one
+ * more row for client data).  the counts are 64 bits so they don't wrap
+ * on a long-running box.
+ *
+ * on each maintenance tick, turn the change in the counts since the last
+ * tick into frames and bytes per second, and fold that into an
+ * exponentially weighted moving average with a time constant of
+ * MSG_STAT_TAU seconds.
+ *
+ * db[67] puts the counts on the cloud status page, and writes them
+ * to MSG_STAT_FILE one line per non-empty counter for other programs.
+ */
+
+#include <time.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "print.h"
+#include "io_stat.h"
+#include "cloud_msg.h"
+#include "msg_stat.h"
+
+static msg_count_t counts[MAX_CLOUD][MSG_STAT_DIRS][MSG_STAT_TYPES];
+
+/* time of the last rate update; 0 before the first one */
+static double last_update;
+
+static char *dir_names[MSG_STAT_DIRS] = {
+    "recv",
+    "send",
+};
+
+/* name of a row in the count matrix */
+static char *type_name(int type)
+{
+    if (type == MSG_STAT_DATA) { return "client_data"; }
+
+    return message_type_string((message_type_t) type);
+}
+
+/* count a frame of "bytes" bytes of message type "type" (or MSG_STAT_DATA)
+ * sent or received on io_stat entry stat_index.
+ */
+void msg_stat_count(int stat_index, msg_stat_dir_t dir, int type, int bytes)
+{
+    msg_count_t *c;
+
+    if (stat_index < 0 || stat_index >= MAX_CLOUD) { return; }
+    if (type < 0 || type >= MSG_STAT_TYPES) { type = unknown_msg; }
+
+    c = &counts[stat_index][dir][type];
+    c->frames++;
+    if (bytes > 0) { c->bytes += bytes; }
+}
+
+/* read the monotonic clock in seconds */
+static double msg_stat_now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) { return 0; }
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* update the moving average rates of all of the counters */
+void msg_stat_update_rates(void)
+{
+    double now = msg_stat_now();
+    double elapsed, alpha;
+    int i, j, k;
+
+    if (last_update == 0) {
+        last_update = now;
+        return;
+    }
+
+    elapsed = now - last_update;
+
+    /* too soon to say anything useful */
+    if (elapsed < .1) { return; }
+
+    last_update = now;
+    alpha = 1 - exp(-elapsed / MSG_STAT_TAU);
+
+    for (i = 0; i < io_stat_count; i++) {
+        for (j = 0; j < MSG_STAT_DIRS; j++) {
+            for (k = 0; k < MSG_STAT_TYPES; k++) {
+                msg_count_t *c = &counts[i][j][k];
+                double frame_rate = (c->frames - c->last_frames) / elapsed;
+                double byte_rate = (c->bytes - c->last_bytes) / elapsed;
+
+                c->frame_rate += alpha * (frame_rate - c->frame_rate);
+                c->byte_rate += alpha * (byte_rate - c->byte_rate);
+
+                c->last_frames = c->frames;
+                c->last_bytes = c->bytes;
+            }
+        }
+    }
+}
+
+/* zero the counts for one io_stat entry */
+void msg_stat_clear(int stat_index)
+{
+    if (stat_index < 0 || stat_index >= MAX_CLOUD) { return; }
+
+    memset(counts[stat_index], 0, sizeof(counts[stat_index]));
+}
+
+/* zero all of the counts */
+void msg_stat_reset(void)
+{
+    memset(counts, 0, sizeof(counts));
+}
+
+/* print one line per non-empty counter */
+void msg_stat_print(ddprintf_t *fn, FILE *f)
+{
+    int i, j, k;
+
+    fn(f, "message counts (rates per second):\n");
+    fn(f, "    dev       dir  type                                  "
+            "frames        bytes   fps      Bps\n");
+
+    for (i = 0; i < io_stat_count; i++) {
+        for (j = 0; j < MSG_STAT_DIRS; j++) {
+            for (k = 0; k < MSG_STAT_TYPES; k++) {
+                msg_count_t *c = &counts[i][j][k];
+
+                if (c->frames == 0) { continue; }
+
+                fn(f, "    %-8s  %-4s %-34s %9llu %12llu %5.1f %8.0f\n",
+                        io_stat[i].device_name, dir_names[j], type_name(k),
+                        c->frames, c->bytes, c->frame_rate, c->byte_rate);
+            }
+        }
+    }
+}
+
+/* write the counts to the cloud status page as an html table */
+void msg_stat_html(FILE *f)
+{
+    int i, j, k;
+
+    fprintf(f, "<p>\n");
+    fprintf(f, "<h3>\n");
+    fprintf(f, "Frames and bytes by message type\n");
+    fprintf(f, "<br>\n");
+    fprintf(f, "(rates per second, averaged over %.0f seconds)\n",
+            MSG_STAT_TAU);
+    fprintf(f, "</h3>\n");
+
+    fprintf(f, "<table frame=box rules=all>\n");
+    fprintf(f, "    <tr>\n");
+    fprintf(f, "        <td> device </td> <td> dir </td> <td> type </td> "
+            "<td> frames </td> <td> bytes </td> <td> frames/s </td> "
+            "<td> bytes/s </td>\n");
+    fprintf(f, "    </tr>\n");
+
+    for (i = 0; i < io_stat_count; i++) {
+        for (j = 0; j < MSG_STAT_DIRS; j++) {
+            for (k = 0; k < MSG_STAT_TYPES; k++) {
+                msg_count_t *c = &counts[i][j][k];
+
+                if (c->frames == 0) { continue; }
+
+                fprintf(f, "    <tr>\n");
+                fprintf(f, "        <td> %s </td> <td> %s </td> "
+                        "<td> %s </td> <td> %llu </td> <td> %llu </td> "
+                        "<td> %.1f </td> <td> %.0f </td>\n",
+                        io_stat[i].device_name, dir_names[j], type_name(k),
+                        c->frames, c->bytes, c->frame_rate, c->byte_rate);
+                fprintf(f, "    </tr>\n");
+            }
+        }
+    }
+
+    fprintf(f, "</table>\n");
+}
+
+/* write the counts to MSG_STAT_FILE, one whitespace-separated line
+ * per non-empty counter:
+ *     device direction type frames bytes frames_per_sec bytes_per_sec
+ * the file is written to a temporary name and renamed, so a reader never
+ * sees a partial snapshot.
+ */
+void msg_stat_snapshot(void)
+{
+    char *tmp_name = MSG_STAT_FILE ".tmp";
+    int i, j, k;
+
+    FILE *f = fopen(tmp_name, "w");
+    if (f == NULL) {
+        ddprintf("msg_stat_snapshot; could not open %s:  %s\n",
+                tmp_name, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "# device dir type frames bytes fps Bps\n");
+
+    for (i = 0; i < io_stat_count; i++) {
+        for (j = 0; j < MSG_STAT_DIRS; j++) {
+            for (k = 0; k < MSG_STAT_TYPES; k++) {
+                msg_count_t *c = &counts[i][j][k];
+
+                if (c->frames == 0) { continue; }
+
+                fprintf(f, "%s %s %s %llu %llu %.3f %.1f\n",
+                        io_stat[i].device_name, dir_names[j], type_name(k),
+                        c->frames, c->bytes, c->frame_rate, c->byte_rate);
+            }
+        }
+    }
+
+    if (fclose(f) != 0) {
+        ddprintf("msg_stat_snapshot; could not fclose %s:  %s\n",
+                tmp_name, strerror(errno));
+        return;
+    }
+
+    if (rename(tmp_name, MSG_STAT_FILE) != 0) {
+        ddprintf("msg_stat_snapshot; unable to rename %s to %s:  %s\n",
+                tmp_name, MSG_STAT_FILE, strerror(errno));
+    }
+}
@@ -0,0 +1,58 @@
+/* msg_stat.h - frame and byte counts by message type and device
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef MSG_STAT_H
+#define MSG_STAT_H
+
+#include <stdio.h>
+#include "util.h"
+#include "cloud_msg_data.h"
+
+/* client traffic (wrapped client messages and frames to and from the
+ * local interfaces) is counted in its own row, after the cloud message
+ * types.
+ */
+#define MSG_STAT_DATA MESSAGE_TYPE_COUNT
+#define MSG_STAT_TYPES (MESSAGE_TYPE_COUNT + 1)
+
+typedef enum {
+    msg_stat_recv,
+    msg_stat_send,
+    MSG_STAT_DIRS,
+} msg_stat_dir_t;
+
+/* time constant of the rate averages, in seconds */
+#define MSG_STAT_TAU 10.0
+
+/* machine-readable snapshot of the counters */
+#define MSG_STAT_FILE "/tmp/msg_stat.txt"
+
+typedef struct {
+    unsigned long long frames, bytes;
+
+    /* counts at the last rate update */
+    unsigned long long last_frames, last_bytes;
+
+    /* exponentially weighted moving averages, per second */
+    double frame_rate, byte_rate;
+} msg_count_t;
+
+extern void msg_stat_count(int stat_index, msg_stat_dir_t dir, int type,
+        int bytes);
+extern void msg_stat_update_rates(void);
+extern void msg_stat_clear(int stat_index);
+extern void msg_stat_reset(void);
+extern void msg_stat_print(ddprintf_t *fn, FILE *f);
+extern void msg_stat_html(FILE *f);
+extern void msg_stat_snapshot(void);
+
+#endif
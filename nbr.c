@@ -22,6 +22,7 @@ static const char Version[] = "Version "
 #include "print.h"
 #include "device.h"
 #include "nbr.h"
+#include "journal.h"
 
 /* devices from which we are receiving beacons.
  * (regular beacons, not stp beacons.  this info is gotten from the wds
@@ -91,12 +92,12 @@ char check_nbr_devices()
 
     #ifdef WRT54G
         if (ad_hoc_mode) {
-            wds = fopen(sig_strength_fname, "r");
+            wds = journal_fopen(sig_strength_fname);
         } else {
-            wds = fopen(wds_file, "r");
+            wds = journal_fopen(wds_file);
         }
     #else
-        wds = fopen(wds_file, "r");
+        wds = journal_fopen(wds_file);
     #endif
 
     if (wds == NULL) {
@@ -150,7 +151,7 @@ char check_nbr_devices()
      */
     if (eth_device_name != 0) {
 
-        eth = fopen(eth_fname, "r");
+        eth = journal_fopen(eth_fname);
         if (eth == NULL) {
             ddprintf("check_eth_devices:  could not open %s\n",
                     eth_fname);
@@ -357,7 +358,7 @@ void update_nbr_signal_strength()
         }
     }
 
-    ap = fopen(sig_strength_fname, "r");
+    ap = journal_fopen(sig_strength_fname);
     if (ap == NULL) {
         ddprintf("update_nbr_signal_strength; could not open ap file:  %s\n",
                 strerror(errno));
@@ -0,0 +1,414 @@
+/* pcap_file.c - write and read pcap and pcapng capture files
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* capture files for ll_dump -w and -f, and merge_cloud's tap.
+ *
+ * pcap files have nanosecond timestamps and no interface information.
+ * pcapng files have one interface description per name given to
+ * pcap_file_add_if(), nanosecond timestamps, and optionally a comment and
+ * a direction on each frame.  interfaces can be added after frames have
+ * been written; each new file of a rotation starts with all of them.
+ *
+ * only files in our own byte order are read.
+ */
+
+#include <sys/types.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "pcap_file.h"
+
+/* write a pcapng option:  code, length, value padded to four bytes */
+static int put_option(FILE *f, int code, void *value, int len)
+{
+    unsigned short hdr[2];
+    static byte zero[4];
+    int pad = (4 - len % 4) % 4;
+
+    hdr[0] = code;
+    hdr[1] = len;
+    fwrite(hdr, sizeof(hdr), 1, f);
+    fwrite(value, 1, len, f);
+    fwrite(zero, 1, pad, f);
+
+    return sizeof(hdr) + len + pad;
+}
+
+static int option_len(int len)
+{
+    return 4 + len + (4 - len % 4) % 4;
+}
+
+static void write_idb(pcap_file_t *p, char *name)
+{
+    byte tsresol = 9;   /* nanoseconds */
+    unsigned int idb[4];
+    int len;
+
+    len = sizeof(idb) + option_len(strlen(name)) + option_len(1) + 4 + 4;
+    idb[0] = PCAPNG_IDB;
+    idb[1] = len;
+    idb[2] = LINKTYPE_ETHERNET;
+    idb[3] = p->snaplen;
+    fwrite(idb, sizeof(idb), 1, p->f);
+    put_option(p->f, PCAPNG_OPT_IF_NAME, name, strlen(name));
+    put_option(p->f, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+    put_option(p->f, PCAPNG_OPT_END, NULL, 0);
+    fwrite(&len, sizeof(len), 1, p->f);
+    p->bytes += len;
+}
+
+/* start the next file.  return 0 on success, -1 otherwise. */
+static int open_file(pcap_file_t *p)
+{
+    char fname[PATH_MAX];
+    int i;
+
+    if (p->rotate_bytes > 0 || p->rotate_secs > 0) {
+        snprintf(fname, sizeof(fname), "%s.%d", p->fname, p->index);
+    } else {
+        copy_string(fname, p->fname, sizeof(fname));
+    }
+
+    p->f = fopen(fname, "w");
+    if (p->f == NULL) {
+        fprintf(stderr, "could not open '%s':  %s\n", fname, strerror(errno));
+        return -1;
+    }
+    setvbuf(p->f, p->buf, _IOFBF, PCAP_BUF_LEN);
+
+    p->opened = time(NULL);
+
+    if (!p->pcapng) {
+        unsigned int hdr[6];
+
+        hdr[0] = PCAP_MAGIC_NSEC;
+        hdr[1] = 2 | (4 << 16);     /* version 2.4 */
+        hdr[2] = 0;                 /* timezone */
+        hdr[3] = 0;                 /* timestamp accuracy */
+        hdr[4] = p->snaplen;
+        hdr[5] = LINKTYPE_ETHERNET;
+        fwrite(hdr, sizeof(hdr), 1, p->f);
+        p->bytes = sizeof(hdr);
+        return 0;
+    }
+
+    {
+        unsigned int shb[7];
+
+        shb[0] = PCAPNG_SHB;
+        shb[1] = sizeof(shb);
+        shb[2] = PCAPNG_BYTE_ORDER;
+        shb[3] = 1;                 /* version 1.0 */
+        shb[4] = shb[5] = 0xffffffff;   /* section length unknown */
+        shb[6] = sizeof(shb);
+        fwrite(shb, sizeof(shb), 1, p->f);
+        p->bytes = sizeof(shb);
+    }
+
+    for (i = 0; i < p->if_count; i++) {
+        write_idb(p, p->if_names[i]);
+    }
+
+    return 0;
+}
+
+/* set up p; the first file is created by the first pcap_file_write().
+ * the caller may set the rotate_ fields before then.
+ */
+void pcap_file_init(pcap_file_t *p, char *fname, bool_t pcapng, int snaplen)
+{
+    memset(p, 0, sizeof(*p));
+    p->fname = fname;
+    p->pcapng = pcapng;
+    p->snaplen = snaplen;
+}
+
+/* add an interface, and return its index for pcap_file_write(), or -1 if
+ * there are too many.
+ */
+int pcap_file_add_if(pcap_file_t *p, char *name)
+{
+    if (p->if_count >= PCAP_MAX_IF) { return -1; }
+
+    p->if_names[p->if_count] = strdup(name);
+
+    if (p->f != NULL && p->pcapng) {
+        write_idb(p, name);
+    }
+
+    return p->if_count++;
+}
+
+/* write one frame, starting a new file first if it's time.  flags is
+ * PCAP_INBOUND, PCAP_OUTBOUND or 0, and it and comment (if not null) are
+ * only written to pcapng files.  return 0 on success, -1 otherwise.
+ */
+int pcap_file_write(pcap_file_t *p, int dev_index, byte *frame, int caplen,
+        int len, struct timespec *ts, int flags, char *comment)
+{
+    static byte zero[4];
+
+    if (p->f == NULL && open_file(p) != 0) { return -1; }
+
+    if ((p->rotate_bytes > 0 && p->bytes + caplen > p->rotate_bytes)
+        || (p->rotate_secs > 0 && ts->tv_sec >= p->opened + p->rotate_secs))
+    {
+        fclose(p->f);
+        p->f = NULL;
+        p->index++;
+        if (p->rotate_files > 0 && p->index >= p->rotate_files) {
+            p->index = 0;
+        }
+        if (open_file(p) != 0) { return -1; }
+    }
+
+    if (!p->pcapng) {
+        unsigned int hdr[4];
+
+        hdr[0] = ts->tv_sec;
+        hdr[1] = ts->tv_nsec;
+        hdr[2] = caplen;
+        hdr[3] = len;
+        fwrite(hdr, sizeof(hdr), 1, p->f);
+        fwrite(frame, 1, caplen, p->f);
+        p->bytes += sizeof(hdr) + caplen;
+
+    } else {
+        unsigned long long t = ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+        int pad = (4 - caplen % 4) % 4;
+        unsigned int epb[7];
+        int block_len;
+
+        block_len = sizeof(epb) + caplen + pad + 4;
+        if (flags != 0) {
+            block_len += option_len(4);
+        }
+        if (comment != NULL) {
+            block_len += option_len(strlen(comment));
+        }
+        if (flags != 0 || comment != NULL) {
+            block_len += 4;
+        }
+
+        epb[0] = PCAPNG_EPB;
+        epb[1] = block_len;
+        epb[2] = dev_index;
+        epb[3] = t >> 32;
+        epb[4] = t & 0xffffffff;
+        epb[5] = caplen;
+        epb[6] = len;
+        fwrite(epb, sizeof(epb), 1, p->f);
+        fwrite(frame, 1, caplen, p->f);
+        fwrite(zero, 1, pad, p->f);
+        if (flags != 0) {
+            unsigned int epb_flags = flags;
+            put_option(p->f, PCAPNG_OPT_EPB_FLAGS, &epb_flags,
+                    sizeof(epb_flags));
+        }
+        if (comment != NULL) {
+            put_option(p->f, PCAPNG_OPT_COMMENT, comment, strlen(comment));
+        }
+        if (flags != 0 || comment != NULL) {
+            put_option(p->f, PCAPNG_OPT_END, NULL, 0);
+        }
+        fwrite(&block_len, sizeof(block_len), 1, p->f);
+        p->bytes += block_len;
+    }
+
+    return 0;
+}
+
+void pcap_file_close(pcap_file_t *p)
+{
+    int i;
+
+    if (p->f != NULL) {
+        fclose(p->f);
+        p->f = NULL;
+    }
+
+    for (i = 0; i < p->if_count; i++) {
+        free(p->if_names[i]);
+    }
+    p->if_count = 0;
+}
+
+/* return 0 on success, -1 otherwise */
+int pcap_reader_open(pcap_reader_t *r, char *fname)
+{
+    memset(r, 0, sizeof(*r));
+
+    r->f = fopen(fname, "r");
+    if (r->f == NULL) {
+        fprintf(stderr, "could not open '%s':  %s\n", fname, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* read the next frame into buf.  return its captured length, or -1 at the
+ * end of the file.
+ */
+int pcap_reader_next(pcap_reader_t *r, byte *buf, int buf_len,
+        int *dev_index, int *len, struct timespec *ts)
+{
+    FILE *f = r->f;
+    unsigned int hdr[4];
+
+    if (!r->started) {
+        unsigned int magic;
+
+        r->started = true;
+        if (fread(&magic, sizeof(magic), 1, f) != 1) { return -1; }
+
+        if (magic == PCAP_MAGIC_NSEC || magic == PCAP_MAGIC_USEC) {
+            unsigned int rest[5];
+            r->pcapng = false;
+            r->nsec = (magic == PCAP_MAGIC_NSEC);
+            if (fread(rest, sizeof(rest), 1, f) != 1) { return -1; }
+            if (rest[4] != LINKTYPE_ETHERNET) {
+                fprintf(stderr, "not an ethernet capture\n");
+                return -1;
+            }
+
+        } else if (magic == PCAPNG_SHB) {
+            r->pcapng = true;
+            rewind(f);
+
+        } else {
+            fprintf(stderr, "not a pcap or pcapng file (or byte-swapped)\n");
+            return -1;
+        }
+    }
+
+    if (!r->pcapng) {
+        int caplen;
+
+        if (fread(hdr, sizeof(hdr), 1, f) != 1) { return -1; }
+
+        caplen = hdr[2];
+        if (caplen > buf_len) {
+            fprintf(stderr, "frame too long (%d bytes)\n", caplen);
+            return -1;
+        }
+        if (fread(buf, 1, caplen, f) != (size_t) caplen) { return -1; }
+
+        ts->tv_sec = hdr[0];
+        ts->tv_nsec = r->nsec ? hdr[1] : hdr[1] * 1000;
+        *len = hdr[3];
+        *dev_index = 0;
+
+        return caplen;
+    }
+
+    /* pcapng; skip blocks other than enhanced packet blocks.  we assume
+     * nanosecond timestamps, as we write them.
+     */
+    while (true) {
+        unsigned int type_len[2];
+        unsigned int epb[5];
+        int caplen;
+
+        if (fread(type_len, sizeof(type_len), 1, f) != 1) { return -1; }
+
+        if (type_len[0] == PCAPNG_SHB) {
+            unsigned int order;
+            if (fread(&order, sizeof(order), 1, f) != 1) { return -1; }
+            if (order != PCAPNG_BYTE_ORDER) {
+                fprintf(stderr, "byte-swapped pcapng is not supported\n");
+                return -1;
+            }
+            fseek(f, type_len[1] - 12, SEEK_CUR);
+            continue;
+        }
+
+        if (type_len[0] != PCAPNG_EPB) {
+            fseek(f, type_len[1] - 8, SEEK_CUR);
+            continue;
+        }
+
+        if (fread(epb, sizeof(epb), 1, f) != 1) { return -1; }
+
+        caplen = epb[3];
+        if (caplen > buf_len) {
+            fprintf(stderr, "frame too long (%d bytes)\n", caplen);
+            return -1;
+        }
+        if (fread(buf, 1, caplen, f) != (size_t) caplen) { return -1; }
+
+        /* options, and the trailing length */
+        r->comment[0] = '\0';
+        r->flags = 0;
+        {
+            int left = type_len[1] - 28 - caplen - 4;
+            int pad = (4 - caplen % 4) % 4;
+
+            fseek(f, pad, SEEK_CUR);
+            left -= pad;
+
+            while (left >= 4) {
+                unsigned short opt[2];
+                int opt_len;
+
+                if (fread(opt, sizeof(opt), 1, f) != 1) { return -1; }
+                opt_len = opt[1] + (4 - opt[1] % 4) % 4;
+                left -= 4 + opt_len;
+                if (opt[0] == PCAPNG_OPT_END) { break; }
+
+                if (opt[0] == PCAPNG_OPT_COMMENT
+                    && opt[1] < PCAP_COMMENT_LEN)
+                {
+                    if (fread(r->comment, 1, opt_len, f)
+                        != (size_t) opt_len)
+                    { return -1; }
+                    r->comment[opt[1]] = '\0';
+
+                } else if (opt[0] == PCAPNG_OPT_EPB_FLAGS && opt[1] == 4) {
+                    if (fread(&r->flags, 4, 1, f) != 1) { return -1; }
+
+                } else {
+                    fseek(f, opt_len, SEEK_CUR);
+                }
+            }
+
+            fseek(f, left + 4, SEEK_CUR);
+        }
+
+        {
+            unsigned long long t = ((unsigned long long) epb[1] << 32)
+                    | epb[2];
+            ts->tv_sec = t / 1000000000ULL;
+            ts->tv_nsec = t % 1000000000ULL;
+        }
+        *len = epb[4];
+        *dev_index = epb[0];
+
+        return caplen;
+    }
+}
+
+void pcap_reader_close(pcap_reader_t *r)
+{
+    if (r->f != NULL) {
+        fclose(r->f);
+        r->f = NULL;
+    }
+}
@@ -0,0 +1,92 @@
+/* pcap_file.h - write and read pcap and pcapng capture files
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef PCAP_FILE_H
+#define PCAP_FILE_H
+
+#include <stdio.h>
+#include <time.h>
+#include "util.h"
+
+/* link type for ethernet, in pcap and pcapng headers */
+#define LINKTYPE_ETHERNET 1
+
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 1
+#define PCAPNG_EPB 6
+#define PCAPNG_BYTE_ORDER 0x1a2b3c4d
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+
+/* epb_flags direction bits */
+#define PCAP_INBOUND 1
+#define PCAP_OUTBOUND 2
+
+#define PCAP_MAX_IF 32
+#define PCAP_BUF_LEN (64 * 1024)
+
+/* an output file, and when to move on to the next one */
+typedef struct {
+    char *fname;
+    bool_t pcapng;
+    int snaplen;
+
+    /* with either of these, files are fname.0, fname.1, ...; with
+     * rotate_files, at most that many, reusing the names.
+     */
+    long long rotate_bytes;
+    int rotate_secs;
+    int rotate_files;
+
+    /* pcapng interface descriptions; a frame's dev_index is its index
+     * here.
+     */
+    char *if_names[PCAP_MAX_IF];
+    int if_count;
+
+    FILE *f;
+    int index;
+    long long bytes;
+    time_t opened;
+    char buf[PCAP_BUF_LEN];
+} pcap_file_t;
+
+/* an input file, pcap or pcapng */
+#define PCAP_COMMENT_LEN 256
+typedef struct {
+    FILE *f;
+    bool_t started, pcapng, nsec;
+
+    /* the last frame's pcapng comment ("" if none) and epb_flags */
+    char comment[PCAP_COMMENT_LEN];
+    unsigned int flags;
+} pcap_reader_t;
+
+extern void pcap_file_init(pcap_file_t *p, char *fname, bool_t pcapng,
+        int snaplen);
+extern int pcap_file_add_if(pcap_file_t *p, char *name);
+extern int pcap_file_write(pcap_file_t *p, int dev_index, byte *frame,
+        int caplen, int len, struct timespec *ts, int flags, char *comment);
+extern void pcap_file_close(pcap_file_t *p);
+
+extern int pcap_reader_open(pcap_reader_t *r, char *fname);
+extern int pcap_reader_next(pcap_reader_t *r, byte *buf, int buf_len,
+        int *dev_index, int *len, struct timespec *ts);
+extern void pcap_reader_close(pcap_reader_t *r);
+
+#endif
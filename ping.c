@@ -24,6 +24,7 @@ static const char Version[] = "Version "
 #include "timer.h"
 #include "cloud_msg.h"
 #include "device.h"
+#include "rtt.h"
 
 /* this is a light-weight message that sometimes is sent even if we sent
  * no ping out.
@@ -38,6 +39,10 @@ void process_ping_response_msg(message_t *message, int device_index)
         wrt_util_update_time(sender);
     }
 
+    if (sender != NULL) {
+        rtt_process_ping(sender, &message->v.ping);
+    }
+
     if (db[7].d) {
         ddprintf("got ping response from ");
         if (sender == NULL) {
@@ -67,10 +72,13 @@ void process_ping_msg(message_t *message, int device_index)
     }
 
     if (sender != NULL) {
+        rtt_process_ping(sender, &message->v.ping);
+
         if (db[7].d) {
             ddprintf("send response..\n");
         }
         response.message_type = ping_response_msg;
+        rtt_fill_ping(&response.v.ping);
         mac_copy(response.dest, sender);
         send_cloud_message(&response);
     } else {
@@ -96,6 +104,7 @@ void do_ping_neighbors()
     if (!db[46].d) { return; }
 
     message.message_type = ping_response_msg;
+    rtt_fill_ping(&message.v.ping);
 
      mac_copy(message.dest, mac_address_bcast);
      send_cloud_message(&message);
@@ -126,8 +135,8 @@ void send_ping(char *buf)
     }
 
     message.message_type = ping_msg;
-    msg_len = ((byte *) &message.message_type)
-            + sizeof(message.message_type)
+    rtt_fill_ping(&message.v.ping);
+    msg_len = ((byte *) &message.v.ping.echo[message.v.ping.echo_count])
             - ((byte *) &message);
 
     ddprintf("pinging device_list[%d]:  ", device_index);
@@ -148,6 +157,7 @@ void send_nbr_pings()
 
     memset(&message, 0, sizeof(message));
     message.message_type = ping_msg;
+    rtt_fill_ping(&message.v.ping);
 
     for (i = 0; i < nbr_device_list_count; i++) {
         if (db[7].d) {
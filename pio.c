@@ -21,6 +21,13 @@ static const char Version[] = "Version "
  * But, having development machine-based simulation infrastructure seems
  * like a very good idea, so let's keep this stuff around until someone
  * gets around to updating it.
+ *
+ * A pio can instead be a ring in a memory-mapped regular file, shared by
+ * one writer and one reader (see pio_ring_create()).  Messages are copied
+ * straight into and out of the shared memory, so there are no system calls
+ * per message; the reader only sleeps on (and the writer only signals) an
+ * eventfd when the ring has run dry.  A message that doesn't fit is dropped
+ * and counted in the ring, instead of being discarded later by the reader.
  */
 
 #include <sys/time.h>
@@ -33,9 +40,16 @@ static const char Version[] = "Version "
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#ifndef WRT54G
+#include <sys/eventfd.h>
+#include <poll.h>
+#endif
 
 #include "pio.h"
 
+static int ring_attach(pio_t *pio, char *fname, int fd);
+
 /* check that fd is the file descriptor for a named pipe, and then
  * initialize "pio" to start communicating using that named pipe.
  */
@@ -51,17 +65,26 @@ int pio_init_from_fd(pio_t *pio, char *fname, int fd)
         return(-1);
     }
 
-    if (!S_ISFIFO(stat_buf.st_mode)) {
-        fprintf(stderr, "pipe; file %s is apparently not a fifo.\n", fname);
-        return(-1);
-    }
-
     pio->bytes_in_pipe = -1;
     pio->fd = fd;
     pio->buf_len = 0;
     pio->seq = 0;
+    pio->drops = 0;
+    pio->ring = 0;
+    pio->ring_data = 0;
+    pio->event_fd = -1;
+    pio->armed = 0;
     strncpy(pio->pipe_name, fname, PATH_MAX);
 
+    if (S_ISREG(stat_buf.st_mode)) {
+        return ring_attach(pio, fname, fd);
+    }
+
+    if (!S_ISFIFO(stat_buf.st_mode)) {
+        fprintf(stderr, "pipe; file %s is apparently not a fifo.\n", fname);
+        return(-1);
+    }
+
     return 0;
 }
 
@@ -92,7 +115,7 @@ int pio_open(pio_t *pio, char *fname)
             perror("pipe; mkfifo failed");
             return(-1);
         }
-    } else if (!S_ISFIFO(stat_buf.st_mode)) {
+    } else if (!S_ISFIFO(stat_buf.st_mode) && !S_ISREG(stat_buf.st_mode)) {
         fprintf(stderr, "pipe; file %s is apparently not a fifo.\n", fname);
         return(-1);
     }
@@ -107,15 +130,352 @@ int pio_open(pio_t *pio, char *fname)
     return pio_init_from_fd(pio, fname, fd);
 }
 
+#ifndef WRT54G
+
+/* make a ring pio of "size" data bytes (rounded up to a power of 2) in the
+ * regular file fname, along with the eventfd used to wake its reader.
+ * the eventfd stays open in this process; the reader and writer of the
+ * ring must be this process or its children, which inherit it.
+ */
+int pio_ring_create(char *fname, int size)
+{
+    int fd, event_fd;
+    unsigned int ring_size = PIO_CACHE_LINE;
+    pio_ring_t *ring;
+    struct stat stat_buf;
+
+    while (ring_size < (unsigned int) size) { ring_size <<= 1; }
+
+    event_fd = eventfd(0, EFD_NONBLOCK);
+    if (event_fd == -1) {
+        fprintf(stderr, "pio_ring_create; eventfd failed:  %s\n",
+                strerror(errno));
+        return -1;
+    }
+
+    fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR|S_IWUSR);
+    if (fd == -1) {
+        fprintf(stderr, "pio_ring_create; could not open %s:  %s\n",
+                fname, strerror(errno));
+        close(event_fd);
+        return -1;
+    }
+
+    if (ftruncate(fd, sizeof(pio_ring_t) + ring_size) == -1) {
+        fprintf(stderr, "pio_ring_create; could not size %s:  %s\n",
+                fname, strerror(errno));
+        close(fd);
+        close(event_fd);
+        return -1;
+    }
+
+    ring = mmap(0, sizeof(pio_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    close(fd);
+
+    if (ring == MAP_FAILED) {
+        fprintf(stderr, "pio_ring_create; could not map %s:  %s\n",
+                fname, strerror(errno));
+        close(event_fd);
+        return -1;
+    }
+
+    fstat(event_fd, &stat_buf);
+
+    ring->size = ring_size;
+    ring->event_fd = event_fd;
+    ring->event_dev = stat_buf.st_dev;
+    ring->event_ino = stat_buf.st_ino;
+    ring->head = ring->tail = 0;
+    ring->drops = 0;
+    ring->waiting = 0;
+
+    /* last, so that nobody attaches to a half-made ring */
+    __sync_synchronize();
+    ring->magic = PIO_RING_MAGIC;
+
+    munmap(ring, sizeof(pio_ring_t));
+
+    return 0;
+}
+
+/* map the ring in the file open on fd, and find its eventfd. */
+static int ring_attach(pio_t *pio, char *fname, int fd)
+{
+    pio_ring_t *ring;
+    unsigned int size;
+    struct stat stat_buf;
+
+    ring = mmap(0, sizeof(pio_ring_t), PROT_READ, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        fprintf(stderr, "pipe; could not map %s:  %s\n", fname,
+                strerror(errno));
+        return -1;
+    }
+
+    if (ring->magic != PIO_RING_MAGIC) {
+        fprintf(stderr, "pipe; file %s is not a pio ring.\n", fname);
+        munmap(ring, sizeof(pio_ring_t));
+        return -1;
+    }
+
+    size = ring->size;
+    munmap(ring, sizeof(pio_ring_t));
+
+    ring = mmap(0, sizeof(pio_ring_t) + size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        fprintf(stderr, "pipe; could not map %s:  %s\n", fname,
+                strerror(errno));
+        return -1;
+    }
+
+    /* an eventfd can't be opened by name, so we must have inherited it. */
+    if (fstat(ring->event_fd, &stat_buf) == -1
+        || stat_buf.st_dev != ring->event_dev
+        || stat_buf.st_ino != ring->event_ino)
+    {
+        fprintf(stderr, "pipe; ring %s was not made by this process or an "
+                "ancestor; no eventfd %d\n", fname, ring->event_fd);
+        munmap(ring, sizeof(pio_ring_t) + size);
+        return -1;
+    }
+
+    pio->ring = ring;
+    pio->ring_data = (unsigned char *) (ring + 1);
+    pio->event_fd = ring->event_fd;
+
+    return 0;
+}
+
+/* wait (briefly) for and consume the writer's wakeup */
+static void ring_consume_event(pio_t *pio)
+{
+    unsigned long long count;
+    struct pollfd pfd;
+
+    if (read(pio->event_fd, &count, sizeof(count)) == sizeof(count)) {
+        return;
+    }
+
+    /* the writer has committed to the wakeup, but not written it yet */
+    pfd.fd = pio->event_fd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 1000);
+    read(pio->event_fd, &count, sizeof(count));
+}
+
+/* (reader) we found a message; stop asking to be woken up */
+static void ring_disarm(pio_t *pio)
+{
+    if (!pio->armed) { return; }
+
+    pio->armed = 0;
+
+    /* if the writer already cleared "waiting", it has signalled or is
+     * about to.  eat that wakeup now, so a later select doesn't return
+     * with nothing in the ring.
+     */
+    if (__sync_lock_test_and_set(&pio->ring->waiting, 0) == 0) {
+        ring_consume_event(pio);
+    }
+}
+
+/* (reader) non-blocking check for a message in the ring.  if there isn't
+ * one, set ring->waiting so that the writer will signal the eventfd when
+ * it adds one; the caller may then select on pio_select_fd().
+ */
+static int ring_read_ok(pio_t *pio)
+{
+    pio_ring_t *ring = pio->ring;
+
+    if (ring->head != ring->tail) {
+        ring_disarm(pio);
+        return 1;
+    }
+
+    if (!pio->armed) {
+        pio->armed = 1;
+        ring->waiting = 1;
+
+        /* either we see the writer's new head, or it sees "waiting" */
+        __sync_synchronize();
+
+        if (ring->head != ring->tail) {
+            ring_disarm(pio);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int ring_timed_read_ok(pio_t *pio, int seconds)
+{
+    struct pollfd pfd;
+
+    if (ring_read_ok(pio)) { return 1; }
+
+    pfd.fd = pio->event_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, seconds * 1000) == -1) { return -1; }
+
+    return ring_read_ok(pio);
+}
+
+/* bytes a message of n bytes takes in the ring */
+static unsigned int ring_record_len(int n)
+{
+    return (PIO_RING_HDR + n + PIO_RING_ALIGN - 1) & ~(PIO_RING_ALIGN - 1);
+}
+
+/* (writer) is there room for a message of n bytes?  leave room for a pad
+ * record if the message would run past the end of the data.
+ */
+static int ring_write_ok(pio_t *pio, int n)
+{
+    pio_ring_t *ring = pio->ring;
+    unsigned int len = ring_record_len(n);
+    unsigned int head = ring->head;
+    unsigned int to_end = ring->size - (head & (ring->size - 1));
+    unsigned int used = head - ring->tail;
+
+    if (n > 0xfffe || len > ring->size) { return -1; }
+
+    if (to_end < len) { len += to_end; }
+
+    return (ring->size - used >= len) ? 1 : 0;
+}
+
+static int ring_read(pio_t *pio, unsigned char *buf, int buf_len)
+{
+    pio_ring_t *ring = pio->ring;
+    unsigned int mask = ring->size - 1;
+    unsigned int tail = ring->tail;
+    unsigned char *rec;
+    int msg_len;
+
+    if (!ring_read_ok(pio)) { return -1; }
+
+    /* see the message the writer published along with head */
+    __sync_synchronize();
+
+    rec = &pio->ring_data[tail & mask];
+    msg_len = rec[0] << 8 | rec[1];
+
+    /* skip the unused end of the data */
+    if (msg_len == PIO_RING_PAD) {
+        tail += ring->size - (tail & mask);
+        rec = &pio->ring_data[tail & mask];
+        msg_len = rec[0] << 8 | rec[1];
+    }
+
+    if (msg_len <= buf_len) {
+        memcpy(buf, &rec[PIO_RING_HDR], msg_len);
+        pio->seq = rec[2];
+    }
+
+    /* done reading the record before the writer may reuse it */
+    __sync_synchronize();
+    ring->tail = tail + ring_record_len(msg_len);
+
+    return (msg_len <= buf_len) ? msg_len : -1;
+}
+
+static int ring_write(pio_t *pio, void *buf, int buf_len)
+{
+    pio_ring_t *ring = pio->ring;
+    unsigned int mask = ring->size - 1;
+    unsigned int head = ring->head;
+    unsigned int to_end = ring->size - (head & mask);
+    unsigned char *rec;
+    int ok = ring_write_ok(pio, buf_len);
+
+    if (ok != 1) {
+        if (ok == 0) {
+            pio->drops++;
+            ring->drops++;
+        }
+        return -1;
+    }
+
+    if (to_end < ring_record_len(buf_len)) {
+        rec = &pio->ring_data[head & mask];
+        rec[0] = rec[1] = 0xff;
+        head += to_end;
+    }
+
+    rec = &pio->ring_data[head & mask];
+    rec[0] = (buf_len >> 8) & 0xff;
+    rec[1] = buf_len & 0xff;
+    rec[2] = pio->seq++;
+    rec[3] = 0;
+    memcpy(&rec[PIO_RING_HDR], buf, buf_len);
+
+    /* publish the message, then see if the reader needs a wakeup */
+    __sync_synchronize();
+    ring->head = head + ring_record_len(buf_len);
+    __sync_synchronize();
+
+    if (ring->waiting && __sync_lock_test_and_set(&ring->waiting, 0) == 1) {
+        unsigned long long one = 1;
+        write(pio->event_fd, &one, sizeof(one));
+    }
+
+    return buf_len;
+}
+
+#else
+
+int pio_ring_create(char *fname, int size)
+{
+    fprintf(stderr, "pio_ring_create; pio rings are not supported here\n");
+    return -1;
+}
+
+static int ring_attach(pio_t *pio, char *fname, int fd)
+{
+    fprintf(stderr, "pipe; file %s is apparently not a fifo.\n", fname);
+    return -1;
+}
+
+static int ring_read_ok(pio_t *pio) { return -1; }
+static int ring_timed_read_ok(pio_t *pio, int seconds) { return -1; }
+static int ring_write_ok(pio_t *pio, int n) { return -1; }
+static int ring_read(pio_t *pio, unsigned char *buf, int buf_len)
+{
+    return -1;
+}
+static int ring_write(pio_t *pio, void *buf, int buf_len) { return -1; }
+
+#endif // WRT54G
+
+/* file descriptor to select on for input to the pio:  the named pipe,
+ * or the ring's eventfd.
+ */
+int pio_select_fd(pio_t *pio)
+{
+    return pio->ring ? pio->event_fd : pio->fd;
+}
+
 /* debug-print the state of the pio */
 void pio_print(FILE *f, pio_t *pio)
 {
     int i;
 
+    if (pio->ring) {
+        fprintf(f, "ring; %s; event fd %d; seq %d; size %u; head %u; "
+                "tail %u; waiting %u; drops %u (%u by us)\n",
+                pio->pipe_name, pio->event_fd, pio->seq, pio->ring->size,
+                pio->ring->head, pio->ring->tail, pio->ring->waiting,
+                pio->ring->drops, pio->drops);
+        return;
+    }
+
     fprintf(f, "pipe; %s; fd %d; bytes_in_pipe %d; seq %d; "
-            "buf_len %d; message <len seq> ",
+            "buf_len %d; drops %u; message <len seq> ",
             pio->pipe_name, pio->fd, pio->bytes_in_pipe, pio->seq,
-            pio->buf_len);
+            pio->buf_len, pio->drops);
 
     i = 0;
     while (i < pio->buf_len) {
@@ -162,6 +522,8 @@ static int pio_read_select(pio_t *pio, int seconds)
  */
 int pio_read_ok(pio_t *pio)
 {
+    if (pio->ring) { return ring_read_ok(pio); }
+
     if (pio->buf_len > 0) {
         return 1;
     }
@@ -175,6 +537,8 @@ int pio_read_ok(pio_t *pio)
  */
 int pio_timed_read_ok(pio_t *pio, int seconds)
 {
+    if (pio->ring) { return ring_timed_read_ok(pio, seconds); }
+
     if (pio->buf_len > 0) {
         return 1;
     }
@@ -190,6 +554,8 @@ int pio_write_ok(pio_t *pio, int n)
     struct timeval timeout = {0, 0};
     fd_set write_set;
 
+    if (pio->ring) { return ring_write_ok(pio, n); }
+
     /* for the length header */
     n += 3;
 
@@ -309,6 +675,8 @@ int pio_read(pio_t *pio, unsigned char *buf, int buf_len)
     char from_pio_buf;
     int bytes_read;
 
+    if (pio->ring) { return ring_read(pio, buf, buf_len); }
+
     if (!pio_read_ok(pio)) {
         // fprintf(stderr, "!pio_read_ok\n");
         return(-1);
@@ -356,6 +724,7 @@ int pio_read(pio_t *pio, unsigned char *buf, int buf_len)
 
             memmove(pio->buf, p, pio->buf_len - (msg_len + 3));
             pio->buf_len -= msg_len + 3;
+            pio->drops++;
         }
     }
 
@@ -454,6 +823,8 @@ int pio_write(pio_t *pio, void *buf, int buf_len)
     int result;
     short len = htons((short) buf_len);
 
+    if (pio->ring) { return ring_write(pio, buf, buf_len); }
+
     if (pio_write_ok(pio, buf_len) != 1) {
         return -1;
     }
@@ -18,6 +18,50 @@
 #define PIPE_BUF_LEN 8192
 #define PIPE_CAPACITY 4096
 
+/* a pio can also be a single-producer/single-consumer ring in a shared,
+ * memory-mapped regular file, made by pio_ring_create().  messages are
+ * PIO_RING_ALIGN-aligned records with a PIO_RING_HDR-byte header.
+ */
+#define PIO_RING_MAGIC 0x50494f52
+#define PIO_RING_SIZE 65536
+#define PIO_RING_HDR 4
+#define PIO_RING_ALIGN 4
+#define PIO_RING_PAD 0xffff
+
+/* keep the producer's and consumer's fields on separate cache lines */
+#define PIO_CACHE_LINE 64
+
+typedef struct {
+    unsigned int magic;
+
+    /* bytes of data after the header; a power of 2 */
+    unsigned int size;
+
+    /* eventfd that the producer signals when the consumer is waiting.
+     * it is the fd number in the process that made the ring, and its
+     * children inherit it; event_dev and event_ino identify it.
+     */
+    int event_fd;
+    unsigned int event_dev, event_ino;
+    unsigned char pad0[PIO_CACHE_LINE - 5 * sizeof(int)];
+
+    /* written by the producer.  head and tail are byte offsets that are
+     * never wrapped; (offset & (size - 1)) is the place in data.
+     */
+    volatile unsigned int head;
+
+    /* messages that didn't fit */
+    volatile unsigned int drops;
+    unsigned char pad1[PIO_CACHE_LINE - 2 * sizeof(int)];
+
+    /* written by the consumer */
+    volatile unsigned int tail;
+
+    /* the consumer is about to block on event_fd */
+    volatile unsigned int waiting;
+    unsigned char pad2[PIO_CACHE_LINE - 2 * sizeof(int)];
+} pio_ring_t;
+
 typedef struct {
     unsigned char seq;
     int fd;
@@ -25,6 +69,19 @@ typedef struct {
     char pipe_name[PATH_MAX];
     unsigned char buf[PIPE_BUF_LEN];
     short buf_len;
+
+    /* messages we dropped:  for a pipe, buffered messages thrown away by
+     * pio_read(); for a ring, messages pio_write() found no room for.
+     */
+    unsigned int drops;
+
+    /* non-null if this pio is a ring rather than a pipe */
+    pio_ring_t *ring;
+    unsigned char *ring_data;
+    int event_fd;
+
+    /* (consumer) we have set ring->waiting, and not yet cleared it */
+    char armed;
 } pio_t;
 
 int pio_open(pio_t *pio, char *fname);
@@ -35,5 +92,7 @@ int pio_write_ok(pio_t *pio, int n);
 int pio_read(pio_t *pio, unsigned char *buf, int buf_len);
 int pio_write(pio_t *pio, void *buf, int buf_len);
 void pio_print(FILE *f, pio_t *pio);
+int pio_select_fd(pio_t *pio);
+int pio_ring_create(char *fname, int size);
 
 #endif
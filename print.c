@@ -23,8 +23,8 @@ static const char Version[] = "Version "
 #include "cloud.h"
 #include "print.h"
 #include "com_util.h"
+#include "log_ring.h"
 
-FILE *perm_log_file = NULL;
 FILE *temp_log_file = NULL;
 
 // char *perm_log_fname = "/tmp/merge_cloud.perm_log";
@@ -33,42 +33,114 @@ bool_t eth_print_cmd = false;
 bool_t temp_print_cmd = false;
 bool_t stdout_print_cmd = false;
 
+/* the permanent log file is a fixed-size circular file (see log_ring.c).
+ * log messages are not written to it as they are generated.  they are
+ * appended to log_buf, and log_buf is copied to the file in one piece
+ * from a periodic timer (print_flush_log()).  if log_buf fills up before
+ * the next flush, we drop the message and count it rather than stalling
+ * the caller.
+ */
+#define PERM_LOG_SIZE 65536
+#define LOG_BUF_LEN 8192
+
+static log_ring_t perm_log = {-1, NULL, 0, 0};
+static char log_buf[LOG_BUF_LEN];
+static int log_buf_len = 0;
+
+/* messages (one per eprintf/ddprintf call, so usually lines) that did not
+ * fit in log_buf.  log_lines_dropped is the running total;
+ * unreported_drops is the number not yet noted in the log file itself.
+ */
+int log_lines_dropped = 0;
+static int unreported_drops = 0;
+
 /* close, clear, and re-open the permanent log file */
 static void setup_perm_log_file()
 {
     if (db[55].d) {
-        if (perm_log_file != NULL) {
-            /* sorta really hope these work, because we don't really
-             * have anywhere to log the messages at the moment.
-             */
-            if (!fclose(perm_log_file)) {
-                ddprintf("setup_perm_log_file; fclose failed:  %s.\n",
-                        strerror(errno));
-            }
-            perm_log_file = NULL;
-
-            if (!unlink(perm_log_fname)) {
-                ddprintf("setup_perm_log_file; unlink failed:  %s.\n",
-                        strerror(errno));
-            }
+        int unlink_errno = 0;
+
+        if (perm_log.base != NULL) {
+            log_ring_close(&perm_log);
+
+            if (unlink(perm_log_fname) != 0) { unlink_errno = errno; }
         }
 
+        log_buf_len = 0;
         db[55].d = false;
+
+        /* after clearing log_buf, so that it goes into the new log */
+        if (unlink_errno != 0) {
+            ddprintf("setup_perm_log_file; unlink failed:  %s.\n",
+                    strerror(unlink_errno));
+        }
     }
-    if (perm_log_file == NULL) {
-        perm_log_file = fopen(perm_log_fname, "w");
-        if (perm_log_file == NULL) {
-            ddprintf("setup_perm_log_file; fopen failed:  %s.\n",
-                    strerror(errno));
+    if (perm_log.base == NULL) {
+        if (log_ring_open(&perm_log, perm_log_fname, PERM_LOG_SIZE) != 0) {
+            /* don't ddprintf; that would just land back in log_buf */
+            fprintf(stderr, "setup_perm_log_file; log_ring_open failed:  "
+                    "%s.\n", strerror(errno));
         }
     }
 }
 
+/* save a message for the permanent log file.  never blocks; if there is
+ * no room, count the message as dropped.
+ */
+static void perm_log_append(char *msg_buf)
+{
+    int len = strlen(msg_buf);
+
+    if (log_buf_len + len > LOG_BUF_LEN) {
+        log_lines_dropped++;
+        unreported_drops++;
+        return;
+    }
+
+    memcpy(&log_buf[log_buf_len], msg_buf, len);
+    log_buf_len += len;
+}
+
+/* copy everything buffered in log_buf to the permanent log file with a
+ * single write, noting in the file how many messages were dropped since
+ * the last flush.
+ */
+void print_flush_log(void)
+{
+    char drop_buf[64];
+
+    if (log_buf_len == 0 && unreported_drops == 0) { return; }
+
+    setup_perm_log_file();
+
+    if (perm_log.base != NULL) {
+        log_ring_write(&perm_log, log_buf, log_buf_len);
+
+        if (unreported_drops > 0) {
+            snprintf(drop_buf, 64, "[%d log lines dropped]\n",
+                    unreported_drops);
+            log_ring_write(&perm_log, drop_buf, strlen(drop_buf));
+            unreported_drops = 0;
+        }
+
+        log_ring_sync(&perm_log);
+    }
+
+    log_buf_len = 0;
+}
+
+/* flush anything buffered and release the permanent log file. */
+void print_close_log(void)
+{
+    print_flush_log();
+    log_ring_close(&perm_log);
+}
+
 /* a debug printing routine that sends messages to each of the following
  * places depending on configuration:
  *
  *     - the stream f (usually stderr)
- *     - the permanent log file
+ *     - the permanent log file (buffered; see print_flush_log())
  *     - the temporary log file
  *     - over the wire via link-level communication to a development box
  */
@@ -86,12 +158,7 @@ int eprintf(FILE *f, const char *msg, ...)
     }
 
     if (db[35].d) {
-        setup_perm_log_file();
-
-        if (perm_log_file != NULL) {
-            fprintf(perm_log_file, "%s", msg_buf);
-            fflush(perm_log_file);
-        }
+        perm_log_append(msg_buf);
     }
 
     if (temp_print_cmd) {
@@ -110,7 +177,7 @@ int eprintf(FILE *f, const char *msg, ...)
  * places depending on configuration:
  *
  *     - stderr
- *     - the permanent log file
+ *     - the permanent log file (buffered; see print_flush_log())
  *     - the temporary log file
  *     - over the wire via link-level communication to a development box
  */
@@ -128,12 +195,7 @@ void ddprintf(const char *msg, ...)
     }
 
     if (db[35].d) {
-        setup_perm_log_file();
-
-        if (perm_log_file != NULL) {
-            fprintf(perm_log_file, "%s", msg_buf);
-            fflush(perm_log_file);
-        }
+        perm_log_append(msg_buf);
     }
 
     if (temp_print_cmd) {
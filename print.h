@@ -20,8 +20,11 @@ extern bool_t eth_print_cmd;
 extern bool_t temp_print_cmd;
 extern bool_t stdout_print_cmd;
 extern FILE *temp_log_file;
+extern int log_lines_dropped;
 
 int eprintf(FILE *f, const char *msg, ...) __attribute__((format(printf,2,3)));
 void ddprintf(const char *msg, ...) __attribute__((format(printf,1,2)));
+void print_flush_log(void);
+void print_close_log(void);
 
 #endif
@@ -19,6 +19,7 @@ static const char Version[] = "Version "
 #include "print.h"
 #include "random.h"
 #include "timer.h"
+#include "journal.h"
 
 /* cumulative distribution for whether to update.  in milliseconds
  * initially, scaled by MEAN_WAKEUP_TIME at initialization.
@@ -105,7 +106,7 @@ void init_random(mac_address_t my_wlan_mac_address)
 /* return a discrete uniform random deviate in the range [0 .. max-1]. */
 int discrete_unif(int max)
 {
-    long int r = random();
+    long int r = journal_random();
     double unif = (r / (double) RAND_MAX) * max;
     int retval = (int) unif;
     if (retval < 0) { retval = 0; }
@@ -118,7 +119,7 @@ int discrete_unif(int max)
  */
 double neg_exp(int mean)
 {
-    long int r = random();
+    long int r = journal_random();
     double unif = r / (double) RAND_MAX;
     return -log(unif) * (double) mean;
 }
@@ -129,7 +130,7 @@ double neg_exp(int mean)
 char random_eval(int diff, int cloud_count)
 {
     char result = 0;
-    long int r = random();
+    long int r = journal_random();
     double u = (r / (double) RAND_MAX);
     int i;
 
@@ -0,0 +1,155 @@
+/* recent_bcast.c - fingerprints of client broadcasts passed along lately
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* a box that hears a client broadcast over the air ignores it if it is
+ * one the cloud has already carried (see ignore_ad_hoc_bcast()).  we know
+ * those by fingerprint, an fnv-1a hash of the whole frame, kept for
+ * RECENT_BCAST_MSEC.  a fingerprint goes in one of two slots picked by
+ * different bits of it, the emptier or older one, so looking one up is
+ * two compares.
+ *
+ * to compile the unit test:
+ *
+ *     gcc -DUNIT_TEST -o test_recent_bcast recent_bcast.c
+ */
+
+#include <string.h>
+
+#include "util.h"
+#include "recent_bcast.h"
+
+typedef struct {
+    unsigned int fingerprint;
+    long long msec;
+} recent_bcast_t;
+
+static recent_bcast_t recent_bcasts[RECENT_BCAST_SLOTS];
+
+/* the fingerprint of a client frame; never 0, which is an empty slot */
+unsigned int recent_bcast_fingerprint(byte *frame, int len)
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    /* fnv-1a */
+    for (i = 0; i < len; i++) {
+        h = (h ^ frame[i]) * 16777619;
+    }
+
+    return h == 0 ? 1 : h;
+}
+
+/* the two slots fingerprint may be in */
+static void slots(unsigned int fingerprint, recent_bcast_t **slot_1,
+        recent_bcast_t **slot_2)
+{
+    *slot_1 = &recent_bcasts[fingerprint % RECENT_BCAST_SLOTS];
+    *slot_2 = &recent_bcasts[(fingerprint >> 16) % RECENT_BCAST_SLOTS];
+}
+
+static bool_t recent(recent_bcast_t *r, unsigned int fingerprint,
+        long long msec)
+{
+    return r->fingerprint == fingerprint
+        && msec - r->msec <= RECENT_BCAST_MSEC;
+}
+
+/* remember, as of msec milliseconds, the broadcast with this fingerprint */
+void recent_bcast_add(unsigned int fingerprint, long long msec)
+{
+    recent_bcast_t *r1, *r2, *r;
+
+    slots(fingerprint, &r1, &r2);
+
+    if (recent(r1, fingerprint, msec)) {
+        r = r1;
+    } else if (recent(r2, fingerprint, msec)) {
+        r = r2;
+    } else {
+        r = (r1->msec <= r2->msec) ? r1 : r2;
+    }
+
+    r->fingerprint = fingerprint;
+    r->msec = msec;
+}
+
+/* as of msec milliseconds, have we seen the broadcast with this fingerprint
+ * lately?
+ */
+bool_t recent_bcast_seen(unsigned int fingerprint, long long msec)
+{
+    recent_bcast_t *r1, *r2;
+
+    slots(fingerprint, &r1, &r2);
+
+    return recent(r1, fingerprint, msec) || recent(r2, fingerprint, msec);
+}
+
+#ifdef UNIT_TEST
+static int failures = 0;
+
+static void check(char *what, bool_t got, bool_t want)
+{
+    if (got != want) {
+        printf("FAILED:  %s:  got %d, want %d\n", what, got, want);
+        failures++;
+    }
+}
+
+/* play out what box x sees when box b, in radio range of x, re-sends a
+ * client broadcast to its ad-hoc clients.  x's path through the spanning
+ * tree to where the broadcast entered the cloud is longer than b's, so x
+ * hears b's raw copy before the wrapped copy reaches it.
+ */
+int main(int argc, char **argv)
+{
+    byte arp[60], other[60];
+    unsigned int f_arp, f_other;
+    long long t = 100000;
+    int i;
+
+    memset(arp, 0xff, 6);
+    for (i = 6; i < (int) sizeof(arp); i++) { arp[i] = (byte) i; }
+    memcpy(other, arp, sizeof(other));
+    other[41] ^= 1;
+
+    f_arp = recent_bcast_fingerprint(arp, sizeof(arp));
+    f_other = recent_bcast_fingerprint(other, sizeof(other));
+    check("different frames, different fingerprints", f_arp != f_other, true);
+
+    /* without b's hint, x would take b's raw copy for a client frame */
+    check("raw copy before anything", recent_bcast_seen(f_arp, t), false);
+
+    /* b sends its hint over the air, then the raw copy */
+    recent_bcast_add(f_arp, t);
+    check("raw copy after the hint", recent_bcast_seen(f_arp, t + 2), true);
+    check("another frame after the hint",
+            recent_bcast_seen(f_other, t + 2), false);
+
+    /* the wrapped copy reaches x over the cloud; x passes it along and
+     * remembers it again
+     */
+    recent_bcast_add(f_arp, t + 40);
+    check("raw copy from a third box",
+            recent_bcast_seen(f_arp, t + 60), true);
+
+    /* the client's identical arp retry a second later is a new frame */
+    check("retry a second later", recent_bcast_seen(f_arp, t + 1040), false);
+
+    if (failures == 0) { printf("test_recent_bcast:  ok\n"); }
+
+    return failures == 0 ? 0 : 1;
+}
+#endif
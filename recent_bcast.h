@@ -0,0 +1,33 @@
+/* recent_bcast.h - fingerprints of client broadcasts passed along lately
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef RECENT_BCAST_H
+#define RECENT_BCAST_H
+
+#include "util.h"
+
+/* in milliseconds; how long we recognize a client broadcast, so as to
+ * ignore copies of it that other boxes send to their ad-hoc clients.
+ * this only has to cover the time between our getting the broadcast (or
+ * the hint for it) and hearing another box's copy, so it is kept well
+ * short of the usual second between a client's identical arp retries.
+ */
+#define RECENT_BCAST_MSEC 500
+
+/* how many of them we can keep track of */
+#define RECENT_BCAST_SLOTS 256
+
+extern unsigned int recent_bcast_fingerprint(byte *frame, int len);
+extern void recent_bcast_add(unsigned int fingerprint, long long msec);
+extern bool_t recent_bcast_seen(unsigned int fingerprint, long long msec);
+
+#endif
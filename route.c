@@ -0,0 +1,253 @@
+/* route.c - link-state routing of unicast client frames through the cloud
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* bcast_forward_message() sends every client frame over the whole spanning
+ * tree, so every box carries every frame.  with db[71] set, a unicast
+ * client frame whose destination we know the cloud box for goes only
+ * along the shortest path to that box instead.
+ *
+ * the stp beacons already carry each box's links and their signal
+ * strengths (see stp_link_matrix()), so every box can run dijkstra over
+ * the whole cloud.  a link costs ROUTE_HOP_COST plus however far its
+ * signal strength is below max_sig_strength.  each box only picks the
+ * next hop; the boxes along the way do the same with their own view.
+ *
+ * the cloud box for a client comes from the bridge table (bridge.c).
+ * the originator puts the box it wants in the wrapped message's dest
+ * field and sets hops to ROUTE_MAX_HOPS; dest stays zero for a frame that
+ * is flooded as before.  the box named in dest sends the frame out its
+ * own client interfaces and no further.
+ *
+ * wired links are left out of the graph, since bcast_forward_message()
+ * sends client frames to wired neighbors unwrapped.  if there is no
+ * route, or the next hop has no wds (or ad-hoc) device, the frame is
+ * flooded after all.
+ */
+
+#include <string.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+
+#include "cloud.h"
+#include "cloud_msg.h"
+#include "device.h"
+#include "nbr.h"
+#include "stp_beacon.h"
+#include "ad_hoc_client.h"
+#include "print.h"
+#include "bridge.h"
+#include "route.h"
+
+/* cost of a link with max_sig_strength */
+#define ROUTE_HOP_COST 32
+
+#define ROUTE_INFINITY 0x7fffffff
+
+static stp_link_matrix_t links, prev_links;
+static bool_t prev_valid = false;
+
+/* for each box in links, its distance from us and the box we send to
+ * first to get there (-1 if there's no route)
+ */
+static int cost[STP_MATRIX_MAX];
+static int next_hop[STP_MATRIX_MAX];
+
+static int routed_count, delivered_count, flooded_count, dropped_count;
+
+/* dijkstra from us (box 0) over the wireless links the stp beacons
+ * tell us about.  called after each round of beacons; skipped if the
+ * links haven't changed since last time.
+ */
+void route_update(void)
+{
+    bool_t done[STP_MATRIX_MAX];
+    int i, a, b;
+
+    stp_link_matrix(&links);
+
+    if (prev_valid && memcmp(&links, &prev_links, sizeof(links)) == 0) {
+        return;
+    }
+    prev_links = links;
+    prev_valid = true;
+
+    for (i = 0; i < links.box_count; i++) {
+        cost[i] = ROUTE_INFINITY;
+        next_hop[i] = -1;
+        done[i] = false;
+    }
+    cost[0] = 0;
+
+    while (true) {
+        a = -1;
+        for (i = 0; i < links.box_count; i++) {
+            if (!done[i] && cost[i] != ROUTE_INFINITY
+                && (a == -1 || cost[i] < cost[a]))
+            { a = i; }
+        }
+        if (a == -1) { break; }
+        done[a] = true;
+
+        for (b = 0; b < links.box_count; b++) {
+            int w = links.weight[a][b];
+            int c;
+
+            if (done[b] || w == 0 || links.wired[a][b]) { continue; }
+
+            c = cost[a] + ROUTE_HOP_COST + (max_sig_strength - w);
+            if (c < cost[b]) {
+                cost[b] = c;
+                next_hop[b] = (a == 0) ? b : next_hop[a];
+            }
+        }
+    }
+
+    if (db[72].d) {
+        ddprintf("route_update; %d boxes\n", links.box_count);
+        route_print(eprintf, stderr);
+    }
+} /* route_update */
+
+/* the wds (or ad-hoc) device to the given neighbor, or -1 */
+static int find_device(mac_address_t nbr)
+{
+    int j;
+
+    for (j = 0; j < device_list_count; j++) {
+        if ((device_list[j].device_type == device_type_wds
+            || (ad_hoc_mode
+                && device_list[j].device_type == device_type_ad_hoc))
+            && mac_equal(device_list[j].mac_address, nbr))
+        {
+            return j;
+        }
+    }
+
+    return -1;
+}
+
+/* we are the box the frame was routed to; send it out our own client
+ * interfaces, as bcast_forward_message() does at the end.
+ */
+static void deliver(message_t *message, int msg_len, int dev)
+{
+    if (eth_device_name != NULL && !db[20].d
+        && device_list[dev].device_type != device_type_eth)
+    {
+        send_to_interface(message->v.msg.msg_body, msg_len - wrapper_len,
+                device_type_eth);
+    }
+
+    if (!db[36].d && device_list[dev].device_type != device_type_wlan) {
+        send_to_interface(message->v.msg.msg_body, msg_len - wrapper_len,
+                device_type_wlan);
+    }
+
+    if (ad_hoc_mode && db[50].d) {
+        ad_hoc_client_forward_msg(message, msg_len, dev);
+    }
+}
+
+/* called by bcast_forward_message() for every new client frame, after it
+ * has filled in the originator fields of a locally originated one and
+ * passed it to bridge_learn().
+ * returns true if the frame has been routed (or delivered, or dropped),
+ * false if it should be flooded as usual.
+ */
+bool_t route_forward(message_t *message, int msg_len, int dev,
+        bool_t originated_locally)
+{
+    struct ethhdr *client = (struct ethhdr *) message->v.msg.msg_body;
+    byte *box;
+    int b, j;
+
+    if (msg_len < wrapper_len + (int) sizeof(struct ethhdr)) { return false; }
+
+    if (originated_locally) {
+        if (client->h_dest[0] & 1) { return false; }
+
+        box = bridge_box(client->h_dest);
+        if (box == NULL || mac_equal(box, my_wlan_mac_address)) {
+            return false;
+        }
+        mac_copy(message->dest, box);
+        message->v.msg.hops = ROUTE_MAX_HOPS;
+
+    } else {
+        if (mac_equal(message->dest, mac_address_zero)) { return false; }
+
+        if (mac_equal(message->dest, my_wlan_mac_address)) {
+            if (db[72].d) {
+                ddprintf("route_forward; delivering frame from %s\n",
+                        mac_sprintf(mac_buf1, message->v.msg.originator));
+            }
+            deliver(message, msg_len, dev);
+            delivered_count++;
+            return true;
+        }
+
+        if (message->v.msg.hops == 0) {
+            if (db[72].d) {
+                ddprintf("route_forward; dropping frame for %s; out of hops\n",
+                        mac_sprintf(mac_buf1, message->dest));
+            }
+            dropped_count++;
+            return true;
+        }
+        message->v.msg.hops--;
+    }
+
+    if (!prev_valid) { route_update(); }
+
+    b = stp_link_matrix_index(&links, message->dest);
+    j = -1;
+    if (b > 0 && next_hop[b] != -1) {
+        j = find_device(links.box[next_hop[b]]);
+    }
+
+    if (j == -1 || j == dev) {
+        if (db[72].d) {
+            ddprintf("route_forward; no route to %s; flooding\n",
+                    mac_sprintf(mac_buf1, message->dest));
+        }
+        mac_copy(message->dest, mac_address_zero);
+        flooded_count++;
+        return false;
+    }
+
+    mac_copy(message->eth_header.h_dest, device_list[j].mac_address);
+    mac_copy(message->eth_header.h_source, my_wlan_mac_address);
+    send_message(message, msg_len, &device_list[j]);
+    routed_count++;
+
+    return true;
+} /* route_forward */
+
+void route_print(ddprintf_t *fn, FILE *f)
+{
+    int i;
+
+    fn(f, "routes (routed %d, delivered %d, flooded %d, dropped %d):\n",
+            routed_count, delivered_count, flooded_count, dropped_count);
+    for (i = 1; i < links.box_count; i++) {
+        if (next_hop[i] == -1) {
+            fn(f, "    %s unreachable\n", mac_sprintf(mac_buf1, links.box[i]));
+        } else {
+            fn(f, "    %s cost %4d via %s\n",
+                    mac_sprintf(mac_buf1, links.box[i]), cost[i],
+                    mac_sprintf(mac_buf2, links.box[next_hop[i]]));
+        }
+    }
+} /* route_print */
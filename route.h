@@ -0,0 +1,28 @@
+/* route.h - link-state routing of unicast client frames through the cloud
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stdio.h>
+#include "util.h"
+#include "cloud.h"
+
+/* hops a routed frame may take before it is dropped */
+#define ROUTE_MAX_HOPS 16
+
+extern void route_update(void);
+extern bool_t route_forward(message_t *message, int msg_len, int dev,
+        bool_t originated_locally);
+extern void route_print(ddprintf_t *fn, FILE *f);
+
+#endif
@@ -0,0 +1,352 @@
+/* rtt.c - round trip times to neighbors, from timestamped pings
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* every ping_msg and ping_response_msg carries the sender's clock, and
+ * echoes the clock from the latest ping it got from each neighbor along
+ * with how long it held that ping.  when a box finds its own name in an
+ * echo, the round trip is its clock now, less the echoed clock, less the
+ * time the neighbor held it.  the two boxes' clocks are never compared,
+ * and since do_ping_neighbors() broadcasts, one ping a second or so gets
+ * a sample from every neighbor at once.
+ *
+ * for each neighbor we keep a smoothed round trip time and variation as
+ * in rfc 6298 (tcp's retransmission timer) and a histogram of samples
+ * with power-of-two buckets.
+ *
+ * with db[80] set, the ack timeout, the stp beacon timeout and the lock
+ * timeouts come from these estimates rather than the constants in
+ * timer.h; for a neighbor without a good estimate they stay as they were.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "print.h"
+#include "timer.h"
+#include "rtt.h"
+
+typedef struct {
+    mac_address_t name;
+
+    /* the neighbor's clock from its latest ping, and our clock when we
+     * got it
+     */
+    unsigned int their_usec;
+    unsigned long long heard_usec;
+
+    /* our clock at the latest sample */
+    unsigned long long sample_usec;
+
+    /* rfc 6298 srtt and rttvar */
+    int srtt, rttvar;
+
+    unsigned int samples;
+    unsigned int hist[RTT_BUCKETS];
+
+} rtt_nbr_t;
+
+static rtt_nbr_t rtt_nbrs[MAX_CLOUD];
+static int rtt_nbr_count = 0;
+
+/* the time in microseconds.  this goes through checked_gettimeofday() so
+ * that a journal replays the same samples.  if the clock is set back, the
+ * differences below come out huge and are thrown away or ignored.
+ */
+static unsigned long long rtt_now(void)
+{
+    struct timeval tv;
+
+    if (!checked_gettimeofday(&tv)) { return 0; }
+
+    return ((unsigned long long) tv.tv_sec) * 1000000ULL + tv.tv_usec;
+}
+
+static rtt_nbr_t *rtt_find(mac_address_t nbr)
+{
+    int i;
+
+    for (i = 0; i < rtt_nbr_count; i++) {
+        if (mac_equal(rtt_nbrs[i].name, nbr)) { return &rtt_nbrs[i]; }
+    }
+
+    return NULL;
+}
+
+/* find nbr's entry, making one if need be.  if the table is full, the
+ * neighbor we heard from least recently loses its entry.
+ */
+static rtt_nbr_t *rtt_find_or_add(mac_address_t nbr)
+{
+    rtt_nbr_t *r = rtt_find(nbr);
+    int i;
+
+    if (r != NULL) { return r; }
+
+    if (rtt_nbr_count < MAX_CLOUD) {
+        r = &rtt_nbrs[rtt_nbr_count++];
+    } else {
+        r = &rtt_nbrs[0];
+        for (i = 1; i < rtt_nbr_count; i++) {
+            if (rtt_nbrs[i].heard_usec < r->heard_usec) { r = &rtt_nbrs[i]; }
+        }
+    }
+
+    memset(r, 0, sizeof(*r));
+    mac_copy(r->name, nbr);
+
+    return r;
+}
+
+/* stamp an outgoing ping, and echo every neighbor we got a ping from
+ * lately.
+ */
+void rtt_fill_ping(ping_msg_t *ping)
+{
+    unsigned long long now_usec = rtt_now();
+    int i;
+
+    ping->usec = (unsigned int) now_usec;
+    ping->echo_count = 0;
+
+    for (i = 0; i < rtt_nbr_count; i++) {
+        rtt_nbr_t *r = &rtt_nbrs[i];
+        ping_echo_t *e;
+
+        if (r->heard_usec == 0 || now_usec - r->heard_usec > RTT_ECHO_USEC) {
+            continue;
+        }
+
+        e = &ping->echo[ping->echo_count++];
+        mac_copy(e->name, r->name);
+        e->usec = r->their_usec;
+        e->held_usec = (unsigned int) (now_usec - r->heard_usec);
+    }
+}
+
+/* fold a round trip of rtt microseconds into r's estimate */
+static void rtt_sample(rtt_nbr_t *r, int rtt, unsigned long long now_usec)
+{
+    int bucket = 0;
+    int err;
+
+    if (r->samples == 0) {
+        r->srtt = rtt;
+        r->rttvar = rtt / 2;
+    } else {
+        err = r->srtt - rtt;
+        if (err < 0) { err = -err; }
+        r->rttvar += (err - r->rttvar) / 4;
+        r->srtt += (rtt - r->srtt) / 8;
+    }
+
+    while ((rtt >>= 1) != 0 && bucket < RTT_BUCKETS - 1) { bucket++; }
+    r->hist[bucket]++;
+
+    r->samples++;
+    r->sample_usec = now_usec;
+}
+
+/* sender sent us a ping.  remember its clock so we can echo it, and if it
+ * echoed ours, take a round trip sample.
+ */
+void rtt_process_ping(mac_address_t sender, ping_msg_t *ping)
+{
+    unsigned long long now_usec = rtt_now();
+    rtt_nbr_t *r = rtt_find_or_add(sender);
+    int i;
+
+    r->their_usec = ping->usec;
+    r->heard_usec = now_usec;
+
+    if (ping->echo_count > MAX_CLOUD) { return; }
+
+    for (i = 0; i < ping->echo_count; i++) {
+        ping_echo_t *e = &ping->echo[i];
+        unsigned int rtt;
+
+        if (!mac_equal(e->name, my_wlan_mac_address)) { continue; }
+
+        /* unsigned, so that a wrapped clock still works out */
+        rtt = (unsigned int) now_usec - e->usec - e->held_usec;
+
+        if (rtt > RTT_MAX_USEC) {
+            if (db[81].d) {
+                ddprintf("rtt_process_ping; discarding %u usec sample from ",
+                        rtt);
+                mac_dprint(eprintf, stderr, sender);
+            }
+            break;
+        }
+
+        rtt_sample(r, (int) rtt, now_usec);
+
+        if (db[81].d) {
+            ddprintf("rtt sample %u usec (held %u), srtt %d, rttvar %d from ",
+                    rtt, e->held_usec, r->srtt, r->rttvar);
+            mac_dprint(eprintf, stderr, sender);
+        }
+        break;
+    }
+}
+
+/* rfc 6298 retransmission timeout in microseconds for nbr, or -1 if we
+ * don't have a good estimate for it.
+ */
+int rtt_rto_usec(mac_address_t nbr)
+{
+    rtt_nbr_t *r = rtt_find(nbr);
+    int var;
+
+    if (r == NULL || r->samples < RTT_MIN_SAMPLES) { return -1; }
+    if (rtt_now() - r->sample_usec > RTT_STALE_USEC) { return -1; }
+
+    var = 4 * r->rttvar;
+    if (var < RTT_GRANULARITY_USEC) { var = RTT_GRANULARITY_USEC; }
+
+    return r->srtt + var;
+}
+
+/* how long to wait for acks:  the largest rto among the boxes we are
+ * waiting on.
+ */
+int rtt_ack_timeout_msec(void)
+{
+    int i;
+    int rto = -1;
+    int msec;
+
+    if (!db[80].d) { return ACK_TIMEOUT_MSEC; }
+
+    for (i = 0; i < stp_list_count; i++) {
+        int nbr_rto;
+
+        if (!stp_list[i].box.awaiting_ack) { continue; }
+
+        nbr_rto = rtt_rto_usec(stp_list[i].box.name);
+        if (nbr_rto == -1) { return ACK_TIMEOUT_MSEC; }
+        if (nbr_rto > rto) { rto = nbr_rto; }
+    }
+
+    if (rto == -1) { return ACK_TIMEOUT_MSEC; }
+
+    msec = (rto + 999) / 1000;
+    if (msec < ACK_TIMEOUT_MIN_MSEC) { msec = ACK_TIMEOUT_MIN_MSEC; }
+    if (msec > ACK_TIMEOUT_MAX_MSEC) { msec = ACK_TIMEOUT_MAX_MSEC; }
+
+    return msec;
+}
+
+/* how long to keep a beacon that came from nbr, in microseconds */
+long long rtt_stp_timeout(mac_address_t nbr)
+{
+    long long result;
+    int rto;
+
+    if (!db[80].d) { return STP_TIMEOUT; }
+
+    rto = rtt_rto_usec(nbr);
+    if (rto == -1) { return STP_TIMEOUT; }
+
+    result = STP_TIMEOUT_MIN + STP_TIMEOUT_RTOS * (long long) rto;
+
+    return result > 2 * STP_TIMEOUT ? 2 * STP_TIMEOUT : result;
+}
+
+/* how long to keep a lock involving nbr, in microseconds */
+int rtt_lock_timeout_usec(mac_address_t nbr, int fallback)
+{
+    long long result;
+    int rto;
+
+    if (!db[80].d) { return fallback; }
+
+    rto = rtt_rto_usec(nbr);
+    if (rto == -1) { return fallback; }
+
+    result = LOCK_TIMEOUT_MIN + LOCK_TIMEOUT_RTOS * (long long) rto;
+
+    return result > 2 * fallback ? 2 * fallback : (int) result;
+}
+
+/* put a human-readable version of 2^bucket microseconds into buf */
+static char *bucket_sprint(char *buf, int bucket)
+{
+    unsigned int usec = 1U << bucket;
+
+    if (usec < 1000U) {
+        sprintf(buf, "%uus", usec);
+    } else if (usec < 1000000U) {
+        sprintf(buf, "%ums", usec / 1000U);
+    } else {
+        sprintf(buf, "%us", usec / 1000000U);
+    }
+
+    return buf;
+}
+
+/* the bucket holding the sample at the given fraction of r's samples */
+static int hist_quantile(rtt_nbr_t *r, double q)
+{
+    unsigned int so_far = 0;
+    unsigned int want = (unsigned int) (q * r->samples + .5);
+    int i;
+
+    if (want == 0) { want = 1; }
+
+    for (i = 0; i < RTT_BUCKETS - 1; i++) {
+        so_far += r->hist[i];
+        if (so_far >= want) { break; }
+    }
+
+    return i;
+}
+
+/* print one line per neighbor:  the estimate, upper bounds for the median
+ * and 90th percentile, and the non-empty buckets as [log2 us]:count.
+ */
+void rtt_print(ddprintf_t *fn, FILE *f)
+{
+    char b1[16], b2[16];
+    int i, k;
+
+    fn(f, "round trip times%s:\n",
+            db[80].d ? "" : " (db[80] is off; not used for timeouts)");
+    fn(f, "    neighbor                 n    srtt  rttvar     rto"
+            "     p50     p90\n");
+
+    for (i = 0; i < rtt_nbr_count; i++) {
+        rtt_nbr_t *r = &rtt_nbrs[i];
+
+        fn(f, "    ");
+        mac_dprint_no_eoln(fn, f, r->name);
+
+        if (r->samples == 0) {
+            fn(f, "       0\n");
+            continue;
+        }
+
+        fn(f, " %7u %7d %7d %7d %7s %7s ",
+                r->samples, r->srtt, r->rttvar, rtt_rto_usec(r->name),
+                bucket_sprint(b1, hist_quantile(r, .5) + 1),
+                bucket_sprint(b2, hist_quantile(r, .9) + 1));
+
+        for (k = 0; k < RTT_BUCKETS; k++) {
+            if (r->hist[k] != 0) { fn(f, " [%d]:%u", k, r->hist[k]); }
+        }
+        fn(f, "\n");
+    }
+}
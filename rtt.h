@@ -0,0 +1,47 @@
+/* rtt.h - round trip times to neighbors, from timestamped pings
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef RTT_H
+#define RTT_H
+
+#include <stdio.h>
+#include "util.h"
+#include "mac.h"
+#include "rtt_data.h"
+
+/* bucket i counts round trips of [2^i .. 2^(i+1)) microseconds */
+#define RTT_BUCKETS 24
+
+/* samples longer than this are clock trouble or a very stale echo */
+#define RTT_MAX_USEC 10000000
+
+/* echo a neighbor's ping only if we got it this recently */
+#define RTT_ECHO_USEC 5000000
+
+/* an estimate is used for timeouts only after this many samples, and
+ * only while samples keep coming.
+ */
+#define RTT_MIN_SAMPLES 3
+#define RTT_STALE_USEC 30000000
+
+/* rto never counts variation as less than this (rfc 6298's G) */
+#define RTT_GRANULARITY_USEC 1000
+
+extern void rtt_fill_ping(ping_msg_t *ping);
+extern void rtt_process_ping(mac_address_t sender, ping_msg_t *ping);
+extern int rtt_rto_usec(mac_address_t nbr);
+extern int rtt_ack_timeout_msec(void);
+extern long long rtt_stp_timeout(mac_address_t nbr);
+extern int rtt_lock_timeout_usec(mac_address_t nbr, int fallback);
+extern void rtt_print(ddprintf_t *fn, FILE *f);
+
+#endif
@@ -0,0 +1,46 @@
+/* rtt_data.h - timestamps carried in ping messages
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef RTT_DATA_H
+#define RTT_DATA_H
+
+#include "util.h"
+#include "mac.h"
+#include "cloud_data.h"
+
+/* the latest ping we got from one neighbor, sent back to it */
+typedef struct {
+    mac_address_t name;
+
+    /* the neighbor's timestamp from that ping */
+    unsigned int usec;
+
+    /* how long we held it before sending it back */
+    unsigned int held_usec;
+
+} ping_echo_t;
+
+/* the body of ping_msg and ping_response_msg.  timestamps are the
+ * sender's clock in microseconds, mod 2^32; only differences between two
+ * readings of the same clock mean anything.
+ */
+typedef struct {
+    unsigned int usec;
+
+    /* how much of echo[] is used */
+    unsigned short echo_count;
+
+    ping_echo_t echo[MAX_CLOUD];
+
+} ping_msg_t;
+
+#endif
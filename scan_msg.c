@@ -27,6 +27,7 @@ static const char Version[] = "Version "
 #include "timer.h"
 #include "nbr.h"
 #include "scan_msg.h"
+#include "journal.h"
 
 typedef struct {
     long sec, usec;
@@ -211,7 +212,7 @@ static bool_t read_scan(FILE *f, scan_struct_t *scan)
 static void add_local_scans(void)
 {
     scan_struct_t scan;
-    FILE *f = fopen("/tmp/local_scan", "r");
+    FILE *f = journal_fopen("/tmp/local_scan");
     if (f == NULL) { return; }
 
     while (read_scan(f, &scan)) {
@@ -229,7 +230,7 @@ static void send_scan_message(void)
 {
     message_t msg;
     scan_struct_t scan;
-    FILE *f = fopen("/tmp/local_scan", "r");
+    FILE *f = journal_fopen("/tmp/local_scan");
     if (f == NULL) { return; }
 
     memset(&msg, 0, sizeof(msg));
@@ -44,6 +44,7 @@ static const char Version[] = "Version "
 #include "timer.h"
 #include "cloud_msg.h"
 #include "nbr.h"
+#include "link_hist.h"
 
 /* we have an incoming message from another cloud box.
  * see if the message has a sequence number, and compare it to our
@@ -69,10 +70,12 @@ void sequence_check(message_t *message, int device_index, int dev_index)
 {
     int pind;
     int diff;
-    byte last_recvd, incoming;
+    unsigned short last_recvd, incoming;
     mac_address_ptr_t neighbor;
     bool_t have_recv_seq;
     bool_t bcast_ping = false;
+    link_hist_class_t class;
+    int lost = 0;
 
     neighbor = get_name(device_index, message->eth_header.h_source);
     if (neighbor == NULL) {
@@ -106,16 +109,19 @@ void sequence_check(message_t *message, int device_index, int dev_index)
         perm_io_stat[pind].ping_packets_received++;
         have_recv_seq = have_recv_ping_sequence[pind];
         last_recvd = recv_ping_sequence[pind];
+        class = link_hist_ping;
 
     } else if (message->eth_header.h_proto == htons(CLOUD_MSG)) {
         perm_io_stat[pind].packets_received++;
         have_recv_seq = have_recv_sequence[pind];
         last_recvd = recv_sequence[pind];
+        class = link_hist_cloud;
 
     } else {
         perm_io_stat[pind].data_packets_received++;
         have_recv_seq = have_recv_data_sequence[pind];
         last_recvd = recv_data_sequence[pind];
+        class = link_hist_data;
     }
 
     incoming = message->sequence_num;
@@ -131,19 +137,24 @@ void sequence_check(message_t *message, int device_index, int dev_index)
 
     if (have_recv_seq) {
 
-        if (incoming != (last_recvd + 1) % 256) {
+        if (incoming != (last_recvd + 1) % SEQUENCE_MODULUS) {
             diff = ((int) incoming) - ((int) last_recvd);
-
-            if (diff != 0) {
-                if (diff < 0) { diff += 256; }
+            if (diff < 0) { diff += SEQUENCE_MODULUS; }
+
+            /* a jump of more than half the sequence space is much more
+             * likely to be a duplicate, a reordered packet, or the other
+             * box restarting than a huge burst of losses; don't count it.
+             */
+            if (diff != 0 && diff < SEQUENCE_MODULUS / 2) {
+                lost = diff - 1;
                 if (bcast_ping) {
-                    perm_io_stat[pind].ping_packets_lost += diff;
+                    perm_io_stat[pind].ping_packets_lost += lost;
 
                 } else if (message->eth_header.h_proto == htons(CLOUD_MSG)) {
-                    perm_io_stat[pind].packets_lost += diff;
+                    perm_io_stat[pind].packets_lost += lost;
 
                 } else {
-                    perm_io_stat[pind].data_packets_lost += diff;
+                    perm_io_stat[pind].data_packets_lost += lost;
                 }
             }
 
@@ -153,6 +164,8 @@ void sequence_check(message_t *message, int device_index, int dev_index)
         }
     }
 
+    link_hist_record(pind, class, 1, lost);
+
     if (bcast_ping) {
         have_recv_ping_sequence[pind] = true;
         recv_ping_sequence[pind] = incoming;
@@ -0,0 +1,150 @@
+/* sim_clock.c - run merge_cloud on cloud_sim's virtual clock
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* with -V (and -i), cloud_sim keeps our time.  every checked_gettimeofday()
+ * returns the time cloud_sim last gave us, and set_alarm() just notes when
+ * the alarm is due instead of calling setitimer().
+ *
+ * cloud_sim and the boxes take turns.  cloud_sim writes the frames due at
+ * time t into a box's pipes, and then t into <dir>/clock.cloud.  the box
+ * sets its clock to t, sets off its alarm if it is due, and works until it
+ * has nothing left to do:  no input on any device and no interrupt
+ * pending.  then it writes the time of its next alarm into
+ * <dir>/clock.cooked and waits for cloud_sim to move the clock on again.
+ * all the while, no time passes on the box.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "print.h"
+#include "timer.h"
+#include "sim_clock.h"
+
+bool_t sim_clock_active = false;
+
+static int clock_in_fd = -1, clock_out_fd = -1;
+
+/* what checked_gettimeofday() says while we're on the virtual clock */
+static struct timeval sim_now;
+
+/* when our alarm goes off, or SIM_CLOCK_NO_ALARM */
+static sim_clock_msg_t alarm_usec = SIM_CLOCK_NO_ALARM;
+
+static sim_clock_msg_t usec_of(struct timeval *tv)
+{
+    return (sim_clock_msg_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static int sim_clock_gettimeofday(struct timeval *tv)
+{
+    *tv = sim_now;
+    return 0;
+}
+
+/* wait for cloud_sim to tell us what time it is.  if cloud_sim has gone
+ * away, so do we.
+ */
+static void read_time(void)
+{
+    sim_clock_msg_t t;
+    int got = 0;
+
+    while (got < (int) sizeof(t)) {
+        int result = read(clock_in_fd, (char *) &t + got, sizeof(t) - got);
+
+        if (result == -1 && errno == EINTR) { continue; }
+
+        if (result <= 0) {
+            ddprintf("sim_clock; lost cloud_sim's clock:  %s\n",
+                    result == 0 ? "end of file" : strerror(errno));
+            exit(1);
+        }
+
+        got += result;
+    }
+
+    sim_now.tv_sec = t / 1000000;
+    sim_now.tv_usec = t % 1000000;
+}
+
+/* open the clock pipes in dir, and take the starting time from them */
+int sim_clock_open(char *dir)
+{
+    char fname[PATH_MAX];
+
+    snprintf(fname, sizeof(fname), "%s/clock.cloud", dir);
+    clock_in_fd = open(fname, O_RDONLY);
+    if (clock_in_fd == -1) {
+        ddprintf("sim_clock_open; could not open %s:  %s\n", fname,
+                strerror(errno));
+        return -1;
+    }
+
+    snprintf(fname, sizeof(fname), "%s/clock.cooked", dir);
+    clock_out_fd = open(fname, O_WRONLY);
+    if (clock_out_fd == -1) {
+        ddprintf("sim_clock_open; could not open %s:  %s\n", fname,
+                strerror(errno));
+        close(clock_in_fd);
+        return -1;
+    }
+
+    read_time();
+
+    util_gettimeofday_hook = sim_clock_gettimeofday;
+    sim_clock_active = true;
+
+    return 0;
+}
+
+/* set_alarm() on the virtual clock */
+void sim_clock_set_alarm(int msec)
+{
+    alarm_usec = usec_of(&sim_now) + 1000LL * msec;
+}
+
+void sim_clock_stop_alarm(void)
+{
+    alarm_usec = SIM_CLOCK_NO_ALARM;
+}
+
+/* the main loop has nothing left to do at this time.  tell cloud_sim when
+ * our alarm is due, and wait for it to move the clock on.  if that takes
+ * us to the alarm, it goes off, as the SIGALRM would have.
+ */
+void sim_clock_wait(void)
+{
+    if (write(clock_out_fd, &alarm_usec, sizeof(alarm_usec))
+        != sizeof(alarm_usec))
+    {
+        ddprintf("sim_clock_wait; write failed:  %s\n", strerror(errno));
+        exit(1);
+    }
+
+    read_time();
+
+    if (alarm_usec != SIM_CLOCK_NO_ALARM && usec_of(&sim_now) >= alarm_usec) {
+        alarm_usec = SIM_CLOCK_NO_ALARM;
+        repeated(0);
+    }
+}
@@ -0,0 +1,33 @@
+/* sim_clock.h - run merge_cloud on cloud_sim's virtual clock
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include "util.h"
+
+/* a clock message, from cloud_sim to a box or back:  microseconds since
+ * 1970, in host byte order.  SIM_CLOCK_NO_ALARM in a box's answer means
+ * it has no alarm set.
+ */
+typedef long long sim_clock_msg_t;
+#define SIM_CLOCK_NO_ALARM (-1LL)
+
+/* true with -V:  our time comes from cloud_sim, not the kernel */
+extern bool_t sim_clock_active;
+
+extern int sim_clock_open(char *dir);
+extern void sim_clock_set_alarm(int msec);
+extern void sim_clock_stop_alarm(void);
+extern void sim_clock_wait(void);
+
+#endif
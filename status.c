@@ -56,19 +56,21 @@ int send_sequence[MAX_CLOUD];
 int send_data_sequence[MAX_CLOUD];
 int send_ping_sequence[MAX_CLOUD];
 
-byte recv_sequence[MAX_CLOUD];
+unsigned short recv_sequence[MAX_CLOUD];
 bool_t have_recv_sequence[MAX_CLOUD];
 
-byte recv_data_sequence[MAX_CLOUD];
+unsigned short recv_data_sequence[MAX_CLOUD];
 bool_t have_recv_data_sequence[MAX_CLOUD];
 
-byte recv_ping_sequence[MAX_CLOUD];
+unsigned short recv_ping_sequence[MAX_CLOUD];
 bool_t have_recv_ping_sequence[MAX_CLOUD];
 
 /* initialize all fields of the struct to zero */
 void status_init(status_t *s)
 {
     memset(s, 0, sizeof(status_t));
+    memset(s->loss_hist, LINK_HIST_NO_DATA, sizeof(s->loss_hist));
+    s->delivery = LINK_HIST_NO_DATA;
 }
 
 /* print column titles for a status report */
@@ -220,6 +222,9 @@ int status_add_by_mac(status_t *status, int *status_count, mac_address_t mac,
     if (*status_count >= MAX_CLOUD) { return -1; }
 
     memset(&status[*status_count], 0, sizeof(status[*status_count]));
+    memset(status[*status_count].loss_hist, LINK_HIST_NO_DATA,
+            sizeof(status[*status_count].loss_hist));
+    status[*status_count].delivery = LINK_HIST_NO_DATA;
     mac_copy(status[*status_count].name, mac);
     status[*status_count].device_type = type;
     (*status_count)++;
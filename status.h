@@ -16,6 +16,7 @@
 #include "util.h"
 #include "mac.h"
 #include "device_type.h"
+#include "link_hist.h"
 
 #define STATUS_PRINT_DATA  1
 #define STATUS_PRINT_CLOUD 2
@@ -34,11 +35,21 @@ typedef struct {
     /* this is the one true name of another cloud box. */
     mac_address_t name;
 
+    /* percent of ping and data packets from the other box that we got
+     * lately; see link_hist.h and etx.h.  it sits here, in what would
+     * otherwise be padding, to keep status_t (and so stp beacons) from
+     * growing; see send_stp_beacon().
+     */
+    byte delivery;
+
     device_type_t device_type;
     byte sig_strength;
     byte neighbor_type;
     byte see_directly;
 
+    /* recent loss rate history; see link_hist.h */
+    byte loss_hist[LINK_HIST_SUMMARY];
+
     /* these are for passive packet counting and errors */
     int packets_received;
     int packets_lost;
@@ -77,13 +88,13 @@ extern int send_sequence[];
 extern int send_data_sequence[];
 extern int send_ping_sequence[];
 
-extern byte recv_sequence[];
+extern unsigned short recv_sequence[];
 extern bool_t have_recv_sequence[];
 
-extern byte recv_data_sequence[];
+extern unsigned short recv_data_sequence[];
 extern bool_t have_recv_data_sequence[];
 
-extern byte recv_ping_sequence[];
+extern unsigned short recv_ping_sequence[];
 extern bool_t have_recv_ping_sequence[];
 
 void status_dprint_title(ddprintf_t fn, FILE *f, int indent);
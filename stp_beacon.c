@@ -13,6 +13,7 @@
 static const char Version[] = "Version "
     "$Id: stp_beacon.c,v 1.21 2012-02-22 19:27:23 greg Exp $";
 
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/time.h>
@@ -27,6 +28,18 @@ static const char Version[] = "Version "
 #include "nbr.h"
 #include "cloud_msg.h"
 #include "stp_beacon.h"
+#include "mcast.h"
+#include "etx.h"
+#include "rtt.h"
+#include "trickle.h"
+
+/* a beacon with all MAX_CLOUD status records has to fit in one frame.
+ * if this doesn't compile, status_t (or the stp_beacon_t fields ahead of
+ * status[]) has grown too big.
+ */
+typedef char status_fits_in_beacon[
+        offsetof(message_t, v.stp_beacon.status)
+        + MAX_CLOUD * sizeof(status_t) <= MAX_SENDTO ? 1 : -1];
 
 /* have an entry for every box in our cloud.  so, stp_recv_beacon_count is
  * the count of the number of boxes in our cloud.
@@ -185,7 +198,7 @@ void send_stp_beacon(bool_t see_disconnected_nbr)
      * see directly with reasonable signal strength, for non-local
      * short-cutting of messages..
      */
-    if (db[30].d || db[60].d) {
+    if (db[30].d || db[60].d || db[69].d || db[71].d || db[79].d) {
         int j;
         
         /* make sure a timer is set to automatically turn this off if it
@@ -277,6 +290,10 @@ void send_stp_beacon(bool_t see_disconnected_nbr)
         ad_hoc_client_update_my_beacon(&count);
     }
 
+    if (db[77].d) {
+        mcast_update_beacon(&my_beacon.v.stp_beacon);
+    }
+
     my_beacon.v.stp_beacon.status_count = count;
 
     if (db[6].d) {
@@ -296,6 +313,8 @@ void send_stp_beacon(bool_t see_disconnected_nbr)
             bump_stp_link_unroutable(stp_list[i].box.name);
         }
     }
+
+    trickle_sent();
 } /* send_stp_beacon */
 
 /* send all of the stp beacons we have received, and an stp beacon from
@@ -481,7 +500,7 @@ void process_stp_beacon_msg(message_t *message, int device_index)
 
     trim_ad_hoc_client(message->v.stp_beacon.originator);
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         printf("process_stp_beacon_msg:  gettimeofday failed\n");
         goto finish;
     }
@@ -508,6 +527,7 @@ void process_stp_beacon_msg(message_t *message, int device_index)
     }
     if (!found) {
         nak_stp_beacon(neighbor);
+        trickle_reset("beacon from a box not in our stp list");
         goto finish;
     } else {
         ack_stp_beacon(neighbor, message);
@@ -539,6 +559,10 @@ void process_stp_beacon_msg(message_t *message, int device_index)
         goto finish;
     }
 
+    if (mac_equal(message->v.stp_beacon.originator, neighbor)) {
+        trickle_heard(&message->v.stp_beacon);
+    }
+
     /* see if we already have a beacon from the originator of this beacon.
      * if so, update the time stamp on it.
      */
@@ -574,6 +598,8 @@ void process_stp_beacon_msg(message_t *message, int device_index)
         mac_copy(recv->stp_beacon.originator, message->v.stp_beacon.originator);
 
         stp_recv_beacon_count++;
+
+        trickle_reset("beacon from a new box");
     }
 
     recv->sec = tv.tv_sec;
@@ -581,15 +607,24 @@ void process_stp_beacon_msg(message_t *message, int device_index)
     mac_copy(recv->neighbor, neighbor);
     recv->stp_beacon.weakest_stp_link = message->v.stp_beacon.weakest_stp_link;
 
+    recv->stp_beacon.group_count = 0;
+    if (message->v.stp_beacon.group_count <= STP_BEACON_GROUPS) {
+        recv->stp_beacon.group_count = message->v.stp_beacon.group_count;
+        memcpy(recv->stp_beacon.groups, message->v.stp_beacon.groups,
+                sizeof(recv->stp_beacon.groups));
+    }
+
     if (message->v.stp_beacon.status_count > MAX_CLOUD) {
         ddprintf("process_stp_beacon_msg; invalid status count %d.\n",
                 message->v.stp_beacon.status_count);
     } else {
 
         recv->direct_sight_count = 0;
+        recv->link_count = 0;
 
         for (i = 0; i < message->v.stp_beacon.status_count; i++) {
             status_t *status = &message->v.stp_beacon.status[i];
+            stp_link_t *link;
 
             if (status->neighbor_type != STATUS_CLOUD_NBR
                 && status->neighbor_type != STATUS_CLOUD_NOT_NBR)
@@ -599,6 +634,17 @@ void process_stp_beacon_msg(message_t *message, int device_index)
                 mac_copy(recv->direct_sight[recv->direct_sight_count++],
                         status->name);
             }
+
+            /* the originator's own devices aren't links */
+            if (status->device_type == device_type_wlan
+                || status->device_type == device_type_eth)
+            { continue; }
+
+            link = &recv->links[recv->link_count++];
+            mac_copy(link->name, status->name);
+            link->sig_strength = status->sig_strength;
+            link->stp = (status->neighbor_type == STATUS_CLOUD_NBR);
+            link->delivery = status->delivery;
         }
     }
 
@@ -730,7 +776,7 @@ void timeout_stp_recv_beacons()
     int next;
     int past_packed;
 
-    if (gettimeofday(&tv, &tz)) {
+    if (util_gettimeofday(&tv, &tz)) {
         printf("timeout_stp_recv_beacons:  gettimeofday failed\n");
         return;
     }
@@ -742,13 +788,18 @@ void timeout_stp_recv_beacons()
     past_packed = 0;
     for (next = 0; next < stp_recv_beacon_count; next++) {
         stp_recv_beacon_t *l = &stp_recv_beacons[next];
-        long long stp_timeout = STP_TIMEOUT;
+        long long stp_timeout = rtt_stp_timeout(l->neighbor);
 
         /* slow down timeouts based on number of cloud boxes, because
          * cloud boxes slow down frequency of stp beacons as size of
-         * cloud increases
+         * cloud increases.  with trickle beacons, they don't, but they
+         * may go as long as 2.5 * TRICKLE_IMAX between beacons.
          */
-        if (db[39].d && stp_recv_beacon_count >= 1) {
+        if (db[82].d) {
+            if (stp_timeout < TRICKLE_STP_TIMEOUT) {
+                stp_timeout = TRICKLE_STP_TIMEOUT;
+            }
+        } else if (db[39].d && stp_recv_beacon_count >= 1) {
             stp_timeout *= stp_recv_beacon_count;
         }
 
@@ -922,3 +973,95 @@ void resend_stp_beacon_msg(mac_address_ptr_t dest, stp_beacon_t *beacon)
 
 } /* resend_stp_beacon_msg */
 #endif
+
+/* index of the named cloud box in m, or -1 */
+int stp_link_matrix_index(stp_link_matrix_t *m, mac_address_t name)
+{
+    int i;
+
+    for (i = 0; i < m->box_count; i++) {
+        if (mac_equal(m->box[i], name)) { return i; }
+    }
+
+    return -1;
+}
+
+/* fill in m from our neighbor list, our stp list, and the links in the
+ * stp beacons we have received.  a link's weight is the weaker of the
+ * signal strengths its two ends report (or the one report we have);
+ * 1 is the default weak signal and doesn't count.  with db[79], the
+ * weight is discounted for the link's etx.  a link either end reports
+ * at max_sig_strength is wired.
+ */
+void stp_link_matrix(stp_link_matrix_t *m)
+{
+    static byte report[STP_MATRIX_MAX][STP_MATRIX_MAX];
+    static byte delivery[STP_MATRIX_MAX][STP_MATRIX_MAX];
+    int i, j, a, b;
+
+    memset(m, 0, sizeof(*m));
+    memset(report, 0, sizeof(report));
+    memset(delivery, LINK_HIST_NO_DATA, sizeof(delivery));
+
+    mac_copy(m->box[m->box_count++], my_wlan_mac_address);
+    for (i = 0; i < stp_recv_beacon_count; i++) {
+        if (stp_link_matrix_index(m, stp_recv_beacons[i].stp_beacon.originator)
+            >= 0)
+        { continue; }
+        mac_copy(m->box[m->box_count++],
+                stp_recv_beacons[i].stp_beacon.originator);
+    }
+
+    for (i = 0; i < nbr_device_list_count; i++) {
+        b = stp_link_matrix_index(m, nbr_device_list[i].name);
+        if (b <= 0) { continue; }
+        report[0][b] = (byte) nbr_device_list[i].signal_strength;
+        delivery[0][b] = etx_delivery_from(nbr_device_list[i].name);
+    }
+
+    for (i = 0; i < stp_list_count; i++) {
+        b = stp_link_matrix_index(m, stp_list[i].box.name);
+        if (b <= 0) { continue; }
+        m->stp[0][b] = m->stp[b][0] = true;
+    }
+
+    for (i = 0; i < stp_recv_beacon_count; i++) {
+        stp_recv_beacon_t *recv = &stp_recv_beacons[i];
+
+        a = stp_link_matrix_index(m, recv->stp_beacon.originator);
+        for (j = 0; j < recv->link_count; j++) {
+            b = stp_link_matrix_index(m, recv->links[j].name);
+            if (b < 0 || b == a) { continue; }
+            report[a][b] = recv->links[j].sig_strength;
+            delivery[a][b] = recv->links[j].delivery;
+            if (recv->links[j].stp) {
+                m->stp[a][b] = m->stp[b][a] = true;
+            }
+        }
+    }
+
+    for (a = 0; a < m->box_count; a++) {
+        for (b = a + 1; b < m->box_count; b++) {
+            int w;
+
+            if (report[a][b] > 1 && report[b][a] > 1) {
+                w = report[a][b] < report[b][a] ? report[a][b] : report[b][a];
+            } else {
+                w = report[a][b] > report[b][a] ? report[a][b] : report[b][a];
+            }
+            if (w <= 1) { w = 0; }
+
+            if (report[a][b] == max_sig_strength
+                || report[b][a] == max_sig_strength)
+            {
+                m->wired[a][b] = m->wired[b][a] = true;
+            }
+
+            if (db[79].d && w > 0) {
+                w = etx_strength(w, etx(delivery[a][b], delivery[b][a]));
+            }
+
+            m->weight[a][b] = m->weight[b][a] = w;
+        }
+    }
+} /* stp_link_matrix */
@@ -38,5 +38,7 @@ extern void send_stp_beacon(bool_t see_disconnected_nbr);
 extern void send_stp_beacons(mac_address_t new_nbr);
 extern void bump_stp_link_unroutable(mac_address_ptr_t dest);
 extern void resend_stp_beacon_msg(mac_address_ptr_t dest, stp_beacon_t *beacon);
+extern void stp_link_matrix(stp_link_matrix_t *m);
+extern int stp_link_matrix_index(stp_link_matrix_t *m, mac_address_t name);
 
 #endif
@@ -16,6 +16,9 @@
 #include "status.h"
 #include "cloud_data.h"
 
+/* most multicast groups a box advertises in its stp beacons */
+#define STP_BEACON_GROUPS 8
+
 /* cloud protocol message body */  
 typedef struct {
 
@@ -34,6 +37,13 @@ typedef struct {
      */
     short tweak_db;
 
+    /* multicast groups (as ethernet addresses) that this box has members
+     * of on its own interfaces; mac_address_bcast means all of them.
+     * see mcast_update_beacon().
+     */
+    short group_count;
+    mac_address_t groups[STP_BEACON_GROUPS];
+
     /* number of records in status array below actually sent in this message */
     int status_count;
 
@@ -45,6 +55,25 @@ typedef struct {
     status_t status[MAX_CLOUD];
 } stp_beacon_t;
 
+/* one of the links to another cloud box that a cloud box reported in its
+ * stp beacon status[] (see send_stp_beacon())
+ */
+typedef struct {
+    /* the other end of the link */
+    mac_address_t name;
+
+    /* signal strength the reporting box sees it with */
+    byte sig_strength;
+
+    /* is the link one of the reporting box's stp arcs? */
+    bool_t stp;
+
+    /* percent of the other end's packets the reporting box gets; see
+     * etx.c
+     */
+    byte delivery;
+} stp_link_t;
+
 /* an stp_beacon received in from the given neighbor, which arrived at the
  * specified time.
  */
@@ -72,6 +101,35 @@ typedef struct {
     /* the names of the other cloud boxes that this one can see directly */
     mac_address_t direct_sight[MAX_CLOUD];
 
+    /* the links to other cloud boxes that this one reported, if it sent
+     * us its status (for check_global_improvement())
+     */
+    int link_count;
+    stp_link_t links[MAX_CLOUD];
+
 } stp_recv_beacon_t;
 
+/* every cloud box we have stp beacons from, plus us */
+#define STP_MATRIX_MAX (MAX_CLOUD + 1)
+
+/* the links among the cloud boxes, as far as we can tell from our own
+ * neighbor and stp lists and the links in the stp beacons we have
+ * received.  we are box[0].  see stp_link_matrix().
+ */
+typedef struct {
+    int box_count;
+    mac_address_t box[STP_MATRIX_MAX];
+
+    /* signal strength of the link between two boxes; 0 if none */
+    byte weight[STP_MATRIX_MAX][STP_MATRIX_MAX];
+
+    /* is the link an stp arc? */
+    bool_t stp[STP_MATRIX_MAX][STP_MATRIX_MAX];
+
+    /* is the link wired?  (an end reports it at max_sig_strength, but
+     * with db[79] its weight can come out lower.)
+     */
+    bool_t wired[STP_MATRIX_MAX][STP_MATRIX_MAX];
+} stp_link_matrix_t;
+
 #endif
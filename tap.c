@@ -0,0 +1,435 @@
+/* tap.c - mirror frames merge_cloud handles, with its verdicts, to pcapng
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* a sniffer on a box's interfaces sees what came in and went out, but not
+ * what merge_cloud made of it.  the tap points in merge_cloud say:  a
+ * frame was received, rejected by the accept matrix, dropped as a
+ * duplicate by new_from_originator(), dropped by message_ok(), or sent.
+ *
+ * -x file[,option...] turns the tap on.  options are:
+ *     v=verdict+...   recv, reject, dup, bad, sent (default all of them)
+ *     d=device+...    only frames on these devices (default all)
+ *     m=type+...      only frames with these ethertypes (hex, e.g. 2983)
+ *                     or cloud message types (e.g. stp_beacon_msg)
+ *     s=bytes         copy at most this much of each frame (default 2048)
+ *     r=kbytes        size of the ring to the writer (default 1024)
+ *     C=megabytes     start a new file after this much, as file.0,
+ *                     file.1, ...
+ *     W=files         with C, keep at most this many files
+ * for example:
+ *     merge_cloud ... -x /tmp/tap.pcapng,v=dup+bad+reject,d=wds0.1
+ *
+ * the output is pcapng, one interface per device, with the verdict and
+ * device in each frame's comment and its direction in its flags.
+ * "ll_dump -f file -d" prints it.
+ *
+ * a tap point copies the frame (up to s bytes) and a small header into a
+ * pio ring, which never blocks; if the ring is full, the frame is dropped
+ * and counted.  a child process drains the ring into the file, so
+ * merge_cloud never waits for the disk.  when the tap is off, a tap point
+ * is a test of tap_verdicts.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/if_ether.h>
+#include <netinet/in.h>
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "print.h"
+#include "pio.h"
+#include "pcap_file.h"
+#include "cloud_msg.h"
+#include "tap.h"
+
+#define TAP_SNAPLEN 2048
+#define TAP_MAX_SNAPLEN 16384
+#define TAP_RING_KBYTES 1024
+#define TAP_NAME_LEN 16
+#define TAP_MAX_DEVICES 16
+#define TAP_MAX_PROTOS 16
+
+unsigned int tap_verdicts = 0;
+
+/* what goes through the ring for each frame; the first snaplen bytes of
+ * the frame follow it.
+ */
+typedef struct {
+    unsigned int sec, nsec;
+    unsigned short len;
+    unsigned char verdict;
+    char device_name[TAP_NAME_LEN];
+} tap_record_t;
+
+static char *verdict_names[] = { "recv", "reject", "dup", "bad", "sent" };
+#define VERDICT_COUNT \
+    ((int) (sizeof(verdict_names) / sizeof(verdict_names[0])))
+
+/* the -x spec */
+static char *fname = NULL;
+static int snaplen = TAP_SNAPLEN;
+static int ring_kbytes = TAP_RING_KBYTES;
+static long long rotate_bytes = 0;
+static int rotate_files = 0;
+static char devices[TAP_MAX_DEVICES][TAP_NAME_LEN];
+static int device_count = 0;
+static int protos[TAP_MAX_PROTOS];
+static int proto_count = 0;
+static bool_t msg_types[MESSAGE_TYPE_COUNT];
+static bool_t have_msg_types = false;
+
+static pio_t ring;
+static pid_t writer_pid = -1;
+static byte record[sizeof(tap_record_t) + TAP_MAX_SNAPLEN];
+
+static unsigned int tapped = 0;
+
+static volatile bool_t writer_stop = false;
+
+static int parse_verdicts(char *s)
+{
+    char *p;
+    int i;
+    unsigned int verdicts = 0;
+
+    for (p = strtok(s, "+"); p != NULL; p = strtok(NULL, "+")) {
+        for (i = 0; i < VERDICT_COUNT; i++) {
+            if (strcmp(p, verdict_names[i]) == 0) { break; }
+        }
+        if (i == VERDICT_COUNT) {
+            ddprintf("tap; unknown verdict '%s'\n", p);
+            return -1;
+        }
+        verdicts |= 1 << i;
+    }
+
+    return verdicts;
+}
+
+static int parse_types(char *s)
+{
+    char *p;
+    int i;
+
+    for (p = strtok(s, "+"); p != NULL; p = strtok(NULL, "+")) {
+        unsigned int proto;
+        char c;
+
+        if (sscanf(p, "%x%c", &proto, &c) == 1) {
+            if (proto_count >= TAP_MAX_PROTOS) {
+                ddprintf("tap; too many ethertypes\n");
+                return -1;
+            }
+            protos[proto_count++] = proto;
+            continue;
+        }
+
+        for (i = 1; i < MESSAGE_TYPE_COUNT; i++) {
+            if (strcmp(p, message_type_string(i)) == 0) { break; }
+        }
+        if (i == MESSAGE_TYPE_COUNT) {
+            ddprintf("tap; unknown message type '%s'\n", p);
+            return -1;
+        }
+        msg_types[i] = true;
+        have_msg_types = true;
+    }
+
+    return 0;
+}
+
+static int parse_devices(char *s)
+{
+    char *p;
+
+    for (p = strtok(s, "+"); p != NULL; p = strtok(NULL, "+")) {
+        if (device_count >= TAP_MAX_DEVICES) {
+            ddprintf("tap; too many devices\n");
+            return -1;
+        }
+        copy_string(devices[device_count++], p, TAP_NAME_LEN);
+    }
+
+    return 0;
+}
+
+/* parse "file[,opt=value...]".  return the verdicts to tap, or -1. */
+static int parse_spec(char *spec)
+{
+    char *opts[8];
+    int opt_count = 0;
+    char *p;
+    int verdicts = TAP_ALL;
+    int i;
+
+    fname = strtok(spec, ",");
+    while (opt_count < 8 && (p = strtok(NULL, ",")) != NULL) {
+        opts[opt_count++] = p;
+    }
+
+    if (fname == NULL || *fname == '\0') {
+        ddprintf("tap; no file name\n");
+        return -1;
+    }
+
+    /* strtok is done with the spec, so the options can use it */
+    for (i = 0; i < opt_count; i++) {
+        char *value = strchr(opts[i], '=');
+        int n = 0;
+
+        if (value == NULL || value[1] == '\0') {
+            ddprintf("tap; bad option '%s'\n", opts[i]);
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (opts[i][0] != '\0' && opts[i][1] == '\0'
+            && strchr("srCW", opts[i][0]) != NULL
+            && (sscanf(value, "%d", &n) != 1 || n <= 0))
+        {
+            ddprintf("tap; bad number '%s'\n", value);
+            return -1;
+        }
+
+        if (strcmp(opts[i], "v") == 0) {
+            if ((verdicts = parse_verdicts(value)) == -1) { return -1; }
+
+        } else if (strcmp(opts[i], "d") == 0) {
+            if (parse_devices(value) != 0) { return -1; }
+
+        } else if (strcmp(opts[i], "m") == 0) {
+            if (parse_types(value) != 0) { return -1; }
+
+        } else if (strcmp(opts[i], "s") == 0) {
+            snaplen = (n > TAP_MAX_SNAPLEN) ? TAP_MAX_SNAPLEN : n;
+
+        } else if (strcmp(opts[i], "r") == 0) {
+            ring_kbytes = n;
+
+        } else if (strcmp(opts[i], "C") == 0) {
+            rotate_bytes = n * 1000000LL;
+
+        } else if (strcmp(opts[i], "W") == 0) {
+            rotate_files = n;
+
+        } else {
+            ddprintf("tap; unknown option '%s'\n", opts[i]);
+            return -1;
+        }
+    }
+
+    return verdicts;
+}
+
+static void catch_stop(int arg)
+{
+    writer_stop = true;
+}
+
+/* the child:  move records from the ring to the file until merge_cloud
+ * tells us to stop or goes away, and the ring is empty.
+ */
+static void writer(pid_t parent)
+{
+    static pcap_file_t out;
+    static byte buf[sizeof(record)];
+    char comment[64];
+    int n;
+
+    signal(SIGTERM, catch_stop);
+    signal(SIGINT, catch_stop);
+    signal(SIGHUP, SIG_IGN);
+
+    pcap_file_init(&out, fname, true, snaplen);
+    out.rotate_bytes = rotate_bytes;
+    out.rotate_files = rotate_files;
+
+    while (true) {
+        tap_record_t *rec = (tap_record_t *) buf;
+        struct timespec ts;
+        int i;
+
+        n = pio_read(&ring, buf, sizeof(buf));
+
+        if (n == -1) {
+            if (writer_stop || getppid() != parent) { break; }
+
+            /* nothing to do; let someone reading the file see it */
+            if (out.f != NULL) { fflush(out.f); }
+            pio_timed_read_ok(&ring, 1);
+            continue;
+        }
+
+        if (n < (int) sizeof(*rec)) { continue; }
+
+        rec->device_name[TAP_NAME_LEN - 1] = '\0';
+        for (i = 0; i < out.if_count; i++) {
+            if (strcmp(out.if_names[i], rec->device_name) == 0) { break; }
+        }
+        if (i == out.if_count && pcap_file_add_if(&out, rec->device_name)
+            == -1)
+        {
+            i = 0;
+        }
+
+        snprintf(comment, sizeof(comment), "%s %s",
+                (rec->verdict < VERDICT_COUNT)
+                ? verdict_names[rec->verdict] : "?",
+                rec->device_name);
+
+        ts.tv_sec = rec->sec;
+        ts.tv_nsec = rec->nsec;
+
+        if (pcap_file_write(&out, i, (byte *) (rec + 1),
+                n - sizeof(*rec), rec->len, &ts,
+                (1 << rec->verdict) == TAP_SENT
+                ? PCAP_OUTBOUND : PCAP_INBOUND, comment) != 0)
+        {
+            break;
+        }
+    }
+
+    pcap_file_close(&out);
+    _exit(0);
+}
+
+/* start tapping, as -x spec says.  return 0 on success, -1 otherwise. */
+int tap_open(char *spec)
+{
+    char ring_fname[PATH_MAX];
+    int verdicts;
+    pid_t parent = getpid();
+
+    verdicts = parse_spec(spec);
+    if (verdicts == -1) { return -1; }
+
+    /* the ring is shared through the mapping the child inherits, so its
+     * file isn't needed once we have it open.
+     */
+    snprintf(ring_fname, sizeof(ring_fname), "%s.ring", fname);
+    unlink(ring_fname);
+    if (pio_ring_create(ring_fname, ring_kbytes * 1024) != 0
+        || pio_open(&ring, ring_fname) != 0)
+    {
+        ddprintf("tap; could not make ring %s\n", ring_fname);
+        unlink(ring_fname);
+        return -1;
+    }
+    unlink(ring_fname);
+
+    fflush(stdout);
+    fflush(stderr);
+
+    writer_pid = fork();
+    if (writer_pid == -1) {
+        ddprintf("tap; fork failed\n");
+        return -1;
+    }
+
+    if (writer_pid == 0) {
+        writer(parent);
+    }
+
+    tap_verdicts = verdicts;
+
+    return 0;
+}
+
+/* the slow part of a tap point:  see if the frame is wanted, and if so,
+ * put it in the ring.
+ */
+void tap_frame(unsigned int verdict, char *device_name, void *frame, int len)
+{
+    tap_record_t *rec = (tap_record_t *) record;
+    struct ethhdr *eth = (struct ethhdr *) frame;
+    struct timespec ts;
+    int caplen;
+    int i;
+
+    if (device_count > 0) {
+        for (i = 0; i < device_count; i++) {
+            if (strncmp(devices[i], device_name, TAP_NAME_LEN) == 0) { break; }
+        }
+        if (i == device_count) { return; }
+    }
+
+    if (proto_count > 0 || have_msg_types) {
+        bool_t match = false;
+        int proto;
+
+        if (len < (int) sizeof(*eth)) { return; }
+        proto = ntohs(eth->h_proto);
+
+        for (i = 0; i < proto_count; i++) {
+            if (protos[i] == proto) { match = true; }
+        }
+
+        if (!match && have_msg_types && proto == CLOUD_MSG
+            && len >= (int) (offsetof(message_t, message_type)
+                + sizeof(message_type_t)))
+        {
+            int type = ((message_t *) frame)->message_type;
+            match = (type >= 0 && type < MESSAGE_TYPE_COUNT
+                    && msg_types[type]);
+        }
+
+        if (!match) { return; }
+    }
+
+    caplen = (len > snaplen) ? snaplen : len;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->sec = ts.tv_sec;
+    rec->nsec = ts.tv_nsec;
+    rec->len = len;
+    for (i = 0; verdict > 1; i++) { verdict >>= 1; }
+    rec->verdict = i;
+    copy_string(rec->device_name, device_name, TAP_NAME_LEN);
+    memcpy(rec + 1, frame, caplen);
+
+    /* if the ring is full, the frame is dropped and counted there */
+    pio_write(&ring, record, sizeof(*rec) + caplen);
+
+    tapped++;
+}
+
+/* stop tapping; the writer empties the ring and closes the file */
+void tap_close(void)
+{
+    tap_verdicts = 0;
+
+    if (writer_pid > 0) {
+        kill(writer_pid, SIGTERM);
+        waitpid(writer_pid, NULL, 0);
+        writer_pid = -1;
+    }
+}
+
+void tap_print_summary(ddprintf_t *fn, FILE *f)
+{
+    if (fname == NULL) { return; }
+
+    fn(f, "tap:  %u frames to %s, %u of them dropped (ring full)\n",
+            tapped, fname, ring.drops);
+}
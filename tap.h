@@ -0,0 +1,47 @@
+/* tap.h - mirror frames merge_cloud handles, with its verdicts, to pcapng
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef TAP_H
+#define TAP_H
+
+#include <stdio.h>
+#include "util.h"
+
+/* what merge_cloud did with a frame */
+#define TAP_RECV    0x01    /* read from a device */
+#define TAP_REJECT  0x02    /* refused by the accept matrix */
+#define TAP_DUP     0x04    /* seen before from its originator; not passed on */
+#define TAP_BAD     0x08    /* dropped by message_ok() */
+#define TAP_SENT    0x10    /* sent on a device */
+#define TAP_ALL     0x1f
+
+/* the verdicts being tapped; 0 unless -x was given */
+extern unsigned int tap_verdicts;
+
+/* a tap point.  the test is here rather than in tap_frame() so that when
+ * the tap is off, or isn't interested in this verdict, a tap point costs
+ * a load and a branch.
+ */
+#define tap(verdict, device_name, frame, len)                               \
+        do {                                                                \
+            if (tap_verdicts & (verdict)) {                                 \
+                tap_frame((verdict), (device_name), (frame), (len));        \
+            }                                                               \
+        } while (0)
+
+extern int tap_open(char *spec);
+extern void tap_frame(unsigned int verdict, char *device_name, void *frame,
+        int len);
+extern void tap_close(void);
+extern void tap_print_summary(ddprintf_t *fn, FILE *f);
+
+#endif
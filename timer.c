@@ -26,6 +26,10 @@ static const char Version[] = "Version "
 #include "random.h"
 #include "sequence.h"
 #include "stp_beacon.h"
+#include "journal.h"
+#include "rtt.h"
+#include "trickle.h"
+#include "sim_clock.h"
 
 #include <sys/time.h>
 
@@ -38,6 +42,11 @@ int intervals[TIMER_COUNT] = {
     0,
     0,
     0,
+    0,
+    LOG_FLUSH_INTERVAL,
+    0,
+    0,
+    0,
 };
 
 struct timeval times[TIMER_COUNT] = {
@@ -49,11 +58,16 @@ struct timeval times[TIMER_COUNT] = {
     {0, 0},
     {0, 0},
     {0, 0},
+    {0, 0},
+    {0, 0},
+    {-1, 0},
+    {-1, 0},
+    {-1, 0},
 };
 struct timeval now;
 struct timeval start;
 
-char got_interrupt[TIMER_COUNT] = {0, 0, 0, 0, 0, 0, 0, 0};
+char got_interrupt[TIMER_COUNT] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 int interrupt_pipe[2];
 
@@ -83,11 +97,22 @@ void send_interrupt_pipe_char()
  * selects on when it is looking for input.
  *
  * also, set the next timer alarm.
+ *
+ * while a journal is being recorded, the main loop holds us off until the
+ * end of each pass, and the times and random numbers we use aren't
+ * journaled; see journal.c.
  */
 void repeated(int arg)
 {
+    if (journal_hold_timer) {
+        journal_timer_pending = true;
+        return;
+    }
+
+    journal_untracked++;
     send_interrupt_pipe_char();
     set_next_alarm();
+    journal_untracked--;
 }
 
 /* create the pipe we use to send interrupts to ourselves. */
@@ -121,6 +146,11 @@ void stop_alarm(void)
     int result;
     struct itimerval timer = {{0, 0}, {0, 0}};
 
+    if (sim_clock_active) {
+        sim_clock_stop_alarm();
+        return;
+    }
+
     result = setitimer(ITIMER_REAL, &timer, 0);
 }
 
@@ -129,8 +159,18 @@ void set_alarm(int msec)
 {
     int result;
     struct itimerval timer;
+
+    /* replaying a journal, the timer events come from the journal */
+    if (journal_mode == journal_replay) { return; }
+
     if (msec == 0) { msec = 1; }
 
+    /* on cloud_sim's clock, it tells us when the time comes */
+    if (sim_clock_active) {
+        sim_clock_set_alarm(msec);
+        return;
+    }
+
     timer.it_value.tv_sec = msec / 1000;
     timer.it_value.tv_usec = (msec % 1000) * 1000;
 
@@ -179,9 +219,13 @@ void timer_print()
     ptime("ping_neighbors     ", times[6]);              ddprintf("\n");
     ptime("disable_print_cloud", times[7]);              ddprintf("\n");
     ptime("wifi_scan          ", times[8]);              ddprintf("\n");
+    ptime("flush_log          ", times[9]);              ddprintf("\n");
+    ptime("dist_send          ", times[10]);             ddprintf("\n");
+    ptime("stp_trickle        ", times[11]);             ddprintf("\n");
+    ptime("stp_hello          ", times[12]);             ddprintf("\n");
 }
 
-/* of the various timers (currently 8), figure out which one is due to
+/* of the various timers (currently 13), figure out which one is due to
  * happen soonest, and set a timer interrupt to go off to wake us up then.
  */
 void set_next_alarm()
@@ -207,13 +251,16 @@ void set_next_alarm()
      * note it and reset timer for the future.
      */
 
-    /* this is the exponential timer for stp_beacons */
+    /* this is the exponential timer for stp_beacons.  (with db[82], the
+     * trickle timer sends the beacons, and this just drives the periodic
+     * maintenance, so it doesn't slow down as the cloud grows.)
+     */
     while ((next_interrupt = usec_diff(times[0].tv_sec, times[0].tv_usec,
             now.tv_sec, now.tv_usec)) < 0)
     {
         double wait_time;
         int iwait_time;
-        if (db[39].d) {
+        if (db[39].d && !db[82].d) {
             int mean_wait_time = MEAN_WAKEUP_TIME;
             if (stp_recv_beacon_count > 0) {
                 mean_wait_time *= stp_recv_beacon_count;
@@ -253,6 +300,16 @@ void set_next_alarm()
     }
     if (maybe_next < next_interrupt) { next_interrupt = maybe_next; }
 
+    /* same as above */
+    /* this is the permanent log file flush interval */
+    while ((maybe_next = usec_diff(times[9].tv_sec, times[9].tv_usec,
+            now.tv_sec, now.tv_usec)) < 0)
+    {
+        usec_add_msecs(&times[9].tv_sec, &times[9].tv_usec, intervals[9]);
+        got_interrupt[flush_log] = 1;
+    }
+    if (maybe_next < next_interrupt) { next_interrupt = maybe_next; }
+
     /* non-cloud message timeout */
     if (times[3].tv_sec != -1) {
 
@@ -363,6 +420,63 @@ void set_next_alarm()
         }
     }
 
+    /* file distribution send timeout */
+    if (times[10].tv_sec != -1) {
+
+        maybe_next = usec_diff(times[10].tv_sec, times[10].tv_usec,
+                now.tv_sec, now.tv_usec);
+
+        if (maybe_next < 0) {
+            times[10].tv_sec = -1;
+            got_interrupt[dist_send] = 1;
+            if (db[28].d) {
+                ddprintf("\nset_next_alarm; "
+                        "detected dist_send timeout..\n");
+            }
+
+        } else if (maybe_next < next_interrupt) {
+            next_interrupt = maybe_next;
+        }
+    }
+
+    /* trickle stp beacon timeout */
+    if (times[11].tv_sec != -1) {
+
+        maybe_next = usec_diff(times[11].tv_sec, times[11].tv_usec,
+                now.tv_sec, now.tv_usec);
+
+        if (maybe_next < 0) {
+            times[11].tv_sec = -1;
+            got_interrupt[stp_trickle] = 1;
+            if (db[28].d) {
+                ddprintf("\nset_next_alarm; "
+                        "detected stp_trickle timeout..\n");
+            }
+
+        } else if (maybe_next < next_interrupt) {
+            next_interrupt = maybe_next;
+        }
+    }
+
+    /* stp neighbor hello timeout */
+    if (times[12].tv_sec != -1) {
+
+        maybe_next = usec_diff(times[12].tv_sec, times[12].tv_usec,
+                now.tv_sec, now.tv_usec);
+
+        if (maybe_next < 0) {
+            times[12].tv_sec = -1;
+            got_interrupt[stp_hello] = 1;
+            if (db[28].d) {
+                ddprintf("\nset_next_alarm; "
+                        "detected stp_hello timeout..\n");
+            }
+
+        } else if (maybe_next < next_interrupt) {
+            next_interrupt = maybe_next;
+        }
+    }
+
     set_alarm((int) (next_interrupt / 1000));
 
     if (db[2].d) {
@@ -377,6 +491,10 @@ void set_next_alarm()
         ptime("t6", times[6]);
         ptime("t7", times[7]);
         ptime("t8", times[8]);
+        ptime("t9", times[9]);
+        ptime("t10", times[10]);
+        ptime("t11", times[11]);
+        ptime("t12", times[12]);
         ddprintf("\ninterrupts pending: ");
         for (i = 0; i < TIMER_COUNT; i++) {
             if (got_interrupt[i]) {
@@ -456,6 +574,58 @@ void set_next_scan_alarm(void)
     block_timer_interrupts(SIG_UNBLOCK);
 }
 
+/* wake up the file distribution code in msec milliseconds, unless it
+ * is already due to be woken up.
+ */
+void set_next_dist_alarm(int msec)
+{
+    if (times[10].tv_sec != -1) {
+        if (db[28].d) { ddprintf("already set; returning.\n"); }
+        return;
+    }
+
+    while (!checked_gettimeofday(&times[10]));
+    usec_add_msecs(&times[10].tv_sec, &times[10].tv_usec, msec);
+
+    block_timer_interrupts(SIG_BLOCK);
+    set_next_alarm();
+    block_timer_interrupts(SIG_UNBLOCK);
+}
+
+/* wake up the trickle stp beacon timer in msec milliseconds, replacing
+ * whatever it was set to; msec of -1 turns it off.
+ */
+void set_trickle_alarm(int msec)
+{
+    if (msec == -1) {
+        times[11].tv_sec = -1;
+    } else {
+        while (!checked_gettimeofday(&times[11]));
+        usec_add_msecs(&times[11].tv_sec, &times[11].tv_usec, msec);
+    }
+
+    block_timer_interrupts(SIG_BLOCK);
+    set_next_alarm();
+    block_timer_interrupts(SIG_UNBLOCK);
+}
+
+/* wake up the stp neighbor hello code in msec milliseconds; msec of -1
+ * turns it off.
+ */
+void set_hello_alarm(int msec)
+{
+    if (msec == -1) {
+        times[12].tv_sec = -1;
+    } else {
+        while (!checked_gettimeofday(&times[12]));
+        usec_add_msecs(&times[12].tv_sec, &times[12].tv_usec, msec);
+    }
+
+    block_timer_interrupts(SIG_BLOCK);
+    set_next_alarm();
+    block_timer_interrupts(SIG_UNBLOCK);
+}
+
 /* if the 'display the cloud' option has been set for this box,
  * every CLOUD_PRINT_INTERVAL seconds (usually 5 seconds), we re-build an
  * ascii version of our model of the current cloud, viewable from our web
@@ -548,7 +718,8 @@ void update_ack_timer()
     if (times[3].tv_sec != -1) { return; }
 
     while (!checked_gettimeofday(&times[3]));
-    usec_add_msecs(&times[3].tv_sec, &times[3].tv_usec, ACK_TIMEOUT_MSEC);
+    usec_add_msecs(&times[3].tv_sec, &times[3].tv_usec,
+            rtt_ack_timeout_msec());
     block_timer_interrupts(SIG_BLOCK);
     set_next_alarm();
     block_timer_interrupts(SIG_UNBLOCK);
@@ -581,9 +752,11 @@ void set_lock_timer(lockable_resource_t *l)
     while (!checked_gettimeofday(&now));
     l->sec = now.tv_sec;
     l->usec = now.tv_usec;
-    usec_add_msecs(&l->sec, &l->usec, RECV_TIMEOUT_USEC / 1000);
+    usec_add_msecs(&l->sec, &l->usec,
+            rtt_lock_timeout_usec(l->node_1, RECV_TIMEOUT_USEC) / 1000);
 
     reset_lock_timer();
+    trickle_reset("lock activity");
 
     if (db[28].d) {
         ptime("\nset_lock_timer now", now);
@@ -40,6 +40,55 @@
  */
 #define ACK_TIMEOUT_MSEC 100
 
+/* with db[80], the timeouts above come from measured round trip times
+ * (see rtt.c) within these bounds.
+ *
+ * ack:  the largest rto of the boxes we await acks from.
+ * stp beacons:  beacons come at exponentially distributed intervals
+ * averaging MEAN_WAKEUP_TIME, so the timeout can't go much below
+ * STP_TIMEOUT_MIN without timing out live boxes; a slow link gets
+ * STP_TIMEOUT_RTOS of its rto on top of that.
+ * locks:  a lock exchange with a neighbor is a few round trips.
+ */
+#define ACK_TIMEOUT_MIN_MSEC 10
+#define ACK_TIMEOUT_MAX_MSEC 1000
+#define STP_TIMEOUT_MIN 4000000LL
+#define STP_TIMEOUT_RTOS 20
+#define LOCK_TIMEOUT_MIN 500000
+#define LOCK_TIMEOUT_RTOS 10
+
+/* in milliseconds; with db[82], stp beacons go out on a trickle timer
+ * (see trickle.c) whose interval runs from TRICKLE_IMIN, after a topology
+ * change, up to TRICKLE_IMAX while nothing changes.  a beacon is skipped
+ * if TRICKLE_K neighbors agreed with us during the interval, but never
+ * if the last one went out TRICKLE_IMAX ago.
+ */
+#define TRICKLE_IMIN 250
+#define TRICKLE_IMAX 8000
+#define TRICKLE_K 2
+
+/* change in a neighbor's signal strength since our last beacon that
+ * counts as a topology change
+ */
+#define TRICKLE_SIG_CHANGE 10
+
+/* in micro-seconds; how fast to time out a received stp message with
+ * db[82].  a box sends a beacon at least every 2.5 * TRICKLE_IMAX.
+ */
+#define TRICKLE_STP_TIMEOUT (4000LL * TRICKLE_IMAX)
+
+/* in milliseconds; with db[84], how often to make sure each stp neighbor
+ * has heard from us (see hello.c), unless -H says otherwise.  we give up
+ * on a neighbor we haven't heard from in HELLO_DETECT_MULT (or -H's
+ * multiplier) of its intervals.  on a lossy link the multiplier goes up
+ * until losing that many hellos in a row has a chance of no more than
+ * HELLO_FALSE_DETECT, but not past HELLO_DETECT_MULT_MAX.
+ */
+#define HELLO_INTERVAL 100
+#define HELLO_DETECT_MULT 3
+#define HELLO_DETECT_MULT_MAX 10
+#define HELLO_FALSE_DETECT .0001
+
 /* in milliseconds; how often to update wds based on incoming beacons */
 #define WRT_UPDATE_INTERVAL 750
 
@@ -63,6 +112,16 @@
 #define SCAN_INTERVAL_MIN 55000
 #define SCAN_INTERVAL_MAX 65000
 
+/* in milliseconds; how often to copy buffered log messages to the
+ * permanent log file
+ */
+#define LOG_FLUSH_INTERVAL 1000
+
+/* in milliseconds; how often the originator of a cloud-wide file
+ * distribution sends its next burst of chunks
+ */
+#define DIST_SEND_INTERVAL 10
+
 /* 10 times TIME_BASE rounded up to seconds; backup timer interrupt */
 #define SAFETY_INTERVAL 1000
 
@@ -73,7 +132,7 @@
 #define NEXT_WRT_UPDATE_TIME 1
 #define NEXT_ETH_UPDATE_TIME 2
 
-#define TIMER_COUNT 9
+#define TIMER_COUNT 13
 
 #define send_stp 0
 #define process_beacon 1
@@ -84,6 +143,10 @@
 #define ping_neighbors 6
 #define disable_print_cloud 7
 #define wifi_scan 8
+#define flush_log 9
+#define dist_send 10
+#define stp_trickle 11
+#define stp_hello 12
 
 /* we maintain multiple streams of timed events.  for each event,
  * this array saves the next time it needs to be performed.
@@ -119,6 +182,9 @@ extern void set_next_scan_alarm(void);
 extern void restart_disable_print_cloud();
 extern void ensure_disable_print_cloud();
 extern void set_next_ping_alarm(void);
+extern void set_next_dist_alarm(int msec);
+extern void set_trickle_alarm(int msec);
+extern void set_hello_alarm(int msec);
 extern void update_ack_timer();
 extern void turn_off_ack_timer();
 extern void reset_lock_timer();
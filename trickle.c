@@ -0,0 +1,317 @@
+/* trickle.c - adaptive stp beacon interval, after rfc 6206
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+static const char Version[] = "Version "
+    "$Id$";
+
+/* without db[82], each send_stp interrupt sends an stp beacon, at
+ * exponentially distributed intervals averaging MEAN_WAKEUP_TIME (times
+ * the number of boxes, with db[39]), whether or not anything is changing.
+ *
+ * with db[82], beacons go out on a trickle timer instead.  each interval
+ * of I msec, we pick a time in its second half; at that time we send a
+ * beacon unless TRICKLE_K stp neighbors have sent us beacons during the
+ * interval that agree with us (they list us as an stp neighbor).  at the
+ * end of the interval, I doubles, up to TRICKLE_IMAX.  a topology change
+ * puts I back to TRICKLE_IMIN:
+ *
+ *     a box joins or leaves our neighbor list or our stp list
+ *     a neighbor's signal strength moves TRICKLE_SIG_CHANGE from what it
+ *         was at our last beacon
+ *     a lock is requested, granted or owned (see set_lock_timer())
+ *     a beacon from a new box, or one that disagrees with us about an arc
+ *
+ * so a quiet cloud sends a beacon per box every 4 to 8 seconds, and a
+ * change goes out within TRICKLE_IMIN.  since we are the only source of
+ * our own beacon, we never skip one if the last went out TRICKLE_IMAX
+ * ago, and the other boxes time our beacons out after TRICKLE_STP_TIMEOUT
+ * (see timeout_stp_recv_beacons()).
+ *
+ * the send_stp interrupt still drives the rest of the periodic
+ * maintenance, at MEAN_WAKEUP_TIME.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "cloud.h"
+#include "print.h"
+#include "timer.h"
+#include "random.h"
+#include "nbr.h"
+#include "stp_beacon.h"
+#include "trickle.h"
+
+/* the current interval in msec; 0 if the timer isn't running */
+static int interval = 0;
+
+/* consistent beacons heard this interval */
+static int heard;
+
+/* have we passed this interval's send time? */
+static bool_t fired;
+
+/* msec from the send time to the end of the interval */
+static int rest;
+
+/* when we last sent a beacon; tv_sec -1 if never */
+static struct timeval last_sent = {-1, 0};
+
+/* the neighbor and stp lists, and neighbor signal strengths, as of our
+ * last beacon
+ */
+static unsigned int nbr_signature;
+static unsigned int stp_signature;
+static int announced_count = 0;
+static mac_address_t announced_name[MAX_CLOUD];
+static int announced_sig[MAX_CLOUD];
+
+static unsigned int sent_count = 0;
+static unsigned int suppressed_count = 0;
+static unsigned int reset_count = 0;
+static char *last_reason = NULL;
+
+/* start a new interval of the current length */
+static void new_interval(void)
+{
+    int t = interval / 2 + discrete_unif(interval / 2);
+
+    heard = 0;
+    fired = false;
+    rest = interval - t;
+
+    set_trickle_alarm(t);
+}
+
+/* an order-independent hash of a set of box names */
+static unsigned int signature(mac_address_t *names, int stride, int count)
+{
+    unsigned int result = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        byte *name = ((byte *) names) + i * stride;
+        result += hash_bytes(name, sizeof(mac_address_t));
+    }
+
+    return result;
+}
+
+static unsigned int nbr_list_signature(void)
+{
+    return signature(&nbr_device_list[0].name, sizeof(nbr_device_list[0]),
+            nbr_device_list_count);
+}
+
+static unsigned int stp_list_signature(void)
+{
+    return signature(&stp_list[0].box.name, sizeof(stp_list[0]),
+            stp_list_count);
+}
+
+/* what, if anything, has changed since our last beacon */
+static char *topology_change(void)
+{
+    int i;
+
+    if (nbr_list_signature() != nbr_signature) {
+        return "neighbor list changed";
+    }
+
+    if (stp_list_signature() != stp_signature) {
+        return "stp list changed";
+    }
+
+    for (i = 0; i < announced_count; i++) {
+        int diff = get_sig_strength(announced_name[i]) - announced_sig[i];
+
+        if (diff >= TRICKLE_SIG_CHANGE || diff <= -TRICKLE_SIG_CHANGE) {
+            return "signal strength changed";
+        }
+    }
+
+    return NULL;
+}
+
+/* remember the state our beacon just announced */
+static void snapshot(void)
+{
+    int i;
+
+    nbr_signature = nbr_list_signature();
+    stp_signature = stp_list_signature();
+
+    announced_count = 0;
+    for (i = 0; i < nbr_device_list_count && i < MAX_CLOUD; i++) {
+        mac_copy(announced_name[i], nbr_device_list[i].name);
+        announced_sig[i] = nbr_device_list[i].signal_strength;
+        announced_count++;
+    }
+}
+
+/* topology change or inconsistency:  go back to the shortest interval */
+void trickle_reset(char *reason)
+{
+    if (!db[82].d || interval == 0) { return; }
+
+    /* rfc 6206:  if we are already at the shortest interval, leave it be */
+    if (interval == TRICKLE_IMIN) { return; }
+
+    if (db[83].d) { ddprintf("trickle_reset; %s\n", reason); }
+
+    reset_count++;
+    last_reason = reason;
+
+    interval = TRICKLE_IMIN;
+    new_interval();
+}
+
+/* we sent a beacon (from the trickle timer or because something in the
+ * cloud protocol wanted one right away)
+ */
+void trickle_sent(void)
+{
+    char *reason;
+
+    if (!db[82].d) { return; }
+
+    reason = topology_change();
+
+    while (!checked_gettimeofday(&last_sent));
+    snapshot();
+
+    if (reason != NULL) { trickle_reset(reason); }
+}
+
+/* called with every send_stp interrupt:  start or stop the timer to
+ * follow db[82], and look for changes in our neighbors.
+ */
+void trickle_check(void)
+{
+    char *reason;
+
+    if (!db[82].d) {
+        if (interval != 0) {
+            interval = 0;
+            set_trickle_alarm(-1);
+        }
+        return;
+    }
+
+    if (interval == 0) {
+        interval = TRICKLE_IMIN;
+        snapshot();
+        new_interval();
+        return;
+    }
+
+    reason = topology_change();
+    if (reason != NULL) { trickle_reset(reason); }
+}
+
+/* the trickle timer went off:  either it is time to send, or the interval
+ * is over.
+ */
+void trickle_timer(void)
+{
+    struct timeval tv;
+
+    if (!db[82].d || interval == 0) { return; }
+
+    if (fired) {
+        interval *= 2;
+        if (interval > TRICKLE_IMAX) { interval = TRICKLE_IMAX; }
+        new_interval();
+        return;
+    }
+
+    fired = true;
+
+    while (!checked_gettimeofday(&tv));
+
+    if (heard >= TRICKLE_K && last_sent.tv_sec != -1
+        && timeval_diff(&tv, &last_sent) < TRICKLE_IMAX * 1000LL)
+    {
+        if (db[83].d) {
+            ddprintf("trickle_timer; %d consistent beacons heard; "
+                    "not sending\n", heard);
+        }
+        suppressed_count++;
+
+    } else {
+        if (db[83].d) {
+            ddprintf("trickle_timer; sending beacon, interval %d\n",
+                    interval);
+        }
+        sent_count++;
+        send_stp_beacon(false /* no disconnected nbr */);
+    }
+
+    /* unless sending the beacon turned up a change and restarted the
+     * timer, wait out the rest of the interval.
+     */
+    if (fired) { set_trickle_alarm(rest); }
+}
+
+/* an stp neighbor sent us its own beacon.  it agrees with us if it lists
+ * us as one of its stp neighbors (or sent no neighbor list).
+ */
+void trickle_heard(stp_beacon_t *beacon)
+{
+    int i;
+
+    if (!db[82].d || interval == 0) { return; }
+
+    if (beacon->status_count > 0 && beacon->status_count <= MAX_CLOUD) {
+        for (i = 0; i < beacon->status_count; i++) {
+            if (mac_equal(beacon->status[i].name, my_wlan_mac_address)
+                && beacon->status[i].neighbor_type == STATUS_CLOUD_NBR)
+            {
+                break;
+            }
+        }
+
+        if (i == beacon->status_count) {
+            trickle_reset("neighbor doesn't list us as an stp neighbor");
+            return;
+        }
+    }
+
+    heard++;
+}
+
+void trickle_print(ddprintf_t *fn, FILE *f)
+{
+    struct timeval tv;
+
+    if (!db[82].d || interval == 0) {
+        fn(f, "trickle stp beacons off (db[82])\n");
+        return;
+    }
+
+    while (!checked_gettimeofday(&tv));
+
+    fn(f, "trickle stp beacons:  interval %d msec (%d .. %d), heard %d, "
+            "%s\n", interval, TRICKLE_IMIN, TRICKLE_IMAX, heard,
+            fired ? "past send time" : "before send time");
+
+    fn(f, "    sent %u, suppressed %u, resets %u", sent_count,
+            suppressed_count, reset_count);
+    if (last_reason != NULL) { fn(f, " (last:  %s)", last_reason); }
+    fn(f, "\n");
+
+    if (last_sent.tv_sec != -1) {
+        fn(f, "    last beacon %lld msec ago\n",
+                timeval_diff(&tv, &last_sent) / 1000);
+    }
+}
@@ -0,0 +1,27 @@
+/* trickle.h - adaptive stp beacon interval, after rfc 6206
+ *
+ * Copyright (C) 2012, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * $Id$
+ */
+#ifndef TRICKLE_H
+#define TRICKLE_H
+
+#include <stdio.h>
+#include "util.h"
+#include "stp_beacon_data.h"
+
+extern void trickle_check(void);
+extern void trickle_timer(void);
+extern void trickle_reset(char *reason);
+extern void trickle_sent(void);
+extern void trickle_heard(stp_beacon_t *beacon);
+extern void trickle_print(ddprintf_t *fn, FILE *f);
+
+#endif
@@ -395,13 +395,27 @@ bool_t file_exists(char *fname)
     return return_value;
 }
 
+/* if set, checked_gettimeofday() and util_gettimeofday() get the time from
+ * here instead of from the kernel.  (journal.c uses this to record and
+ * replay merge_cloud's idea of the time.)
+ */
+int (*util_gettimeofday_hook)(struct timeval *tv) = NULL;
+
+/* gettimeofday, by way of util_gettimeofday_hook if there is one */
+int util_gettimeofday(struct timeval *tv, struct timezone *tz)
+{
+    if (util_gettimeofday_hook != NULL) { return util_gettimeofday_hook(tv); }
+
+    return gettimeofday(tv, tz);
+}
+
 /* try gettimeofday, and print error to stderr if it doesn't work.
  * can't imagine how gettimeofday would ever fail, but just in case..
  */
 char checked_gettimeofday(struct timeval *tv)
 {
     static struct timezone tz;
-    if (gettimeofday(tv, &tz)) {
+    if (util_gettimeofday(tv, &tz)) {
         fprintf(stderr, "gettimeofday failed\n");
         return 0;
     } else {
@@ -588,6 +602,34 @@ unsigned int hash_bytes(byte *bytes, int len)
     return result;
 }
 
+/* the crc-32 of ethernet and zlib.  start with crc 0; to checksum
+ * something in pieces, pass each piece the crc of the ones before it.
+ */
+unsigned int crc32_bytes(unsigned int crc, byte *bytes, int len)
+{
+    static unsigned int table[256];
+    static bool_t have_table = false;
+    int i, j;
+
+    if (!have_table) {
+        for (i = 0; i < 256; i++) {
+            unsigned int c = i;
+            for (j = 0; j < 8; j++) {
+                c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        have_table = true;
+    }
+
+    crc = ~crc;
+    for (i = 0; i < len; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
 /* copy at most len-1 chars of src string to dest string.
  * terminate on null char, eoln char (not included in output string)
  * or len-1 chars copied.
@@ -16,6 +16,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/time.h>
 
 /* used with tweak_db_vec - see comment there. */
 #define UTIL_DB_VEC_MAX 16
@@ -61,6 +62,8 @@ extern bool_t file_exists(char *fname);
 extern char *bool_string(bool_t bool);
 extern long long timeval_diff(struct timeval *tv1, struct timeval *tv2);
 extern char checked_gettimeofday(struct timeval *tv);
+extern int util_gettimeofday(struct timeval *tv, struct timezone *tz);
+extern int (*util_gettimeofday_hook)(struct timeval *tv);
 extern long long usec_diff(long sec1, long usec1, long sec2, long usec2);
 extern void usec_add_msecs(long *sec, long *usec, int msec);
 extern void update_time(long *out_sec, long *out_usec, long sec, long usec);
@@ -70,6 +73,7 @@ extern void read_all_available(int fd);
 extern bool_t util_debug_print(bool_t b);
 extern int skip_comment_line(FILE *f);
 extern unsigned int hash_bytes(byte *bytes, int len);
+extern unsigned int crc32_bytes(unsigned int crc, byte *bytes, int len);
 extern void print_space(ddprintf_t *fn, FILE *f, int space);
 extern void copy_string(char *dest, char *src, int len);
 